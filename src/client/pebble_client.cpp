@@ -161,7 +161,8 @@ int32_t PebbleClient::Attach(Router* router, IProcessor* processor) {
 }
 
 PebbleRpc* PebbleClient::GetPebbleRpc(ProtocolType protocol_type) {
-    if (protocol_type < kPEBBLE_RPC_BINARY || protocol_type > kPEBBLE_RPC_PROTOBUF) {
+    if (protocol_type < kPEBBLE_RPC_BINARY || protocol_type >= kPROTOCOL_TYPE_BUTT
+        || protocol_type == kPEBBLE_PIPE) {
         PLOG_ERROR("param protocol_type invalid(%d)", protocol_type);
         return NULL;
     }
@@ -189,6 +190,10 @@ PebbleRpc* PebbleClient::GetPebbleRpc(ProtocolType protocol_type) {
             rpc_code_type = kCODE_PB;
             break;
 
+        case kPEBBLE_RPC_COMPACT:
+            rpc_code_type = kCODE_COMPACT;
+            break;
+
         default:
             PLOG_FATAL("unsupport protocol type %d", protocol_type);
             return NULL;
@@ -197,6 +202,9 @@ PebbleRpc* PebbleClient::GetPebbleRpc(ProtocolType protocol_type) {
     PebbleRpc* rpc_instance = new PebbleRpc(rpc_code_type, m_coroutine_schedule);
     rpc_instance->SetSendFunction(Message::Send, Message::SendV);
     rpc_instance->SetEventHandler(m_rpc_event_handler);
+    rpc_instance->SetRpcVersion(m_options._rpc_version);
+    rpc_instance->SetHedgeOptions(m_options._hedge_percentile, m_options._hedge_max_ratio);
+    rpc_instance->SetConcurrencyLimit(m_options._concurrency_limit);
     m_processor_array[protocol_type] = rpc_instance;
 
     return rpc_instance;
@@ -250,7 +258,8 @@ Router* PebbleClient::GetRouter(const std::string& name, RouterType router_type)
 int32_t PebbleClient::Update() {
     int32_t num = 0;
 
-    int64_t old = TimeUtility::GetCurrentMS();
+    TimeUtility::RefreshLoopTime();
+    int64_t old = TimeUtility::GetLoopMS();
 
 	num += Message::Update();
 
@@ -276,7 +285,7 @@ int32_t PebbleClient::Update() {
 
     if (m_stat_manager) {
         num += m_stat_manager->Update();
-        m_stat_manager->GetStat()->AddResourceItem("_loop", TimeUtility::GetCurrentMS() - old);
+        m_stat_manager->GetStat()->AddResourceItem("_loop", TimeUtility::GetMonotonicMS() - old);
     }
 
     return num;
@@ -321,7 +330,8 @@ int32_t PebbleClient::InitCoSchedule() {
     }
 
     m_coroutine_schedule = new CoroutineSchedule();
-    int32_t ret = m_coroutine_schedule->Init(GetTimer(), m_options._co_stack_size_bytes);
+    int32_t ret = m_coroutine_schedule->Init(GetTimer(), m_options._co_stack_size_bytes,
+        m_options._co_shared_stack_num, m_options._co_stack_pool_size, m_options._co_stack_madv_free);
     if (ret != 0) {
         delete m_coroutine_schedule;
         m_coroutine_schedule = NULL;
@@ -347,7 +357,7 @@ int32_t PebbleClient::InitStat() {
 
 int32_t PebbleClient::InitTimer() {
     if (!m_timer) {
-        m_timer = new SequenceTimer();
+        m_timer = new WheelTimer();
     }
 
     TimeoutCallback on_stat_timeout = cxx::bind(&PebbleClient::OnStatTimeout, this);
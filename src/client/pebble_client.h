@@ -69,6 +69,7 @@ typedef enum {
     kPEBBLE_RPC_JSON,       // thrift json编码协议
     kPEBBLE_RPC_PROTOBUF,   // protobuf编码协议
     kPEBBLE_PIPE,           // pipe协议，pipe是接入gconnd的私有协议，上面承载其他rpc编码协议
+    kPEBBLE_RPC_COMPACT,    // thrift compact编码协议，整数使用varint/zigzag编码，适合小整数为主的消息
     kPROTOCOL_TYPE_BUTT
 } ProtocolType;
 
@@ -0,0 +1,107 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#include <stdlib.h>
+
+#include "common/arena.h"
+
+
+namespace pebble {
+
+// 块大小的下限，保证不单独申请的分配(不超过块大小的1/4)一定能放进新块
+static const uint32_t kMinBlockSize = 256;
+
+Arena::Arena(uint32_t block_size)
+    :   m_block_size(block_size < kMinBlockSize ? kMinBlockSize : block_size),
+        m_space_used(0), m_space_allocated(0), m_head(NULL), m_large(NULL), m_cleanups(NULL) {
+}
+
+Arena::~Arena() {
+    Reset();
+    if (m_head != NULL) {
+        free(m_head);
+        m_head = NULL;
+    }
+    m_space_allocated = 0;
+}
+
+void* Arena::AllocateSlow(uint32_t size) {
+    uint32_t aligned = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    if (aligned < size || aligned > 0xFFFFFFFFu - BLOCK_HEAD_SIZE) {
+        return NULL;
+    }
+
+    // 大的分配单独申请一块，不浪费当前块的剩余空间
+    bool large = aligned > m_block_size / 4;
+    uint32_t block_size = large ? aligned + BLOCK_HEAD_SIZE : m_block_size;
+    Block* block = static_cast<Block*>(malloc(block_size));
+    if (NULL == block) {
+        return NULL;
+    }
+    block->_size = block_size;
+    block->_pos  = BLOCK_HEAD_SIZE + aligned;
+    if (large) {
+        block->_next = m_large;
+        m_large      = block;
+    } else {
+        block->_next = m_head;
+        m_head       = block;
+    }
+
+    m_space_allocated += block_size;
+    m_space_used      += aligned;
+    return reinterpret_cast<char*>(block) + BLOCK_HEAD_SIZE;
+}
+
+void* Arena::AllocateObject(uint32_t size, Cleanup** cleanup) {
+    *cleanup = static_cast<Cleanup*>(Allocate(sizeof(Cleanup)));
+    if (NULL == *cleanup) {
+        return NULL;
+    }
+    return Allocate(size);
+}
+
+void Arena::RunCleanups() {
+    // 析构函数中可能继续在arena上分配或创建对象
+    while (m_cleanups != NULL) {
+        Cleanup* cleanup = m_cleanups;
+        m_cleanups = cleanup->_next;
+        cleanup->_destroy(cleanup->_obj);
+    }
+}
+
+void Arena::Reset() {
+    RunCleanups();
+
+    while (m_large != NULL) {
+        Block* block = m_large;
+        m_large = block->_next;
+        free(block);
+    }
+
+    // 只保留第一个块
+    while (m_head != NULL && m_head->_next != NULL) {
+        Block* block = m_head;
+        m_head = block->_next;
+        free(block);
+    }
+
+    m_space_used      = 0;
+    m_space_allocated = 0;
+    if (m_head != NULL) {
+        m_head->_pos      = BLOCK_HEAD_SIZE;
+        m_space_allocated = m_head->_size;
+    }
+}
+
+} // namespace pebble
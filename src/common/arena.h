@@ -0,0 +1,204 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#ifndef _PEBBLE_COMMON_ARENA_H_
+#define _PEBBLE_COMMON_ARENA_H_
+
+#include <new>
+#include <stddef.h>
+
+#include "common/platform.h"
+#include "common/uncopyable.h"
+
+namespace pebble {
+
+
+/// @brief 按块分配的线性内存池
+/// @note 分配只移动当前块的偏移，对象不单独释放，Reset时按创建的逆序析构Create出的对象并统一回收内存
+///     Reset保留第一个块，反复使用时稳定后不再产生堆内存分配；第一个块在首次分配时才申请
+///     非线程安全
+class Arena : public Uncopyable {
+public:
+    /// @param block_size 每次向系统申请的块大小，超过块大小1/4的分配单独申请一块
+    explicit Arena(uint32_t block_size = DEFAULT_BLOCK_SIZE);
+    ~Arena();
+
+    /// @brief 分配内存，按ALIGNMENT字节对齐
+    /// @return 内存地址，失败返回NULL
+    void* Allocate(uint32_t size) {
+        uint32_t aligned = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+        if (m_head != NULL && aligned >= size && m_head->_size - m_head->_pos >= aligned) {
+            void* mem = reinterpret_cast<char*>(m_head) + m_head->_pos;
+            m_head->_pos += aligned;
+            m_space_used += aligned;
+            return mem;
+        }
+        return AllocateSlow(size);
+    }
+
+    /// @brief 在arena上构造对象，对象在Reset或arena析构时析构
+    template <typename T>
+    T* Create() {
+        Cleanup* cleanup = NULL;
+        void* mem = AllocateObject(sizeof(T), &cleanup);
+        if (NULL == mem) {
+            return NULL;
+        }
+        T* obj = new (mem) T();
+        AddCleanup(cleanup, obj, &Destroy<T>);
+        return obj;
+    }
+
+    template <typename T, typename A1>
+    T* Create(const A1& a1) {
+        Cleanup* cleanup = NULL;
+        void* mem = AllocateObject(sizeof(T), &cleanup);
+        if (NULL == mem) {
+            return NULL;
+        }
+        T* obj = new (mem) T(a1);
+        AddCleanup(cleanup, obj, &Destroy<T>);
+        return obj;
+    }
+
+    template <typename T, typename A1, typename A2>
+    T* Create(const A1& a1, const A2& a2) {
+        Cleanup* cleanup = NULL;
+        void* mem = AllocateObject(sizeof(T), &cleanup);
+        if (NULL == mem) {
+            return NULL;
+        }
+        T* obj = new (mem) T(a1, a2);
+        AddCleanup(cleanup, obj, &Destroy<T>);
+        return obj;
+    }
+
+    /// @brief 析构所有对象，释放除第一个块外的内存
+    void Reset();
+
+    /// @brief 已分配出去的字节数
+    uint32_t SpaceUsed() const { return m_space_used; }
+
+    /// @brief 向系统申请的字节数
+    uint32_t SpaceAllocated() const { return m_space_allocated; }
+
+    static const uint32_t DEFAULT_BLOCK_SIZE = 4096;
+    static const uint32_t ALIGNMENT          = 16;
+
+private:
+    // 块头之后是数据区，_size和_pos都从块的起始地址算起
+    struct Block {
+        Block*   _next;
+        uint32_t _size;
+        uint32_t _pos;
+    };
+    static const uint32_t BLOCK_HEAD_SIZE = (sizeof(Block) + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+
+    struct Cleanup {
+        Cleanup* _next;
+        void*    _obj;
+        void   (*_destroy)(void* obj);
+    };
+
+    template <typename T>
+    static void Destroy(void* obj) {
+        static_cast<T*>(obj)->~T();
+    }
+
+    // 分配对象内存和析构登记项，对象构造成功后才登记，构造抛出异常时不会析构
+    void* AllocateObject(uint32_t size, Cleanup** cleanup);
+
+    void AddCleanup(Cleanup* cleanup, void* obj, void (*destroy)(void* obj)) {
+        cleanup->_obj     = obj;
+        cleanup->_destroy = destroy;
+        cleanup->_next    = m_cleanups;
+        m_cleanups        = cleanup;
+    }
+
+    void* AllocateSlow(uint32_t size);
+
+    void RunCleanups();
+
+private:
+    uint32_t m_block_size;
+    uint32_t m_space_used;
+    uint32_t m_space_allocated;
+    Block*   m_head;     // 当前分配的块，链表尾部为第一个块
+    Block*   m_large;    // 单独申请的大块
+    Cleanup* m_cleanups;
+};
+
+
+/// @brief 从Arena分配内存的STL分配器，deallocate不释放内存，容器的内存随arena整体回收
+/// @note 容器的生命期不能超过arena的Reset，例如:
+///     std::vector<int, ArenaAllocator<int> > v((ArenaAllocator<int>(arena)));
+template <typename T>
+class ArenaAllocator {
+public:
+    typedef T           value_type;
+    typedef T*          pointer;
+    typedef const T*    const_pointer;
+    typedef T&          reference;
+    typedef const T&    const_reference;
+    typedef size_t      size_type;
+    typedef ptrdiff_t   difference_type;
+
+    template <typename U>
+    struct rebind {
+        typedef ArenaAllocator<U> other;
+    };
+
+    explicit ArenaAllocator(Arena* arena) : m_arena(arena) {}
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& rhs) : m_arena(rhs.GetArena()) {}
+
+    pointer address(reference x) const { return &x; }
+    const_pointer address(const_reference x) const { return &x; }
+
+    pointer allocate(size_type n, const void* hint = 0) {
+        void* mem = n <= max_size() ? m_arena->Allocate(n * sizeof(T)) : NULL;
+        if (NULL == mem) {
+            throw std::bad_alloc();
+        }
+        return static_cast<pointer>(mem);
+    }
+
+    void deallocate(pointer p, size_type n) {}
+
+    size_type max_size() const { return 0xFFFFFFFFu / sizeof(T); }
+
+    void construct(pointer p, const T& val) { new (p) T(val); }
+
+    void destroy(pointer p) { p->~T(); }
+
+    Arena* GetArena() const { return m_arena; }
+
+private:
+    Arena* m_arena;
+};
+
+template <typename T, typename U>
+inline bool operator==(const ArenaAllocator<T>& lhs, const ArenaAllocator<U>& rhs) {
+    return lhs.GetArena() == rhs.GetArena();
+}
+
+template <typename T, typename U>
+inline bool operator!=(const ArenaAllocator<T>& lhs, const ArenaAllocator<U>& rhs) {
+    return lhs.GetArena() != rhs.GetArena();
+}
+
+} // namespace pebble
+
+#endif // _PEBBLE_COMMON_ARENA_H_
@@ -0,0 +1,201 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#include <stdlib.h>
+
+#include "common/coctx.h"
+
+
+#if PEBBLE_COCTX_ASM
+
+#if defined(__x86_64__)
+
+// void pebble_coctx_swap(void** from_sp, void* to_sp)
+// 按SysV ABI保存rbp/rbx/r12-r15和mxcsr/x87控制字，其余寄存器由调用者保存
+// 栈布局(低地址->高地址): mxcsr(4) fpucw(2) pad(2) r15 r14 r13 r12 rbx rbp ret
+__asm__(
+    ".text\n"
+    ".p2align 4\n"
+    ".globl pebble_coctx_swap\n"
+    ".hidden pebble_coctx_swap\n"
+    ".type pebble_coctx_swap, @function\n"
+"pebble_coctx_swap:\n"
+    "pushq %rbp\n"
+    "pushq %rbx\n"
+    "pushq %r12\n"
+    "pushq %r13\n"
+    "pushq %r14\n"
+    "pushq %r15\n"
+    "subq $8, %rsp\n"
+    "stmxcsr (%rsp)\n"
+    "fnstcw 4(%rsp)\n"
+    "movq %rsp, (%rdi)\n"
+    "movq %rsi, %rsp\n"
+    "ldmxcsr (%rsp)\n"
+    "fldcw 4(%rsp)\n"
+    "addq $8, %rsp\n"
+    "popq %r15\n"
+    "popq %r14\n"
+    "popq %r13\n"
+    "popq %r12\n"
+    "popq %rbx\n"
+    "popq %rbp\n"
+    "ret\n"
+    ".size pebble_coctx_swap, .-pebble_coctx_swap\n"
+
+// 新上下文首次切入时由ret跳转到此处，r12为入口函数，r13为参数
+    ".p2align 4\n"
+    ".globl pebble_coctx_entry\n"
+    ".hidden pebble_coctx_entry\n"
+    ".type pebble_coctx_entry, @function\n"
+"pebble_coctx_entry:\n"
+    "movq %r13, %rdi\n"
+    "callq *%r12\n"
+    "ud2\n"
+    ".size pebble_coctx_entry, .-pebble_coctx_entry\n"
+);
+
+#elif defined(__aarch64__)
+
+// void pebble_coctx_swap(void** from_sp, void* to_sp)
+// 按AAPCS64保存x19-x30和d8-d15
+__asm__(
+    ".text\n"
+    ".p2align 4\n"
+    ".globl pebble_coctx_swap\n"
+    ".hidden pebble_coctx_swap\n"
+    ".type pebble_coctx_swap, %function\n"
+"pebble_coctx_swap:\n"
+    "sub sp, sp, #160\n"
+    "stp x19, x20, [sp, #0]\n"
+    "stp x21, x22, [sp, #16]\n"
+    "stp x23, x24, [sp, #32]\n"
+    "stp x25, x26, [sp, #48]\n"
+    "stp x27, x28, [sp, #64]\n"
+    "stp x29, x30, [sp, #80]\n"
+    "stp d8, d9, [sp, #96]\n"
+    "stp d10, d11, [sp, #112]\n"
+    "stp d12, d13, [sp, #128]\n"
+    "stp d14, d15, [sp, #144]\n"
+    "mov x2, sp\n"
+    "str x2, [x0]\n"
+    "mov sp, x1\n"
+    "ldp x19, x20, [sp, #0]\n"
+    "ldp x21, x22, [sp, #16]\n"
+    "ldp x23, x24, [sp, #32]\n"
+    "ldp x25, x26, [sp, #48]\n"
+    "ldp x27, x28, [sp, #64]\n"
+    "ldp x29, x30, [sp, #80]\n"
+    "ldp d8, d9, [sp, #96]\n"
+    "ldp d10, d11, [sp, #112]\n"
+    "ldp d12, d13, [sp, #128]\n"
+    "ldp d14, d15, [sp, #144]\n"
+    "add sp, sp, #160\n"
+    "ret\n"
+    ".size pebble_coctx_swap, .-pebble_coctx_swap\n"
+
+// 新上下文首次切入时由ret跳转到此处，x19为入口函数，x20为参数
+    ".p2align 4\n"
+    ".globl pebble_coctx_entry\n"
+    ".hidden pebble_coctx_entry\n"
+    ".type pebble_coctx_entry, %function\n"
+"pebble_coctx_entry:\n"
+    "mov x0, x20\n"
+    "blr x19\n"
+    "brk #0\n"
+    ".size pebble_coctx_entry, .-pebble_coctx_entry\n"
+);
+
+#endif
+
+extern "C" void pebble_coctx_entry();
+
+#endif // PEBBLE_COCTX_ASM
+
+
+namespace pebble {
+
+#if PEBBLE_COCTX_ASM
+
+int coctx_make(coctx* ctx, char* stack, uint32_t stack_size, coctx_func func, void* arg) {
+    if (NULL == ctx || NULL == stack || NULL == func) {
+        return -1;
+    }
+
+    // 栈顶16字节对齐，按pebble_coctx_swap恢复时的顺序预置寄存器
+    uintptr_t top = (reinterpret_cast<uintptr_t>(stack) + stack_size) & ~static_cast<uintptr_t>(15);
+
+#if defined(__x86_64__)
+    static const uint32_t kFrameSize = 64;
+    if (stack_size < kFrameSize * 2) {
+        return -1;
+    }
+    uint64_t* frame = reinterpret_cast<uint64_t*>(top - kFrameSize);
+    memset(frame, 0, kFrameSize);
+    // 继承当前线程的浮点控制状态
+    uint32_t mxcsr = 0;
+    uint16_t fpucw = 0;
+    __asm__ __volatile__("stmxcsr %0" : "=m"(mxcsr));
+    __asm__ __volatile__("fnstcw %0" : "=m"(fpucw));
+    memcpy(reinterpret_cast<char*>(frame), &mxcsr, sizeof(mxcsr));
+    memcpy(reinterpret_cast<char*>(frame) + 4, &fpucw, sizeof(fpucw));
+    frame[3] = reinterpret_cast<uint64_t>(arg);                 // r13
+    frame[4] = reinterpret_cast<uint64_t>(func);                // r12
+    frame[7] = reinterpret_cast<uint64_t>(pebble_coctx_entry);  // ret
+#elif defined(__aarch64__)
+    static const uint32_t kFrameSize = 160;
+    if (stack_size < kFrameSize * 2) {
+        return -1;
+    }
+    uint64_t* frame = reinterpret_cast<uint64_t*>(top - kFrameSize);
+    memset(frame, 0, kFrameSize);
+    frame[0]  = reinterpret_cast<uint64_t>(func);               // x19
+    frame[1]  = reinterpret_cast<uint64_t>(arg);                // x20
+    frame[11] = reinterpret_cast<uint64_t>(pebble_coctx_entry); // x30
+#endif
+
+    ctx->sp = frame;
+    return 0;
+}
+
+#else
+
+static void coctx_main(uint32_t low32, uint32_t hi32) {
+    uintptr_t ptr = (uintptr_t) low32 | ((uintptr_t) hi32 << 32);
+    coctx* ctx = (coctx*) ptr;
+    ctx->func(ctx->arg);
+    abort();
+}
+
+int coctx_make(coctx* ctx, char* stack, uint32_t stack_size, coctx_func func, void* arg) {
+    if (NULL == ctx || NULL == stack || NULL == func) {
+        return -1;
+    }
+
+    getcontext(&ctx->uc);
+    ctx->uc.uc_stack.ss_sp = stack;
+    ctx->uc.uc_stack.ss_size = stack_size;
+    ctx->uc.uc_stack.ss_flags = 0;
+    ctx->uc.uc_link = NULL;
+    ctx->func = func;
+    ctx->arg = arg;
+    uintptr_t ptr = (uintptr_t) ctx;
+    makecontext(&ctx->uc, (void (*)(void)) coctx_main, 2,
+        (uint32_t)ptr,  // NOLINT
+        (uint32_t)(ptr>>32));  // NOLINT
+    return 0;
+}
+
+#endif
+
+} // namespace pebble
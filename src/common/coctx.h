@@ -0,0 +1,75 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#ifndef _PEBBLE_COMMON_COCTX_H_
+#define _PEBBLE_COMMON_COCTX_H_
+
+#include <stdint.h>
+#include <string.h>
+
+/// @brief 协程上下文切换
+/// x86-64和aarch64下默认使用汇编实现，只保存被调用者保存寄存器，不涉及信号掩码，没有系统调用
+/// 其他平台或编译时定义PEBBLE_USE_UCONTEXT时使用ucontext实现
+#if !defined(PEBBLE_USE_UCONTEXT) && (defined(__x86_64__) || defined(__aarch64__))
+#define PEBBLE_COCTX_ASM 1
+#else
+#define PEBBLE_COCTX_ASM 0
+#include <ucontext.h>
+#endif
+
+
+namespace pebble {
+
+/// @brief 上下文入口函数，不允许返回，结束时必须切换到其他上下文
+typedef void (*coctx_func)(void* arg);
+
+struct coctx {
+#if PEBBLE_COCTX_ASM
+    void* sp;               // 切出时的栈顶，寄存器保存在栈上
+#else
+    ucontext_t uc;
+    coctx_func func;
+    void* arg;
+#endif
+
+    coctx() {
+        memset(this, 0, sizeof(coctx));
+    }
+};
+
+#if PEBBLE_COCTX_ASM
+extern "C" void pebble_coctx_swap(void** from_sp, void* to_sp);
+#endif
+
+/// @brief 在指定的栈上创建上下文，首次切换到该上下文时执行func(arg)
+/// @param ctx 上下文
+/// @param stack 栈的起始地址(低地址)
+/// @param stack_size 栈大小
+/// @param func 入口函数
+/// @param arg 入口函数参数
+/// @return 0 成功，<0 参数错误
+int coctx_make(coctx* ctx, char* stack, uint32_t stack_size, coctx_func func, void* arg);
+
+/// @brief 保存当前上下文到from，切换到to
+inline void coctx_swap(coctx* from, coctx* to) {
+#if PEBBLE_COCTX_ASM
+    pebble_coctx_swap(&from->sp, to->sp);
+#else
+    swapcontext(&from->uc, &to->uc);
+#endif
+}
+
+} // namespace pebble
+
+#endif // _PEBBLE_COMMON_COCTX_H_
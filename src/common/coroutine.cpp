@@ -29,22 +29,24 @@
 #include <sys/syscall.h>
 #include "common/coroutine.h"
 #include "common/log.h"
+#include "common/stack_pool.h"
 #include "common/timer.h"
 
 namespace pebble {
 
 
-struct coroutine *
-_co_new(struct schedule *S, cxx::function<void()>& std_func) {
-    if (NULL == S) {
-        assert(0);
-        return NULL;
-    }
+#if !PEBBLE_COCTX_ASM
+// ucontext模式下无法直接取得切出时的栈顶，在记录位置下方额外保存一段
+static const uint32_t kStackSaveMargin = 1024;
+#endif
 
+static struct coroutine * _co_alloc(struct schedule *S) {
     struct coroutine * co = NULL;
     if (S->co_free_list.empty()) {
         co = new coroutine;
-        co->stack = new char[S->stack_size];
+        if (!S->shared_stacks.empty()) {
+            co->stack_idx = S->next_shared_stack++ % S->shared_stacks.size();
+        }
     } else {
         co = S->co_free_list.front();
         S->co_free_list.pop_front();
@@ -52,6 +54,30 @@ _co_new(struct schedule *S, cxx::function<void()>& std_func) {
         S->co_free_num--;
     }
 
+    // 独立栈从栈池中分配，协程结束时放回
+    if (co->stack_idx < 0 && NULL == co->stack) {
+        co->stack = S->stack_pool->Alloc();
+        if (NULL == co->stack) {
+            S->co_free_list.push_back(co);
+            S->co_free_num++;
+            return NULL;
+        }
+    }
+    return co;
+}
+
+struct coroutine *
+_co_new(struct schedule *S, cxx::function<void()>& std_func) {
+    if (NULL == S) {
+        assert(0);
+        return NULL;
+    }
+
+    struct coroutine * co = _co_alloc(S);
+    if (NULL == co) {
+        return NULL;
+    }
+
     co->std_func = std_func;
     co->func = NULL;
     co->ud = NULL;
@@ -68,17 +94,11 @@ _co_new(struct schedule *S, coroutine_func func, void *ud) {
         return NULL;
     }
 
-    struct coroutine * co = NULL;
-
-    if (S->co_free_list.empty()) {
-        co = new coroutine;
-        co->stack = new char[S->stack_size];
-    } else {
-        co = S->co_free_list.front();
-        S->co_free_list.pop_front();
-
-        S->co_free_num--;
+    struct coroutine * co = _co_alloc(S);
+    if (NULL == co) {
+        return NULL;
     }
+
     co->func = func;
     co->ud = ud;
     co->sch = S;
@@ -87,13 +107,85 @@ _co_new(struct schedule *S, coroutine_func func, void *ud) {
     return co;
 }
 
-void _co_delete(struct coroutine *co) {
-    delete [] co->stack;
+void _co_delete(struct schedule *S, struct coroutine *co) {
+    S->stack_pool->Free(co->stack);
+    free(co->save_buff);
     delete co;
 }
 
+/// @brief 回收已结束的协程，必须在协程栈之外调用
+static void _co_recycle(struct schedule *S, struct coroutine *C) {
+    S->stack_pool->Free(C->stack);
+    C->stack = NULL;
+
+    S->co_free_list.push_back(C);
+    S->co_free_num++;
+
+    if (S->co_free_num > MAX_FREE_CO_NUM) {
+        coroutine* co = S->co_free_list.front();
+        _co_delete(S, co);
+
+        S->co_free_list.pop_front();
+        S->co_free_num--;
+    }
+}
+
+/// @brief 释放协程保存的栈内容
+static void _co_release_saved_stack(struct schedule *S, struct coroutine *C) {
+    if (C->save_size > 0) {
+        S->saved_stack_bytes -= C->save_size;
+        S->saved_stack_num--;
+        C->save_size = 0;
+    }
+}
+
+/// @brief 共享栈模式下把挂起协程实际使用的栈内容保存到堆上
+static void _co_save_stack(struct schedule *S, struct coroutine *C) {
+    char* base = S->shared_stacks[C->stack_idx].stack;
+    char* top  = base + S->stack_size;
+#if PEBBLE_COCTX_ASM
+    char* bottom = static_cast<char*>(C->ctx.sp);
+#else
+    char* bottom = C->stack_sp - kStackSaveMargin;
+#endif
+    if (bottom < base) {
+        bottom = base;
+    }
+
+    uint32_t size = top - bottom;
+    // 按实际大小分配，原缓冲区过大时也重新分配，避免长期挂起的协程占用过多内存
+    if (size > C->save_cap || size < C->save_cap / 2) {
+        free(C->save_buff);
+        C->save_buff = static_cast<char*>(malloc(size));
+        C->save_cap  = size;
+    }
+    memcpy(C->save_buff, bottom, size);
+
+    _co_release_saved_stack(S, C);
+    C->save_size = size;
+    S->saved_stack_bytes += size;
+    S->saved_stack_num++;
+}
+
+/// @brief 共享栈模式下协程运行前换出共享栈上的其他协程，并恢复自己的栈内容
+static void _co_switch_stack(struct schedule *S, struct coroutine *C) {
+    struct shared_stack& ss = S->shared_stacks[C->stack_idx];
+    if (ss.owner == C) {
+        return;
+    }
+    if (ss.owner != NULL) {
+        _co_save_stack(S, ss.owner);
+    }
+    if (C->save_size > 0) {
+        memcpy(ss.stack + S->stack_size - C->save_size, C->save_buff, C->save_size);
+        _co_release_saved_stack(S, C);
+    }
+    ss.owner = C;
+}
+
 struct schedule *
-coroutine_open(uint32_t stack_size) {
+coroutine_open(uint32_t stack_size, uint32_t shared_stack_num,
+    uint32_t stack_pool_size, bool stack_madv_free) {
     if (0 == stack_size) {
         stack_size = 256 * 1024;
     }
@@ -103,6 +195,26 @@ coroutine_open(uint32_t stack_size) {
     S->running = -1;
     S->co_free_num = 0;
     S->stack_size = stack_size;
+    S->next_shared_stack = 0;
+    S->saved_stack_bytes = 0;
+    S->saved_stack_num = 0;
+    S->stack_pool = new StackPool();
+    if (S->stack_pool->Init(stack_size, stack_pool_size, stack_madv_free) != 0) {
+        PLOG_ERROR("init stack pool failed, stack size = %u", stack_size);
+        delete S->stack_pool;
+        delete S;
+        return NULL;
+    }
+    S->stack_size = S->stack_pool->StackSize();
+
+    S->shared_stacks.resize(shared_stack_num);
+    for (uint32_t i = 0; i < shared_stack_num; i++) {
+        S->shared_stacks[i].stack = S->stack_pool->Alloc();
+        if (NULL == S->shared_stacks[i].stack) {
+            coroutine_close(S);
+            return NULL;
+        }
+    }
 
     PLOG_INFO("coroutine_open is called.");
     return S;
@@ -118,14 +230,19 @@ void coroutine_close(struct schedule *S) {
     cxx::unordered_map<int64_t, coroutine*>::iterator pos = S->co_hash_map.begin();
     for (; pos != S->co_hash_map.end(); pos++) {
         if (pos->second) {
-            _co_delete(pos->second);
+            _co_delete(S, pos->second);
         }
     }
 
     std::list<coroutine*>::iterator p = S->co_free_list.begin();
     for (; p != S->co_free_list.end(); p++) {
-        _co_delete(*p);
+        _co_delete(S, *p);
+    }
+
+    for (uint32_t i = 0; i < S->shared_stacks.size(); i++) {
+        S->stack_pool->Free(S->shared_stacks[i].stack);
     }
+    delete S->stack_pool;
 
     // 释放掉整个调度器
     delete S;
@@ -136,6 +253,9 @@ int64_t coroutine_new(struct schedule *S, cxx::function<void()>& std_func) {
         return -1;
     }
     struct coroutine *co = _co_new(S, std_func);
+    if (NULL == co) {
+        return -1;
+    }
     int64_t id = S->nco;
     S->co_hash_map[id] = co;
     S->nco++;
@@ -149,6 +269,9 @@ int64_t coroutine_new(struct schedule *S, coroutine_func func, void *ud) {
         return -1;
     }
     struct coroutine *co = _co_new(S, func, ud);
+    if (NULL == co) {
+        return -1;
+    }
     int64_t id = S->nco;
     S->co_hash_map[id] = co;
     S->nco++;
@@ -157,9 +280,8 @@ int64_t coroutine_new(struct schedule *S, coroutine_func func, void *ud) {
     return id;
 }
 
-static void mainfunc(uint32_t low32, uint32_t hi32) {
-    uintptr_t ptr = (uintptr_t) low32 | ((uintptr_t) hi32 << 32);
-    struct schedule *S = (struct schedule *) ptr;
+static void mainfunc(void* arg) {
+    struct schedule *S = (struct schedule *) arg;
     int64_t id = S->running;
     struct coroutine *C = S->co_hash_map[id];
     if (C->func != NULL) {
@@ -167,20 +289,21 @@ static void mainfunc(uint32_t low32, uint32_t hi32) {
     } else {
         C->std_func();
     }
-    S->co_free_list.push_back(C);
-    S->co_free_num++;
-
-    if (S->co_free_num > MAX_FREE_CO_NUM) {
-        coroutine* co = S->co_free_list.front();
-        _co_delete(co);
-
-        S->co_free_list.pop_front();
-        S->co_free_num--;
+    if (C->stack_idx >= 0) {
+        // 协程结束，共享栈可直接给其他协程使用
+        S->shared_stacks[C->stack_idx].owner = NULL;
+        free(C->save_buff);
+        C->save_buff = NULL;
+        C->save_cap = 0;
     }
 
+    C->status = COROUTINE_DEAD;
     S->co_hash_map.erase(id);
     S->running = -1;
     PLOG_TRACE("coroutine %ld is deleted.", id);
+
+    // 切回主流程后不会再被恢复，协程栈由coroutine_resume回收
+    coctx_swap(&C->ctx, &S->main);
 }
 
 int32_t coroutine_resume(struct schedule * S, int64_t id, int32_t result) {
@@ -210,30 +333,36 @@ int32_t coroutine_resume(struct schedule * S, int64_t id, int32_t result) {
         case COROUTINE_READY: {
             PLOG_TRACE("coroutine %ld status is COROUTINE_READY, begin to execute...", id);
 
-            getcontext(&C->ctx);
-            C->ctx.uc_stack.ss_sp = C->stack;
-            C->ctx.uc_stack.ss_size = S->stack_size;
-            C->ctx.uc_stack.ss_flags = 0;
-            C->ctx.uc_link = &S->main;
+            if (C->stack_idx >= 0) {
+                _co_switch_stack(S, C);
+                coctx_make(&C->ctx, S->shared_stacks[C->stack_idx].stack, S->stack_size, mainfunc, S);
+            } else {
+                coctx_make(&C->ctx, C->stack, S->stack_size, mainfunc, S);
+            }
             S->running = id;
             C->status = COROUTINE_RUNNING;
-            uintptr_t ptr = (uintptr_t) S;
-            makecontext(&C->ctx, (void (*)(void)) mainfunc, 2,
-            (uint32_t)ptr,  // NOLINT
-            (uint32_t)(ptr>>32));  // NOLINT
 
-            swapcontext(&S->main, &C->ctx);
+            coctx_swap(&S->main, &C->ctx);
 
+            if (COROUTINE_DEAD == C->status) {
+                _co_recycle(S, C);
+            }
             break;
         }
         case COROUTINE_SUSPEND: {
             PLOG_TRACE("coroutine %ld status is COROUTINE_SUSPEND,"
                     "begin to resume...", id);
 
+            if (C->stack_idx >= 0) {
+                _co_switch_stack(S, C);
+            }
             S->running = id;
             C->status = COROUTINE_RUNNING;
-            swapcontext(&S->main, &C->ctx);
+            coctx_swap(&S->main, &C->ctx);
 
+            if (COROUTINE_DEAD == C->status) {
+                _co_recycle(S, C);
+            }
             break;
         }
 
@@ -267,8 +396,11 @@ int32_t coroutine_yield(struct schedule * S) {
     C->status = COROUTINE_SUSPEND;
     S->running = -1;
 
+    char here = 0;
+    C->stack_sp = &here;
+
     PLOG_TRACE("coroutine %ld will be yield, swith to main loop...", id);
-    swapcontext(&C->ctx, &S->main);
+    coctx_swap(&C->ctx, &S->main);
 
     return C->result;
 }
@@ -295,6 +427,19 @@ int coroutine_status(struct schedule * S, int64_t id) {
     return (pos->second)->status;
 }
 
+int64_t coroutine_saved_stack_size(struct schedule * S, int64_t id) {
+    if (NULL == S) {
+        return 0;
+    }
+
+    cxx::unordered_map<int64_t, coroutine*>::iterator pos = S->co_hash_map.find(id);
+    if (pos == S->co_hash_map.end() || NULL == pos->second) {
+        return 0;
+    }
+
+    return (pos->second)->save_size;
+}
+
 int64_t coroutine_running(struct schedule * S) {
     if (NULL == S) {
         return -1;
@@ -338,8 +483,12 @@ int64_t CoroutineTask::Start(bool is_immediately) {
         return -1;
     }
     id_ = coroutine_new(schedule_obj_->schedule_, DoTask, this);
-    if (id_ < 0)
+    if (id_ < 0) {
+        // 协程栈分配失败
         id_ = -1;
+        delete this;
+        return -1;
+    }
     int64_t id = id_;
     schedule_obj_->task_map_[id_] = this;
     schedule_obj_->pre_start_task_.erase(this);
@@ -365,9 +514,10 @@ CoroutineSchedule::~CoroutineSchedule() {
         Close();
 }
 
-int CoroutineSchedule::Init(Timer* timer, uint32_t stack_size) {
+int CoroutineSchedule::Init(Timer* timer, uint32_t stack_size, uint32_t shared_stack_num,
+    uint32_t stack_pool_size, bool stack_madv_free) {
     timer_ = timer;
-    schedule_ = coroutine_open(stack_size);
+    schedule_ = coroutine_open(stack_size, shared_stack_num, stack_pool_size, stack_madv_free);
     if (schedule_ == NULL)
         return -1;
     return 0;
@@ -463,6 +613,45 @@ int CoroutineSchedule::Status(int64_t id) {
     return coroutine_status(this->schedule_, id);
 }
 
+bool CoroutineSchedule::IsSharedStack() const {
+    return schedule_ != NULL && !schedule_->shared_stacks.empty();
+}
+
+int64_t CoroutineSchedule::SavedStackSize(int64_t id) const {
+    return coroutine_saved_stack_size(schedule_, id);
+}
+
+int64_t CoroutineSchedule::TotalSavedStackSize(int64_t* num) const {
+    if (NULL == schedule_) {
+        if (num != NULL) {
+            *num = 0;
+        }
+        return 0;
+    }
+    if (num != NULL) {
+        *num = schedule_->saved_stack_num;
+    }
+    return schedule_->saved_stack_bytes;
+}
+
+uint32_t CoroutineSchedule::StackHighWatermark() const {
+    if (NULL == schedule_) {
+        return 0;
+    }
+    // 共享栈不会被释放，统计时采样
+    for (uint32_t i = 0; i < schedule_->shared_stacks.size(); i++) {
+        schedule_->stack_pool->Sample(schedule_->shared_stacks[i].stack);
+    }
+    return schedule_->stack_pool->HighWatermark();
+}
+
+uint32_t CoroutineSchedule::IdleStackNum() const {
+    if (NULL == schedule_) {
+        return 0;
+    }
+    return schedule_->stack_pool->FreeNum();
+}
+
 int32_t CoroutineSchedule::OnTimeout(int64_t id) {
     Resume(id, kCO_TIMEOUT);
     return kTIMER_BE_REMOVED;
@@ -19,8 +19,9 @@
 #include <set>
 #include <string.h>
 #include <sys/poll.h>
-#include <ucontext.h>
+#include <vector>
 
+#include "common/coctx.h"
 #include "common/error.h"
 #include "common/platform.h"
 
@@ -69,12 +70,17 @@ struct coroutine {
     coroutine_func func;
     cxx::function<void()> std_func;
     void *ud;
-    ucontext_t ctx;
+    coctx ctx;
     struct schedule * sch;
     int status;
     bool enable_hook;
-    char* stack;                // 协程栈的内容
+    char* stack;                // 协程栈，从栈池中分配，共享栈模式下为NULL
     int32_t result;             // 携带resume结果
+    int32_t stack_idx;          // 共享栈模式下使用的共享栈下标，-1表示使用独立栈
+    char* stack_sp;             // 共享栈模式下切出时的栈顶位置
+    char* save_buff;            // 共享栈模式下被其他协程换出时保存的栈内容
+    uint32_t save_size;         // 保存的栈内容大小
+    uint32_t save_cap;          // save_buff的容量
 
     coroutine() {
         func = NULL;
@@ -84,27 +90,53 @@ struct coroutine {
         enable_hook = false;
         stack = NULL;
         result = 0;
-        memset(&ctx, 0, sizeof(ucontext_t));
+        stack_idx = -1;
+        stack_sp = NULL;
+        save_buff = NULL;
+        save_size = 0;
+        save_cap = 0;
     }
 };
 
+/// @brief 共享栈，同一时刻只有owner的栈内容在栈上
+struct shared_stack {
+    char* stack;
+    coroutine* owner;
+
+    shared_stack() : stack(NULL), owner(NULL) {}
+};
+
+class StackPool;
+
 /// @brief struct schedule 协程调度器的数据结构
 struct schedule {
-    ucontext_t main;
+    coctx main;
     int64_t nco;                // 下一个要创建的协程ID
     int64_t running;            // 当前正在运行的协程ID
     cxx::unordered_map<int64_t, coroutine*> co_hash_map;
     std::list<coroutine*> co_free_list;
     int32_t co_free_num;
     uint32_t stack_size;
+    StackPool* stack_pool;      // 协程栈分配器，共享栈也从中分配
+    std::vector<shared_stack> shared_stacks;    // 为空时每个协程使用独立栈
+    uint32_t next_shared_stack;
+    int64_t saved_stack_bytes;  // 共享栈模式下所有协程保存的栈内容总大小
+    int64_t saved_stack_num;    // 共享栈模式下保存了栈内容的协程数
 };
 
 
 /// @brief 协程库初始化函数
 /// @param stack_size 协程的栈大小，默认是256k
+/// @param shared_stack_num 共享栈个数，默认为0，表示每个协程使用独立栈
+/// @param stack_pool_size 栈池中最多缓存的空闲栈个数，默认为1024
+/// @param stack_madv_free 是否对栈池中的空闲栈执行MADV_FREE，默认为false
 /// @return 返回struct schedule* 类型的指针
 /// @note 只能够在主线程调用
-struct schedule * coroutine_open(uint32_t stack_size = 256 * 1024);
+///     协程栈使用mmap分配，带有保护页，栈溢出时直接触发SIGSEGV
+///     共享栈模式下协程轮流分配到各共享栈上运行，协程被同一共享栈上的其他协程换出时，
+///     只把实际使用的栈内容保存到按需分配的堆内存中，恢复运行时再拷贝回共享栈
+struct schedule * coroutine_open(uint32_t stack_size = 256 * 1024, uint32_t shared_stack_num = 0,
+    uint32_t stack_pool_size = MAX_FREE_CO_NUM, bool stack_madv_free = false);
 
 /// @brief 协程库关闭
 /// @param 协程调度器结构体指针
@@ -145,6 +177,12 @@ int coroutine_status(struct schedule *, int64_t id);
 /// @return 返回正在运行的协程ID
 int64_t coroutine_running(struct schedule *);
 
+/// @brief 获取协程被换出时保存的栈大小
+/// @param 协程调度器结构体指针
+/// @param 协程ID
+/// @return 保存的栈大小(字节)，独立栈模式或协程不存在时为0
+int64_t coroutine_saved_stack_size(struct schedule *, int64_t id);
+
 /// @brief 暂停一个协程的运行
 /// @param[in] 协程调度器结构体指针
 /// @return 处理结果，@see CoroutineErrorCode
@@ -232,9 +270,15 @@ public:
     /// @brief 初始化工作, new了一个新的schedule
     /// @param timer 定时器实例，使协程支持yield超时
     /// @param stack_size 协程的栈大小，默认是256k
+    /// @param shared_stack_num 共享栈个数，默认为0，表示每个协程使用独立栈
+    /// @param stack_pool_size 栈池中最多缓存的空闲栈个数，默认为1024
+    /// @param stack_madv_free 是否对栈池中的空闲栈执行MADV_FREE，默认为false
     /// @return = 0 成功
     /// @return = -1 失败
-    int Init(Timer* timer = NULL, uint32_t stack_size = 256 * 1024);
+    /// @note 共享栈模式下挂起的协程只占用实际使用的栈大小，适合大量协程长时间挂起的场景，
+    ///     但协程被换出后其栈上变量的地址不再有效，不能把栈上变量的指针交给其他协程或主流程在挂起期间使用
+    int Init(Timer* timer = NULL, uint32_t stack_size = 256 * 1024, uint32_t shared_stack_num = 0,
+        uint32_t stack_pool_size = MAX_FREE_CO_NUM, bool stack_madv_free = false);
 
     /// @brief 关闭协程系统, 释放所有资源
     /// @return 还未结束的协程数
@@ -271,6 +315,22 @@ public:
     /// @return 协程状态
     int Status(int64_t id);
 
+    /// @brief 是否为共享栈模式
+    bool IsSharedStack() const;
+
+    /// @brief 返回指定id协程被换出时保存的栈大小，仅共享栈模式有效
+    int64_t SavedStackSize(int64_t id) const;
+
+    /// @brief 返回所有协程保存的栈大小总和，仅共享栈模式有效
+    /// @param num 输出保存了栈内容的协程数，可为NULL
+    int64_t TotalSavedStackSize(int64_t* num = NULL) const;
+
+    /// @brief 返回采样得到的协程栈使用高水位(字节)
+    uint32_t StackHighWatermark() const;
+
+    /// @brief 返回栈池中空闲栈的个数
+    uint32_t IdleStackNum() const;
+
     /// @brief 模版方法, 新建一个协程任务
     /// @note 使用此种方法生成的task对象指针会在协程结束后自动delete掉
     template<typename TASK>
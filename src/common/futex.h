@@ -0,0 +1,51 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+
+#ifndef _PEBBLE_COMMON_FUTEX_H_
+#define _PEBBLE_COMMON_FUTEX_H_
+
+#include <linux/futex.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace pebble {
+
+
+/// @brief 当*addr等于value时休眠，直到被FutexWake唤醒或超时，可能虚假唤醒
+/// @param timeout_ms 超时时间，小于0表示不超时
+inline void FutexWait(int32_t* addr, int32_t value, int32_t timeout_ms)
+{
+    if (timeout_ms < 0)
+    {
+        syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+        return;
+    }
+    struct timespec ts;
+    ts.tv_sec  = timeout_ms / 1000;
+    ts.tv_nsec = (timeout_ms % 1000) * 1000000;
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, value, &ts, NULL, 0);
+}
+
+/// @brief 唤醒最多num个在addr上休眠的线程
+inline void FutexWake(int32_t* addr, int32_t num = 1)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, num, NULL, NULL, 0);
+}
+
+} // namespace pebble
+
+#endif // _PEBBLE_COMMON_FUTEX_H_
@@ -37,6 +37,27 @@ namespace pebble {
 
 #define ARRAYSIZE(a) (sizeof(a) / sizeof(*(a)))
 
+static void InitRecursiveMutex(pthread_mutex_t* mutex) {
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+// 只有持有Log::m_mutex时才访问m_log_array和输出设备
+class LogLocker {
+public:
+    explicit LogLocker(pthread_mutex_t* mutex) : m_mutex(mutex) {
+        pthread_mutex_lock(m_mutex);
+    }
+    ~LogLocker() {
+        pthread_mutex_unlock(m_mutex);
+    }
+private:
+    pthread_mutex_t* m_mutex;
+};
+
 static const char*  g_device_str[]   = { "STDOUT", "FILE" };
 static const char*  g_priority_str[] = { "TRACE", "DEBUG", "INFO", "ERROR", "FATAL" };
 
@@ -150,7 +171,8 @@ Log::Log() {
     m_log_array[kLOG_STAT]  = new RollUtil("./log", self_name + ".stat");
 
     m_isset_time    = false;
-    m_current_time  = TimeUtility::GetCurrentUS();
+    m_current_time  = TimeUtility::GetWallUS();
+    InitRecursiveMutex(&m_mutex);
 }
 
 Log::Log(const Log& rhs) {
@@ -163,6 +185,7 @@ Log::Log(const Log& rhs) {
 
     m_isset_time    = false;
     m_current_time  = 0;
+    InitRecursiveMutex(&m_mutex);
 }
 
 Log::~Log() {
@@ -170,6 +193,7 @@ Log::~Log() {
         delete m_log_array[i];
         m_log_array[i] = NULL;
     }
+    pthread_mutex_destroy(&m_mutex);
 }
 
 void Log::Write(LOG_PRIORITY pri, const char* file, uint32_t line,
@@ -180,7 +204,8 @@ void Log::Write(LOG_PRIORITY pri, const char* file, uint32_t line,
         return;
     }
 
-    static char buff[4096] = {0};
+    // 多网络线程模式下网络线程也会打印日志，格式化缓冲区按线程独立
+    static __thread char buff[4096] = {0};
 
     // log前缀，接入其他log时不用组装
     int pre_len = 0;
@@ -206,6 +231,9 @@ void Log::Write(LOG_PRIORITY pri, const char* file, uint32_t line,
         len = 0;
     }
 
+    // 格式化在锁外进行，只有输出和文件滚动互斥
+    LogLocker locker(&m_mutex);
+
     // 输出到其他log
     if (m_log_write_func) {
         m_log_write_func(pri, file, line, function, buff);
@@ -246,6 +274,7 @@ void Log::Write(LOG_PRIORITY pri, const char* file, uint32_t line,
 
 void Log::Write(const char* data)
 {
+    LogLocker locker(&m_mutex);
     if (m_log_array[kLOG_STAT] == NULL) {
         return;
     }
@@ -261,6 +290,7 @@ void Log::Write(const char* data)
 
 void Log::Close()
 {
+    LogLocker locker(&m_mutex);
     for (int i = 0; i < kLOG_BUTT; i++) {
         if (m_log_array[i]) {
             m_log_array[i]->Close();
@@ -270,6 +300,7 @@ void Log::Close()
 
 void Log::RegisterLogWriteFunc(const LogWriteFunc& log_write_func)
 {
+    LogLocker locker(&m_mutex);
     m_log_write_func = log_write_func;
 }
 
@@ -280,6 +311,7 @@ void Log::EnableCrashRecord()
 
 void Log::Flush()
 {
+    LogLocker locker(&m_mutex);
     for (int i = 0; i < kLOG_BUTT; i++) {
         if (m_log_array[i]) {
             m_log_array[i]->Flush();
@@ -339,6 +371,7 @@ void Log::SetMaxFileSize(uint32_t max_size_Mbytes)
     }
     file_size = file_size * 1024 * 1024;
 
+    LogLocker locker(&m_mutex);
     for (int i = 0; i < kLOG_BUTT; i++) {
         if (m_log_array[i]) {
             m_log_array[i]->SetFileSize(file_size);
@@ -348,6 +381,7 @@ void Log::SetMaxFileSize(uint32_t max_size_Mbytes)
 
 void Log::SetMaxRollNum(uint32_t num)
 {
+    LogLocker locker(&m_mutex);
     for (int i = 0; i < kLOG_BUTT; i++) {
         if (m_log_array[i]) {
             m_log_array[i]->SetRollNum(num);
@@ -357,6 +391,7 @@ void Log::SetMaxRollNum(uint32_t num)
 
 void Log::SetFilePath(const std::string& file_path)
 {
+    LogLocker locker(&m_mutex);
     for (int i = 0; i < kLOG_BUTT; i++) {
         if (m_log_array[i]) {
             m_log_array[i]->SetFilePath(file_path);
@@ -376,7 +411,7 @@ int64_t Log::GetCurrentTime() {
     if (m_isset_time) {
         return m_current_time;
     }
-    return TimeUtility::GetCurrentUS();
+    return TimeUtility::GetWallUS();
 }
 
 } // namespace pebble
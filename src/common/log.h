@@ -15,6 +15,8 @@
 #ifndef _PEBBLE_COMMON_LOG_H_
 #define _PEBBLE_COMMON_LOG_H_
 
+#include <pthread.h>
+
 #include "common/platform.h"
 
 namespace pebble {
@@ -141,6 +143,10 @@ private:
 
     bool            m_isset_time;
     int64_t         m_current_time;
+
+    // 多网络线程模式下网络线程也会写日志，输出和文件滚动需要互斥
+    // 使用递归锁，写日志过程中崩溃时信号处理函数还能在同一线程内写日志
+    pthread_mutex_t m_mutex;
 };
 
 } // namespace pebble
@@ -179,7 +185,7 @@ private:
 #define PLOG_N_EVERY_SECOND(num, pri, fmt, args...) \
     do { \
         if (pri >= pebble::Log::Instance().GetPriority()) { \
-            static int32_t LOG_CNT_VAR = 0; static int64_t START_TIME_VAR = 0; \
+            static __thread int32_t LOG_CNT_VAR = 0; static __thread int64_t START_TIME_VAR = 0; \
             if (START_TIME_VAR == 0) { START_TIME_VAR = pebble::Log::Instance().GetCurrentTime(); } \
             int64_t NOW_TIME_VAR = pebble::Log::Instance().GetCurrentTime(); \
             if (START_TIME_VAR + 1000000 < NOW_TIME_VAR) { \
@@ -0,0 +1,391 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+
+#ifndef _PEBBLE_COMMON_MPMC_QUEUE_H_
+#define _PEBBLE_COMMON_MPMC_QUEUE_H_
+
+#include <assert.h>
+#include <sched.h>
+#include <stdint.h>
+#include <time.h>
+#include <cstddef>
+
+#include "common/futex.h"
+#include "common/uncopyable.h"
+
+namespace pebble {
+
+
+/// @brief 多生产者多消费者有界无锁环形队列(Vyukov算法)
+/// @note 接口与BlockingQueue的PushBack/PopFront系列一致，可直接替换；容量向上取整为2的幂
+///     Try*操作不加锁，只有存在等待的线程时才执行唤醒；阻塞操作使用futex等待，
+///     futex_wait为false时阻塞操作改为让出CPU轮询，Try*操作不再检查等待者
+template <typename T>
+class MpmcQueue : public Uncopyable
+{
+public:
+    typedef T ValueType;
+
+    explicit MpmcQueue(size_t max_elements, bool futex_wait = true)
+        : m_cells(NULL), m_mask(0), m_futex_wait(futex_wait), m_enqueue_pos(0), m_dequeue_pos(0)
+    {
+        assert(max_elements > 0 && max_elements <= 0x80000000U);
+        size_t size = 2;
+        while (size < max_elements)
+        {
+            size <<= 1;
+        }
+        m_cells = new Cell[size];
+        for (size_t i = 0; i < size; i++)
+        {
+            m_cells[i].sequence = i;
+        }
+        m_mask = size - 1;
+    }
+
+    ~MpmcQueue()
+    {
+        delete [] m_cells;
+    }
+
+    /// @brief push element in to back of queue
+    /// @note if queue is full, block and wait for non-full
+    void PushBack(const T& value)
+    {
+        TimedPushBack(value, -1);
+    }
+
+    /// @brief Try push element in to back of queue
+    /// @note if queue is full, return false
+    bool TryPushBack(const T& value)
+    {
+        if (!Enqueue(value))
+        {
+            return false;
+        }
+        Notify(&m_not_empty);
+        return true;
+    }
+
+    /// @brief push back with time out
+    /// @param timeout_in_ms timeout, in milliseconds, <0 means wait forever
+    /// @return whether pushed
+    bool TimedPushBack(const T& value, int timeout_in_ms)
+    {
+        if (TryPushBack(value))
+        {
+            return true;
+        }
+        if (0 == timeout_in_ms)
+        {
+            return false;
+        }
+        // 等待通常很短，先让出CPU重试几次，避免每次都进入futex休眠
+        for (int i = 0; i < SPIN_COUNT; i++)
+        {
+            sched_yield();
+            if (TryPushBack(value))
+            {
+                return true;
+            }
+        }
+        int64_t deadline = Deadline(timeout_in_ms);
+        while (true)
+        {
+            int32_t remain_ms = Remain(deadline);
+            if (0 == remain_ms)
+            {
+                return false;
+            }
+            int32_t seq = PrepareWait(&m_not_full);
+            if (Enqueue(value))
+            {
+                CancelWait(&m_not_full);
+                Notify(&m_not_empty);
+                return true;
+            }
+            Wait(&m_not_full, seq, remain_ms);
+        }
+    }
+
+    /// @brief popup from front of queue.
+    /// @note if queue is empty, block and wait for non-empty
+    void PopFront(T* value)
+    {
+        TimedPopFront(value, -1);
+    }
+
+    /// @brief Try popup from front of queue.
+    /// @note if queue is empty, return false
+    bool TryPopFront(T* value)
+    {
+        if (!Dequeue(value))
+        {
+            return false;
+        }
+        Notify(&m_not_full);
+        return true;
+    }
+
+    /// @brief pop front with time out
+    /// @param timeout_in_ms timeout, in milliseconds, <0 means wait forever
+    /// @return whether poped
+    bool TimedPopFront(T* value, int timeout_in_ms)
+    {
+        if (TryPopFront(value))
+        {
+            return true;
+        }
+        if (0 == timeout_in_ms)
+        {
+            return false;
+        }
+        for (int i = 0; i < SPIN_COUNT; i++)
+        {
+            sched_yield();
+            if (TryPopFront(value))
+            {
+                return true;
+            }
+        }
+        int64_t deadline = Deadline(timeout_in_ms);
+        while (true)
+        {
+            int32_t remain_ms = Remain(deadline);
+            if (0 == remain_ms)
+            {
+                return false;
+            }
+            int32_t seq = PrepareWait(&m_not_empty);
+            if (Dequeue(value))
+            {
+                CancelWait(&m_not_empty);
+                Notify(&m_not_full);
+                return true;
+            }
+            Wait(&m_not_empty, seq, remain_ms);
+        }
+    }
+
+    /// @brief number of elements in the queue, for reference only
+    size_t Size() const
+    {
+        size_t dequeue_pos = __atomic_load_n(&m_dequeue_pos, __ATOMIC_ACQUIRE);
+        size_t enqueue_pos = __atomic_load_n(&m_enqueue_pos, __ATOMIC_ACQUIRE);
+        return enqueue_pos > dequeue_pos ? enqueue_pos - dequeue_pos : 0;
+    }
+
+    /// @brief whether the queue is empty, for reference only
+    bool IsEmpty() const
+    {
+        return Size() == 0;
+    }
+
+    /// @brief whether the queue is full, for reference only
+    bool IsFull() const
+    {
+        return Size() > m_mask;
+    }
+
+    size_t Capacity() const
+    {
+        return m_mask + 1;
+    }
+
+    /// @brief clear the queue
+    void Clear()
+    {
+        T value;
+        while (Dequeue(&value))
+        {
+        }
+        Notify(&m_not_full, 0x7fffffff);
+    }
+
+private:
+    struct Cell
+    {
+        size_t sequence;
+        T      data;
+    };
+
+    // futex等待的序号和等待者个数
+    struct Waiter
+    {
+        Waiter() : seq(0), waiters(0) {}
+        int32_t seq;
+        int32_t waiters;
+    };
+
+    bool Enqueue(const T& value)
+    {
+        Cell* cell = NULL;
+        size_t pos = __atomic_load_n(&m_enqueue_pos, __ATOMIC_RELAXED);
+        while (true)
+        {
+            cell = &m_cells[pos & m_mask];
+            size_t seq = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+            intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (0 == dif)
+            {
+                if (__atomic_compare_exchange_n(&m_enqueue_pos, &pos, pos + 1, true,
+                    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                {
+                    break;
+                }
+            }
+            else if (dif < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = __atomic_load_n(&m_enqueue_pos, __ATOMIC_RELAXED);
+            }
+        }
+        cell->data = value;
+        __atomic_store_n(&cell->sequence, pos + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    bool Dequeue(T* value)
+    {
+        Cell* cell = NULL;
+        size_t pos = __atomic_load_n(&m_dequeue_pos, __ATOMIC_RELAXED);
+        while (true)
+        {
+            cell = &m_cells[pos & m_mask];
+            size_t seq = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+            intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if (0 == dif)
+            {
+                if (__atomic_compare_exchange_n(&m_dequeue_pos, &pos, pos + 1, true,
+                    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                {
+                    break;
+                }
+            }
+            else if (dif < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = __atomic_load_n(&m_dequeue_pos, __ATOMIC_RELAXED);
+            }
+        }
+        *value = cell->data;
+        // 及时释放元素持有的资源
+        cell->data = T();
+        __atomic_store_n(&cell->sequence, pos + m_mask + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    // 先登记等待再重试操作，与Notify配对，避免丢失唤醒
+    int32_t PrepareWait(Waiter* waiter)
+    {
+        if (!m_futex_wait)
+        {
+            return 0;
+        }
+        int32_t seq = __atomic_load_n(&waiter->seq, __ATOMIC_ACQUIRE);
+        __atomic_add_fetch(&waiter->waiters, 1, __ATOMIC_SEQ_CST);
+        return seq;
+    }
+
+    void CancelWait(Waiter* waiter)
+    {
+        if (m_futex_wait)
+        {
+            __atomic_sub_fetch(&waiter->waiters, 1, __ATOMIC_SEQ_CST);
+        }
+    }
+
+    void Wait(Waiter* waiter, int32_t seq, int32_t timeout_ms)
+    {
+        if (!m_futex_wait)
+        {
+            sched_yield();
+            return;
+        }
+        FutexWait(&waiter->seq, seq, timeout_ms);
+        __atomic_sub_fetch(&waiter->waiters, 1, __ATOMIC_SEQ_CST);
+    }
+
+    void Notify(Waiter* waiter, int32_t num = 1)
+    {
+        if (!m_futex_wait)
+        {
+            return;
+        }
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&waiter->waiters, __ATOMIC_RELAXED) > 0)
+        {
+            __atomic_add_fetch(&waiter->seq, 1, __ATOMIC_SEQ_CST);
+            FutexWake(&waiter->seq, num);
+        }
+    }
+
+    static int64_t NowMs()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<int64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+    }
+
+    // 返回-1表示不超时
+    static int64_t Deadline(int timeout_in_ms)
+    {
+        return timeout_in_ms < 0 ? -1 : NowMs() + timeout_in_ms;
+    }
+
+    // 返回剩余等待时间，-1表示不超时，0表示已超时
+    static int32_t Remain(int64_t deadline)
+    {
+        if (deadline < 0)
+        {
+            return -1;
+        }
+        int64_t remain = deadline - NowMs();
+        return remain > 0 ? static_cast<int32_t>(remain) : 0;
+    }
+
+private:
+    static const size_t CACHE_LINE_SIZE = 64;
+    // 阻塞操作进入futex等待前让出CPU重试的次数
+    static const int SPIN_COUNT = 16;
+
+    Cell*       m_cells;
+    size_t      m_mask;
+    bool        m_futex_wait;
+    char        m_pad0[CACHE_LINE_SIZE];
+
+    // 生产者竞争修改
+    size_t      m_enqueue_pos;
+    char        m_pad1[CACHE_LINE_SIZE - sizeof(size_t)];
+
+    // 消费者竞争修改
+    size_t      m_dequeue_pos;
+    char        m_pad2[CACHE_LINE_SIZE - sizeof(size_t)];
+
+    Waiter      m_not_empty;
+    char        m_pad3[CACHE_LINE_SIZE - sizeof(Waiter)];
+
+    Waiter      m_not_full;
+};
+
+} // namespace pebble
+
+#endif // _PEBBLE_COMMON_MPMC_QUEUE_H_
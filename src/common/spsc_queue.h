@@ -0,0 +1,133 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#ifndef _PEBBLE_COMMON_SPSC_QUEUE_H_
+#define _PEBBLE_COMMON_SPSC_QUEUE_H_
+
+#include <assert.h>
+#include <stdint.h>
+#include <cstddef>
+
+#include "common/uncopyable.h"
+
+namespace pebble {
+
+
+/// @brief 单生产者单消费者无锁环形队列
+/// @note 只允许一个线程Push、一个线程Pop，容量向上取整为2的幂
+template <typename T>
+class SpscQueue : public Uncopyable
+{
+public:
+    typedef T ValueType;
+
+    explicit SpscQueue(uint32_t capacity)
+        : m_buffer(NULL), m_mask(0), m_head(0), m_tail(0), m_cached_head(0), m_cached_tail(0)
+    {
+        assert(capacity > 0 && capacity <= 0x80000000U);
+        uint32_t size = 1;
+        while (size < capacity)
+        {
+            size <<= 1;
+        }
+        m_buffer = new T[size];
+        m_mask = size - 1;
+    }
+
+    ~SpscQueue()
+    {
+        delete [] m_buffer;
+    }
+
+    /// @brief 生产者线程调用
+    /// @return false 队列已满
+    bool TryPush(const T& value)
+    {
+        uint32_t tail = m_tail;
+        if (tail - m_cached_head > m_mask)
+        {
+            m_cached_head = __atomic_load_n(&m_head, __ATOMIC_ACQUIRE);
+            if (tail - m_cached_head > m_mask)
+            {
+                return false;
+            }
+        }
+        m_buffer[tail & m_mask] = value;
+        __atomic_store_n(&m_tail, tail + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    /// @brief 消费者线程调用
+    /// @return false 队列为空
+    bool TryPop(T* value)
+    {
+        uint32_t head = m_head;
+        if (head == m_cached_tail)
+        {
+            m_cached_tail = __atomic_load_n(&m_tail, __ATOMIC_ACQUIRE);
+            if (head == m_cached_tail)
+            {
+                return false;
+            }
+        }
+        *value = m_buffer[head & m_mask];
+        __atomic_store_n(&m_head, head + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    /// @brief 任意线程调用，结果仅供参考
+    bool IsEmpty() const
+    {
+        return Size() == 0;
+    }
+
+    /// @brief 任意线程调用，结果仅供参考
+    size_t Size() const
+    {
+        uint32_t tail = __atomic_load_n(&m_tail, __ATOMIC_ACQUIRE);
+        uint32_t head = __atomic_load_n(&m_head, __ATOMIC_ACQUIRE);
+        return tail - head;
+    }
+
+    size_t Capacity() const
+    {
+        return m_mask + 1;
+    }
+
+private:
+    static const size_t CACHE_LINE_SIZE = 64;
+
+    T*          m_buffer;
+    uint32_t    m_mask;
+    char        m_pad0[CACHE_LINE_SIZE];
+
+    // 消费者写，生产者读
+    uint32_t    m_head;
+    char        m_pad1[CACHE_LINE_SIZE - sizeof(uint32_t)];
+
+    // 生产者写，消费者读
+    uint32_t    m_tail;
+    char        m_pad2[CACHE_LINE_SIZE - sizeof(uint32_t)];
+
+    // 生产者缓存的m_head
+    uint32_t    m_cached_head;
+    char        m_pad3[CACHE_LINE_SIZE - sizeof(uint32_t)];
+
+    // 消费者缓存的m_tail
+    uint32_t    m_cached_tail;
+};
+
+} // namespace pebble
+
+#endif // _PEBBLE_COMMON_SPSC_QUEUE_H_
@@ -0,0 +1,136 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "common/log.h"
+#include "common/stack_pool.h"
+
+#ifndef MADV_FREE
+#define MADV_FREE 8
+#endif
+
+namespace pebble {
+
+
+StackPool::StackPool()
+    :   m_page_size(0), m_stack_size(0), m_max_free_num(0), m_madv_free(false),
+        m_advice(MADV_FREE), m_used_num(0), m_free_count(0), m_high_watermark(0) {
+}
+
+StackPool::~StackPool() {
+    for (std::vector<char*>::iterator it = m_free_stacks.begin(); it != m_free_stacks.end(); ++it) {
+        Unmap(*it);
+    }
+    m_free_stacks.clear();
+}
+
+int32_t StackPool::Init(uint32_t stack_size, uint32_t max_free_num, bool madv_free) {
+    long page_size = sysconf(_SC_PAGESIZE);
+    if (page_size <= 0) {
+        page_size = 4096;
+    }
+    m_page_size    = page_size;
+    m_stack_size   = (stack_size + m_page_size - 1) / m_page_size * m_page_size;
+    if (m_stack_size == 0) {
+        return -1;
+    }
+    m_max_free_num = max_free_num;
+    m_madv_free    = madv_free;
+    m_mincore_vec.resize(m_stack_size / m_page_size);
+    return 0;
+}
+
+char* StackPool::Alloc() {
+    char* stack = NULL;
+    if (!m_free_stacks.empty()) {
+        stack = m_free_stacks.back();
+        m_free_stacks.pop_back();
+        m_used_num++;
+        return stack;
+    }
+
+    // 多映射一个保护页，MAP_NORESERVE使未访问的栈空间不计入提交内存
+    void* addr = mmap(NULL, m_stack_size + m_page_size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (MAP_FAILED == addr) {
+        PLOG_ERROR("mmap stack failed %d:%s, size = %u", errno, strerror(errno), m_stack_size);
+        return NULL;
+    }
+    if (mprotect(addr, m_page_size, PROT_NONE) != 0) {
+        PLOG_ERROR("mprotect stack guard page failed %d:%s", errno, strerror(errno));
+        munmap(addr, m_stack_size + m_page_size);
+        return NULL;
+    }
+
+    m_used_num++;
+    return static_cast<char*>(addr) + m_page_size;
+}
+
+void StackPool::Free(char* stack) {
+    if (NULL == stack) {
+        return;
+    }
+    m_used_num--;
+
+    if (++m_free_count % SAMPLE_INTERVAL == 0) {
+        Sample(stack);
+    }
+
+    if (m_free_stacks.size() >= m_max_free_num) {
+        Unmap(stack);
+        return;
+    }
+
+    if (m_madv_free) {
+        Advise(stack);
+    }
+    m_free_stacks.push_back(stack);
+}
+
+void StackPool::Sample(char* stack) {
+    if (NULL == stack || mincore(stack, m_stack_size, &m_mincore_vec[0]) != 0) {
+        return;
+    }
+    // 栈从高地址向低地址增长，最低的已驻留页即为用到的最深位置
+    uint32_t page_num = m_mincore_vec.size();
+    for (uint32_t i = 0; i < page_num; i++) {
+        if (m_mincore_vec[i] & 1) {
+            uint32_t used = (page_num - i) * m_page_size;
+            if (used > m_high_watermark) {
+                m_high_watermark = used;
+            }
+            break;
+        }
+    }
+}
+
+void StackPool::Unmap(char* stack) {
+    munmap(stack - m_page_size, m_stack_size + m_page_size);
+}
+
+void StackPool::Advise(char* stack) {
+    if (madvise(stack, m_stack_size, m_advice) == 0) {
+        return;
+    }
+    // 内核不支持MADV_FREE时退化为MADV_DONTNEED
+    if (EINVAL == errno && MADV_FREE == m_advice) {
+        m_advice = MADV_DONTNEED;
+        madvise(stack, m_stack_size, m_advice);
+    }
+}
+
+} // namespace pebble
@@ -0,0 +1,87 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#ifndef _PEBBLE_COMMON_STACK_POOL_H_
+#define _PEBBLE_COMMON_STACK_POOL_H_
+
+#include <vector>
+
+#include "common/platform.h"
+#include "common/uncopyable.h"
+
+namespace pebble {
+
+
+/// @brief 协程栈分配器
+/// @note 每个栈单独mmap，低地址处有一个PROT_NONE的保护页，栈溢出时立即触发SIGSEGV而不是破坏堆内存
+///     物理内存在首次访问时才分配，释放的栈缓存在池中复用，可选用MADV_FREE让内核回收空闲栈的物理内存
+///     通过mincore采样栈实际用到的最低地址，统计栈使用的高水位，用于评估栈大小配置
+class StackPool : public Uncopyable {
+public:
+    StackPool();
+    ~StackPool();
+
+    /// @brief 初始化
+    /// @param stack_size 栈大小，向上取整到页大小
+    /// @param max_free_num 池中最多缓存的空闲栈个数，超出时直接munmap
+    /// @param madv_free 是否对放回池中的栈执行MADV_FREE(内核不支持时使用MADV_DONTNEED)
+    /// @return 0 成功，<0 失败
+    int32_t Init(uint32_t stack_size, uint32_t max_free_num, bool madv_free);
+
+    /// @brief 分配一个栈
+    /// @return 栈的起始地址(低地址，保护页之上)，失败返回NULL
+    char* Alloc();
+
+    /// @brief 释放一个栈，按采样间隔统计其使用高水位
+    void Free(char* stack);
+
+    /// @brief 采样一个栈的使用量，更新高水位
+    void Sample(char* stack);
+
+    /// @brief 实际的栈大小(不含保护页)
+    uint32_t StackSize() const { return m_stack_size; }
+
+    /// @brief 采样到的栈使用高水位(字节)
+    uint32_t HighWatermark() const { return m_high_watermark; }
+
+    /// @brief 池中空闲栈个数
+    uint32_t FreeNum() const { return m_free_stacks.size(); }
+
+    /// @brief 已分配出去的栈个数
+    uint32_t UsedNum() const { return m_used_num; }
+
+    // 每释放多少个栈采样一次
+    static const uint32_t SAMPLE_INTERVAL = 16;
+
+private:
+    void Unmap(char* stack);
+
+    void Advise(char* stack);
+
+private:
+    uint32_t m_page_size;
+    uint32_t m_stack_size;
+    uint32_t m_max_free_num;
+    bool     m_madv_free;
+    int      m_advice;
+    uint32_t m_used_num;
+    uint32_t m_free_count;
+    uint32_t m_high_watermark;
+    std::vector<char*> m_free_stacks;
+    std::vector<unsigned char> m_mincore_vec;
+};
+
+} // namespace pebble
+
+#endif // _PEBBLE_COMMON_STACK_POOL_H_
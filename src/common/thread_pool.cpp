@@ -14,21 +14,26 @@
 
 #include <iostream>
 
+#include "common/futex.h"
 #include "common/thread_pool.h"
 
 namespace pebble {
 
+// 当前线程所属的WORK_STEALING工作线程，用于任务中添加任务时直接放入自己的队列
+static __thread void* g_current_stealer = NULL;
 
-ThreadPool::ThreadPool() : m_exit(false), m_initialized(false),
-    m_thread_num(0), m_mode(PENDING) {
+ThreadPool::ThreadPool() : m_idle_num(0), m_searching_num(0), m_next_stealer(0), m_waiting(true),
+    m_bounded_queue(NULL), m_working_num(0), m_exit(false), m_initialized(false), m_thread_num(0),
+    m_mode(PENDING) {
 }
 
 
 ThreadPool::~ThreadPool() {
     Terminate();
+    delete m_bounded_queue;
 }
 
-int ThreadPool::Init(int32_t thread_num, int32_t mode) {
+int ThreadPool::Init(int32_t thread_num, int32_t mode, uint32_t max_pending_num) {
     if (m_initialized) {
         return -1;
     }
@@ -42,13 +47,22 @@ int ThreadPool::Init(int32_t thread_num, int32_t mode) {
     }
     m_thread_num = thread_num;
 
-    if (mode >= NO_PENDING || mode < PENDING) {
+    if (mode >= NO_PENDING && mode <= WORK_STEALING) {
         m_mode = mode;
     }
 
+    if (m_mode == WORK_STEALING) {
+        return InitStealing();
+    }
+
+    if (max_pending_num > 0) {
+        m_bounded_queue = new MpmcQueue<Task>(max_pending_num);
+    }
+
     for (int32_t i = 0; i < thread_num; i++) {
 
-        InnerThread* thread = new InnerThread(&m_pending_queue, &m_finished_queue, &m_working_queue);
+        InnerThread* thread = new InnerThread(&m_pending_queue, m_bounded_queue, &m_finished_queue,
+            &m_working_num, &m_finished_notify);
         m_threads.push_back(thread);
 
         thread->Start();
@@ -64,6 +78,10 @@ int ThreadPool::AddTask(cxx::function<void()>& fun, int64_t task_id) {
         return -1;
     }
 
+    if (m_mode == WORK_STEALING) {
+        return AddStealingTask(fun, task_id);
+    }
+
     if (m_mode == NO_PENDING) {
         Stats stat;
         GetStatus(&stat);
@@ -76,6 +94,10 @@ int ThreadPool::AddTask(cxx::function<void()>& fun, int64_t task_id) {
     t.fun = fun;
     t.task_id = task_id;
 
+    if (m_bounded_queue != NULL) {
+        return m_bounded_queue->TryPushBack(t) ? 0 : -3;
+    }
+
     m_pending_queue.PushBack(t);
 
     return 0;
@@ -85,12 +107,23 @@ void ThreadPool::GetStatus(Stats* stat) {
     if (stat == NULL) {
         return;
     }
-    stat->pending_task_num = m_pending_queue.Size();
-    stat->working_thread_num = m_working_queue.Size();
+    if (m_mode == WORK_STEALING) {
+        GetStealingStatus(stat);
+        return;
+    }
+    stat->pending_task_num = m_bounded_queue ? m_bounded_queue->Size() : m_pending_queue.Size();
+    stat->working_thread_num = __atomic_load_n(&m_working_num, __ATOMIC_RELAXED);
+    stat->parked_thread_num = 0;
+    stat->executed_task_num = 0;
+    stat->stolen_task_num = 0;
+    for (size_t i = 0; i < m_threads.size(); i++) {
+        stat->executed_task_num += m_threads[i]->ExecutedNum();
+    }
 }
 
 void ThreadPool::Terminate(bool waiting /* = true */) {
     m_exit = true;
+    TerminateStealing(waiting);
     for (size_t i = 0; i < m_threads.size(); i++) {
         m_threads[i]->Terminate(waiting);
     }
@@ -101,6 +134,9 @@ void ThreadPool::Terminate(bool waiting /* = true */) {
     }
 
     m_pending_queue.Clear();
+    if (m_bounded_queue != NULL) {
+        m_bounded_queue->Clear();
+    }
     m_finished_queue.Clear();
     m_threads.clear();
 }
@@ -114,32 +150,48 @@ bool ThreadPool::GetFinishedTaskID(int64_t* task_id) {
     return ret;
 }
 
+void ThreadPool::SetFinishedNotify(const cxx::function<void()>& notify) {
+    if (m_initialized) {
+        return;
+    }
+    m_finished_notify = notify;
+}
+
 ThreadPool::InnerThread::InnerThread(BlockingQueue<Task>* pending_queue,
-    BlockingQueue<int64_t>* finished_queue, BlockingQueue<int64_t>* working_queue) :
+    MpmcQueue<Task>* bounded_queue, BlockingQueue<int64_t>* finished_queue, int32_t* working_num,
+    const cxx::function<void()>* finished_notify) :
         m_pending_queue(pending_queue),
+        m_bounded_queue(bounded_queue),
         m_finished_queue(finished_queue),
-        m_working_queue(working_queue),
+        m_working_num(working_num),
+        m_finished_notify(finished_notify),
         m_exit(false),
-        m_waiting(true) {
+        m_waiting(true),
+        m_executed(0) {
 }
 
 void ThreadPool::InnerThread::Run() {
     while (1) {
 
-        if (m_exit && ((!m_waiting) || (m_waiting && m_pending_queue->IsEmpty()))) {
+        if (m_exit && ((!m_waiting) || (m_waiting && (m_bounded_queue ?
+            m_bounded_queue->IsEmpty() : m_pending_queue->IsEmpty())))) {
             break;
         }
 
         Task t;
-        bool ret = m_pending_queue->TimedPopFront(&t, 1000);
+        bool ret = m_bounded_queue ? m_bounded_queue->TimedPopFront(&t, 1000)
+            : m_pending_queue->TimedPopFront(&t, 1000);
         if (ret) {
-            m_working_queue->PushBack(0); // 不关心元素的值，只是通过队列size记录忙的线程数
+            __atomic_add_fetch(m_working_num, 1, __ATOMIC_RELAXED);
             t.fun();
             if (t.task_id >= 0) {
                 m_finished_queue->PushBack(t.task_id);
+                if (*m_finished_notify) {
+                    (*m_finished_notify)();
+                }
             }
-            int64_t tmp;
-            m_working_queue->TryPopBack(&tmp);
+            __atomic_sub_fetch(m_working_num, 1, __ATOMIC_RELAXED);
+            __atomic_store_n(&m_executed, m_executed + 1, __ATOMIC_RELAXED);
         }
     }
 }
@@ -149,5 +201,285 @@ void ThreadPool::InnerThread::Terminate(bool waiting /* = true */) {
     m_waiting = waiting;
 }
 
+int ThreadPool::InitStealing() {
+    for (uint32_t i = 0; i < m_thread_num; i++) {
+        m_stealers.push_back(new StealingThread(this, i));
+    }
+    // 所有线程对象创建完成后再启动，线程中会访问其他线程的队列
+    for (uint32_t i = 0; i < m_thread_num; i++) {
+        m_stealers[i]->Start();
+    }
+
+    m_initialized = true;
+
+    return 0;
+}
+
+int ThreadPool::AddStealingTask(cxx::function<void()>& fun, int64_t task_id) {
+    if (__atomic_load_n(&m_exit, __ATOMIC_RELAXED)) {
+        return -2;
+    }
+
+    Task* t = new Task;
+    t->fun = fun;
+    t->task_id = task_id;
+
+    StealingThread* current = static_cast<StealingThread*>(g_current_stealer);
+    if (current != NULL && current->m_pool == this) {
+        current->m_deque.Push(t);
+    } else {
+        uint32_t index = __atomic_fetch_add(&m_next_stealer, 1, __ATOMIC_RELAXED);
+        m_stealers[index % m_stealers.size()]->Inject(t);
+    }
+
+    // 与StealingThread::Park配对: 要么休眠前的检查能看到新任务，要么这里能看到休眠的线程
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&m_idle_num, __ATOMIC_RELAXED) > 0) {
+        WakeOne();
+    }
+    return 0;
+}
+
+void ThreadPool::WakeOne() {
+    // 已有线程在寻找任务时由它负责，它找到任务后再唤醒下一个
+    if (__atomic_load_n(&m_searching_num, __ATOMIC_SEQ_CST) > 0) {
+        return;
+    }
+    uint32_t num = m_stealers.size();
+    uint32_t start = __atomic_load_n(&m_next_stealer, __ATOMIC_RELAXED);
+    for (uint32_t i = 0; i < num; i++) {
+        if (m_stealers[(start + i) % num]->Unpark(true)) {
+            return;
+        }
+    }
+}
+
+bool ThreadPool::HasStealingTask() const {
+    for (size_t i = 0; i < m_stealers.size(); i++) {
+        if (!m_stealers[i]->m_deque.IsEmpty()
+            || __atomic_load_n(&m_stealers[i]->m_inbox, __ATOMIC_ACQUIRE) != NULL) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::GetStealingStatus(Stats* stat) {
+    stat->pending_task_num = 0;
+    stat->working_thread_num = 0;
+    stat->parked_thread_num = 0;
+    stat->executed_task_num = 0;
+    stat->stolen_task_num = 0;
+    for (size_t i = 0; i < m_stealers.size(); i++) {
+        StealingThread* thread = m_stealers[i];
+        stat->pending_task_num += thread->m_deque.Size();
+        // 投递栈中的任务随时可能被取走执行，不能遍历，只读计数
+        int64_t inbox_num = __atomic_load_n(&thread->m_inbox_num, __ATOMIC_RELAXED);
+        stat->pending_task_num += inbox_num > 0 ? inbox_num : 0;
+        stat->working_thread_num += __atomic_load_n(&thread->m_busy, __ATOMIC_RELAXED);
+        stat->parked_thread_num  += (__atomic_load_n(&thread->m_parked, __ATOMIC_RELAXED) == 1);
+        stat->executed_task_num  += __atomic_load_n(&thread->m_executed, __ATOMIC_RELAXED);
+        stat->stolen_task_num    += __atomic_load_n(&thread->m_stolen, __ATOMIC_RELAXED);
+    }
+}
+
+void ThreadPool::TerminateStealing(bool waiting) {
+    if (m_stealers.empty()) {
+        return;
+    }
+
+    m_waiting = waiting;
+    __atomic_store_n(&m_exit, true, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (size_t i = 0; i < m_stealers.size(); i++) {
+        m_stealers[i]->Unpark(false);
+    }
+
+    for (size_t i = 0; i < m_stealers.size(); i++) {
+        m_stealers[i]->Join();
+    }
+    for (size_t i = 0; i < m_stealers.size(); i++) {
+        m_stealers[i]->Clear();
+        delete m_stealers[i];
+    }
+    m_stealers.clear();
+}
+
+ThreadPool::StealingThread::StealingThread(ThreadPool* pool, uint32_t index) :
+        m_pool(pool),
+        m_index(index),
+        m_rand(index * 2654435761U + 1),
+        m_inbox(NULL),
+        m_inbox_num(0),
+        m_parked(0),
+        m_busy(0),
+        m_executed(0),
+        m_stolen(0),
+        m_searching(false) {
+}
+
+ThreadPool::StealingThread::~StealingThread() {
+    Clear();
+}
+
+void ThreadPool::StealingThread::Run() {
+    g_current_stealer = this;
+    while (1) {
+        bool exit = __atomic_load_n(&m_pool->m_exit, __ATOMIC_ACQUIRE);
+        if (exit && !m_pool->m_waiting) {
+            break;
+        }
+
+        Task* t = FindTask();
+        if (t != NULL) {
+            Execute(t);
+            continue;
+        }
+
+        if (exit) {
+            break;
+        }
+        Park();
+    }
+    g_current_stealer = NULL;
+}
+
+void ThreadPool::StealingThread::Inject(Task* task) {
+    Task* head = __atomic_load_n(&m_inbox, __ATOMIC_RELAXED);
+    do {
+        task->next = head;
+    } while (!__atomic_compare_exchange_n(&m_inbox, &head, task, true,
+        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    __atomic_add_fetch(&m_inbox_num, 1, __ATOMIC_RELAXED);
+}
+
+bool ThreadPool::StealingThread::Unpark(bool searching) {
+    int32_t parked = 1;
+    if (!__atomic_compare_exchange_n(&m_parked, &parked, searching ? 2 : 0, false,
+        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return false;
+    }
+    if (searching) {
+        __atomic_add_fetch(&m_pool->m_searching_num, 1, __ATOMIC_SEQ_CST);
+    }
+    __atomic_sub_fetch(&m_pool->m_idle_num, 1, __ATOMIC_SEQ_CST);
+    FutexWake(&m_parked);
+    return true;
+}
+
+void ThreadPool::StealingThread::Clear() {
+    Task* t = NULL;
+    while (m_deque.Pop(&t)) {
+        delete t;
+    }
+    t = __atomic_exchange_n(&m_inbox, static_cast<Task*>(NULL), __ATOMIC_ACQUIRE);
+    while (t != NULL) {
+        Task* next = t->next;
+        delete t;
+        t = next;
+    }
+    __atomic_store_n(&m_inbox_num, 0, __ATOMIC_RELAXED);
+}
+
+ThreadPool::Task* ThreadPool::StealingThread::FindTask() {
+    Task* t = NULL;
+    if (m_deque.Pop(&t) || (TakeInbox(this) && m_deque.Pop(&t))) {
+        StopSearching();
+        return t;
+    }
+
+    // 从随机的线程开始窃取，窃取可能因竞争失败，多尝试一轮
+    uint32_t num = m_pool->m_stealers.size();
+    for (uint32_t round = 0; round < 2; round++) {
+        m_rand ^= m_rand << 13;
+        m_rand ^= m_rand >> 17;
+        m_rand ^= m_rand << 5;
+        uint32_t start = m_rand % num;
+        for (uint32_t i = 0; i < num; i++) {
+            StealingThread* victim = m_pool->m_stealers[(start + i) % num];
+            if (victim == this) {
+                continue;
+            }
+            if (victim->m_deque.Steal(&t)
+                || (TakeInbox(victim) && m_deque.Pop(&t))) {
+                __atomic_store_n(&m_stolen, m_stolen + 1, __ATOMIC_RELAXED);
+                StopSearching();
+                return t;
+            }
+        }
+    }
+    return NULL;
+}
+
+void ThreadPool::StealingThread::StopSearching() {
+    if (!m_searching) {
+        return;
+    }
+    m_searching = false;
+    // 最后一个寻找任务的线程找到了任务，可能还有更多任务，唤醒下一个线程接力
+    if (__atomic_sub_fetch(&m_pool->m_searching_num, 1, __ATOMIC_SEQ_CST) == 0
+        && __atomic_load_n(&m_pool->m_idle_num, __ATOMIC_SEQ_CST) > 0) {
+        m_pool->WakeOne();
+    }
+}
+
+bool ThreadPool::StealingThread::TakeInbox(StealingThread* from) {
+    if (__atomic_load_n(&from->m_inbox, __ATOMIC_RELAXED) == NULL) {
+        return false;
+    }
+    Task* t = __atomic_exchange_n(&from->m_inbox, static_cast<Task*>(NULL), __ATOMIC_ACQUIRE);
+    if (t == NULL) {
+        return false;
+    }
+    // 投递栈中最新的任务在前，依次放入队列后最早投递的任务在底部，最先被自己执行
+    int64_t num = 0;
+    while (t != NULL) {
+        Task* next = t->next;
+        m_deque.Push(t);
+        t = next;
+        num++;
+    }
+    __atomic_sub_fetch(&from->m_inbox_num, num, __ATOMIC_RELAXED);
+    return true;
+}
+
+void ThreadPool::StealingThread::Execute(Task* task) {
+    __atomic_store_n(&m_busy, 1, __ATOMIC_RELAXED);
+    task->fun();
+    if (task->task_id >= 0) {
+        m_pool->m_finished_queue.PushBack(task->task_id);
+        if (m_pool->m_finished_notify) {
+            m_pool->m_finished_notify();
+        }
+    }
+    delete task;
+    __atomic_store_n(&m_executed, m_executed + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&m_busy, 0, __ATOMIC_RELAXED);
+}
+
+void ThreadPool::StealingThread::Park() {
+    if (m_searching) {
+        m_searching = false;
+        __atomic_sub_fetch(&m_pool->m_searching_num, 1, __ATOMIC_SEQ_CST);
+    }
+    __atomic_store_n(&m_parked, 1, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&m_pool->m_idle_num, 1, __ATOMIC_SEQ_CST);
+
+    // 与AddStealingTask配对，登记休眠后再检查一次，避免丢失唤醒
+    if (!m_pool->HasStealingTask() && !__atomic_load_n(&m_pool->m_exit, __ATOMIC_ACQUIRE)) {
+        // 超时只是兜底，正常由添加任务或终止时唤醒
+        FutexWait(&m_parked, 1, 1000);
+    }
+
+    int32_t parked = 1;
+    if (__atomic_compare_exchange_n(&m_parked, &parked, 0, false,
+        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        __atomic_sub_fetch(&m_pool->m_idle_num, 1, __ATOMIC_SEQ_CST);
+    } else if (2 == parked) {
+        m_searching = true;
+        __atomic_store_n(&m_parked, 0, __ATOMIC_RELAXED);
+    }
+}
+
 
 } // namespace pebble
@@ -20,6 +20,8 @@
     1、固定线程个数。
     2、线程关系对等。如果有不对等的场景，可以使用不同的线程池。
     3、添加一个任务后，先放到队列里，由多个线程同时去抢，由抢到者负责执行。
+    4、WORK_STEALING模式下每个线程有自己的无锁任务队列，空闲线程随机从其他线程窃取任务，
+       没有全局锁，适合大量细粒度任务。
 */
 
 #include <pthread.h>
@@ -27,8 +29,10 @@
 #include <vector>
 
 #include "common/blocking_queue.h"
+#include "common/mpmc_queue.h"
 #include "common/platform.h"
 #include "common/thread.h"
+#include "common/work_stealing_deque.h"
 
 namespace pebble {
 
@@ -38,14 +42,19 @@ public:
     // 线程池的运行状态，放到结构体里，便于后面扩展
     struct Stats
     {
-        Stats() : pending_task_num(0), working_thread_num(0) {}
+        Stats() : pending_task_num(0), working_thread_num(0), parked_thread_num(0),
+            executed_task_num(0), stolen_task_num(0) {}
         size_t pending_task_num;    // 等待被执行任务数
         size_t working_thread_num;  // 处于忙状态的线程数
+        size_t parked_thread_num;   // 没有任务而休眠的线程数，仅WORK_STEALING模式统计
+        int64_t executed_task_num;  // 累计执行的任务数
+        int64_t stolen_task_num;    // 累计从其他线程窃取的任务数，仅WORK_STEALING模式统计
     };
 
     enum Mode {
         NO_PENDING = 0, // 当所有线程忙时，不再接受新的任务，因为线程为抢占运行，所有状态均为瞬态，存在误差
         PENDING,        // 当所有线程忙时，新增任务暂时被缓存起来
+        WORK_STEALING,  // 任务缓存在各线程的无锁队列中，空闲线程窃取其他线程的任务，不保证执行顺序
     };
 
     ThreadPool();
@@ -55,8 +64,10 @@ public:
     ///
     /// @param[in] thread_num 线程个数，默认为4, 最大为256
     /// @param[in] mode 运行模式，默认为PENDING模式
+    /// @param[in] max_pending_num PENDING/NO_PENDING模式下缓存任务的上限，
+    //  0表示不限制，使用加锁的队列；大于0时使用无锁的有界队列，缓存满时AddTask失败
     /// @return 0: 成功 其他: 失败
-    int Init(int32_t thread_num = 4, int32_t mode = PENDING);
+    int Init(int32_t thread_num = 4, int32_t mode = PENDING, uint32_t max_pending_num = 0);
 
     /// @brief 向线程池中增加一个待执行的任务
     //         线程池中的线程有空闲时，就会争抢并且执行该任务
@@ -71,10 +82,12 @@ public:
     //  task_id >= 0, 用户需主动调用GetFinishedTaskID获得已完成任务id，
     //                  否则已完成队列会不断堆积
     //
+    //  WORK_STEALING模式下可在任务中调用，新任务放入当前线程的队列
+    //
     /// @return 0: 成功 其他: 失败
     int AddTask(cxx::function<void()>& fun, int64_t task_id = -1);
 
-    /// @brief 获得线程池的运行状态（暂时还未实现）
+    /// @brief 获得线程池的运行状态，各项为瞬态统计，存在误差
     ///
     /// @param[out] stat 线程池运行状态
     /// @return void
@@ -89,32 +102,114 @@ public:
 
     bool GetFinishedTaskID(int64_t* task_id);
 
+    /// @brief 设置任务完成通知，task_id >= 0的任务ID写入完成队列后在执行线程中调用
+    //  可用于唤醒等待完成队列的主线程，需在Init之前设置
+    ///
+    /// @param[in] notify 完成通知函数，需保证线程安全
+    /// @return void
+    void SetFinishedNotify(const cxx::function<void()>& notify);
+
 private:
     struct Task {
     public:
+        Task() : task_id(-1), next(NULL) {}
         cxx::function<void()> fun;
         int64_t task_id;
+        Task* next; // WORK_STEALING模式下串联投递到线程的任务
     };
 
     class InnerThread : public Thread {
     public:
-        InnerThread(BlockingQueue<Task>* pending_queue,
-            BlockingQueue<int64_t>* finished_queue, BlockingQueue<int64_t>* working_queue);
+        InnerThread(BlockingQueue<Task>* pending_queue, MpmcQueue<Task>* bounded_queue,
+            BlockingQueue<int64_t>* finished_queue, int32_t* working_num,
+            const cxx::function<void()>* finished_notify);
 
         virtual void Run();
         void Terminate(bool waiting = true);
+        int64_t ExecutedNum() const { return __atomic_load_n(&m_executed, __ATOMIC_RELAXED); }
     private:
         BlockingQueue<Task>* m_pending_queue;
+        MpmcQueue<Task>* m_bounded_queue;
         BlockingQueue<int64_t>* m_finished_queue;
-        BlockingQueue<int64_t>* m_working_queue;
+        int32_t* m_working_num;
+        const cxx::function<void()>* m_finished_notify;
         bool m_exit;
         bool m_waiting;
+        int64_t m_executed;
     };
 
+    /// @brief WORK_STEALING模式的工作线程
+    //  自己添加的任务放入Chase-Lev队列底部，其他线程添加的任务通过无锁栈投递，
+    //  空闲时从随机的线程开始窃取队列顶部的任务或整批取走其投递栈，都没有任务时在futex上休眠
+    class StealingThread : public Thread {
+    public:
+        StealingThread(ThreadPool* pool, uint32_t index);
+        ~StealingThread();
+
+        virtual void Run();
+
+        /// @brief 其他线程投递任务
+        void Inject(Task* task);
+
+        /// @brief 唤醒休眠中的线程
+        /// @param searching 被唤醒的线程是否计入寻找任务的线程数
+        /// @return true 线程之前处于休眠状态
+        bool Unpark(bool searching);
+
+        /// @brief 丢弃未执行的任务，需在线程结束后调用
+        void Clear();
+
+    private:
+        friend class ThreadPool;
+
+        Task* FindTask();
+        void StopSearching();
+        bool TakeInbox(StealingThread* from);
+        void Execute(Task* task);
+        void Park();
+
+        static const size_t CACHE_LINE_SIZE = 64;
+
+        ThreadPool* m_pool;
+        uint32_t m_index;
+        uint32_t m_rand;
+        WorkStealingDeque<Task> m_deque;
+
+        // 其他线程投递的任务栈，m_inbox_num为栈中的任务数，供统计使用，
+        // 投递和取走任务后才更新，瞬间可能与栈不一致
+        Task* m_inbox;
+        int64_t m_inbox_num;
+        char m_pad0[CACHE_LINE_SIZE - sizeof(Task*) - sizeof(int64_t)];
+
+        // 0: 运行中，1: 休眠中，2: 被唤醒去寻找任务，由唤醒者修改
+        int32_t m_parked;
+        int32_t m_busy;
+        int64_t m_executed;
+        int64_t m_stolen;
+        bool m_searching;
+        char m_pad1[CACHE_LINE_SIZE - sizeof(int32_t) * 2 - sizeof(int64_t) * 2 - sizeof(bool)];
+    };
+
+    int InitStealing();
+    int AddStealingTask(cxx::function<void()>& fun, int64_t task_id);
+    void WakeOne();
+    bool HasStealingTask() const;
+    void GetStealingStatus(Stats* stat);
+    void TerminateStealing(bool waiting);
+
     std::vector<InnerThread*> m_threads;
+    std::vector<StealingThread*> m_stealers;
+    int32_t  m_idle_num;
+    // 被唤醒后正在寻找任务的线程数，大于0时添加任务不再唤醒其他线程，避免频繁的唤醒和休眠
+    int32_t  m_searching_num;
+    uint32_t m_next_stealer;
+    bool m_waiting;
     BlockingQueue<Task> m_pending_queue;
+    // 设置了缓存任务上限时代替m_pending_queue
+    MpmcQueue<Task>* m_bounded_queue;
     BlockingQueue<int64_t> m_finished_queue;
-    BlockingQueue<int64_t> m_working_queue;
+    int32_t m_working_num;
+    cxx::function<void()> m_finished_notify;
     bool m_exit;
     bool m_initialized;
     uint32_t m_thread_num;
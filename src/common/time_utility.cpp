@@ -16,18 +16,74 @@
 #include <string.h>
 #include <sys/time.h>
 #include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
 
 #include "common/time_utility.h"
 
 
 namespace pebble {
 
+// 各线程独立缓存循环时间，网络线程和主线程互不干扰
+static __thread int64_t g_loop_us = 0;
+
+// TSC时钟参数，EnableTscClock时先写好参数再以release语义置位g_tsc_enabled，
+// 读取方以acquire语义读到g_tsc_enabled为true后参数一定可见
+static bool     g_tsc_enabled      = false;
+static uint64_t g_tsc_base         = 0;
+static int64_t  g_tsc_base_us      = 0;
+static double   g_tsc_us_per_cycle = 0.0;
+
+#if defined(__x86_64__) || defined(__i386__)
+static inline uint64_t ReadTsc() {
+    uint32_t lo = 0;
+    uint32_t hi = 0;
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    return (static_cast<uint64_t>(hi) << 32) | lo;
+}
+
+static bool HasInvariantTsc() {
+    uint32_t eax = 0, ebx = 0, ecx = 0, edx = 0;
+    if (__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) == 0 || eax < 0x80000007) {
+        return false;
+    }
+    if (__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) == 0) {
+        return false;
+    }
+    // CPUID.80000007H:EDX[8] 频率恒定且不随C-state停止
+    return (edx & (1 << 8)) != 0;
+}
+#else
+static inline uint64_t ReadTsc() {
+    return 0;
+}
+
+static bool HasInvariantTsc() {
+    return false;
+}
+#endif
+
+static int64_t ClockMonotonicUS() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
 int64_t TimeUtility::GetCurrentMS() {
-    int64_t timestamp = GetCurrentUS();
-    return timestamp / 1000;
+    return GetWallMS();
 }
 
 int64_t TimeUtility::GetCurrentUS() {
+    return GetWallUS();
+}
+
+int64_t TimeUtility::GetWallMS() {
+    int64_t timestamp = GetWallUS();
+    return timestamp / 1000;
+}
+
+int64_t TimeUtility::GetWallUS() {
     struct timeval tv;
     gettimeofday(&tv, NULL);
 
@@ -35,6 +91,73 @@ int64_t TimeUtility::GetCurrentUS() {
     return timestamp;
 }
 
+int64_t TimeUtility::GetMonotonicMS() {
+    return GetMonotonicUS() / 1000;
+}
+
+int64_t TimeUtility::GetMonotonicUS() {
+    if (__atomic_load_n(&g_tsc_enabled, __ATOMIC_ACQUIRE)) {
+        // 其他核的TSC可能略小于校准时的基准值，按有符号差值计算并截断到0，避免无符号回绕
+        int64_t cycles = static_cast<int64_t>(ReadTsc() - g_tsc_base);
+        if (cycles < 0) {
+            cycles = 0;
+        }
+        return g_tsc_base_us + static_cast<int64_t>(cycles * g_tsc_us_per_cycle);
+    }
+    return ClockMonotonicUS();
+}
+
+void TimeUtility::RefreshLoopTime() {
+    int64_t now = GetMonotonicUS();
+    // TSC在不同核间可能有微小偏差，保证缓存值不回退
+    if (now > g_loop_us) {
+        g_loop_us = now;
+    }
+}
+
+int64_t TimeUtility::GetLoopMS() {
+    return GetLoopUS() / 1000;
+}
+
+int64_t TimeUtility::GetLoopUS() {
+    if (0 == g_loop_us) {
+        RefreshLoopTime();
+    }
+    return g_loop_us;
+}
+
+bool TimeUtility::EnableTscClock(bool enable) {
+    if (!enable || !HasInvariantTsc()) {
+        __atomic_store_n(&g_tsc_enabled, false, __ATOMIC_RELEASE);
+        return false;
+    }
+
+    // 重复启用时先退回CLOCK_MONOTONIC，再改写参数
+    __atomic_store_n(&g_tsc_enabled, false, __ATOMIC_RELEASE);
+
+    // 以CLOCK_MONOTONIC为基准校准TSC频率，起点与CLOCK_MONOTONIC对齐，切换前后时间连续
+    int64_t begin_us = ClockMonotonicUS();
+    uint64_t begin_tsc = ReadTsc();
+    int64_t end_us = begin_us;
+    while (end_us - begin_us < 10000) {
+        end_us = ClockMonotonicUS();
+    }
+    uint64_t end_tsc = ReadTsc();
+    if (end_tsc <= begin_tsc) {
+        return false;
+    }
+
+    g_tsc_us_per_cycle = static_cast<double>(end_us - begin_us) / (end_tsc - begin_tsc);
+    g_tsc_base         = end_tsc;
+    g_tsc_base_us      = end_us;
+    __atomic_store_n(&g_tsc_enabled, true, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool TimeUtility::IsTscClock() {
+    return __atomic_load_n(&g_tsc_enabled, __ATOMIC_ACQUIRE);
+}
+
 std::string TimeUtility::GetStringTime()
 {
     time_t now = time(NULL);
@@ -57,11 +180,12 @@ std::string TimeUtility::GetStringTime()
 }
 
 const char* TimeUtility::GetStringTimeDetail() {
-    static char buff[64] = {0};
-    static struct timeval tv_now;
-    static time_t now;
-    static struct tm tm_now;
-    static struct tm* p_tm_now;
+    // 返回的缓冲区按线程独立，网络线程写日志时也会调用
+    static __thread char buff[64] = {0};
+    struct timeval tv_now;
+    time_t now;
+    struct tm tm_now;
+    struct tm* p_tm_now;
 
     gettimeofday(&tv_now, NULL);
     now = (time_t)tv_now.tv_sec;
@@ -21,14 +21,47 @@
 
 namespace pebble {
 
+/// @brief 时间工具
+/// 墙上时间(gettimeofday)会被NTP/手工调整，只用于日志、展示等需要真实时刻的场景
+/// 超时、耗时统计等计算时间间隔的场景使用单调时间，单调时间的起点无意义，不能跨进程比较
+/// 主循环每轮调用一次RefreshLoopTime缓存当前单调时间，循环内各模块通过GetLoopMS/US读取缓存值，
+/// 避免每条消息、每个定时器都产生一次取时间的开销
 class TimeUtility {
 public:
-    // 得到当前的毫秒
+    // 得到当前的毫秒(墙上时间)，同GetWallMS，保留兼容
     static int64_t GetCurrentMS();
 
-    // 得到当前的微妙
+    // 得到当前的微妙(墙上时间)，同GetWallUS，保留兼容
     static int64_t GetCurrentUS();
 
+    // 得到墙上时间的毫秒，用于日志等需要真实时刻的场景
+    static int64_t GetWallMS();
+
+    // 得到墙上时间的微秒，用于日志等需要真实时刻的场景
+    static int64_t GetWallUS();
+
+    // 得到单调时间的毫秒，不受系统时间调整影响
+    static int64_t GetMonotonicMS();
+
+    // 得到单调时间的微秒，不受系统时间调整影响
+    static int64_t GetMonotonicUS();
+
+    // 刷新当前线程缓存的循环时间，由主循环(及网络线程收到事件时)调用
+    static void RefreshLoopTime();
+
+    // 得到当前线程缓存的循环时间(单调时间)的毫秒，从未刷新过时自动刷新一次
+    static int64_t GetLoopMS();
+
+    // 得到当前线程缓存的循环时间(单调时间)的微秒，从未刷新过时自动刷新一次
+    static int64_t GetLoopUS();
+
+    // 使用TSC计算单调时间，需要CPU支持invariant TSC，启用时以CLOCK_MONOTONIC校准(约10ms)
+    // 应在创建其他线程前调用，返回是否使用TSC
+    static bool EnableTscClock(bool enable);
+
+    // 当前是否使用TSC计算单调时间
+    static bool IsTscClock();
+
     // 得到字符串形式的时间 格式：2015-04-10 10:11:12
     static std::string GetStringTime();
 
@@ -23,14 +23,6 @@
 #include "common/time_utility.h"
 #include "common/timer.h"
 
-#ifndef offsetof
-#define offsetof(s,m) (size_t)(&reinterpret_cast<const volatile char&>((((s *)0x1)->m)) - 0x1)
-#endif
-
-#ifndef container
-#define container(TYPE, MEMBER, pMember) (NULL == pMember ? NULL:((TYPE*)((size_t)(pMember)-offsetof(TYPE,MEMBER))))
-#endif
-
 
 namespace pebble {
 
@@ -211,14 +203,14 @@ int64_t SequenceTimer::StartTimer(uint32_t timeout_ms, const TimeoutCallback& cb
     TimerItem* item = new TimerItem;
     item->id         = m_timer_seqid;
     item->timeout_ms = timeout_ms;
-	item->start_time = TimeUtility::GetCurrentMS();
+	item->start_time = TimeUtility::GetLoopMS();
     item->cb         = cb;
 
 	DbListItem& head = m_timer_lists[timeout_ms];
 	if (head._next == NULL || head._prev == NULL) {
 		db_list_init(&head);
 	}
-	db_list_add_tail(&head, &item->list_item);
+	db_list_add_tail(&head, item);
 
     m_timers[m_timer_seqid] = item;
 
@@ -238,7 +230,7 @@ int32_t SequenceTimer::StopTimer(int64_t timer_id) {
     }
 
 	TimerItem* timer_item = it->second;
-	db_list_del(&timer_item->list_item);
+	db_list_del(timer_item);
 	delete timer_item;
 
     m_timers.erase(it);
@@ -259,20 +251,44 @@ int32_t SequenceTimer::ReStartTimer(int64_t timer_id) {
     }
 
     TimerItem* timer_item = it->second;
-	timer_item->start_time = TimeUtility::GetCurrentMS();
+	timer_item->start_time = TimeUtility::GetLoopMS();
 	
 	DbListItem& head = m_timer_lists[timer_item->timeout_ms];
 	assert(head._next != NULL && head._prev != NULL);
-	db_list_del(&timer_item->list_item);
-	db_list_add_tail(&head, &timer_item->list_item);
+	db_list_del(timer_item);
+	db_list_add_tail(&head, timer_item);
 
     return 0;
 }
 
+int64_t SequenceTimer::GetNextTimeout() {
+    int64_t next = -1;
+    int64_t now = TimeUtility::GetLoopMS();
+
+    cxx::unordered_map<uint32_t, DbListItem>::iterator it = m_timer_lists.begin();
+    for (; it != m_timer_lists.end(); it++) {
+        DbListItem& head = it->second;
+        if (head._next == &head) {
+            continue;
+        }
+        TimerItem* timer_item = static_cast<TimerItem*>(head._next);
+        int64_t left = timer_item->start_time + timer_item->timeout_ms - now;
+        if (left <= 0) {
+            return 0;
+        }
+        if (next < 0 || left < next) {
+            next = left;
+        }
+    }
+
+    return next;
+}
+
 int32_t SequenceTimer::Update() {
     int32_t num = 0;
-    int64_t now = TimeUtility::GetCurrentMS();
+    int64_t now = TimeUtility::GetLoopMS();
     int32_t ret = 0;
+    std::vector<TimerItem*> moved_items;
     m_in_callback = true;
 
     cxx::unordered_map<uint32_t, DbListItem>::iterator it = m_timer_lists.begin();
@@ -280,7 +296,7 @@ int32_t SequenceTimer::Update() {
 		DbListItem& head = it->second;
 		DbListItem* item = head._next;
 		while (item != &head) {
-			TimerItem* timer_item = container(TimerItem, list_item, item);
+			TimerItem* timer_item = static_cast<TimerItem*>(item);
 			assert(timer_item);
 			if (timer_item->start_time + timer_item->timeout_ms > now) {
 				break;
@@ -293,11 +309,14 @@ int32_t SequenceTimer::Update() {
 	        if (ret < 0) {
 				db_list_del(item);
 	            m_timers.erase(timer_item->id);
-				delete item;
+				delete timer_item;
+	        } else if (ret > 0 && static_cast<uint32_t>(ret) != timer_item->timeout_ms) {
+				// 超时时间变化，遍历结束后再移到新超时时间的列表中，避免遍历中修改m_timer_lists
+				timer_item->timeout_ms = ret;
+				timer_item->start_time = now;
+				db_list_del(item);
+				moved_items.push_back(timer_item);
 	        } else {
-	            if (ret > 0) {
-	                timer_item->timeout_ms = ret;
-	            }
 				timer_item->start_time = now;
 				db_list_del(item);
 				db_list_add_tail(&head, item);
@@ -308,10 +327,303 @@ int32_t SequenceTimer::Update() {
         }
     }
 
+    for (std::vector<TimerItem*>::iterator mit = moved_items.begin(); mit != moved_items.end(); ++mit) {
+		DbListItem& head = m_timer_lists[(*mit)->timeout_ms];
+		if (head._next == NULL || head._prev == NULL) {
+			db_list_init(&head);
+		}
+		db_list_add_tail(&head, *mit);
+    }
+
     m_in_callback = false;
 
     return num;
 }
 
+WheelTimer::WheelTimer() {
+    m_current_tick      = TimeUtility::GetLoopMS();
+    m_timer_num         = 0;
+    m_running_node      = NULL;
+    m_running_stopped   = false;
+    m_running_restarted = false;
+    m_last_error[0]     = 0;
+    for (uint32_t i = 0; i < SLOT_NUM; i++) {
+        db_list_init(&m_slots[i]);
+    }
+    memset(m_level0_bitmap, 0, sizeof(m_level0_bitmap));
+    memset(m_leveln_bitmap, 0, sizeof(m_leveln_bitmap));
+}
+
+WheelTimer::~WheelTimer() {
+    for (std::vector<TimerNode*>::iterator it = m_node_blocks.begin(); it != m_node_blocks.end(); ++it) {
+        delete [] *it;
+    }
+}
+
+WheelTimer::TimerNode* WheelTimer::AllocNode() {
+    if (m_free_nodes.empty()) {
+        // 按块分配节点，减少内存分配次数
+        TimerNode* block = new TimerNode[NODE_BLOCK_SIZE];
+        m_node_blocks.push_back(block);
+        uint32_t base = m_nodes.size();
+        for (uint32_t i = 0; i < NODE_BLOCK_SIZE; i++) {
+            m_nodes.push_back(&block[i]);
+            m_free_nodes.push_back(base + NODE_BLOCK_SIZE - 1 - i);
+        }
+    }
+
+    uint32_t index = m_free_nodes.back();
+    m_free_nodes.pop_back();
+
+    TimerNode* node = m_nodes[index];
+    node->generation++;
+    // 高32位为版本号，低32位为节点下标，节点复用后旧的ID失效
+    node->id = (static_cast<int64_t>(node->generation & 0x7FFFFFFF) << 32) | index;
+    return node;
+}
+
+void WheelTimer::FreeNode(TimerNode* node) {
+    uint32_t index = static_cast<uint32_t>(node->id & 0xFFFFFFFF);
+    node->id = -1;
+    node->cb = TimeoutCallback();
+    m_free_nodes.push_back(index);
+}
+
+WheelTimer::TimerNode* WheelTimer::FindNode(int64_t timer_id) {
+    if (timer_id < 0) {
+        return NULL;
+    }
+    uint32_t index = static_cast<uint32_t>(timer_id & 0xFFFFFFFF);
+    if (index >= m_nodes.size() || m_nodes[index]->id != timer_id) {
+        return NULL;
+    }
+    return m_nodes[index];
+}
+
+void WheelTimer::AddNode(TimerNode* node) {
+    int64_t expire = node->expire;
+    int64_t delta  = expire - m_current_tick;
+    uint32_t slot  = 0;
+
+    if (delta < 0) {
+        // 已超时的放到当前槽，下次Update立即处理
+        slot = LevelSlot(0, m_current_tick & (LEVEL0_SIZE - 1));
+    } else if (delta < LEVEL0_SIZE) {
+        slot = LevelSlot(0, expire & (LEVEL0_SIZE - 1));
+    } else {
+        uint32_t level = 1;
+        uint32_t shift = LEVEL0_BITS;
+        for (; level < LEVEL_NUM - 1; level++, shift += LEVELN_BITS) {
+            if (delta < (1LL << (shift + LEVELN_BITS))) {
+                break;
+            }
+        }
+        if (delta >= (1LL << (shift + LEVELN_BITS))) {
+            // 超出时间轮范围的放到最高层最远的槽，下移时重新计算
+            expire = m_current_tick + (1LL << (shift + LEVELN_BITS)) - 1;
+        }
+        slot = LevelSlot(level, (expire >> shift) & (LEVELN_SIZE - 1));
+    }
+
+    node->slot = slot;
+    db_list_add_tail(&m_slots[slot], node);
+    if (slot < LEVEL0_SIZE) {
+        m_level0_bitmap[slot >> 6] |= (1ULL << (slot & 63));
+    } else {
+        uint32_t index = slot - LEVEL0_SIZE;
+        m_leveln_bitmap[index / LEVELN_SIZE + 1] |= (1ULL << (index % LEVELN_SIZE));
+    }
+}
+
+void WheelTimer::RemoveNode(TimerNode* node) {
+    uint32_t slot = node->slot;
+    db_list_del(node);
+    if (m_slots[slot]._next != &m_slots[slot]) {
+        return;
+    }
+    if (slot < LEVEL0_SIZE) {
+        m_level0_bitmap[slot >> 6] &= ~(1ULL << (slot & 63));
+    } else {
+        uint32_t index = slot - LEVEL0_SIZE;
+        m_leveln_bitmap[index / LEVELN_SIZE + 1] &= ~(1ULL << (index % LEVELN_SIZE));
+    }
+}
+
+void WheelTimer::Cascade(uint32_t level, uint32_t index) {
+    DbListItem& head = m_slots[LevelSlot(level, index)];
+    while (head._next != &head) {
+        TimerNode* node = static_cast<TimerNode*>(head._next);
+        RemoveNode(node);
+        AddNode(node);
+    }
+}
+
+int32_t WheelTimer::ExpireSlot(uint32_t slot, int64_t now) {
+    int32_t num = 0;
+    DbListItem& head = m_slots[slot];
+    // 回调中可能增删任意定时器，每次都从表头取
+    while (head._next != &head) {
+        TimerNode* node = static_cast<TimerNode*>(head._next);
+        RemoveNode(node);
+
+        m_running_node      = node;
+        m_running_stopped   = false;
+        m_running_restarted = false;
+        int32_t ret = node->cb(node->id);
+        m_running_node      = NULL;
+        num++;
+
+        // 返回 <0 删除定时器，=0 继续，>0按新的超时时间重启定时器
+        if (m_running_stopped || (ret < 0 && !m_running_restarted)) {
+            FreeNode(node);
+            m_timer_num--;
+            continue;
+        }
+        if (ret > 0) {
+            node->timeout_ms = ret;
+        }
+        node->expire = now + node->timeout_ms;
+        AddNode(node);
+    }
+    return num;
+}
+
+int64_t WheelTimer::StartTimer(uint32_t timeout_ms, const TimeoutCallback& cb) {
+    if (!cb || 0 == timeout_ms) {
+        _LOG_LAST_ERROR("param is invalid: timeout_ms = %u, cb = %d", timeout_ms, (cb ? true : false));
+        return kTIMER_INVALID_PARAM;
+    }
+
+    TimerNode* node  = AllocNode();
+    node->timeout_ms = timeout_ms;
+    node->expire     = TimeUtility::GetLoopMS() + timeout_ms;
+    node->cb         = cb;
+    AddNode(node);
+    m_timer_num++;
+
+    return node->id;
+}
+
+int32_t WheelTimer::StopTimer(int64_t timer_id) {
+    TimerNode* node = FindNode(timer_id);
+    if (NULL == node) {
+        _LOG_LAST_ERROR("timer id %ld not exist", timer_id);
+        return kTIMER_UNEXISTED;
+    }
+
+    // 当前回调的定时器已从槽中摘下，回调返回后再释放
+    if (node == m_running_node) {
+        m_running_stopped = true;
+        return 0;
+    }
+
+    RemoveNode(node);
+    FreeNode(node);
+    m_timer_num--;
+
+    return 0;
+}
+
+int32_t WheelTimer::ReStartTimer(int64_t timer_id) {
+    TimerNode* node = FindNode(timer_id);
+    if (NULL == node) {
+        _LOG_LAST_ERROR("timer id %ld not exist", timer_id);
+        return kTIMER_UNEXISTED;
+    }
+
+    if (node == m_running_node) {
+        m_running_restarted = true;
+        return 0;
+    }
+
+    RemoveNode(node);
+    node->expire = TimeUtility::GetLoopMS() + node->timeout_ms;
+    AddNode(node);
+
+    return 0;
+}
+
+int32_t WheelTimer::Update() {
+    int64_t now = TimeUtility::GetLoopMS();
+    if (0 == m_timer_num) {
+        // 没有定时器时直接跳到当前时间，避免空转
+        if (now >= m_current_tick) {
+            m_current_tick = now + 1;
+        }
+        return 0;
+    }
+
+    int32_t num = 0;
+    while (m_current_tick <= now) {
+        uint32_t index = m_current_tick & (LEVEL0_SIZE - 1);
+        if (0 == index) {
+            // 第0层转完一圈，依次把上层对应槽中的定时器下移
+            uint32_t shift = LEVEL0_BITS;
+            for (uint32_t level = 1; level < LEVEL_NUM; level++, shift += LEVELN_BITS) {
+                uint32_t level_index = (m_current_tick >> shift) & (LEVELN_SIZE - 1);
+                Cascade(level, level_index);
+                if (level_index != 0) {
+                    break;
+                }
+            }
+        }
+        if (0 == (m_level0_bitmap[0] | m_level0_bitmap[1] | m_level0_bitmap[2] | m_level0_bitmap[3])) {
+            // 第0层为空时直接跳到下一圈的起点
+            int64_t next_round = (m_current_tick & ~static_cast<int64_t>(LEVEL0_SIZE - 1)) + LEVEL0_SIZE;
+            m_current_tick = next_round <= now ? next_round : now + 1;
+            continue;
+        }
+        num += ExpireSlot(index, now);
+        m_current_tick++;
+    }
+
+    return num;
+}
+
+int64_t WheelTimer::GetNextTimeout() {
+    if (0 == m_timer_num) {
+        return -1;
+    }
+
+    int64_t next = -1;
+    int64_t tick = m_current_tick;
+
+    // 第0层，从当前槽往后找第一个非空槽
+    uint32_t index = tick & (LEVEL0_SIZE - 1);
+    for (uint32_t i = 0; i < LEVEL0_SIZE / 64 + 1 && next < 0; i++) {
+        uint32_t word = ((index >> 6) + i) % (LEVEL0_SIZE / 64);
+        uint64_t bits = m_level0_bitmap[word];
+        if (0 == i) {
+            bits &= (~0ULL << (index & 63));
+        } else if (i == LEVEL0_SIZE / 64) {
+            bits &= ~(~0ULL << (index & 63));
+        }
+        if (bits != 0) {
+            uint32_t slot = word * 64 + __builtin_ctzll(bits);
+            next = tick + ((slot - index) & (LEVEL0_SIZE - 1));
+        }
+    }
+
+    // 更高层，取最近一个非空槽的下移时间
+    uint32_t shift = LEVEL0_BITS;
+    for (uint32_t level = 1; level < LEVEL_NUM; level++, shift += LEVELN_BITS) {
+        uint64_t bits = m_leveln_bitmap[level];
+        if (0 == bits) {
+            continue;
+        }
+        uint32_t cur = (tick >> shift) & (LEVELN_SIZE - 1);
+        // 循环右移到当前槽之后，当前槽本身要转满一圈才会下移
+        uint64_t rotated = (cur == LEVELN_SIZE - 1) ? bits : ((bits >> (cur + 1)) | (bits << (LEVELN_SIZE - cur - 1)));
+        int64_t offset = __builtin_ctzll(rotated) + 1;
+        int64_t cascade_tick = ((tick >> shift) + offset) << shift;
+        if (next < 0 || cascade_tick < next) {
+            next = cascade_tick;
+        }
+    }
+
+    int64_t left = next - TimeUtility::GetMonotonicMS();
+    return left > 0 ? left : 0;
+}
+
 }  // namespace pebble
 
@@ -14,6 +14,8 @@
 #ifndef _PEBBLE_COMMON_TIMER_H_
 #define _PEBBLE_COMMON_TIMER_H_
 
+#include <vector>
+
 #include "common/db_list.h"
 #include "common/error.h"
 #include "common/platform.h"
@@ -90,6 +92,11 @@ public:
 
     /// @brief 获取定时器数目
     virtual int64_t GetTimerNum() { return 0; }
+
+    /// @brief 获取距离最近一个定时器超时的时间，供主循环决定可以阻塞等待多久
+    /// @return >=0 最近一个定时器超时的剩余时间(ms)，0表示已有定时器超时
+    /// @return <0 没有定时器或实现不支持
+    virtual int64_t GetNextTimeout() { return -1; }
 };
 
 #if 0
@@ -178,16 +185,18 @@ public:
         return m_timers.size();
     }
 
+    /// @see Timer::GetNextTimeout
+    /// @note 只检查每个超时时间列表的表头，复杂度O(超时时间种类数)
+    virtual int64_t GetNextTimeout();
+
 private:
-    struct TimerItem {
+    struct TimerItem : public DbListItem {
         TimerItem() {
             id      = -1;
             timeout_ms = 0;
 			start_time = -1;
         }
 
-		DbListItem list_item;
-
         int64_t id;
         uint32_t timeout_ms;
 		int64_t start_time;
@@ -204,6 +213,96 @@ private:
     char m_last_error[256];
 };
 
+/// @brief 分层时间轮定时器，精度为1ms
+///     第0层256个槽，覆盖256ms，第1~4层各64个槽，逐层放大64倍，共覆盖2^32ms
+///     定时器节点侵入式挂在槽的链表上，节点从池中分配复用，定时器ID中包含节点下标和版本号，无需查表
+///     复杂度:start O(1)，stop O(1)，timeout 均摊O(1)，GetNextTimeout O(层数)
+/// @note 允许在超时回调中stop/restart任意定时器，对当前回调的定时器stop优先于回调返回值
+class WheelTimer : public Timer {
+public:
+    WheelTimer();
+    virtual ~WheelTimer();
+
+    /// @see Timer::StartTimer
+    virtual int64_t StartTimer(uint32_t timeout_ms, const TimeoutCallback& cb);
+
+    /// @see Timer::StopTimer
+    virtual int32_t StopTimer(int64_t timer_id);
+
+    /// @see Timer::ReStartTimer
+    virtual int32_t ReStartTimer(int64_t timer_id);
+
+    /// @see Timer::Update
+    virtual int32_t Update();
+
+    /// @see Timer::LastErrorStr
+    virtual const char* GetLastError() const {
+        return m_last_error;
+    }
+
+    /// @see Timer::GetTimerNum
+    virtual int64_t GetTimerNum() {
+        return m_timer_num;
+    }
+
+    /// @see Timer::GetNextTimeout
+    /// @note 第0层返回精确值，更高层返回其最近一次下移的时间，可能略早于实际超时时间
+    virtual int64_t GetNextTimeout();
+
+private:
+    static const uint32_t LEVEL0_BITS  = 8;
+    static const uint32_t LEVEL0_SIZE  = 1 << LEVEL0_BITS;
+    static const uint32_t LEVELN_BITS  = 6;
+    static const uint32_t LEVELN_SIZE  = 1 << LEVELN_BITS;
+    static const uint32_t LEVEL_NUM    = 5;
+    static const uint32_t SLOT_NUM     = LEVEL0_SIZE + (LEVEL_NUM - 1) * LEVELN_SIZE;
+    static const uint32_t NODE_BLOCK_SIZE = 1024;
+
+    // 节点以基类的方式挂在槽的链表上，从链表项到节点用static_cast转换，不依赖offsetof
+    struct TimerNode : public DbListItem {
+        TimerNode() : id(-1), expire(0), timeout_ms(0), slot(0), generation(0) {}
+
+        int64_t id;
+        int64_t expire;
+        uint32_t timeout_ms;
+        uint32_t slot;
+        uint32_t generation;
+        TimeoutCallback cb;
+    };
+
+    TimerNode* AllocNode();
+    void FreeNode(TimerNode* node);
+    TimerNode* FindNode(int64_t timer_id);
+
+    void AddNode(TimerNode* node);
+    void RemoveNode(TimerNode* node);
+    void Cascade(uint32_t level, uint32_t index);
+    int32_t ExpireSlot(uint32_t slot, int64_t now);
+
+    uint32_t LevelSlot(uint32_t level, uint32_t index) const {
+        if (0 == level) {
+            return index;
+        }
+        return LEVEL0_SIZE + (level - 1) * LEVELN_SIZE + index;
+    }
+
+private:
+    int64_t m_current_tick;     // 下一个待处理的时间点(ms)，之前的都已处理
+    int64_t m_timer_num;
+    DbListItem m_slots[SLOT_NUM];
+    uint64_t m_level0_bitmap[LEVEL0_SIZE / 64];
+    uint64_t m_leveln_bitmap[LEVEL_NUM];
+
+    std::vector<TimerNode*> m_node_blocks;
+    std::vector<TimerNode*> m_nodes;        // 下标 -> 节点
+    std::vector<uint32_t> m_free_nodes;
+
+    TimerNode* m_running_node;   // 正在执行回调的定时器
+    bool m_running_stopped;      // 回调中停止了当前定时器
+    bool m_running_restarted;    // 回调中重启了当前定时器
+    char m_last_error[256];
+};
+
 }  // namespace pebble
 
 #endif  // _PEBBLE_COMMON_TIMER_H_
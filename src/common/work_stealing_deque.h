@@ -0,0 +1,189 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+
+#ifndef _PEBBLE_COMMON_WORK_STEALING_DEQUE_H_
+#define _PEBBLE_COMMON_WORK_STEALING_DEQUE_H_
+
+#include <assert.h>
+#include <stdint.h>
+#include <cstddef>
+#include <vector>
+
+#include "common/uncopyable.h"
+
+namespace pebble {
+
+
+/// @brief Chase-Lev无锁工作窃取双端队列，元素为指针
+/// @note 只允许所有者线程Push/Pop(底部，后进先出)，任意线程可Steal(顶部，先进先出)
+///     队列满时所有者线程将数组扩容一倍，旧数组可能仍被窃取线程读取，延迟到析构时释放
+template <typename T>
+class WorkStealingDeque : public Uncopyable
+{
+public:
+    typedef T* ValueType;
+
+    explicit WorkStealingDeque(uint32_t capacity = 256)
+        : m_top(0), m_bottom(0), m_array(NULL)
+    {
+        assert(capacity > 0 && capacity <= 0x40000000U);
+        uint32_t size = 1;
+        while (size < capacity)
+        {
+            size <<= 1;
+        }
+        m_array = new Array(size);
+    }
+
+    ~WorkStealingDeque()
+    {
+        for (size_t i = 0; i < m_retired.size(); i++)
+        {
+            delete m_retired[i];
+        }
+        delete m_array;
+    }
+
+    /// @brief 所有者线程调用，放入底部
+    void Push(T* value)
+    {
+        int64_t bottom = __atomic_load_n(&m_bottom, __ATOMIC_RELAXED);
+        int64_t top    = __atomic_load_n(&m_top, __ATOMIC_ACQUIRE);
+        Array* array   = __atomic_load_n(&m_array, __ATOMIC_RELAXED);
+        if (bottom - top > static_cast<int64_t>(array->mask))
+        {
+            array = Grow(array, top, bottom);
+        }
+        array->Put(bottom, value);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        __atomic_store_n(&m_bottom, bottom + 1, __ATOMIC_RELAXED);
+    }
+
+    /// @brief 所有者线程调用，从底部取出
+    /// @return false 队列为空
+    bool Pop(T** value)
+    {
+        int64_t bottom = __atomic_load_n(&m_bottom, __ATOMIC_RELAXED) - 1;
+        Array* array   = __atomic_load_n(&m_array, __ATOMIC_RELAXED);
+        __atomic_store_n(&m_bottom, bottom, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        int64_t top = __atomic_load_n(&m_top, __ATOMIC_RELAXED);
+
+        if (top > bottom)
+        {
+            __atomic_store_n(&m_bottom, bottom + 1, __ATOMIC_RELAXED);
+            return false;
+        }
+
+        *value = array->Get(bottom);
+        if (top == bottom)
+        {
+            // 最后一个元素，与窃取线程竞争
+            bool won = __atomic_compare_exchange_n(&m_top, &top, top + 1, false,
+                __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+            __atomic_store_n(&m_bottom, bottom + 1, __ATOMIC_RELAXED);
+            return won;
+        }
+        return true;
+    }
+
+    /// @brief 任意线程调用，从顶部窃取
+    /// @return false 队列为空或与其他线程竞争失败
+    bool Steal(T** value)
+    {
+        int64_t top = __atomic_load_n(&m_top, __ATOMIC_ACQUIRE);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        int64_t bottom = __atomic_load_n(&m_bottom, __ATOMIC_ACQUIRE);
+        if (top >= bottom)
+        {
+            return false;
+        }
+
+        Array* array = __atomic_load_n(&m_array, __ATOMIC_ACQUIRE);
+        T* tmp = array->Get(top);
+        if (!__atomic_compare_exchange_n(&m_top, &top, top + 1, false,
+            __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        {
+            return false;
+        }
+        *value = tmp;
+        return true;
+    }
+
+    /// @brief 任意线程调用，结果仅供参考
+    bool IsEmpty() const
+    {
+        return Size() == 0;
+    }
+
+    /// @brief 任意线程调用，结果仅供参考
+    size_t Size() const
+    {
+        int64_t bottom = __atomic_load_n(&m_bottom, __ATOMIC_ACQUIRE);
+        int64_t top    = __atomic_load_n(&m_top, __ATOMIC_ACQUIRE);
+        return bottom > top ? static_cast<size_t>(bottom - top) : 0;
+    }
+
+private:
+    struct Array
+    {
+        explicit Array(uint32_t size) : mask(size - 1), slots(new T*[size]) {}
+        ~Array() { delete [] slots; }
+
+        T* Get(int64_t index) const
+        {
+            return __atomic_load_n(&slots[index & mask], __ATOMIC_RELAXED);
+        }
+
+        void Put(int64_t index, T* value)
+        {
+            __atomic_store_n(&slots[index & mask], value, __ATOMIC_RELAXED);
+        }
+
+        uint32_t mask;
+        T**      slots;
+    };
+
+    Array* Grow(Array* array, int64_t top, int64_t bottom)
+    {
+        Array* bigger = new Array((array->mask + 1) << 1);
+        for (int64_t i = top; i < bottom; i++)
+        {
+            bigger->Put(i, array->Get(i));
+        }
+        m_retired.push_back(array);
+        __atomic_store_n(&m_array, bigger, __ATOMIC_RELEASE);
+        return bigger;
+    }
+
+private:
+    static const size_t CACHE_LINE_SIZE = 64;
+
+    // 窃取线程竞争修改
+    int64_t     m_top;
+    char        m_pad0[CACHE_LINE_SIZE - sizeof(int64_t)];
+
+    // 所有者线程修改
+    int64_t     m_bottom;
+    char        m_pad1[CACHE_LINE_SIZE - sizeof(int64_t)];
+
+    Array*      m_array;
+    // 扩容后被替换的数组，仅所有者线程访问
+    std::vector<Array*> m_retired;
+};
+
+} // namespace pebble
+
+#endif // _PEBBLE_COMMON_WORK_STEALING_DEQUE_H_
@@ -447,7 +447,7 @@ void ZookeeperClient::OnConnected()
         AExists(it->c_str(), 1, NULL);
     }
     // 恢复临时节点
-    m_last_resume_time = TimeUtility::GetCurrentMS();
+    m_last_resume_time = TimeUtility::GetLoopMS();
     std::set<EphemeralNodeInfo> resume_nodes;
     for (std::set<EphemeralNodeInfo>::iterator it = m_ephemeral_node.begin() ;
         it != m_ephemeral_node.end() ; ++it)
@@ -1003,7 +1003,7 @@ void ZookeeperClient::ResumeEphemeralNode()
         return;
     }
 
-    int64_t now = TimeUtility::GetCurrentMS();
+    int64_t now = TimeUtility::GetLoopMS();
     if (m_last_resume_time + m_time_out_ms > now) {
         // 恢复重试周期和会话超时时间保持一致
         return;
@@ -74,6 +74,9 @@ struct SyncWaitAdaptor
     virtual ~SyncWaitAdaptor() {}
 
     int32_t _rc;
+    // 结果先存放在适配器中，等待返回后再由调用方取走
+    // 共享栈协程挂起时栈已被换出，回调中不能写入调用方栈上的变量
+    std::vector<std::string> _urls;
 
     virtual void WaitRsp() { assert(false); }
 };
@@ -81,15 +84,11 @@ struct SyncWaitAdaptor
 struct BlockWaitAdaptor : public SyncWaitAdaptor
 {
     explicit BlockWaitAdaptor(ZookeeperClient* zk_client)
-        : SyncWaitAdaptor(), _zk_client(zk_client), _urls(NULL) {}
-
-    BlockWaitAdaptor(ZookeeperClient* zk_client, std::vector<std::string>* urls)
-        : SyncWaitAdaptor(), _zk_client(zk_client), _urls(urls) {}
+        : SyncWaitAdaptor(), _zk_client(zk_client) {}
 
     virtual ~BlockWaitAdaptor() {}
 
     ZookeeperClient* _zk_client;
-    std::vector<std::string>* _urls;
 
     virtual void WaitRsp()
     {
@@ -107,23 +106,19 @@ struct BlockWaitAdaptor : public SyncWaitAdaptor
     void OnRsp(int32_t rc, const std::vector<std::string>& urls)
     {
         _rc = rc;
-        *_urls = urls;
+        _urls = urls;
     }
 };
 
 struct CoroutineWaitAdaptor : public SyncWaitAdaptor
 {
     explicit CoroutineWaitAdaptor(CoroutineSchedule* cor_sche)
-        : SyncWaitAdaptor(), _cor_sche(cor_sche), _cor_id(-1), _urls(NULL) {}
-
-    CoroutineWaitAdaptor(CoroutineSchedule* cor_sche, std::vector<std::string>* urls)
-        : SyncWaitAdaptor(), _cor_sche(cor_sche), _cor_id(-1), _urls(urls) {}
+        : SyncWaitAdaptor(), _cor_sche(cor_sche), _cor_id(-1) {}
 
     virtual ~CoroutineWaitAdaptor() {}
 
     CoroutineSchedule* _cor_sche;
     int64_t            _cor_id;
-    std::vector<std::string>* _urls;
 
     virtual void WaitRsp()
     {
@@ -140,7 +135,7 @@ struct CoroutineWaitAdaptor : public SyncWaitAdaptor
     void OnRsp(int32_t rc, const std::vector<std::string>& urls)
     {
         _rc = rc;
-        *_urls = urls;
+        _urls = urls;
         _cor_sche->Resume(_cor_id);
     }
 };
@@ -363,11 +358,11 @@ int32_t ZookeeperNaming::GetUrlsByName(const std::string& name, std::vector<std:
     SyncWaitAdaptor *sync_adaptor = NULL;
     CbReturnValue ret_cob = NULL;
     if (NULL != m_cor_schedule && m_cor_schedule->CurrentTaskId() >= 0) {
-        CoroutineWaitAdaptor *coroutine_adaptor = new CoroutineWaitAdaptor(m_cor_schedule, urls);
+        CoroutineWaitAdaptor *coroutine_adaptor = new CoroutineWaitAdaptor(m_cor_schedule);
         ret_cob = cxx::bind(&CoroutineWaitAdaptor::OnRsp, coroutine_adaptor, _1, _2);
         sync_adaptor = coroutine_adaptor;
     } else {
-        BlockWaitAdaptor *block_adaptor = new BlockWaitAdaptor(m_zk_client, urls);
+        BlockWaitAdaptor *block_adaptor = new BlockWaitAdaptor(m_zk_client);
         ret_cob = cxx::bind(&BlockWaitAdaptor::OnRsp, block_adaptor, _1, _2);
         sync_adaptor = block_adaptor;
     }
@@ -375,6 +370,7 @@ int32_t ZookeeperNaming::GetUrlsByName(const std::string& name, std::vector<std:
     if (0 == ret) {
         sync_adaptor->WaitRsp();
         ret = sync_adaptor->_rc;
+        urls->swap(sync_adaptor->_urls);
     }
 
     delete sync_adaptor;
@@ -0,0 +1,153 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#include <sstream>
+
+#include "common/time_utility.h"
+#include "framework/concurrency_limiter.h"
+
+
+namespace pebble {
+
+ConcurrencyLimiter::ConcurrencyLimiter()
+    :   m_max_limit(0), m_rejected_num(0), m_last_update_ms(0) {
+}
+
+ConcurrencyLimiter::~ConcurrencyLimiter() {
+}
+
+void ConcurrencyLimiter::SetMaxLimit(uint32_t max_limit) {
+    m_max_limit = max_limit;
+    // 已有目标的限制按新的上限收紧，不限制时保留统计直到请求全部完成
+    if (0 == m_max_limit) {
+        return;
+    }
+    for (cxx::unordered_map<int64_t, RouteLimit>::iterator it = m_limits.begin();
+        it != m_limits.end(); ++it) {
+        if (it->second._limit > m_max_limit) {
+            it->second._limit = m_max_limit;
+        }
+    }
+}
+
+bool ConcurrencyLimiter::Acquire(int64_t handle) {
+    if (0 == m_max_limit) {
+        return true;
+    }
+
+    RouteLimit& route = m_limits[handle];
+    if (route._limit < 1) {
+        route._limit = LIMIT_INITIAL < m_max_limit ? LIMIT_INITIAL : m_max_limit;
+    }
+    route._last_active_ms = TimeUtility::GetLoopMS();
+
+    if (route._in_flight >= static_cast<uint32_t>(route._limit)) {
+        route._rejected++;
+        m_rejected_num++;
+        return false;
+    }
+
+    route._in_flight++;
+    return true;
+}
+
+void ConcurrencyLimiter::Release(int64_t handle, bool dropped, int64_t latency_ms) {
+    cxx::unordered_map<int64_t, RouteLimit>::iterator it = m_limits.find(handle);
+    if (m_limits.end() == it || 0 == it->second._in_flight) {
+        return;
+    }
+
+    RouteLimit& route = it->second;
+    route._in_flight--;
+    if (0 == m_max_limit) {
+        return;
+    }
+
+    int64_t now = TimeUtility::GetLoopMS();
+    if (dropped) {
+        Decrease(&route, now);
+        return;
+    }
+
+    if (route._window_min_rtt < 0 || latency_ms < route._window_min_rtt) {
+        route._window_min_rtt = latency_ms;
+    }
+    if (route._min_rtt < 0) {
+        route._min_rtt = latency_ms;
+    }
+    if (++route._window_samples >= LIMIT_WINDOW) {
+        route._min_rtt        = route._window_min_rtt;
+        route._window_min_rtt = -1;
+        route._window_samples = 0;
+    }
+
+    if (latency_ms > route._min_rtt * 2 + LIMIT_RTT_SLACK_MS) {
+        Decrease(&route, now);
+        return;
+    }
+
+    // 只有限制被用到一半以上时才增加，避免低负载时限制无限增长
+    if ((route._in_flight + 1) * 2 >= route._limit) {
+        route._limit += 1.0 / route._limit;
+        if (route._limit > m_max_limit) {
+            route._limit = m_max_limit;
+        }
+    }
+}
+
+void ConcurrencyLimiter::Decrease(RouteLimit* route, int64_t now) {
+    int64_t interval = route->_min_rtt > 0 ? route->_min_rtt : 1;
+    if (now - route->_last_decrease_ms < interval) {
+        return;
+    }
+    route->_last_decrease_ms = now;
+
+    route->_limit *= 0.9;
+    uint32_t min_limit = LIMIT_MIN < m_max_limit ? LIMIT_MIN : m_max_limit;
+    if (route->_limit < min_limit) {
+        route->_limit = min_limit;
+    }
+}
+
+void ConcurrencyLimiter::Update() {
+    int64_t now = TimeUtility::GetLoopMS();
+    if (now - m_last_update_ms < LIMIT_IDLE_MS) {
+        return;
+    }
+    m_last_update_ms = now;
+
+    cxx::unordered_map<int64_t, RouteLimit>::iterator it = m_limits.begin();
+    while (it != m_limits.end()) {
+        if (0 == it->second._in_flight && now - it->second._last_active_ms >= LIMIT_IDLE_MS) {
+            m_limits.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+}
+
+std::string ConcurrencyLimiter::ToString() const {
+    std::ostringstream oss;
+    oss << "max_limit = " << m_max_limit << ", rejected = " << m_rejected_num << "\n";
+    for (cxx::unordered_map<int64_t, RouteLimit>::const_iterator it = m_limits.begin();
+        it != m_limits.end(); ++it) {
+        const RouteLimit& route = it->second;
+        oss << "handle(" << it->first << ") limit = " << static_cast<uint32_t>(route._limit)
+            << ", in_flight = " << route._in_flight
+            << ", min_rtt = " << route._min_rtt
+            << ", rejected = " << route._rejected << "\n";
+    }
+    return oss.str();
+}
+
+} // namespace pebble
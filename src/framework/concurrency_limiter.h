@@ -0,0 +1,99 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#ifndef _PEBBLE_FRAMEWORK_CONCURRENCY_LIMITER_H_
+#define _PEBBLE_FRAMEWORK_CONCURRENCY_LIMITER_H_
+
+#include <string>
+
+#include "common/platform.h"
+
+
+namespace pebble {
+
+/// @brief 客户端按目标(连接句柄)的自适应并发限制
+/// @note 采用AIMD策略: 响应时间未明显超过无负载时的响应时间时，每个响应时间周期限制约加1；
+///     响应时间超过无负载响应时间的2倍或请求超时时，限制乘以0.9，每个响应时间周期最多减一次
+///     无负载响应时间取上一个采样窗口内的最小响应时间
+class ConcurrencyLimiter {
+public:
+    ConcurrencyLimiter();
+    ~ConcurrencyLimiter();
+
+    /// @brief 设置每个目标的最大并发请求数，0表示不限制
+    void SetMaxLimit(uint32_t max_limit);
+
+    uint32_t GetMaxLimit() const { return m_max_limit; }
+
+    /// @brief 请求发出前申请并发配额
+    /// @return true 成功，false 目标的并发请求数已达到限制
+    bool Acquire(int64_t handle);
+
+    /// @brief 请求完成，释放Acquire成功时申请的配额
+    /// @param handle 请求的目标
+    /// @param dropped 请求超时或发送失败
+    /// @param latency_ms 请求的响应时间
+    void Release(int64_t handle, bool dropped, int64_t latency_ms);
+
+    /// @brief 清理长时间没有请求的目标
+    void Update();
+
+    /// @brief 累计被拒绝的请求数
+    int64_t GetRejectedNum() const { return m_rejected_num; }
+
+    /// @brief 当前限制的目标数
+    uint32_t GetRouteNum() const { return m_limits.size(); }
+
+    /// @brief 输出每个目标的限制、并发请求数、无负载响应时间和被拒绝的请求数
+    std::string ToString() const;
+
+    // 初始限制
+    static const uint32_t LIMIT_INITIAL     = 20;
+    // 最小限制
+    static const uint32_t LIMIT_MIN         = 4;
+    // 采样窗口的样本数
+    static const uint32_t LIMIT_WINDOW      = 64;
+    // 响应时间的容忍余量(ms)，避免无负载响应时间很小时误判
+    static const int64_t  LIMIT_RTT_SLACK_MS = 5;
+    // 没有请求的目标超过此时间后清理(ms)
+    static const int64_t  LIMIT_IDLE_MS     = 60 * 1000;
+
+private:
+    struct RouteLimit {
+        RouteLimit()
+            :   _limit(0), _in_flight(0), _min_rtt(-1), _window_min_rtt(-1), _window_samples(0),
+                _last_decrease_ms(0), _last_active_ms(0), _rejected(0) {}
+
+        double   _limit;
+        uint32_t _in_flight;
+        int64_t  _min_rtt;
+        int64_t  _window_min_rtt;
+        uint32_t _window_samples;
+        int64_t  _last_decrease_ms;
+        int64_t  _last_active_ms;
+        int64_t  _rejected;
+    };
+
+    void Decrease(RouteLimit* route, int64_t now);
+
+private:
+    uint32_t m_max_limit;
+    int64_t  m_rejected_num;
+    int64_t  m_last_update_ms;
+    cxx::unordered_map<int64_t, RouteLimit> m_limits;
+};
+
+} // namespace pebble
+
+#endif // _PEBBLE_FRAMEWORK_CONCURRENCY_LIMITER_H_
@@ -51,6 +51,21 @@ class TBinaryProtocolT
     string_buf_(NULL),
     string_buf_size_(0) {}
 
+  /**
+   * Does not own the transport, which must outlive the protocol and
+   * getTransport() returns an empty pointer. Lets the protocol and the
+   * transport both live on the stack without any heap allocation.
+   */
+  explicit TBinaryProtocolT(Transport_* trans) :
+    TVirtualProtocol< TBinaryProtocolT<Transport_> >(),
+    trans_(trans),
+    string_limit_(MAX_STRING_SIZE),
+    container_limit_(MAX_CONTAINER_SIZE),
+    strict_read_(false),
+    strict_write_(false),
+    string_buf_(NULL),
+    string_buf_size_(0) {}
+
   TBinaryProtocolT(cxx::shared_ptr<Transport_> trans,
                    int32_t string_limit,
                    int32_t container_limit,
@@ -23,6 +23,11 @@
 #include <limits>
 #include <sstream>
 #include <exception>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #include "framework/dr/protocol/base64_utils.h"
 #include "framework/dr/transport/transport_exception.h"
 
@@ -45,8 +50,6 @@ static const uint8_t kJSONStringDelimiter = '"';
 static const uint8_t kJSONZeroChar = '0';
 static const uint8_t kJSONEscapeChar = 'u';
 
-static const std::string kJSONEscapePrefix("\\u00");
-
 static const uint32_t kThriftVersion1 = 1;
 
 static const std::string kThriftNan("NaN");
@@ -171,6 +174,89 @@ const static uint8_t kEscapeCharVals[7] = {
   '"', '\\', '\b', '\f', '\n', '\r', '\t',
 };
 
+// 写字符串时需要转义的字符: 控制字符、'"'和'\\'，与kJSONCharTable及writeJSONChar一致
+static inline bool needJSONEscape(uint8_t ch) {
+  return ch < 0x20 || ch == kJSONStringDelimiter || ch == kJSONBackslash;
+}
+
+// 返回[p, p + len)中第一个需要转义的字符的偏移，没有则返回len
+// 定义了__AVX2__时每次扫描32字节，__SSE2__时16字节，其余平台逐字节扫描
+static size_t scanJSONEscape(const uint8_t* p, size_t len) {
+  size_t i = 0;
+#if defined(__AVX2__)
+  const __m256i quote32 = _mm256_set1_epi8(kJSONStringDelimiter);
+  const __m256i slash32 = _mm256_set1_epi8(kJSONBackslash);
+  const __m256i ctrl32  = _mm256_set1_epi8(0x1f);
+  for (; i + 32 <= len; i += 32) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+    // 无符号比较 v <= 0x1f 等价于 min(v, 0x1f) == v
+    __m256i m = _mm256_or_si256(
+      _mm256_or_si256(_mm256_cmpeq_epi8(v, quote32), _mm256_cmpeq_epi8(v, slash32)),
+      _mm256_cmpeq_epi8(_mm256_min_epu8(v, ctrl32), v));
+    uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(m));
+    if (mask != 0) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+#endif
+#if defined(__SSE2__)
+  const __m128i quote = _mm_set1_epi8(kJSONStringDelimiter);
+  const __m128i slash = _mm_set1_epi8(kJSONBackslash);
+  const __m128i ctrl  = _mm_set1_epi8(0x1f);
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+    __m128i m = _mm_or_si128(
+      _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, slash)),
+      _mm_cmpeq_epi8(_mm_min_epu8(v, ctrl), v));
+    uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(m));
+    if (mask != 0) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+#endif
+  for (; i < len; ++i) {
+    if (needJSONEscape(p[i])) {
+      break;
+    }
+  }
+  return i;
+}
+
+// 返回[p, p + len)中第一个'"'或'\\'的偏移，没有则返回len，读字符串时其余字符原样拷贝
+static size_t scanJSONUnescape(const uint8_t* p, size_t len) {
+  size_t i = 0;
+#if defined(__AVX2__)
+  const __m256i quote32 = _mm256_set1_epi8(kJSONStringDelimiter);
+  const __m256i slash32 = _mm256_set1_epi8(kJSONBackslash);
+  for (; i + 32 <= len; i += 32) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+    __m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(v, quote32), _mm256_cmpeq_epi8(v, slash32));
+    uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(m));
+    if (mask != 0) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+#endif
+#if defined(__SSE2__)
+  const __m128i quote = _mm_set1_epi8(kJSONStringDelimiter);
+  const __m128i slash = _mm_set1_epi8(kJSONBackslash);
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+    __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, slash));
+    uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(m));
+    if (mask != 0) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+#endif
+  for (; i < len; ++i) {
+    if (p[i] == kJSONStringDelimiter || p[i] == kJSONBackslash) {
+      break;
+    }
+  }
+  return i;
+}
+
 static bool isWhitespace(uint8_t ch) {
     if (ch == ' ' || ch == '\n' || ch == '\r' || ch == '\t') {
         return true;
@@ -443,12 +529,9 @@ void TJSONProtocol::popContext() {
 
 // Write the character ch as a JSON escape sequence ("\u00xx")
 uint32_t TJSONProtocol::writeJSONEscapeChar(uint8_t ch) {
-  trans_->write((const uint8_t *)kJSONEscapePrefix.c_str(),
-                static_cast<uint32_t>(kJSONEscapePrefix.length()));
-  uint8_t outCh = hexChar(ch >> 4);
-  trans_->write(&outCh, 1);
-  outCh = hexChar(ch);
-  trans_->write(&outCh, 1);
+  uint8_t out[6] = { kJSONBackslash, kJSONEscapeChar, kJSONZeroChar, kJSONZeroChar,
+                     hexChar(ch >> 4), hexChar(ch) };
+  trans_->write(out, sizeof(out));
   return 6;
 }
 
@@ -456,8 +539,8 @@ uint32_t TJSONProtocol::writeJSONEscapeChar(uint8_t ch) {
 uint32_t TJSONProtocol::writeJSONChar(uint8_t ch) {
   if (ch >= 0x30) {
     if (ch == kJSONBackslash) { // Only special character >= 0x30 is '\'
-      trans_->write(&kJSONBackslash, 1);
-      trans_->write(&kJSONBackslash, 1);
+      uint8_t out[2] = { kJSONBackslash, kJSONBackslash };
+      trans_->write(out, 2);
       return 2;
     }
     else {
@@ -473,8 +556,8 @@ uint32_t TJSONProtocol::writeJSONChar(uint8_t ch) {
       return 1;
     }
     else if (outCh > 1) {
-      trans_->write(&kJSONBackslash, 1);
-      trans_->write(&outCh, 1);
+      uint8_t out[2] = { kJSONBackslash, outCh };
+      trans_->write(out, 2);
       return 2;
     }
     else {
@@ -485,14 +568,24 @@ uint32_t TJSONProtocol::writeJSONChar(uint8_t ch) {
 
 // Write out the contents of the string str as a JSON string, escaping
 // characters as appropriate.
+// 不需要转义的连续字符批量写入，只有需要转义的字符逐个经过writeJSONChar
 uint32_t TJSONProtocol::writeJSONString(const std::string &str) {
   uint32_t result = context_->write(*trans_);
   result += 2; // For quotes
   trans_->write(&kJSONStringDelimiter, 1);
-  std::string::const_iterator iter(str.begin());
-  std::string::const_iterator end(str.end());
-  while (iter != end) {
-    result += writeJSONChar(*iter++);
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(str.data());
+  size_t len = str.length();
+  size_t pos = 0;
+  while (pos < len) {
+    size_t run = scanJSONEscape(data + pos, len - pos);
+    if (run > 0) {
+      trans_->write(data + pos, static_cast<uint32_t>(run));
+      result += static_cast<uint32_t>(run);
+      pos += run;
+    }
+    if (pos < len) {
+      result += writeJSONChar(data[pos++]);
+    }
   }
   trans_->write(&kJSONStringDelimiter, 1);
   return result;
@@ -763,6 +856,21 @@ uint32_t TJSONProtocol::readJSONString(std::string &str, bool skipContext) {
   uint8_t ch;
   str.clear();
   while (true) {
+    // 读过起始引号或转义字符后reader_中没有预读的字符，可以直接从transport借出缓冲区，
+    // 批量拷贝到下一个'"'或'\\'为止
+    uint32_t avail = 1;
+    const uint8_t* borrowed = trans_->borrow(NULL, &avail);
+    if (borrowed != NULL) {
+      size_t run = scanJSONUnescape(borrowed, avail);
+      if (run > 0) {
+        str.append(reinterpret_cast<const char*>(borrowed), run);
+        trans_->consume(static_cast<uint32_t>(run));
+        result += static_cast<uint32_t>(run);
+        if (run == avail) {
+          continue;
+        }
+      }
+    }
     ch = reader_.read();
     ++result;
     if (ch == kJSONStringDelimiter) {
@@ -170,6 +170,30 @@ enum TType {
 };
 
 
+/**
+ * skip结构体和容器时记录嵌套深度，超过限制时抛DEPTH_LIMIT，避免构造的深层嵌套数据导致栈溢出
+ * 析构时恢复深度，读取过程中抛异常后协议对象仍可继续使用
+ */
+template <class Protocol_>
+class TSkipRecursionTracker {
+ public:
+  explicit TSkipRecursionTracker(Protocol_& prot) : prot_(prot) {
+    try {
+      prot_.incrementRecursionDepth();
+    } catch (...) {
+      prot_.decrementRecursionDepth();
+      throw;
+    }
+  }
+
+  ~TSkipRecursionTracker() {
+    prot_.decrementRecursionDepth();
+  }
+
+ private:
+  Protocol_& prot_;
+};
+
 /**
  * Helper template for implementing TProtocol::skip().
  *
@@ -215,6 +239,7 @@ uint32_t skip(Protocol_& prot, TType type) {
     }
   case T_STRUCT:
     {
+      TSkipRecursionTracker<Protocol_> tracker(prot);
       uint32_t result = 0;
       std::string name;
       int16_t fid;
@@ -233,6 +258,7 @@ uint32_t skip(Protocol_& prot, TType type) {
     }
   case T_MAP:
     {
+      TSkipRecursionTracker<Protocol_> tracker(prot);
       uint32_t result = 0;
       TType keyType = T_NULL;
       TType valType = T_NULL;
@@ -247,6 +273,7 @@ uint32_t skip(Protocol_& prot, TType type) {
     }
   case T_SET:
     {
+      TSkipRecursionTracker<Protocol_> tracker(prot);
       uint32_t result = 0;
       TType elemType = T_NULL;
       uint32_t i = 0, size = 0;
@@ -259,6 +286,7 @@ uint32_t skip(Protocol_& prot, TType type) {
     }
   case T_LIST:
     {
+      TSkipRecursionTracker<Protocol_> tracker(prot);
       uint32_t result = 0;
       TType elemType = T_NULL;
       uint32_t i = 0, size = 0;
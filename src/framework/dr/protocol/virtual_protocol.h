@@ -313,6 +313,10 @@ class TProtocolDefaults : public TProtocol {
   TProtocolDefaults(cxx::shared_ptr<TTransport> ptrans)
     : TProtocol(ptrans)
   {}
+
+  TProtocolDefaults()
+    : TProtocol()
+  {}
 };
 
 /**
@@ -557,6 +561,10 @@ class TVirtualProtocol : public Super_ {
   TVirtualProtocol(cxx::shared_ptr<TTransport> ptrans)
     : Super_(ptrans)
   {}
+
+  TVirtualProtocol()
+    : Super_()
+  {}
 };
 
 }}} // pebble::dr::protocol
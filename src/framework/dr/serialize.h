@@ -16,7 +16,9 @@
 
 #include <string>
 #include <stdlib.h>
+#include <string.h>
 #include "common/platform.h"
+#include "framework/dr/protocol/binary_protocol.h"
 #include "framework/dr/transport/virtual_transport.h"
 
 namespace pebble { namespace dr { namespace detail {
@@ -71,6 +73,81 @@ class AutoBuffer : public pebble::dr::transport::TVirtualTransport<AutoBuffer> {
 
         uint8_t *m_buf_pos;
 };
+
+/// @brief 定长buffer，不抛异常，越界时置溢出标记，供TryPack/TryUnPack在栈上使用
+/// @note 写越界后不再写入，只累计需要的长度；读越界时返回全0数据，使解包尽快结束
+class StackBuffer {
+    public:
+        StackBuffer(uint8_t *buf, uint32_t buf_len)
+            : m_buf(buf),
+              m_buf_bound(buf + buf_len),
+              m_buf_pos(buf),
+              m_lack_len(0),
+              m_overflow(false) {
+        }
+
+        uint32_t read(uint8_t* buf, uint32_t len) {
+            return readAll(buf, len);
+        }
+
+        uint32_t readAll(uint8_t* buf, uint32_t len) {
+            if (len > static_cast<uint32_t>(m_buf_bound - m_buf_pos)) {
+                m_overflow = true;
+                m_buf_pos = m_buf_bound;
+                memset(buf, 0, len);
+                return len;
+            }
+            memcpy(buf, m_buf_pos, len);
+            m_buf_pos += len;
+            return len;
+        }
+
+        void write(const uint8_t* buf, uint32_t len) {
+            if (m_overflow || len > static_cast<uint32_t>(m_buf_bound - m_buf_pos)) {
+                m_overflow = true;
+                m_lack_len += len;
+                return;
+            }
+            memcpy(m_buf_pos, buf, len);
+            m_buf_pos += len;
+        }
+
+        const uint8_t* borrow(uint8_t* buf, uint32_t* len) {
+            (void) buf;
+            if (*len > static_cast<uint32_t>(m_buf_bound - m_buf_pos)) {
+                return NULL;
+            }
+            return m_buf_pos;
+        }
+
+        void consume(uint32_t len) {
+            m_buf_pos += len;
+        }
+
+        int32_t used() const {
+            return m_buf_pos - m_buf;
+        }
+
+        /// @brief 完整打包需要的长度
+        uint32_t needed() const {
+            return m_buf_pos - m_buf + m_lack_len;
+        }
+
+        bool overflow() const {
+            return m_overflow;
+        }
+
+    private:
+        uint8_t *m_buf;
+
+        uint8_t *m_buf_bound;
+
+        uint8_t *m_buf_pos;
+
+        uint32_t m_lack_len;
+
+        bool m_overflow;
+};
 } // namespace detail
 
 /// @brief 字段序列化接口返回码
@@ -123,6 +200,49 @@ int UnPack(TDATA *obj, const uint8_t *buff, uint32_t buff_len) {
     }
 }
 
+/// @brief Binary打包，不抛异常、不分配内存，transport和protocol都在栈上
+/// @param overflow 输出参数，buff不足时置为true
+/// @return buff足够时返回打包后的长度；buff不足时返回完整打包需要的长度，可按此长度重试；
+///     <0 失败，具体看@ref PackError
+template<typename TDATA>
+int TryPack(const TDATA *obj, uint8_t *buff, uint32_t buff_len, bool *overflow) {
+    if (obj == NULL || buff == NULL || overflow == NULL) return pebble::dr::kINVALIDPARAMETER;
+
+    detail::StackBuffer s_buff(buff, buff_len);
+    pebble::dr::protocol::TBinaryProtocolT<detail::StackBuffer> protocol(&s_buff);
+
+    try {
+        obj->write(&protocol);
+    } catch (...) {
+        return pebble::dr::kUNKNOW;
+    }
+
+    *overflow = s_buff.overflow();
+    return s_buff.needed();
+}
+
+/// @brief Binary解包，不抛异常、不分配内存(对象自身成员的分配除外)
+/// @param overflow 输出参数，buff中的数据不完整时置为true
+/// @return >=0 解包使用的长度，<0 失败，数据不完整时返回kINVALIDBUFFER
+template<typename TDATA>
+int TryUnPack(TDATA *obj, const uint8_t *buff, uint32_t buff_len, bool *overflow) {
+    if (obj == NULL || buff == NULL || overflow == NULL) return pebble::dr::kINVALIDPARAMETER;
+
+    detail::StackBuffer s_buff(const_cast<uint8_t*>(buff), buff_len);
+    pebble::dr::protocol::TBinaryProtocolT<detail::StackBuffer> protocol(&s_buff);
+
+    // 数据不完整时按全0继续读，不会抛异常；只有数据格式错误时才会抛出
+    try {
+        obj->read(&protocol);
+    } catch (...) {
+        *overflow = s_buff.overflow();
+        return pebble::dr::kINVALIDBUFFER;
+    }
+
+    *overflow = s_buff.overflow();
+    return *overflow ? pebble::dr::kINVALIDBUFFER : s_buff.used();
+}
+
 class InvalidParameterException : public pebble::TException {
 };
 
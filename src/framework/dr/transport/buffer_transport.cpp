@@ -32,7 +32,10 @@ namespace pebble { namespace dr { namespace transport {
 void TMemoryBuffer::computeRead(uint32_t len, uint8_t** out_start, uint32_t* out_give)
 {
     // Correct rBound_ so we can use the fast path in the future.
-    rBound_ = wBase_;
+    // 只向后修正，wBase_停在开头时缩小读边界会越过数据末尾继续读
+    if (wBase_ > rBound_) {
+        rBound_ = wBase_;
+    }
 
     // Decide how much to give.
     uint32_t give = (std::min)(len, available_read());
@@ -146,7 +149,9 @@ void TMemoryBuffer::wroteBytes(uint32_t len)
 const uint8_t* TMemoryBuffer::borrowSlow(uint8_t* buf, uint32_t* len)
 {
     (void) buf;
-    rBound_ = wBase_;
+    if (wBase_ > rBound_) {
+        rBound_ = wBase_;
+    }
     if (available_read() >= *len) {
         *len = available_read();
         return rBase_;
@@ -414,7 +414,8 @@ public:
 
     uint32_t available_read() const {
         // Remember, wBase_ is the real rBound_.
-        return static_cast<uint32_t>(wBase_ - rBase_);
+        // 以OBSERVE方式读外部缓冲区时wBase_停在开头，此时读边界由rBound_给出
+        return static_cast<uint32_t>((wBase_ > rBound_ ? wBase_ : rBound_) - rBase_);
     }
 
     uint32_t available_write() const {
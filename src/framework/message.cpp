@@ -11,9 +11,14 @@
  *
  */
 
+#include <unistd.h>
+
 #include "common/log.h"
+#include "ev.h"
 #include "framework/message.h"
 #include "framework/tcp_driver.h"
+#include "framework/tcp_reactor_driver.h"
+#include "framework/udp_driver.h"
 
 namespace pebble {
 
@@ -22,7 +27,7 @@ namespace pebble {
 /*
 	handle MASK:
 		tcp	 : 0 << 60
-		http : 1 << 60
+		udp  : 1 << 60
 		...
 */
 
@@ -33,8 +38,24 @@ typedef union {
 } HandleHelper;
 
 
+// 所有驱动共用default loop，Poll阻塞在这个loop上
+static struct ev_loop* g_poll_loop = NULL;
+static ev_async g_wakeup_watcher;
+static ev_timer g_poll_timer;
+
+static void on_wakeup(EV_P_ ev_async *w, int revents) {
+	// 仅用于从Poll中返回
+}
+
+static void on_poll_timeout(EV_P_ ev_timer *w, int revents) {
+	// 仅用于从Poll中返回
+}
+
+
 MessageCallbacks Message::m_cbs;
 int Message::m_driver_num = 0;
+int Message::m_first_driver = 0;
+uint32_t Message::m_max_msg_num_per_loop = 0;
 cxx::shared_ptr<MessageDriver> Message::m_drivers[Message::MAX_DRIVER_NUM];
 std::map<std::string, cxx::shared_ptr<MessageDriver> > Message::m_prefix_to_driver;
 
@@ -42,25 +63,78 @@ std::map<std::string, cxx::shared_ptr<MessageDriver> > Message::m_prefix_to_driv
 MessageDriver::MessageDriver() {
 	m_handle_seq = 0;
 	m_handle_mask = 0;
+	m_max_msg_num_per_connection = 0;
+	m_loop_msg_budget = -1;
+	m_budget_exhausted_num = 0;
+	m_carry_over_num = 0;
+}
+
+void MessageDriver::GetBudgetStat(int64_t* exhausted_num, int64_t* carry_over_num) {
+	*exhausted_num  = m_budget_exhausted_num;
+	*carry_over_num = m_carry_over_num;
+	m_budget_exhausted_num = 0;
+	m_carry_over_num = 0;
+}
+
+uint32_t MessageDriver::GetMsgBudget(uint32_t max_num) const {
+	uint32_t num = max_num;
+	if (m_max_msg_num_per_connection > 0 && m_max_msg_num_per_connection < num) {
+		num = m_max_msg_num_per_connection;
+	}
+	if (m_loop_msg_budget >= 0 && m_loop_msg_budget < num) {
+		num = static_cast<uint32_t>(m_loop_msg_budget);
+	}
+	return num;
+}
+
+bool MessageDriver::AcquireMsgBudget(uint32_t conn_msg_num) {
+	if (m_max_msg_num_per_connection > 0 && conn_msg_num >= m_max_msg_num_per_connection) {
+		return false;
+	}
+	if (m_loop_msg_budget == 0) {
+		return false;
+	}
+	if (m_loop_msg_budget > 0 && --m_loop_msg_budget == 0) {
+		m_budget_exhausted_num++;
+	}
+	return true;
 }
 
 int64_t MessageDriver::GenHandle() {
 	return m_handle_mask | m_handle_seq++;
 }
 
-int32_t Message::Init(const MessageCallbacks& cb) {
+int32_t Message::Init(const MessageCallbacks& cb, uint32_t io_thread_num) {
 	int a = 1;
 	(*(char *)&a == 1) ? endian_pos = 7 : endian_pos = 0;
 
 	m_cbs = cb;
 
-	cxx::shared_ptr<MessageDriver> tcp_driver(new TcpDriver());
+	cxx::shared_ptr<MessageDriver> tcp_driver;
+	if (io_thread_num > 0) {
+		tcp_driver.reset(new TcpReactorDriver(io_thread_num));
+	} else {
+		tcp_driver.reset(new TcpDriver());
+	}
     int ret = AddDriver(tcp_driver);
 	if (ret != 0) {
 		return ret;
 	}
+
+	cxx::shared_ptr<MessageDriver> udp_driver(new UdpDriver());
+	ret = AddDriver(udp_driver);
+	if (ret != 0) {
+		return ret;
+	}
 	// add other driver...
 
+	if (NULL == g_poll_loop) {
+		g_poll_loop = ev_default_loop(0);
+		ev_async_init(&g_wakeup_watcher, on_wakeup);
+		ev_async_start(g_poll_loop, &g_wakeup_watcher);
+		ev_timer_init(&g_poll_timer, on_poll_timeout, 0., 0.);
+	}
+
     return 0;
 }
 
@@ -123,12 +197,75 @@ int32_t Message::Close(int64_t handle) {
 
 int32_t Message::Update() {
 	int num = 0;
+	int64_t budget = (m_max_msg_num_per_loop > 0 ? m_max_msg_num_per_loop : -1);
+	// 每轮从不同的驱动开始，避免配额总被排在前面的驱动用完
     for (int i = 0; i < m_driver_num; i++) {
-		num += m_drivers[i]->Update();
+		cxx::shared_ptr<MessageDriver>& driver = m_drivers[(m_first_driver + i) % m_driver_num];
+		driver->SetLoopMsgBudget(budget);
+		num += driver->Update();
+		budget = driver->GetLoopMsgBudget();
+	}
+	if (m_driver_num > 0) {
+		m_first_driver = (m_first_driver + 1) % m_driver_num;
 	}
     return num;
 }
 
+void Message::SetMsgBudget(uint32_t max_msg_num_per_loop, uint32_t max_msg_num_per_connection) {
+	m_max_msg_num_per_loop = max_msg_num_per_loop;
+    for (int i = 0; i < m_driver_num; i++) {
+		m_drivers[i]->SetMaxMsgNumPerConnection(max_msg_num_per_connection);
+	}
+}
+
+void Message::GetBudgetStat(int64_t* exhausted_num, int64_t* carry_over_num) {
+	*exhausted_num  = 0;
+	*carry_over_num = 0;
+    for (int i = 0; i < m_driver_num; i++) {
+		int64_t exhausted = 0;
+		int64_t carry_over = 0;
+		m_drivers[i]->GetBudgetStat(&exhausted, &carry_over);
+		*exhausted_num  += exhausted;
+		*carry_over_num += carry_over;
+	}
+}
+
+int32_t Message::Poll(int64_t timeout_us) {
+	// Poll中到达的消息同样受每轮配额限制
+	int64_t budget = (m_max_msg_num_per_loop > 0 ? m_max_msg_num_per_loop : -1);
+    for (int i = 0; i < m_driver_num; i++) {
+		m_drivers[i]->Flush();
+		m_drivers[i]->SetLoopMsgBudget(budget);
+	}
+
+	if (NULL == g_poll_loop) {
+		if (timeout_us > 0) {
+			usleep(timeout_us);
+		}
+		return 0;
+	}
+
+	if (timeout_us <= 0) {
+		ev_run(g_poll_loop, EVRUN_NOWAIT);
+		return 0;
+	}
+
+	// loop时间可能是上次ev_run时缓存的，先刷新避免定时器提前到期
+	ev_now_update(g_poll_loop);
+	ev_timer_set(&g_poll_timer, timeout_us / 1000000.0, 0.);
+	ev_timer_start(g_poll_loop, &g_poll_timer);
+	ev_run(g_poll_loop, EVRUN_ONCE);
+	ev_timer_stop(g_poll_loop, &g_poll_timer);
+
+	return 0;
+}
+
+void Message::Wakeup() {
+	if (g_poll_loop != NULL) {
+		ev_async_send(g_poll_loop, &g_wakeup_watcher);
+	}
+}
+
 int32_t Message::AddDriver(const cxx::shared_ptr<MessageDriver>& driver) {
 	if (!driver) {
 		return kMESSAGE_INVAILD_PARAM;
@@ -85,12 +85,14 @@ struct MsgExternInfo {
         _remote_handle  = -1;
         _msg_arrived_ms = 0;
         _src            = NULL;
+        _overload_level = 0;
     }
     MsgExternInfo(const MsgExternInfo& rhs) {
         _self_handle    = rhs._self_handle;
         _remote_handle  = rhs._remote_handle;
         _msg_arrived_ms = rhs._msg_arrived_ms;
         _src            = rhs._src;
+        _overload_level = rhs._overload_level;
     }
 
     int64_t         _self_handle;       // bind或connect获得的handle
@@ -98,6 +100,7 @@ struct MsgExternInfo {
     int64_t         _msg_arrived_ms;    // 消息到达时间
 
     IProcessor*     _src;               // 消息源，由消息分发Processor填写，方便消息在各Processor间传递
+    uint32_t        _overload_level;    // 收到消息时系统的过载等级，由框架填写 @see OverLoadLevel
 };
 
 struct MessageCallbacks {
@@ -139,6 +142,9 @@ public:
 
 	virtual const char* Prefix() const = 0;
 
+	/// @brief 主循环阻塞等待前调用，驱动需把缓存待发的数据发出去
+	virtual void Flush() {}
+
 public:
 	// framework call
 	void SetCallBack(const MessageCallbacks& callbacks) { m_cbs = callbacks; }
@@ -146,14 +152,47 @@ public:
 	// framework call
 	void SetHandleMask(int64_t handle_mask) { m_handle_mask = handle_mask; }
 
+	// framework call, 设置单个连接一次最多连续处理的消息数，0表示不限制
+	void SetMaxMsgNumPerConnection(uint32_t num) { m_max_msg_num_per_connection = num; }
+
+	// framework call, 设置本轮Update可处理的消息数，<0表示不限制
+	void SetLoopMsgBudget(int64_t budget) { m_loop_msg_budget = budget; }
+
+	// framework call, 返回本轮剩余可处理的消息数，<0表示不限制
+	int64_t GetLoopMsgBudget() const { return m_loop_msg_budget; }
+
+	// framework call, 取出配额用完和连接被推迟处理的次数，取出后清零
+	void GetBudgetStat(int64_t* exhausted_num, int64_t* carry_over_num);
+
 protected:
 	int64_t GenHandle();
 
+	int64_t GetHandleMask() const { return m_handle_mask; }
+
+	/// @brief 处理一个消息前申请配额
+	/// @param conn_msg_num 本次已在该连接上连续处理的消息数
+	/// @return true 可以处理，false 本轮或该连接的配额已用完
+	bool AcquireMsgBudget(uint32_t conn_msg_num);
+
+	/// @brief 本轮是否还有剩余配额
+	bool HasLoopMsgBudget() const { return m_loop_msg_budget != 0; }
+
+	/// @brief 单个连接本次最多可连续处理的消息数，不超过max_num
+	uint32_t GetMsgBudget(uint32_t max_num) const;
+
+	/// @brief 记录一次因配额用完而推迟到后续Update处理的连接
+	void OnCarryOver() { m_carry_over_num++; }
+
 	MessageCallbacks m_cbs;
 
 private:
 	int64_t m_handle_seq;
 	int64_t m_handle_mask;
+
+	uint32_t m_max_msg_num_per_connection;
+	int64_t  m_loop_msg_budget;
+	int64_t  m_budget_exhausted_num;
+	int64_t  m_carry_over_num;
 };
 
 /// @brief 基于消息的通讯接口类
@@ -163,7 +202,9 @@ public:
     // -------------------message api begin-------------------------
 
     /// @brief 初始化
-    static int32_t Init(const MessageCallbacks& cb);
+    /// @param cb 消息回调
+    /// @param io_thread_num 网络线程数，为0时tcp在主线程收发，>0时使用多网络线程的TcpReactorDriver
+    static int32_t Init(const MessageCallbacks& cb, uint32_t io_thread_num = 0);
 
     // TODO: url规范需要统一
     /// @brief （服务端）把一个句柄绑定到指定url
@@ -218,6 +259,15 @@ public:
     /// @return -1 等待超时
     static int32_t Update();
 
+    /// @brief 阻塞等待网络事件，有网络事件、Wakeup或等待超时时返回
+    /// @param timeout_us 最长等待时间，单位us，<=0时不等待
+    /// @return 0 成功
+    /// @note 等待期间到达的事件直接在Poll中处理
+    static int32_t Poll(int64_t timeout_us);
+
+    /// @brief 唤醒阻塞在Poll中的主线程，可在任意线程中调用
+    static void Wakeup();
+
     // -------------------network api end-------------------------
 public:
 	static const int MAX_DRIVER_NUM = 8;
@@ -229,9 +279,22 @@ public:
 
 	static cxx::shared_ptr<MessageDriver> GetDriver(int64_t handle);
 
+    /// @brief 设置消息处理配额，避免单个连接或大量消息占满一轮循环，导致其他连接和定时器饥饿
+    /// @param max_msg_num_per_loop 每轮Update最多处理的消息数(所有驱动共享)，0表示不限制
+    /// @param max_msg_num_per_connection 单个连接一次最多连续处理的消息数，0表示不限制
+    /// @note 配额用完时连接中未处理的消息保留，后续Update中按轮询方式继续处理
+    static void SetMsgBudget(uint32_t max_msg_num_per_loop, uint32_t max_msg_num_per_connection);
+
+    /// @brief 获取配额统计，取出后清零
+    /// @param exhausted_num 每轮配额用完的次数
+    /// @param carry_over_num 连接因配额用完被推迟处理的次数
+    static void GetBudgetStat(int64_t* exhausted_num, int64_t* carry_over_num);
+
 private:
 	static MessageCallbacks m_cbs;
 	static int m_driver_num;
+	static int m_first_driver;
+	static uint32_t m_max_msg_num_per_loop;
     static cxx::shared_ptr<MessageDriver> m_drivers[MAX_DRIVER_NUM];
 	static std::map<std::string, cxx::shared_ptr<MessageDriver> > m_prefix_to_driver;
 };
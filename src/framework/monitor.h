@@ -26,6 +26,15 @@ enum OverLoadType {
     kNO_OVERLOAD     = 0,   // 未过载
     kMESSAGE_EXPIRED = 0x1, // 消息过期
     kTASK_OVERLOAD   = 0x2, // 并发任务数过载(超出限制)
+    kQUEUE_DELAY     = 0x8, // 消息排队时延持续超过目标值
+};
+
+/// @brief 过载等级，等级越高，过载时仍处理的请求优先级要求越高
+enum OverLoadLevel {
+    kOVERLOAD_LEVEL_NONE   = 0, // 未过载
+    kOVERLOAD_LEVEL_LIGHT  = 1, // 接近过载，丢弃低优先级请求
+    kOVERLOAD_LEVEL_HEAVY  = 2, // 过载(IsOverLoad非0)，只处理高优先级和关键请求
+    kOVERLOAD_LEVEL_SEVERE = 3, // 严重过载，只处理关键请求
 };
 
 /// @brief 系统过载监控接口定义
@@ -36,6 +45,12 @@ public:
     /// @brief 是否过载
     /// @return 0 不过载，其他参考 @seeOverLoadType
     virtual uint32_t IsOverLoad() = 0;
+
+    /// @brief 过载等级，默认过载时为kOVERLOAD_LEVEL_HEAVY
+    /// @return @see OverLoadLevel
+    virtual uint32_t GetOverLoadLevel() {
+        return IsOverLoad() != kNO_OVERLOAD ? kOVERLOAD_LEVEL_HEAVY : kOVERLOAD_LEVEL_NONE;
+    }
 };
 
 /// @brief 系统并发任务监控，当系统未处理完毕的任务数超过限制认为过载
@@ -57,6 +72,20 @@ public:
         return m_task_num >= m_task_threshold ? kTASK_OVERLOAD : kNO_OVERLOAD;
     }
 
+    /// @brief 任务数达到门限的80%为轻度过载，达到门限为过载，超过门限的120%为严重过载
+    virtual uint32_t GetOverLoadLevel() {
+        uint64_t task_num  = static_cast<uint64_t>(m_task_num) * 5;
+        uint64_t threshold = m_task_threshold;
+        if (task_num >= threshold * 6) {
+            return kOVERLOAD_LEVEL_SEVERE;
+        } else if (task_num >= threshold * 5) {
+            return kOVERLOAD_LEVEL_HEAVY;
+        } else if (task_num >= threshold * 4) {
+            return kOVERLOAD_LEVEL_LIGHT;
+        }
+        return kOVERLOAD_LEVEL_NONE;
+    }
+
 private:
     uint32_t m_task_num;
     uint32_t m_task_threshold;
@@ -78,15 +107,96 @@ public:
     }
 
     virtual uint32_t IsOverLoad() {
-        return (m_arrived_ms + m_expire_threshold_ms) < TimeUtility::GetCurrentMS()
+        return (m_arrived_ms + m_expire_threshold_ms) < TimeUtility::GetLoopMS()
             ? kMESSAGE_EXPIRED : kNO_OVERLOAD;
     }
 
+    /// @brief 消息排队时间超过门限的一半为轻度过载，超过门限为过载，超过门限的2倍为严重过载
+    virtual uint32_t GetOverLoadLevel() {
+        int64_t delay_ms = TimeUtility::GetLoopMS() - m_arrived_ms;
+        if (delay_ms > 2 * static_cast<int64_t>(m_expire_threshold_ms)) {
+            return kOVERLOAD_LEVEL_SEVERE;
+        } else if (delay_ms > m_expire_threshold_ms) {
+            return kOVERLOAD_LEVEL_HEAVY;
+        } else if (delay_ms > m_expire_threshold_ms / 2) {
+            return kOVERLOAD_LEVEL_LIGHT;
+        }
+        return kOVERLOAD_LEVEL_NONE;
+    }
+
 private:
     int64_t m_arrived_ms;
     uint32_t m_expire_threshold_ms;
 };
 
+/// @brief 消息排队时延监控，参考CoDel(Controlled Delay)算法
+/// @note 排队时延为消息从网络收到到开始处理的时间，时延低于目标值时不过载；
+///     时延在一个检测周期内一直不低于目标值(即周期内的最小时延超过目标值)时进入过载状态，
+///     直到出现低于目标值的消息才退出，瞬时的突发不会触发过载
+///     时延超过目标值但未满一个检测周期时为轻度过载，过载状态下时延超过检测周期时为严重过载
+class CoDelMonitor : public IMonitor {
+public:
+    CoDelMonitor()
+        :   m_target_ms(0), m_interval_ms(100), m_sojourn_ms(0), m_first_above_ms(0),
+            m_dropping(false) {}
+    virtual ~CoDelMonitor() {}
+
+    /// @brief 设置目标时延，0表示不监控
+    void SetTarget(uint32_t target_ms) {
+        m_target_ms = target_ms;
+        if (0 == m_target_ms) {
+            m_first_above_ms = 0;
+            m_dropping = false;
+        }
+    }
+
+    /// @brief 设置检测周期，时延持续超过目标值的时间达到检测周期时认为过载
+    void SetInterval(uint32_t interval_ms) {
+        m_interval_ms = interval_ms;
+    }
+
+    /// @brief 消息开始处理时调用
+    /// @param arrived_ms 消息从网络读取时的时间(单调时间)
+    void OnMessage(int64_t arrived_ms) {
+        if (0 == m_target_ms || arrived_ms <= 0) {
+            return;
+        }
+
+        // 循环时间在收包时刚刷新过，排队时延需要取实时时间
+        int64_t now  = TimeUtility::GetMonotonicMS();
+        m_sojourn_ms = now - arrived_ms;
+        if (m_sojourn_ms < m_target_ms) {
+            m_first_above_ms = 0;
+            m_dropping = false;
+            return;
+        }
+
+        if (0 == m_first_above_ms) {
+            m_first_above_ms = now;
+        } else if (now - m_first_above_ms >= m_interval_ms) {
+            m_dropping = true;
+        }
+    }
+
+    virtual uint32_t IsOverLoad() {
+        return m_dropping ? kQUEUE_DELAY : kNO_OVERLOAD;
+    }
+
+    virtual uint32_t GetOverLoadLevel() {
+        if (m_dropping) {
+            return m_sojourn_ms >= m_interval_ms ? kOVERLOAD_LEVEL_SEVERE : kOVERLOAD_LEVEL_HEAVY;
+        }
+        return m_first_above_ms != 0 ? kOVERLOAD_LEVEL_LIGHT : kOVERLOAD_LEVEL_NONE;
+    }
+
+private:
+    uint32_t m_target_ms;
+    uint32_t m_interval_ms;
+    int64_t  m_sojourn_ms;      // 最近一个消息的排队时延
+    int64_t  m_first_above_ms;  // 时延开始超过目标值的时间，0表示未超过
+    bool     m_dropping;        // 是否处于过载状态
+};
+
 /// @brief 监控中心，根据系统负载情况和流控策略配置提供流控决策支持
 class MonitorCenter {
 public:
@@ -107,6 +217,20 @@ public:
         return overload;
     }
 
+    /// @brief 过载等级，取各监控器中最高的等级
+    /// @return @see OverLoadLevel
+    uint32_t GetOverLoadLevel() {
+        uint32_t level = kOVERLOAD_LEVEL_NONE;
+        for (std::vector<IMonitor*>::iterator it = m_monitors.begin();
+            it != m_monitors.end(); ++it) {
+            uint32_t monitor_level = (*it)->GetOverLoadLevel();
+            if (monitor_level > level) {
+                level = monitor_level;
+            }
+        }
+        return level;
+    }
+
     /// @brief 添加新的监控能力
     void AddMonitor(IMonitor* monitor) {
         m_monitors.push_back(monitor);
@@ -27,9 +27,17 @@ Options::Options() {
     _app_instance_id        = DEFAULT_APP_INSTANCE_ID;
     _app_unit_id            = DEFAULT_APP_UNIT_ID;
     _app_program_id         = DEFAULT_APP_PROGRAM_ID;
+    _app_tsc_clock          = DEFAULT_APP_TSC_CLOCK;
 
     // coroutine
     _co_stack_size_bytes    = DEFAULT_CO_STACK_SIZE;
+    _co_shared_stack_num    = DEFAULT_CO_SHARED_STACK_NUM;
+    _co_stack_pool_size     = DEFAULT_CO_STACK_POOL_SIZE;
+    _co_stack_madv_free     = DEFAULT_CO_STACK_MADV_FREE;
+    _co_pool_thread_num     = DEFAULT_CO_POOL_THREAD_NUM;
+
+    // message
+    _io_thread_num          = DEFAULT_IO_THREAD_NUM;
 
     // log
     _log_device             = DEFAULT_LOG_DEVICE;
@@ -48,8 +56,11 @@ Options::Options() {
     // flow control
     _enable_flow_control    = DEFAULT_ENABLE_FLOW_CONTROL;
     _max_msg_num_per_loop   = DEFAULT_MAX_MSG_NUM_PER_LOOP;
+    _max_msg_num_per_connection = DEFAULT_MAX_MSG_NUM_PER_CONNECTION;
     _task_threshold         = DEFAULT_TASK_THRESHOLD;
     _message_expire_ms      = DEFAULT_MESSAGE_EXPIRE_MS;
+    _codel_target_ms        = DEFAULT_CODEL_TARGET_MS;
+    _codel_interval_ms      = DEFAULT_CODEL_INTERVAL_MS;
     _idle_us                = DEFAULT_IDLE_US;
 
     // broadcast
@@ -57,6 +68,10 @@ Options::Options() {
 
     // rpc
     _proc_req_timeout_ms    = DEFAULT_PROC_REQ_TIMEOUT_MS;
+    _rpc_version            = DEFAULT_RPC_VERSION;
+    _hedge_percentile       = DEFAULT_HEDGE_PERCENTILE;
+    _hedge_max_ratio        = DEFAULT_HEDGE_MAX_RATIO;
+    _concurrency_limit      = DEFAULT_CONCURRENCY_LIMIT;
 }
 
 std::string Options::ToString() {
@@ -69,8 +84,15 @@ std::string Options::ToString() {
             << kAppUnitId           << " = " << _app_unit_id          << "\n"
             << kAppProgramId        << " = " << _app_program_id       << "\n"
             << kAppCtrlCmdAddr      << " = " << _app_ctrl_cmd_addr    << "\n"
+            << kAppTscClock         << " = " << _app_tsc_clock        << "\n"
         << "[" << kSectionCoroutine << "]\n"
             << kCoStackSize         << " = " << _co_stack_size_bytes  << "\n"
+            << kCoSharedStackNum    << " = " << _co_shared_stack_num  << "\n"
+            << kCoStackPoolSize     << " = " << _co_stack_pool_size   << "\n"
+            << kCoStackMadvFree     << " = " << _co_stack_madv_free   << "\n"
+            << kCoPoolThreadNum     << " = " << _co_pool_thread_num   << "\n"
+        << "[" << kSectionMessage << "]\n"
+            << kIoThreadNum         << " = " << _io_thread_num        << "\n"
         << "[" << kSectionLog << "]\n"
             << kLogDevice           << " = " << _log_device           << "\n"
             << kLogPriority         << " = " << _log_priority         << "\n"
@@ -86,8 +108,11 @@ std::string Options::ToString() {
         << "[" << kSectionFlowControl << "]\n"
             << kEnableFlowControl   << " = " << _enable_flow_control  << "\n"
             << kMaxMsgNumPerLoop    << " = " << _max_msg_num_per_loop << "\n"
+            << kMaxMsgNumPerConnection << " = " << _max_msg_num_per_connection << "\n"
             << kTaskThreshold       << " = " << _task_threshold       << "\n"
             << kMessageExpireMs     << " = " << _message_expire_ms    << "\n"
+            << kCoDelTargetMs       << " = " << _codel_target_ms      << "\n"
+            << kCoDelIntervalMs     << " = " << _codel_interval_ms    << "\n"
             << kIdleUs              << " = " << _idle_us              << "\n"
         << "[" << kSectionBroadcast << "]\n"
             << kBcRelayAddress      << " = " << _bc_relay_address     << "\n"
@@ -95,6 +120,10 @@ std::string Options::ToString() {
             << kBcZkTimeoutMs       << " = " << _bc_zk_timeout_ms     << "\n"
         << "[" << kSectionRpc << "]\n"
             << kProcReqTimeoutMs    << " = " << _proc_req_timeout_ms  << "\n"
+            << kRpcVersion          << " = " << _rpc_version          << "\n"
+            << kHedgePercentile     << " = " << _hedge_percentile     << "\n"
+            << kHedgeMaxRatio       << " = " << _hedge_max_ratio      << "\n"
+            << kConcurrencyLimit    << " = " << _concurrency_limit    << "\n"
         ;
 
     return oss.str();
@@ -103,6 +132,7 @@ std::string Options::ToString() {
 // section
 const char* kSectionApp         = "app";
 const char* kSectionCoroutine   = "coroutine";
+const char* kSectionMessage     = "message";
 const char* kSectionLog         = "log";
 const char* kSectionStat        = "stat";
 const char* kSectionFlowControl = "flow_control";
@@ -118,9 +148,17 @@ const char* kAppInstanceId      = "instance_id";
 const char* kAppUnitId          = "unit_id";
 const char* kAppProgramId       = "program_id";
 const char* kAppCtrlCmdAddr     = "ctrl_cmd_address";
+const char* kAppTscClock        = "tsc_clock";
 
 // [coroutine]
 const char* kCoStackSize        = "stack_size";
+const char* kCoSharedStackNum   = "shared_stack_num";
+const char* kCoStackPoolSize    = "stack_pool_size";
+const char* kCoStackMadvFree    = "stack_madv_free";
+const char* kCoPoolThreadNum    = "pool_thread_num";
+
+// [message]
+const char* kIoThreadNum        = "io_thread_num";
 
 // [log]
 const char* kLogDevice          = "device";
@@ -139,8 +177,11 @@ const char* kGdataLogPath       = "gdata_log_path";
 // [flow_control]
 const char* kEnableFlowControl  = "enable";
 const char* kMaxMsgNumPerLoop   = "msg_num_per_loop";
+const char* kMaxMsgNumPerConnection = "msg_num_per_connection";
 const char* kTaskThreshold      = "task_threshold";
 const char* kMessageExpireMs    = "message_expire_ms";
+const char* kCoDelTargetMs      = "codel_target_ms";
+const char* kCoDelIntervalMs    = "codel_interval_ms";
 const char* kIdleUs             = "idle_us";
 
 // [broadcast]
@@ -150,6 +191,10 @@ const char* kBcZkTimeoutMs      = "zk_connect_timeout_ms";
 
 // [rpc]
 const char* kProcReqTimeoutMs   = "proc_request_timeout_ms";
+const char* kRpcVersion         = "rpc_version";
+const char* kHedgePercentile    = "hedge_percentile";
+const char* kHedgeMaxRatio      = "hedge_max_ratio";
+const char* kConcurrencyLimit   = "concurrency_limit";
 
 }  // namespace pebble
 
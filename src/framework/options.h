@@ -33,9 +33,17 @@ struct Options {
     int32_t     _app_unit_id;       // 兼容OMS，UNIT ID，默认为0
     int32_t     _app_program_id;    // 兼容OMS, PROGRAM(SERVER) ID，默认为0
     std::string _app_ctrl_cmd_addr; // 控制命令监听地址
+    bool        _app_tsc_clock;     // 单调时钟是否使用TSC计算(需CPU支持invariant TSC)，默认为0，非reload生效
 
     // coroutine
     uint32_t _co_stack_size_bytes;  // 协程栈大小（单位字节），默认为256K，非reload生效
+    uint32_t _co_shared_stack_num;  // 共享栈个数，0表示每个协程使用独立栈，默认为0，非reload生效
+    uint32_t _co_stack_pool_size;   // 栈池中最多缓存的空闲协程栈个数，默认为1024，非reload生效
+    bool     _co_stack_madv_free;   // 是否让内核回收空闲协程栈的物理内存，默认为0，非reload生效
+    uint32_t _co_pool_thread_num;   // RunInPool使用的线程数，首次调用RunInPool时创建，默认为4，非reload生效
+
+    // message
+    uint32_t _io_thread_num;        // tcp网络线程数，0表示在主线程收发，默认为0，非reload生效
 
     // log
     std::string _log_device;        // 打印输出方式 { FILE、STDOUT }，默认为FILE
@@ -54,9 +62,12 @@ struct Options {
     // flow control
     bool     _enable_flow_control;  // 是否打开流控，0 - 关闭，1 - 打开，默认为1
     uint32_t _max_msg_num_per_loop; // 每个tick最大消息处理数量，默认为100
+    uint32_t _max_msg_num_per_connection; // 每个tick单个连接一次最多连续处理的消息数量，超出部分轮询到后续tick处理，默认为10
     uint32_t _task_threshold;       // 系统并发任务门限，默认为1w
     uint32_t _message_expire_ms;    // 消息过期时间（单位ms），默认为10*1000(10s)
-    uint32_t _idle_us;              // idle time by us
+    uint32_t _codel_target_ms;      // 消息排队时延目标值（单位ms），时延持续超过此值时过载，0表示不检测，默认为0
+    uint32_t _codel_interval_ms;    // 消息排队时延检测周期（单位ms），默认为100
+    uint32_t _idle_us;              // 空闲时最长阻塞等待时间(us)，有网络事件或定时器到期时提前唤醒，默认为1000us
 
     // broadcast
     std::string _bc_relay_address;  // 接收其他server转发的广播消息的监听地址，非reload生效
@@ -65,6 +76,10 @@ struct Options {
 
     // rpc
     uint32_t _proc_req_timeout_ms; // 请求处理超时时间，超时未回响应就释放session
+    int32_t  _rpc_version;          // 发送请求的消息头版本，0 - 携带方法名，1 - 携带方法ID(不支持的对端自动改用方法名)，默认为0
+    uint32_t _hedge_percentile;     // 对冲请求的等待时间为该方法响应时间的此分位数，取值1-99，默认为95
+    uint32_t _hedge_max_ratio;      // 对冲请求数占对冲方法请求数的最大百分比，0表示不对冲，默认为5
+    uint32_t _concurrency_limit;    // 到每个目标的最大并发请求数，实际限制在此范围内自适应调整，0表示不限制，默认为0
 
     Options();
     std::string ToString();
@@ -74,6 +89,7 @@ struct Options {
 // section
 extern const char* kSectionApp;         // [app]
 extern const char* kSectionCoroutine;   // [coroutine]
+extern const char* kSectionMessage;     // [message]
 extern const char* kSectionLog;         // [log]
 extern const char* kSectionStat;        // [stat]
 extern const char* kSectionFlowControl; // [flowcontrol]
@@ -89,10 +105,18 @@ extern const char* kAppInstanceId;
 extern const char* kAppUnitId;
 extern const char* kAppProgramId;
 extern const char* kAppCtrlCmdAddr;
+extern const char* kAppTscClock;
 
 
 // [coroutine]
 extern const char* kCoStackSize;
+extern const char* kCoSharedStackNum;
+extern const char* kCoStackPoolSize;
+extern const char* kCoStackMadvFree;
+extern const char* kCoPoolThreadNum;
+
+// [message]
+extern const char* kIoThreadNum;
 
 // [log]
 extern const char* kLogDevice;
@@ -111,8 +135,11 @@ extern const char* kGdataLogPath;
 // [flow_control]
 extern const char* kEnableFlowControl;
 extern const char* kMaxMsgNumPerLoop;
+extern const char* kMaxMsgNumPerConnection;
 extern const char* kTaskThreshold;
 extern const char* kMessageExpireMs;
+extern const char* kCoDelTargetMs;
+extern const char* kCoDelIntervalMs;
 extern const char* kIdleUs;
 
 // [broadcast]
@@ -122,6 +149,10 @@ extern const char* kBcZkTimeoutMs;
 
 // [rpc]
 extern const char* kProcReqTimeoutMs;
+extern const char* kRpcVersion;
+extern const char* kHedgePercentile;
+extern const char* kHedgeMaxRatio;
+extern const char* kConcurrencyLimit;
 
 // default values
 // [app]
@@ -131,10 +162,18 @@ extern const char* kProcReqTimeoutMs;
 
 #define DEFAULT_APP_UNIT_ID     0
 #define DEFAULT_APP_PROGRAM_ID  0
+#define DEFAULT_APP_TSC_CLOCK   false
 
 
 // [coroutine]
 #define DEFAULT_CO_STACK_SIZE   (256 * 1024)
+#define DEFAULT_CO_SHARED_STACK_NUM 0
+#define DEFAULT_CO_STACK_POOL_SIZE  1024
+#define DEFAULT_CO_STACK_MADV_FREE  false
+#define DEFAULT_CO_POOL_THREAD_NUM  4
+
+// [message]
+#define DEFAULT_IO_THREAD_NUM   0
 
 // [log]
 #define DEFAULT_LOG_DEVICE      "FILE"
@@ -153,8 +192,11 @@ extern const char* kProcReqTimeoutMs;
 // [flow_control]
 #define DEFAULT_ENABLE_FLOW_CONTROL true
 #define DEFAULT_MAX_MSG_NUM_PER_LOOP    100
+#define DEFAULT_MAX_MSG_NUM_PER_CONNECTION  10
 #define DEFAULT_TASK_THRESHOLD      (10000)
 #define DEFAULT_MESSAGE_EXPIRE_MS   (10 * 1000)
+#define DEFAULT_CODEL_TARGET_MS     0
+#define DEFAULT_CODEL_INTERVAL_MS   100
 #define DEFAULT_IDLE_US         (1000)
 
 // [broadcast]
@@ -162,6 +204,10 @@ extern const char* kProcReqTimeoutMs;
 
 // [rpc]
 #define DEFAULT_PROC_REQ_TIMEOUT_MS 20000
+#define DEFAULT_RPC_VERSION         0
+#define DEFAULT_HEDGE_PERCENTILE    95
+#define DEFAULT_HEDGE_MAX_RATIO     5
+#define DEFAULT_CONCURRENCY_LIMIT   0
 
 }  // namespace pebble
 #endif   //  _PEBBLE_EXTENSION_OPTIONS_H_
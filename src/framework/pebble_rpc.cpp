@@ -17,6 +17,7 @@
 #include "framework/rpc_util.inh"
 #include "framework/dr/common/dr_define.h"
 #include "framework/dr/protocol/binary_protocol.h"
+#include "framework/dr/protocol/compact_protocol.h"
 #include "framework/dr/protocol/json_protocol.h"
 #include "framework/dr/transport/buffer_transport.h"
 #include "src/framework/exception.h"
@@ -31,6 +32,7 @@ PebbleRpc::PebbleRpc(CodeType code_type, CoroutineSchedule* coroutine_schedule)
     switch (m_code_type) {
         case kCODE_BINARY:
         case kCODE_JSON:
+        case kCODE_COMPACT:
             m_rpc_plugin = new ThriftRpcPlugin(this);
             break;
         case kCODE_PB:
@@ -70,12 +72,14 @@ dr::protocol::TProtocol* PebbleRpc::GetCodec(MemoryPolicy mem_policy) {
         (static_cast<dr::transport::TMemoryBuffer*>(codec->getTransport().get()))->resetBuffer();
         if (kCODE_JSON == m_code_type) {
             (static_cast<dr::protocol::TJSONProtocol*>(codec))->clearContext();
+        } else if (kCODE_COMPACT == m_code_type) {
+            (static_cast<dr::protocol::TCompactProtocol*>(codec))->clearContext();
         }
         return codec;
     }
 
     // 首次创建
-    cxx::shared_ptr<dr::transport::TTransport> trans;
+    cxx::shared_ptr<dr::transport::TMemoryBuffer> trans;
     try {
         if (kBORROW == mem_policy) {
             trans.reset(new dr::transport::TMemoryBuffer(NULL, 0));
@@ -94,7 +98,12 @@ dr::protocol::TProtocol* PebbleRpc::GetCodec(MemoryPolicy mem_policy) {
 
         case kCODE_BINARY:
         case kCODE_PB: // Protobuf rpc head使用dr binary编码
-            codec = new dr::protocol::TBinaryProtocol(trans);
+            // 以TMemoryBuffer实例化，读写buffer时不经过transport的虚函数
+            codec = new BinaryCodec(trans);
+            break;
+
+        case kCODE_COMPACT:
+            codec = new dr::protocol::TCompactProtocol(trans);
             break;
 
         default:
@@ -106,6 +115,13 @@ dr::protocol::TProtocol* PebbleRpc::GetCodec(MemoryPolicy mem_policy) {
     return codec;
 }
 
+PebbleRpc::BinaryCodec* PebbleRpc::GetBinaryCodec(dr::protocol::TProtocol* codec) {
+    if (kCODE_BINARY != m_code_type || NULL == codec) {
+        return NULL;
+    }
+    return static_cast<BinaryCodec*>(codec);
+}
+
 uint8_t* PebbleRpc::GetBuffer(int32_t size) {
     static const int32_t max_buff_size = 1024 * 1024 * 8;
     if (m_buff != NULL && size <= m_buff_size) {
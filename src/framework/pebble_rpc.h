@@ -57,6 +57,7 @@ typedef enum {
     kCODE_BINARY  = 0,  // thrift binary protocol
     kCODE_JSON,         // thrift json protocol
     kCODE_PB,           // protobuff protocol
+    kCODE_COMPACT,      // thrift compact protocol
     kCODE_BUTT
 } CodeType;
 
@@ -68,6 +69,10 @@ class RpcUtil;
 namespace dr {
 namespace protocol {
 class TProtocol;
+template <class Transport_> class TBinaryProtocolT;
+}
+namespace transport {
+class TMemoryBuffer;
 }
 }
 
@@ -98,6 +103,13 @@ public:
     /// @note 内部使用，用户无需关注
     dr::protocol::TProtocol* GetCodec(MemoryPolicy mem_policy);
 
+    /// @brief binary编码时编解码器的具体类型
+    typedef dr::protocol::TBinaryProtocolT<dr::transport::TMemoryBuffer> BinaryCodec;
+
+    /// @brief 编码类型为binary时将GetCodec返回的编解码器转为具体类型，否则返回NULL
+    /// @note 内部使用，生成代码用其调用模板化的read/write，字段编解码不经过虚函数
+    BinaryCodec* GetBinaryCodec(dr::protocol::TProtocol* codec);
+
     /// @brief 获取内存buffer
     /// @note 内部使用，用户无需关注
     uint8_t* GetBuffer(int32_t size);
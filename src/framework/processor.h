@@ -131,15 +131,20 @@ public:
     /// @param msg_info 消息属性
     /// @param is_overload 是否过载(框架根据程序运行情况告知Processor目前是否过载，由Processor自行过载处理)
     ///     涵盖了具体的过载类型，具体可参考 @see OverLoadType
+    ///     过载程度见msg_info->_overload_level，Processor可以按消息优先级分级丢弃，如IRpc的RpcPriority
     /// @return 0 成功
     /// @return 非0 失败
-    // TODO: 每个Processor建议维护一个消息白名单或优先级列表，允许某些消息即使在过载情况下仍然要处理
     virtual int32_t OnMessage(int64_t handle, const uint8_t* msg, uint32_t msg_len, const MsgExternInfo* msg_info, uint32_t is_overload) = 0;
 
     /// @brief 事件驱动
     /// @return 处理的事件数，0表示无事件
     virtual int32_t Update() = 0;
 
+    /// @brief 获取Processor内部最近一个定时事件的剩余时间，主循环空闲时最多阻塞到这个时间
+    /// @return >=0 剩余时间(ms)
+    /// @return <0 没有定时事件
+    virtual int64_t GetNextTimeout() { return -1; }
+
     /// @brief Processor发送消息接口，实际使用SetSendFunction设置的send函数，用户可扩展在send前做些特殊处理
     /// @return 0 成功，<0 失败
     virtual int32_t Send(int64_t handle, const uint8_t* msg, uint32_t msg_len, int32_t flag);
@@ -86,6 +86,20 @@ int64_t Router::GetRoute(uint64_t key)
     return kROUTER_NOT_SUPPORTTED;
 }
 
+int64_t Router::GetHedgeRoute(int64_t handle)
+{
+    uint32_t num = m_route_handles.size();
+    if (num < 2) {
+        return kROUTER_NONE_VALID_HANDLE;
+    }
+    for (uint32_t idx = 0 ; idx < num ; ++idx) {
+        if (m_route_handles[idx] == handle) {
+            return m_route_handles[(idx + 1) % num];
+        }
+    }
+    return m_route_handles[0];
+}
+
 void Router::NameWatch(const std::string& name, const std::vector<std::string>& urls)
 {
     // TODO: 后续优化，目前实现有点粗暴
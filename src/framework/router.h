@@ -111,6 +111,12 @@ public:
     /// @return 非负数 - 成功，其它失败@see RouterErrorCode
     virtual int64_t GetRoute(uint64_t key = 0);
 
+    /// @brief 获取对冲请求的备用路由，返回地址列表中handle之后的下一个地址
+    /// @param handle 首次请求使用的地址
+    /// @return 非负数 - 成功，其它失败@see RouterErrorCode
+    /// @note 可作为生成的Client的SetHedgeRouteFunction参数
+    virtual int64_t GetHedgeRoute(int64_t handle);
+
     /// @brief 设置router监测到地址列表发生变化时的回调函数
     /// @param on_address_changed 当地址列表发生变化时，调用此函数
     virtual void SetOnAddressChanged(const OnAddressChanged& on_address_changed);
@@ -14,23 +14,21 @@
 #include <sstream>
 #include <string.h>
 
+#include "common/arena.h"
 #include "common/log.h"
 #include "common/timer.h"
 #include "common/time_utility.h"
+#include "framework/monitor.h"
 #include "framework/rpc.h"
 
 namespace pebble {
 
 /// @brief RPC会话数据结构定义
+/// @note 会话由IRpc的会话池管理，槽位复用，m_rpc_head和m_rsp的存储随槽位复用
 struct RpcSession {
 private:
-    RpcSession(const RpcSession& rhs) {
-        m_session_id  = rhs.m_session_id;
-        m_handle      = rhs.m_handle;
-        m_timerid     = rhs.m_timerid;
-        m_start_time  = rhs.m_start_time;
-        m_server_side = rhs.m_server_side;
-    }
+    RpcSession(const RpcSession& rhs);
+    RpcSession& operator=(const RpcSession& rhs);
 public:
     RpcSession() {
         m_session_id  = 0;
@@ -38,6 +36,20 @@ public:
         m_timerid     = -1;
         m_start_time  = 0;
         m_server_side = false;
+        m_generation  = 0;
+        m_rpc         = NULL;
+        m_timeout_ms  = 0;
+        m_hedge_handle = -1;
+        m_hedge_key   = 0;
+        m_limited     = false;
+        m_hedge_limited = -1;
+        m_version_probe = false;
+        m_arena       = NULL;
+    }
+
+    // 会话超时回调，定时器通过cxx::ref引用会话本身，启动定时器不产生内存分配
+    int32_t operator()(int64_t timer_id) {
+        return m_rpc->OnTimeout(this);
     }
 
     uint64_t m_session_id;
@@ -47,13 +59,34 @@ public:
     RpcHead  m_rpc_head;
     bool     m_server_side;
     OnRpcResponse m_rsp;
+
+    uint32_t m_generation;      // 槽位版本号，每次分配加1
+    IRpc*    m_rpc;
+
+    int32_t  m_timeout_ms;      // 请求的超时时间
+    int64_t  m_hedge_handle;    // 对冲请求的备用目标，<0表示不需要(或已经)对冲
+    uint32_t m_hedge_key;       // 对冲方法的统计key，0表示不是对冲方法
+    std::string m_hedge_buff;   // 对冲或按方法名重发时使用的请求数据，存储随槽位复用
+    bool     m_limited;         // 请求占用了并发限制的配额
+    int64_t  m_hedge_limited;   // 对冲请求占用了并发配额的备用目标，<0表示没有占用
+    bool     m_version_probe;   // 还不确定对端是否支持kVERSION_1，根据响应确定
+    Arena*   m_arena;           // 处理函数返回时响应还未发送的请求的arena，会话释放时回收
 };
 
 // TODO: timer改为外部传入
 IRpc::IRpc() {
     m_session_id        = 0;
-    m_timer             = new SequenceTimer();
+    m_session_num       = 0;
+    m_timer             = new WheelTimer();
     m_proc_req_timeout_ms = REQ_PROC_TIMEOUT_MS;
+    m_rpc_version       = kVERSION_0;
+    m_hedge_percentile  = 95;
+    m_hedge_max_ratio   = 5;
+    m_hedge_tokens      = 0;
+    m_hedge_num         = 0;
+    m_arena_num         = 0;
+    m_arena             = NULL;
+    m_in_request_proc   = false;
 }
 
 IRpc::~IRpc() {
@@ -61,6 +94,107 @@ IRpc::~IRpc() {
         delete m_timer;
         m_timer = NULL;
     }
+    for (std::vector<RpcSession*>::iterator it = m_session_blocks.begin();
+        it != m_session_blocks.end(); ++it) {
+        for (uint32_t i = 0; i < SESSION_BLOCK_SIZE; i++) {
+            delete (*it)[i].m_arena;
+        }
+        delete [] *it;
+    }
+    m_session_blocks.clear();
+    for (std::vector<Arena*>::iterator it = m_free_arenas.begin(); it != m_free_arenas.end(); ++it) {
+        delete *it;
+    }
+    m_free_arenas.clear();
+}
+
+RpcSession* IRpc::AllocSession() {
+    if (m_free_sessions.empty()) {
+        // 按块分配会话，减少内存分配次数
+        RpcSession* block = new RpcSession[SESSION_BLOCK_SIZE];
+        uint32_t base = m_session_blocks.size() * SESSION_BLOCK_SIZE;
+        m_session_blocks.push_back(block);
+        m_free_sessions.reserve(m_session_blocks.size() * SESSION_BLOCK_SIZE);
+        for (uint32_t i = 0; i < SESSION_BLOCK_SIZE; i++) {
+            block[i].m_rpc        = this;
+            block[i].m_session_id = base + i;
+            m_free_sessions.push_back(base + SESSION_BLOCK_SIZE - 1 - i);
+        }
+    }
+
+    uint32_t index = m_free_sessions.back();
+    m_free_sessions.pop_back();
+
+    RpcSession* session = &m_session_blocks[index >> SESSION_BLOCK_BITS][index & (SESSION_BLOCK_SIZE - 1)];
+    if (0 == ++session->m_generation) {
+        session->m_generation = 1;
+    }
+    session->m_session_id = (static_cast<uint64_t>(session->m_generation) << 32) | index;
+    m_session_num++;
+    return session;
+}
+
+void IRpc::FreeSession(RpcSession* session) {
+    uint32_t index = static_cast<uint32_t>(session->m_session_id & 0xFFFFFFFF);
+    // 只保留下标，旧的会话ID不再能查到
+    session->m_session_id = index;
+    session->m_timerid    = -1;
+    session->m_rpc_head.m_dst = NULL;
+    session->m_rsp        = OnRpcResponse();
+    session->m_hedge_handle = -1;
+    session->m_hedge_key  = 0;
+    session->m_limited    = false;
+    session->m_hedge_limited = -1;
+    session->m_version_probe = false;
+    if (session->m_arena != NULL) {
+        FreeArena(session->m_arena);
+        session->m_arena  = NULL;
+    }
+    m_free_sessions.push_back(index);
+    m_session_num--;
+}
+
+RpcSession* IRpc::FindSession(uint64_t session_id) {
+    uint32_t index = static_cast<uint32_t>(session_id & 0xFFFFFFFF);
+    if ((session_id >> 32) == 0 || (index >> SESSION_BLOCK_BITS) >= m_session_blocks.size()) {
+        return NULL;
+    }
+    RpcSession* session = &m_session_blocks[index >> SESSION_BLOCK_BITS][index & (SESSION_BLOCK_SIZE - 1)];
+    return session->m_session_id == session_id ? session : NULL;
+}
+
+Arena* IRpc::AllocArena() {
+    Arena* arena = NULL;
+    if (m_free_arenas.empty()) {
+        arena = new Arena();
+    } else {
+        arena = m_free_arenas.back();
+        m_free_arenas.pop_back();
+    }
+    m_arena_num++;
+    return arena;
+}
+
+void IRpc::FreeArena(Arena* arena) {
+    arena->Reset();
+    m_free_arenas.push_back(arena);
+    m_arena_num--;
+}
+
+int32_t IRpc::CallRequestProc(const OnRpcRequest& on_request, const uint8_t* buff, uint32_t buff_len,
+    cxx::function<int32_t(int32_t, const uint8_t*, uint32_t)>& rsp, Arena** arena) { // NOLINT
+    // 处理函数中同步等待时可能嵌套处理其他请求，返回时恢复外层请求的状态
+    Arena* outer_arena = m_arena;
+    bool outer_in_request_proc = m_in_request_proc;
+    m_arena = NULL;
+    m_in_request_proc = true;
+
+    int32_t ret = on_request(buff, buff_len, rsp);
+
+    *arena = m_arena;
+    m_arena = outer_arena;
+    m_in_request_proc = outer_in_request_proc;
+    return ret;
 }
 
 int32_t IRpc::Update() {
@@ -68,10 +202,18 @@ int32_t IRpc::Update() {
     if (m_timer) {
         num += m_timer->Update();
     }
+    m_limiter.Update();
 
     return num;
 }
 
+int64_t IRpc::GetNextTimeout() {
+    if (m_timer) {
+        return m_timer->GetNextTimeout();
+    }
+    return -1;
+}
+
 int32_t IRpc::OnMessage(int64_t handle, const uint8_t* msg,
     uint32_t msg_len, const MsgExternInfo* msg_info, uint32_t is_overload) {
 
@@ -85,6 +227,10 @@ int32_t IRpc::OnMessage(int64_t handle, const uint8_t* msg,
     int32_t head_len = HeadDecode(msg, msg_len, &head);
     if (head_len < 0) {
         PLOG_ERROR_N_EVERY_SECOND(1, "HeadDecode failed(%d).", head_len);
+        // 还在探测的对端可能不支持kVERSION_1的消息头，之后发往它的请求改用方法名
+        if (m_rpc_version >= kVERSION_1 && m_peer_versions.find(handle) == m_peer_versions.end()) {
+            SetPeerVersion(handle, kVERSION_0);
+        }
         return kRPC_DECODE_FAILED;
     }
 
@@ -103,10 +249,18 @@ int32_t IRpc::OnMessage(int64_t handle, const uint8_t* msg,
     int32_t ret = kRPC_UNKNOWN_TYPE;
     switch (head.m_message_type) {
         case kRPC_CALL:
-            if (is_overload != 0) {
-                ret = ResponseException(handle, kRPC_SYSTEM_OVERLOAD_BASE - is_overload, head);
-                RequestProcComplete(head.m_function_name, kRPC_SYSTEM_OVERLOAD_BASE - is_overload,
-                    head.m_arrived_ms > 0 ? TimeUtility::GetCurrentMS() - head.m_arrived_ms : 0);
+            // 调用方已经超时放弃的请求直接丢弃，不解码请求，也不回响应
+            if (IsExpired(head)) {
+                ret = kRPC_MESSAGE_EXPIRED;
+                RequestProcComplete(GetFunctionName(head), kRPC_MESSAGE_EXPIRED,
+                    TimeUtility::GetLoopMS() - head.m_arrived_ms);
+                break;
+            }
+            ret = CheckOverload(head, msg_info, is_overload);
+            if (ret != kRPC_SUCCESS) {
+                RequestProcComplete(GetFunctionName(head), ret,
+                    head.m_arrived_ms > 0 ? TimeUtility::GetLoopMS() - head.m_arrived_ms : 0);
+                ret = ResponseException(handle, ret, head);
                 break;
             }
         case kRPC_ONEWAY:
@@ -115,7 +269,7 @@ int32_t IRpc::OnMessage(int64_t handle, const uint8_t* msg,
 
         case kRPC_REPLY:
         case kRPC_EXCEPTION:
-            ret = ProcessResponse(head, data, data_len);
+            ret = ProcessResponse(handle, head, data, data_len);
             break;
 
         default:
@@ -127,16 +281,38 @@ int32_t IRpc::OnMessage(int64_t handle, const uint8_t* msg,
 }
 
 int32_t IRpc::AddOnRequestFunction(const std::string& name, const OnRpcRequest& on_request) {
+    return AddOnRequestFunction(name, 0, on_request);
+}
+
+int32_t IRpc::AddOnRequestFunction(const std::string& name, uint32_t method_id,
+    const OnRpcRequest& on_request) {
     if (name.empty() || !on_request) {
         PLOG_ERROR("param invalid: name = %s, !on_request = %u", name.c_str(), !on_request);
         return kRPC_INVALID_PARAM;
     }
 
-    if (false == m_service_map.insert({name, on_request}).second) {
+    // 方法ID由名字hash得到，不同名字ID冲突时不能按ID区分，需要修改方法名
+    if (method_id != 0) {
+        for (RpcMethodMap::iterator it = m_service_map.begin(); it != m_service_map.end(); ++it) {
+            if (it->second._method_id == method_id && it->first != name) {
+                PLOG_ERROR("the method id %u of %s conflicts with %s", method_id, name.c_str(), it->first.c_str());
+                return kRPC_FUNCTION_NAME_EXISTED;
+            }
+        }
+    }
+
+    RpcMethod method;
+    method._method_id  = method_id;
+    method._on_request = on_request;
+    if (false == m_service_map.insert({name, method}).second) {
         PLOG_ERROR("the %s is existed", name.c_str());
         return kRPC_FUNCTION_NAME_EXISTED;
     }
 
+    if (method_id != 0) {
+        RebuildMethodIndex();
+    }
+
     if (m_event_handler) {
         m_event_handler->AddNameToStat(name);
     }
@@ -148,7 +324,95 @@ int32_t IRpc::RemoveOnRequestFunction(const std::string& name) {
     if (m_event_handler) {
         m_event_handler->RemoveNameFromStat(name);
     }
-    return m_service_map.erase(name) == 1 ? kRPC_SUCCESS : kRPC_FUNCTION_NAME_UNEXISTED;
+    if (m_service_map.erase(name) != 1) {
+        return kRPC_FUNCTION_NAME_UNEXISTED;
+    }
+    RebuildMethodIndex();
+    return kRPC_SUCCESS;
+}
+
+int32_t IRpc::SetMethodPriority(const std::string& name, uint32_t priority) {
+    if (priority > kRPC_PRIORITY_LOW) {
+        PLOG_ERROR("param invalid: name = %s, priority = %u", name.c_str(), priority);
+        return kRPC_INVALID_PARAM;
+    }
+
+    RpcMethodMap::iterator it = m_service_map.find(name);
+    if (m_service_map.end() == it) {
+        return kRPC_FUNCTION_NAME_UNEXISTED;
+    }
+    it->second._priority = priority;
+    return kRPC_SUCCESS;
+}
+
+uint32_t IRpc::GenMethodId(const std::string& name) {
+    uint32_t hash = 2166136261u;
+    for (std::string::const_iterator it = name.begin(); it != name.end(); ++it) {
+        hash ^= static_cast<uint8_t>(*it);
+        hash *= 16777619u;
+    }
+    return hash != 0 ? hash : 1;
+}
+
+void IRpc::RebuildMethodIndex() {
+    uint32_t num = 0;
+    for (RpcMethodMap::iterator it = m_service_map.begin(); it != m_service_map.end(); ++it) {
+        if (it->second._method_id != 0) {
+            num++;
+        }
+    }
+
+    m_method_index.clear();
+    if (0 == num) {
+        return;
+    }
+
+    uint32_t size = 16;
+    while (size < num * 2) {
+        size <<= 1;
+    }
+    m_method_index.resize(size, NULL);
+
+    uint32_t mask = size - 1;
+    for (RpcMethodMap::iterator it = m_service_map.begin(); it != m_service_map.end(); ++it) {
+        if (0 == it->second._method_id) {
+            continue;
+        }
+        uint32_t pos = it->second._method_id & mask;
+        while (m_method_index[pos] != NULL) {
+            pos = (pos + 1) & mask;
+        }
+        // unordered_map重建hash表时元素地址不变，可以直接保存元素指针
+        m_method_index[pos] = &(*it);
+    }
+}
+
+IRpc::RpcMethodMap::value_type* IRpc::FindMethod(const RpcHead& rpc_head) {
+    if (rpc_head.m_version >= kVERSION_1 && rpc_head.m_method_id != 0) {
+        if (m_method_index.empty()) {
+            return NULL;
+        }
+        uint32_t mask = m_method_index.size() - 1;
+        uint32_t pos = rpc_head.m_method_id & mask;
+        while (m_method_index[pos] != NULL) {
+            if (m_method_index[pos]->second._method_id == rpc_head.m_method_id) {
+                return m_method_index[pos];
+            }
+            pos = (pos + 1) & mask;
+        }
+        return NULL;
+    }
+
+    RpcMethodMap::iterator it = m_service_map.find(rpc_head.m_function_name);
+    return it != m_service_map.end() ? &(*it) : NULL;
+}
+
+const std::string& IRpc::GetFunctionName(const RpcHead& rpc_head) {
+    if (!rpc_head.m_function_name.empty() || 0 == rpc_head.m_method_id) {
+        return rpc_head.m_function_name;
+    }
+    RpcMethodMap::value_type* method = FindMethod(rpc_head);
+    return method != NULL ? method->first : rpc_head.m_function_name;
 }
 
 void IRpc::GetResourceUsed(cxx::unordered_map<std::string, int64_t>* resource_info) {
@@ -161,12 +425,28 @@ void IRpc::GetResourceUsed(cxx::unordered_map<std::string, int64_t>* resource_in
 
     std::ostringstream session;
     session << "Rpc(" << this << "):session";
-    (*resource_info)[session.str()] = m_session_map.size();
+    (*resource_info)[session.str()] = m_session_num;
+
+    std::ostringstream hedge;
+    hedge << "Rpc(" << this << "):hedge";
+    (*resource_info)[hedge.str()]   = m_hedge_num;
+
+    std::ostringstream arena;
+    arena << "Rpc(" << this << "):arena";
+    (*resource_info)[arena.str()]   = m_arena_num;
+
+    std::ostringstream limit_route;
+    limit_route << "Rpc(" << this << "):limit_route";
+    (*resource_info)[limit_route.str()] = m_limiter.GetRouteNum();
+
+    std::ostringstream limit_rejected;
+    limit_rejected << "Rpc(" << this << "):limit_rejected";
+    (*resource_info)[limit_rejected.str()] = m_limiter.GetRejectedNum();
     return;
 }
 
 int32_t IRpc::SendRequest(int64_t handle,
-                    const RpcHead& rpc_head,
+                    const RpcHead& req_head,
                     const uint8_t* buff,
                     uint32_t buff_len,
                     const OnRpcResponse& on_rsp,
@@ -177,41 +457,79 @@ int32_t IRpc::SendRequest(int64_t handle,
         return kRPC_INVALID_PARAM;
     }
 
+    // 调用者的消息头保持不变，版本、超时和会话ID填写在副本中
+    RpcHead rpc_head(req_head);
+
+    // 请求的消息头版本由本端配置和对端支持的版本决定，没有方法ID时只能使用方法名
+    if (rpc_head.m_method_id != 0) {
+        rpc_head.m_version = GetPeerVersion(handle);
+    }
+
+    // ONEWAY请求
+    if (!on_rsp) {
+        int32_t ret = SendMessage(handle, rpc_head, buff, buff_len);
+        ResponseProcComplete(rpc_head.m_function_name,
+            ret != kRPC_SUCCESS ? kRPC_SEND_FAILED : kRPC_SUCCESS, 0);
+        return ret;
+    }
+
+    if (timeout_ms <= 0) {
+        timeout_ms = 10 * 1000;
+    }
+    rpc_head.m_timeout_ms = timeout_ms;
+
+    // 到目标的并发请求数超出限制时快速失败，不再堆积会话
+    bool limited = m_limiter.GetMaxLimit() > 0;
+    if (limited && !m_limiter.Acquire(handle)) {
+        ResponseProcComplete(rpc_head.m_function_name, kRPC_CONCURRENCY_LIMITED, 0);
+        return kRPC_CONCURRENCY_LIMITED;
+    }
+
+    // 需要等待响应的请求先分配会话，使用会话ID作为请求的session id，响应按下标直接定位会话
+    RpcSession* session = AllocSession();
+    rpc_head.m_session_id = session->m_session_id;
+
     // 发送请求
     int32_t ret = SendMessage(handle, rpc_head, buff, buff_len);
     if (ret != kRPC_SUCCESS) {
+        if (limited) {
+            m_limiter.Release(handle, true, 0);
+        }
+        FreeSession(session);
         ResponseProcComplete(rpc_head.m_function_name, kRPC_SEND_FAILED, 0);
         return ret;
     }
 
-    // ONEWAY请求
-    if (!on_rsp) {
-        ResponseProcComplete(rpc_head.m_function_name, kRPC_SUCCESS, 0);
-        return kRPC_SUCCESS;
-    }
-
     // 保持会话
-    cxx::shared_ptr<RpcSession> session(new RpcSession());
-    session->m_session_id  = rpc_head.m_session_id;
     session->m_handle      = handle;
     session->m_rsp         = on_rsp;
     session->m_rpc_head    = rpc_head;
     session->m_server_side = false;
-    TimeoutCallback cb     = cxx::bind(&IRpc::OnTimeout, this, session->m_session_id);
-
-    if (timeout_ms <= 0) {
-        timeout_ms = 10 * 1000;
+    session->m_limited     = limited;
+    session->m_timeout_ms  = timeout_ms;
+    session->m_start_time  = TimeUtility::GetLoopMS();
+
+    // 还不确定对端是否支持kVERSION_1时保留请求数据，对端不支持时按方法名重发
+    session->m_version_probe = rpc_head.m_version >= kVERSION_1
+        && m_peer_versions.find(handle) == m_peer_versions.end();
+
+    // 对冲请求先按对冲延迟启动定时器，对冲后按剩余的超时时间继续
+    int64_t hedge_delay_ms = GetHedgeDelay(session, timeout_ms);
+    if (hedge_delay_ms > 0 || session->m_version_probe) {
+        session->m_hedge_buff.assign(reinterpret_cast<const char*>(buff), buff_len);
+    }
+    if (hedge_delay_ms > 0) {
+        session->m_hedge_handle = rpc_head.m_hedge_handle;
+        session->m_timerid  = m_timer->StartTimer(hedge_delay_ms, cxx::ref(*session));
+    } else {
+        session->m_timerid  = m_timer->StartTimer(timeout_ms, cxx::ref(*session));
     }
-    session->m_timerid     = m_timer->StartTimer(timeout_ms, cb);
-    session->m_start_time  = TimeUtility::GetCurrentMS();
-
-    m_session_map[session->m_session_id] = session;
 
     return kRPC_SUCCESS;
 }
 
 int32_t IRpc::BroadcastRequest(const std::string& name,
-                    const RpcHead& rpc_head,
+                    const RpcHead& req_head,
                     const uint8_t* buff,
                     uint32_t buff_len) {
     // buff允许为空，长度非0时做非空检查
@@ -220,6 +538,11 @@ int32_t IRpc::BroadcastRequest(const std::string& name,
         return kRPC_INVALID_PARAM;
     }
 
+    RpcHead rpc_head(req_head);
+    if (rpc_head.m_method_id != 0) {
+        rpc_head.m_version = m_rpc_version;
+    }
+
     // 发送请求
     int32_t head_len = HeadEncode(rpc_head, m_rpc_head_buff, sizeof(m_rpc_head_buff));
     if (head_len < 0) {
@@ -238,31 +561,30 @@ int32_t IRpc::BroadcastRequest(const std::string& name,
 int32_t IRpc::SendResponse(uint64_t session_id, int32_t ret,
     const uint8_t* buff, uint32_t buff_len) {
 
-    cxx::unordered_map< uint64_t, cxx::shared_ptr<RpcSession> >::iterator it =
-        m_session_map.find(session_id);
-    if (m_session_map.end() == it) {
+    RpcSession* session = FindSession(session_id);
+    if (NULL == session) {
         PLOG_ERROR("session %lu not found", session_id);
         return kRPC_SESSION_NOT_FOUND;
     }
 
-    m_timer->StopTimer(it->second->m_timerid);
+    m_timer->StopTimer(session->m_timerid);
 
     int32_t result = kRPC_SUCCESS;
     int32_t error_code = kRPC_SUCCESS;
     if (kRPC_SUCCESS == ret) {
         // 业务处理成功，构造响应消息返回
-        it->second->m_rpc_head.m_message_type = kRPC_REPLY;
-        result = SendMessage(it->second->m_handle, it->second->m_rpc_head, buff, buff_len);
+        session->m_rpc_head.m_message_type = kRPC_REPLY;
+        result = SendMessage(session->m_handle, session->m_rpc_head, buff, buff_len);
         error_code = result;
     } else {
         // 业务处理失败，构造异常消息携带错误信息返回
-        result = ResponseException(it->second->m_handle, ret, it->second->m_rpc_head, buff, buff_len);
+        result = ResponseException(session->m_handle, ret, session->m_rpc_head, buff, buff_len);
         error_code = ret;
     }
-    RequestProcComplete(it->second->m_rpc_head.m_function_name,
-        error_code, TimeUtility::GetCurrentMS() - it->second->m_start_time);
+    RequestProcComplete(GetFunctionName(session->m_rpc_head),
+        error_code, TimeUtility::GetLoopMS() - session->m_start_time);
 
-    m_session_map.erase(it);
+    FreeSession(session);
 
     return result;
 }
@@ -293,15 +615,19 @@ int32_t IRpc::SendMessage(int64_t handle, const RpcHead& rpc_head,
     return send_ret;
 }
 
-int32_t IRpc::OnTimeout(uint64_t session_id) {
-    cxx::unordered_map< uint64_t, cxx::shared_ptr<RpcSession> >::iterator it =
-        m_session_map.find(session_id);
-    if (m_session_map.end() == it) {
-        PLOG_ERROR("session %lu not found", session_id);
-        return kTIMER_BE_REMOVED;
+int32_t IRpc::OnTimeout(RpcSession* session) {
+    // 定时器随会话释放而停止，这里的会话一定有效
+    if (session->m_hedge_handle >= 0) {
+        int64_t remain_ms = session->m_timeout_ms - (TimeUtility::GetLoopMS() - session->m_start_time);
+        if (remain_ms > 0) {
+            SendHedgeRequest(session, remain_ms);
+            // 定时器按剩余的超时时间重启
+            return remain_ms;
+        }
     }
 
-    cxx::shared_ptr<RpcSession> session = it->second;
+    // 回调返回后定时器由时间轮释放
+    session->m_timerid = -1;
 
     // request timeout
     if (session->m_rsp) {
@@ -309,19 +635,221 @@ int32_t IRpc::OnTimeout(uint64_t session_id) {
         ReportTransportQuality(session->m_handle, kRPC_REQUEST_TIMEOUT, 0);
     }
 
+    if (session->m_limited) {
+        m_limiter.Release(session->m_handle, true, TimeUtility::GetLoopMS() - session->m_start_time);
+    }
+    if (session->m_hedge_limited >= 0) {
+        m_limiter.Release(session->m_hedge_limited, true, TimeUtility::GetLoopMS() - session->m_start_time);
+    }
+
     if (session->m_server_side) {
-        RequestProcComplete(session->m_rpc_head.m_function_name,
-            kRPC_PROCESS_TIMEOUT, TimeUtility::GetCurrentMS() - session->m_start_time);
+        RequestProcComplete(GetFunctionName(session->m_rpc_head),
+            kRPC_PROCESS_TIMEOUT, TimeUtility::GetLoopMS() - session->m_start_time);
     } else {
         ResponseProcComplete(session->m_rpc_head.m_function_name,
-            kRPC_REQUEST_TIMEOUT, TimeUtility::GetCurrentMS() - session->m_start_time);
+            kRPC_REQUEST_TIMEOUT, TimeUtility::GetLoopMS() - session->m_start_time);
     }
 
-    m_session_map.erase(session_id);
+    FreeSession(session);
 
     return kTIMER_BE_REMOVED;
 }
 
+bool IRpc::IsExpired(const RpcHead& rpc_head) {
+    if (rpc_head.m_timeout_ms <= 0 || rpc_head.m_arrived_ms <= 0) {
+        return false;
+    }
+    return TimeUtility::GetLoopMS() - rpc_head.m_arrived_ms >= rpc_head.m_timeout_ms;
+}
+
+int32_t IRpc::CheckOverload(const RpcHead& rpc_head, const MsgExternInfo* msg_info,
+    uint32_t is_overload) {
+    // 没有提供过载等级时，过载按kOVERLOAD_LEVEL_HEAVY处理
+    uint32_t level = msg_info ? msg_info->_overload_level : kOVERLOAD_LEVEL_NONE;
+    if (is_overload != 0 && level < kOVERLOAD_LEVEL_HEAVY) {
+        level = kOVERLOAD_LEVEL_HEAVY;
+    }
+    if (kOVERLOAD_LEVEL_NONE == level) {
+        return kRPC_SUCCESS;
+    }
+
+    RpcMethodMap::value_type* method = FindMethod(rpc_head);
+    uint32_t priority = method ? method->second._priority : static_cast<uint32_t>(kRPC_PRIORITY_NORMAL);
+    if (priority + level <= kRPC_PRIORITY_LOW) {
+        return kRPC_SUCCESS;
+    }
+
+    return is_overload != 0 ? kRPC_SYSTEM_OVERLOAD_BASE - is_overload : kRPC_PRIORITY_SHED;
+}
+
+// 响应时间分桶: [0, 8)每桶1ms，之后每个[2^n, 2^(n+1))区间等分为4个桶
+static uint32_t HedgeBucket(int64_t latency_ms, uint32_t bucket_num) {
+    if (latency_ms < 8) {
+        return latency_ms > 0 ? static_cast<uint32_t>(latency_ms) : 0;
+    }
+    uint32_t msb = 63 - __builtin_clzll(static_cast<uint64_t>(latency_ms));
+    uint32_t sub = static_cast<uint32_t>(latency_ms >> (msb - 2)) & 3;
+    uint32_t bucket = 8 + (msb - 3) * 4 + sub;
+    return bucket < bucket_num ? bucket : bucket_num - 1;
+}
+
+// 桶的上界(不含)
+static int64_t HedgeBucketBound(uint32_t bucket) {
+    if (bucket < 8) {
+        return bucket + 1;
+    }
+    uint32_t msb = (bucket - 8) / 4 + 3;
+    uint32_t sub = (bucket - 8) % 4;
+    return static_cast<int64_t>(4 + sub + 1) << (msb - 2);
+}
+
+void IRpc::SetHedgeOptions(uint32_t percentile, uint32_t max_ratio) {
+    if (percentile < 1) {
+        percentile = 1;
+    } else if (percentile > 99) {
+        percentile = 99;
+    }
+    m_hedge_percentile = percentile;
+    m_hedge_max_ratio  = max_ratio;
+}
+
+int64_t IRpc::GetHedgeDelay(RpcSession* session, int32_t timeout_ms) {
+    const RpcHead& rpc_head = session->m_rpc_head;
+    if (0 == m_hedge_max_ratio || rpc_head.m_hedge_handle < 0
+        || rpc_head.m_hedge_handle == session->m_handle) {
+        return 0;
+    }
+
+    session->m_hedge_key = rpc_head.m_method_id != 0 ?
+        rpc_head.m_method_id : GenMethodId(rpc_head.m_function_name);
+
+    // 每个对冲方法的请求积累max_ratio/100个对冲配额
+    m_hedge_tokens += m_hedge_max_ratio;
+    if (m_hedge_tokens > 100 * HEDGE_MAX_BURST) {
+        m_hedge_tokens = 100 * HEDGE_MAX_BURST;
+    }
+
+    cxx::unordered_map<uint32_t, HedgeStat>::iterator it = m_hedge_stats.find(session->m_hedge_key);
+    if (m_hedge_stats.end() == it || it->second._total < HEDGE_MIN_SAMPLES) {
+        return 0;
+    }
+
+    const HedgeStat& stat = it->second;
+    uint32_t target = (stat._total * m_hedge_percentile + 99) / 100;
+    uint32_t count  = 0;
+    for (uint32_t i = 0; i < HEDGE_BUCKET_NUM; i++) {
+        count += stat._buckets[i];
+        if (count >= target) {
+            int64_t delay_ms = HedgeBucketBound(i);
+            // 对冲后已经没有剩余时间的请求不对冲
+            return delay_ms < timeout_ms ? delay_ms : 0;
+        }
+    }
+    return 0;
+}
+
+void IRpc::SendHedgeRequest(RpcSession* session, int64_t remain_ms) {
+    int64_t handle = session->m_hedge_handle;
+    session->m_hedge_handle = -1;
+
+    if (m_hedge_tokens < 100) {
+        return;
+    }
+
+    // 对冲请求同样计入备用目标的并发数，备用目标已达到限制时不对冲
+    bool limited = m_limiter.GetMaxLimit() > 0;
+    if (limited && !m_limiter.Acquire(handle)) {
+        return;
+    }
+    m_hedge_tokens -= 100;
+
+    // 消息头版本按备用目标确定，还不确定备用目标是否支持kVERSION_1时按方法名发送
+    RpcHead hedge_head(session->m_rpc_head);
+    if (hedge_head.m_method_id != 0) {
+        hedge_head.m_version = m_peer_versions.find(handle) != m_peer_versions.end() ?
+            GetPeerVersion(handle) : static_cast<int32_t>(kVERSION_0);
+    }
+    hedge_head.m_timeout_ms = static_cast<int32_t>(remain_ms);
+
+    // 同一会话ID，先到的响应释放会话，后到的响应找不到会话被丢弃
+    int32_t ret = SendMessage(handle, hedge_head,
+        reinterpret_cast<const uint8_t*>(session->m_hedge_buff.data()), session->m_hedge_buff.size());
+    if (ret != kRPC_SUCCESS) {
+        if (limited) {
+            m_limiter.Release(handle, true, 0);
+        }
+        return;
+    }
+    if (limited) {
+        session->m_hedge_limited = handle;
+    }
+    m_hedge_num++;
+}
+
+int32_t IRpc::GetPeerVersion(int64_t handle) {
+    if (m_rpc_version < kVERSION_1) {
+        return m_rpc_version;
+    }
+    cxx::unordered_map<int64_t, int32_t>::iterator it = m_peer_versions.find(handle);
+    return it != m_peer_versions.end() ? it->second : m_rpc_version;
+}
+
+void IRpc::SetPeerVersion(int64_t handle, int32_t version) {
+    if (m_peer_versions.size() >= MAX_PEER_VERSION_NUM) {
+        m_peer_versions.clear();
+    }
+    m_peer_versions[handle] = version;
+}
+
+bool IRpc::OnVersionProbe(int64_t handle, RpcSession* session, int32_t ret) {
+    session->m_version_probe = false;
+
+    RpcHead& rpc_head = session->m_rpc_head;
+    if (ret != kRPC_UNSUPPORT_FUNCTION_NAME) {
+        // kVERSION_1请求正常处理说明对端支持，按方法名重发后正常处理说明对端只支持方法名
+        SetPeerVersion(handle, rpc_head.m_version);
+        return false;
+    }
+
+    // 按方法名重发后仍然不支持，是对端确实没有这个方法，对端的版本仍不确定
+    if (rpc_head.m_version < kVERSION_1) {
+        return false;
+    }
+
+    int64_t remain_ms = session->m_timeout_ms - (TimeUtility::GetLoopMS() - session->m_start_time);
+    if (remain_ms <= 0) {
+        return false;
+    }
+
+    rpc_head.m_version    = kVERSION_0;
+    rpc_head.m_timeout_ms = static_cast<int32_t>(remain_ms);
+    int32_t result = SendMessage(handle, rpc_head,
+        reinterpret_cast<const uint8_t*>(session->m_hedge_buff.data()), session->m_hedge_buff.size());
+    if (result != kRPC_SUCCESS) {
+        return false;
+    }
+
+    // 同一会话等待重发请求的响应，定时器按剩余的超时时间重启
+    session->m_version_probe = true;
+    session->m_timerid = m_timer->StartTimer(remain_ms, cxx::ref(*session));
+    return true;
+}
+
+void IRpc::AddHedgeLatency(uint32_t method_key, int64_t latency_ms) {
+    HedgeStat& stat = m_hedge_stats[method_key];
+    stat._buckets[HedgeBucket(latency_ms, HEDGE_BUCKET_NUM)]++;
+    if (++stat._total < HEDGE_WINDOW) {
+        return;
+    }
+
+    // 窗口满时衰减一半
+    stat._total = 0;
+    for (uint32_t i = 0; i < HEDGE_BUCKET_NUM; i++) {
+        stat._buckets[i] >>= 1;
+        stat._total += stat._buckets[i];
+    }
+}
+
 int32_t IRpc::ProcessRequest(int64_t handle, const RpcHead& rpc_head,
     const uint8_t* buff, uint32_t buff_len) {
     return ProcessRequestImp(handle, rpc_head, buff, buff_len);
@@ -330,57 +858,79 @@ int32_t IRpc::ProcessRequest(int64_t handle, const RpcHead& rpc_head,
 int32_t IRpc::ProcessRequestImp(int64_t handle, const RpcHead& rpc_head,
     const uint8_t* buff, uint32_t buff_len) {
 
-    cxx::unordered_map<std::string, OnRpcRequest>::iterator it =
-        m_service_map.find(rpc_head.m_function_name);
-    if (m_service_map.end() == it) {
-        PLOG_ERROR_N_EVERY_SECOND(1, "%s's request proc func not found", rpc_head.m_function_name.c_str());
+    RpcMethodMap::value_type* method = FindMethod(rpc_head);
+    if (NULL == method) {
+        PLOG_ERROR_N_EVERY_SECOND(1, "%s(%u)'s request proc func not found",
+            rpc_head.m_function_name.c_str(), rpc_head.m_method_id);
         ResponseException(handle, kRPC_UNSUPPORT_FUNCTION_NAME, rpc_head);
         RequestProcComplete(rpc_head.m_function_name, kRPC_UNSUPPORT_FUNCTION_NAME,
-            rpc_head.m_arrived_ms > 0 ? TimeUtility::GetCurrentMS() - rpc_head.m_arrived_ms : 0);
+            rpc_head.m_arrived_ms > 0 ? TimeUtility::GetLoopMS() - rpc_head.m_arrived_ms : 0);
         return kRPC_UNSUPPORT_FUNCTION_NAME;
     }
 
     if (kRPC_ONEWAY == rpc_head.m_message_type) {
         cxx::function<int32_t(int32_t, const uint8_t*, uint32_t)> rsp; // NOLINT
-        int32_t ret = (it->second)(buff, buff_len, rsp);
-        RequestProcComplete(rpc_head.m_function_name, ret,
-            rpc_head.m_arrived_ms > 0 ? TimeUtility::GetCurrentMS() - rpc_head.m_arrived_ms : 0);
+        Arena* arena = NULL;
+        int32_t ret = CallRequestProc(method->second._on_request, buff, buff_len, rsp, &arena);
+        if (arena != NULL) {
+            FreeArena(arena);
+        }
+        RequestProcComplete(method->first, ret,
+            rpc_head.m_arrived_ms > 0 ? TimeUtility::GetLoopMS() - rpc_head.m_arrived_ms : 0);
         return ret;
     }
 
     // 请求处理也保持会话，方便扩展
-    cxx::shared_ptr<RpcSession> session(new RpcSession());
-    session->m_session_id  = GenSessionId();
+    RpcSession* session    = AllocSession();
     session->m_handle      = handle;
     session->m_rpc_head    = rpc_head;
     session->m_server_side = true;
 
-    TimeoutCallback cb     = cxx::bind(&IRpc::OnTimeout, this, session->m_session_id);
-    session->m_timerid     = m_timer->StartTimer(m_proc_req_timeout_ms, cb);
-    session->m_start_time  = rpc_head.m_arrived_ms > 0 ? rpc_head.m_arrived_ms : TimeUtility::GetCurrentMS();
+    session->m_start_time  = rpc_head.m_arrived_ms > 0 ? rpc_head.m_arrived_ms : TimeUtility::GetLoopMS();
 
-    m_session_map[session->m_session_id] = session;
+    // 调用方带了剩余时间时，处理超时不超过剩余时间，超时后调用方已经放弃，不再回响应
+    int64_t proc_timeout_ms = m_proc_req_timeout_ms;
+    if (rpc_head.m_timeout_ms > 0) {
+        int64_t remain_ms = rpc_head.m_timeout_ms - (TimeUtility::GetLoopMS() - session->m_start_time);
+        if (remain_ms < proc_timeout_ms) {
+            proc_timeout_ms = remain_ms > 0 ? remain_ms : 1;
+        }
+    }
+    session->m_timerid     = m_timer->StartTimer(proc_timeout_ms, cxx::ref(*session));
 
+    // 业务可能保存rsp异步回复，rsp中按值携带会话ID，会话超时复用后旧的rsp不会串到新会话
     cxx::function<int32_t(int32_t, const uint8_t*, uint32_t)> rsp = cxx::bind( // NOLINT
         &IRpc::SendResponse, this, session->m_session_id,
         cxx::placeholders::_1, cxx::placeholders::_2, cxx::placeholders::_3);
 
-    return (it->second)(buff, buff_len, rsp);
+    // 处理函数切出协程后其他请求会改写m_arena，处理函数需要在调用开始时取出
+    uint64_t session_id = session->m_session_id;
+    Arena* arena = NULL;
+    int32_t ret = CallRequestProc(method->second._on_request, buff, buff_len, rsp, &arena);
+    if (NULL == arena) {
+        return ret;
+    }
+
+    // 响应已发送(或会话已超时)时立即回收，否则交给会话，在发送响应释放会话时回收
+    RpcSession* pending = FindSession(session_id);
+    if (pending != NULL) {
+        pending->m_arena = arena;
+    } else {
+        FreeArena(arena);
+    }
+    return ret;
 }
 
-int32_t IRpc::ProcessResponse(const RpcHead& rpc_head,
+int32_t IRpc::ProcessResponse(int64_t handle, const RpcHead& rpc_head,
     const uint8_t* buff, uint32_t buff_len) {
 
-    cxx::unordered_map< uint64_t, cxx::shared_ptr<RpcSession> >::iterator it =
-        m_session_map.find(rpc_head.m_session_id);
-    if (m_session_map.end() == it) {
+    RpcSession* session = FindSession(rpc_head.m_session_id);
+    if (NULL == session || session->m_server_side) {
         PLOG_ERROR_N_EVERY_SECOND(1, "session(%lu) not found, function_name(%s)",
                         rpc_head.m_session_id, rpc_head.m_function_name.c_str());
         return kRPC_SESSION_NOT_FOUND;
     }
 
-    cxx::shared_ptr<RpcSession> session = it->second;
-
     m_timer->StopTimer(session->m_timerid);
 
     int ret = kRPC_SUCCESS;
@@ -402,15 +952,37 @@ int32_t IRpc::ProcessResponse(const RpcHead& rpc_head,
         }
     }
 
+    // 对端不支持kVERSION_1时按方法名重发，业务不感知
+    // 对冲请求按备用目标的版本发送，只有主目标的响应才能确定探测结果
+    if (session->m_version_probe && handle == session->m_handle
+        && OnVersionProbe(handle, session, ret)) {
+        return kRPC_SUCCESS;
+    }
+
+    // 先到的响应结束整个会话，主目标和备用目标的配额一起释放
+    if (session->m_limited) {
+        m_limiter.Release(session->m_handle, false, TimeUtility::GetLoopMS() - session->m_start_time);
+    }
+    if (session->m_hedge_limited >= 0) {
+        m_limiter.Release(session->m_hedge_limited, false, TimeUtility::GetLoopMS() - session->m_start_time);
+    }
+
+    // 只统计对端正常处理的响应时间
+    if (session->m_hedge_key != 0 && kRPC_SUCCESS == ret) {
+        AddHedgeLatency(session->m_hedge_key, TimeUtility::GetLoopMS() - session->m_start_time);
+    }
+
+    // 回调中可能发起新的请求，会话在回调返回后才释放，不会被新请求复用
     if (session->m_rsp) {
         ret = session->m_rsp(ret, real_buff, real_buff_len);
     }
 
-    int64_t time_cost = TimeUtility::GetCurrentMS() - session->m_start_time;
-    ReportTransportQuality(session->m_handle, ret, time_cost);
+    int64_t time_cost = TimeUtility::GetLoopMS() - session->m_start_time;
+    // 对冲方法的响应可能来自备用目标
+    ReportTransportQuality(session->m_hedge_key != 0 ? handle : session->m_handle, ret, time_cost);
     ResponseProcComplete(session->m_rpc_head.m_function_name, ret, time_cost);
 
-    m_session_map.erase(rpc_head.m_session_id);
+    FreeSession(session);
 
     return ret;
 }
@@ -15,6 +15,10 @@
 #ifndef _PEBBLE_COMMON_RPC_H_
 #define _PEBBLE_COMMON_RPC_H_
 
+#include <string.h>
+#include <vector>
+
+#include "framework/concurrency_limiter.h"
 #include "framework/processor.h"
 
 
@@ -42,6 +46,9 @@ typedef enum {
     kRPC_SYSTEM_OVERLOAD_BASE    = kRPC_ERROR_BASE - 300, // 系统过载BASE
     kRPC_MESSAGE_EXPIRED         = kRPC_SYSTEM_OVERLOAD_BASE - 1, // 系统过载-消息过期
     kRPC_TASK_OVERLOAD           = kRPC_SYSTEM_OVERLOAD_BASE - 2, // 系统过载-并发任务过载
+    kRPC_CONCURRENCY_LIMITED     = kRPC_SYSTEM_OVERLOAD_BASE - 3, // 系统过载-到目标的并发请求数超出限制
+    kRPC_PRIORITY_SHED           = kRPC_SYSTEM_OVERLOAD_BASE - 4, // 系统过载-丢弃低优先级请求
+    kRPC_QUEUE_DELAY             = kRPC_SYSTEM_OVERLOAD_BASE - 8, // 系统过载-消息排队时延过长
     kRPC_SUCCESS                 = 0,
 } RpcErrorCode;
 
@@ -64,6 +71,9 @@ public:
         SetErrorString(kRPC_FUNCTION_NAME_UNEXISTED, "service name unexisted");
         SetErrorString(kRPC_MESSAGE_EXPIRED, "system overload: message expired");
         SetErrorString(kRPC_TASK_OVERLOAD, "system overload: task overload");
+        SetErrorString(kRPC_CONCURRENCY_LIMITED, "system overload: concurrency limited");
+        SetErrorString(kRPC_PRIORITY_SHED, "system overload: low priority request shed");
+        SetErrorString(kRPC_QUEUE_DELAY, "system overload: queue delay");
     }
 };
 
@@ -76,14 +86,25 @@ typedef enum {
     kRPC_ONEWAY    = 4,
 } RpcMessageType;
 
+/// @brief RPC方法的优先级，过载时按过载等级从低优先级开始丢弃请求
+/// 优先级与过载等级之和超过kRPC_PRIORITY_LOW时丢弃 @see OverLoadLevel
+typedef enum {
+    kRPC_PRIORITY_CRITICAL = 0, // 关键方法，如控制命令、健康检查、登录，任何过载等级都处理
+    kRPC_PRIORITY_HIGH     = 1, // 严重过载时丢弃
+    kRPC_PRIORITY_NORMAL   = 2, // 过载时丢弃，方法的默认优先级
+    kRPC_PRIORITY_LOW      = 3, // 接近过载时即丢弃
+} RpcPriority;
+
 
 // 前置声明
-class SequenceTimer;
+class Arena;
+class WheelTimer;
 struct RpcSession;
 
 /// @brief RPC协议版本号
 typedef enum {
-    kVERSION_0 = 0,
+    kVERSION_0 = 0,     // 消息头携带方法名
+    kVERSION_1 = 1,     // 请求消息头携带32位方法ID，不携带方法名，服务端按ID分发，响应与请求版本一致
 } RpcVersion;
 
 /// @brief RPC消息头定义
@@ -92,25 +113,36 @@ struct RpcHead {
         m_version       = kVERSION_0;
         m_message_type  = kRPC_EXCEPTION;
         m_session_id    = 0;
+        m_method_id     = 0;
+        m_timeout_ms    = 0;
         m_arrived_ms    = -1;
         m_dst           = NULL;
+        m_hedge_handle  = -1;
     }
     RpcHead(const RpcHead& rhs) {
         m_version       = rhs.m_version;
         m_message_type  = rhs.m_message_type;
         m_session_id    = rhs.m_session_id;
         m_function_name = rhs.m_function_name;
+        m_method_id     = rhs.m_method_id;
+        m_timeout_ms    = rhs.m_timeout_ms;
         m_arrived_ms    = rhs.m_arrived_ms;
         m_dst           = rhs.m_dst;
+        m_hedge_handle  = rhs.m_hedge_handle;
     }
 
     int32_t     m_version;
     int32_t     m_message_type;
     uint64_t    m_session_id;
     std::string m_function_name;
+    uint32_t    m_method_id;  // 方法ID，由IDL编译器根据"服务名:方法名"生成，0表示没有方法ID
+    int32_t     m_timeout_ms; // 请求的剩余处理时间(ms)，由SendRequest填写，0表示不限制
+                              // PB消息头和thrift的kVERSION_1消息头携带，thrift kVERSION_0不携带，
+                              // 服务端收到的为0，按不限制处理，不做过期丢弃，也不向下游传递
 
     int64_t     m_arrived_ms; // 消息到达时间
     IProcessor* m_dst;        // 非消息相关，标示消息来源模块，响应原路返回
+    int64_t     m_hedge_handle; // 非消息相关，对冲请求的备用目标，<0表示不对冲，只应对幂等的方法设置
 };
 
 /// @brief RPC异常结构定义
@@ -148,6 +180,9 @@ public:
     /// @return 处理的事件数，0表示无事件
     virtual int32_t Update();
 
+    /// @brief 实现Processor接口，返回最近一个会话超时的剩余时间
+    virtual int64_t GetNextTimeout();
+
     /// @brief 实现Processor接口，消息处理入口
     /// @return 0 成功
     /// @return 非0 失败 @see RpcErrorCode
@@ -164,21 +199,39 @@ public:
     /// @return 非0 失败 @see RpcErrorCode
     int32_t AddOnRequestFunction(const std::string& name, const OnRpcRequest& on_request);
 
+    /// @brief 添加RPC请求处理函数(RPC服务)，同时注册方法ID，kVERSION_1的请求按ID分发
+    /// @param name RPC请求服务的名字
+    /// @param method_id 方法ID，由IDL编译器生成，为0时只按名字注册
+    /// @param on_request 请求处理函数
+    /// @return 0 成功
+    /// @return 非0 失败 @see RpcErrorCode
+    int32_t AddOnRequestFunction(const std::string& name, uint32_t method_id,
+        const OnRpcRequest& on_request);
+
     /// @brief 注销RPC请求处理函数(RPC服务)
     /// @param name RPC请求服务的名字
     /// @return 0 成功
     /// @return 非0 失败 @see RpcErrorCode
     int32_t RemoveOnRequestFunction(const std::string& name);
 
+    /// @brief 设置RPC方法的优先级，IDL中可以通过(priority = "critical|high|normal|low")指定
+    /// @param name RPC请求服务的名字，需已注册
+    /// @param priority 优先级 @see RpcPriority
+    /// @return 0 成功
+    /// @return 非0 失败 @see RpcErrorCode
+    int32_t SetMethodPriority(const std::string& name, uint32_t priority);
+
     /// @brief 发送RPC请求
     /// @param handle 网络句柄
     /// @param rpc_head RPC头部信息
     /// @param buff RPC数据部分
     /// @param buff_len RPC数据部分长度
     /// @param on_rsp 响应回调，为空时表示ONEWAY请求
-    /// @param timeout_ms 等待响应超时时间，单位为ms，<=0时使用默认值(10s)
+    /// @param timeout_ms 等待响应超时时间，单位为ms，<=0时使用默认值(10s)，同时作为剩余时间带给服务端
     /// @return 0 成功
     /// @return 非0 失败 @see RpcErrorCode
+    /// @note thrift编码时只有kVERSION_1的请求携带剩余时间，kVERSION_0的消息头需要与旧版本兼容，
+    ///   不携带剩余时间，包括没有方法ID的方法和已回退到方法名的对端
     int32_t SendRequest(int64_t handle,
                     const RpcHead& rpc_head,
                     const uint8_t* buff,
@@ -206,6 +259,7 @@ public:
         const uint8_t* buff, uint32_t buff_len);
 
     /// @note 内部使用，用户无需关注
+    /// @note 需要等待响应的请求在SendRequest时会被替换为会话池分配的会话ID
     uint64_t GenSessionId() {
         return m_session_id++;
     }
@@ -215,6 +269,48 @@ public:
         m_proc_req_timeout_ms = proc_req_timeout_ms;
     }
 
+    /// @brief 设置发送请求使用的消息头版本 @see RpcVersion
+    /// @note 开启kVERSION_1后，旧版本的对端收到kVERSION_1请求会返回kRPC_UNSUPPORT_FUNCTION_NAME，
+    ///     此时自动按方法名重发，并记住该对端，之后发往它的请求都使用方法名
+    void SetRpcVersion(int32_t version) {
+        m_rpc_version = version;
+    }
+
+    int32_t GetRpcVersion() const {
+        return m_rpc_version;
+    }
+
+    /// @brief 根据方法名计算方法ID(32位FNV-1a)，和IDL编译器生成的方法ID一致，0保留
+    static uint32_t GenMethodId(const std::string& name);
+
+    /// @brief 设置对冲请求参数，对设置了m_hedge_handle的请求生效
+    /// @param percentile 等待响应的时间超过该方法最近响应时间的此分位数(1-99)时，向备用目标再发一份请求
+    /// @param max_ratio 对冲请求数占对冲方法请求总数的最大百分比，0表示不对冲
+    /// @note 先到的响应生效，后到的响应因会话已释放被丢弃
+    void SetHedgeOptions(uint32_t percentile, uint32_t max_ratio);
+
+    /// @brief 设置到每个目标(连接句柄)的最大并发请求数，0表示不限制
+    /// @note 实际的限制在此范围内根据响应时间自适应调整，超出限制的请求直接返回kRPC_CONCURRENCY_LIMITED
+    void SetConcurrencyLimit(uint32_t max_limit) {
+        m_limiter.SetMaxLimit(max_limit);
+    }
+
+    const ConcurrencyLimiter& GetConcurrencyLimiter() const {
+        return m_limiter;
+    }
+
+    /// @brief 当前请求的arena，请求解码出的对象和处理过程中的临时对象可以分配在上面
+    /// @note 处理函数首次调用时分配，响应已发送且处理函数已返回后整体释放，ONEWAY请求在处理函数返回后释放
+    /// @note 只在请求处理函数被调用后、首次切出协程前有效，之后还要使用时需要先保存
+    /// @note 框架只在protobuf 3.0及以上的pb服务中用它解码请求，dr服务和更低版本的protobuf不使用，
+    ///     不调用GetArena的请求不会取出arena，没有额外开销
+    Arena* GetArena() {
+        if (NULL == m_arena && m_in_request_proc) {
+            m_arena = AllocArena();
+        }
+        return m_arena;
+    }
+
 protected:
     /// @brief RPC头的编码接口
     /// @param rpc_head RPC头部信息
@@ -262,10 +358,53 @@ private:
     int32_t SendMessage(int64_t handle, const RpcHead& rpc_head, const uint8_t* buff, uint32_t buff_len);
 
     // 超时处理，暂时支持请求的超时，可扩展支持服务处理超时
-    int32_t OnTimeout(uint64_t session_id);
+    int32_t OnTimeout(RpcSession* session);
+
+    // 请求在本端排队的时间已经超过调用方的剩余时间，调用方已经超时放弃
+    bool IsExpired(const RpcHead& rpc_head);
+
+    // 按过载等级和方法优先级判断请求是否丢弃，返回0表示处理，否则为丢弃的错误码
+    int32_t CheckOverload(const RpcHead& rpc_head, const MsgExternInfo* msg_info, uint32_t is_overload);
+
+    // 对冲请求的延迟，<=0表示本次请求不对冲
+    int64_t GetHedgeDelay(RpcSession* session, int32_t timeout_ms);
+
+    // 对冲时间到，向备用目标发送同一会话的请求
+    void SendHedgeRequest(RpcSession* session, int64_t remain_ms);
+
+    // 记录对冲方法的响应时间
+    void AddHedgeLatency(uint32_t method_key, int64_t latency_ms);
+
+    // 发往对端的请求使用的消息头版本，对端不支持kVERSION_1时使用方法名
+    int32_t GetPeerVersion(int64_t handle);
+
+    // 记录对端支持的消息头版本
+    void SetPeerVersion(int64_t handle, int32_t version);
+
+    // 根据探测请求的响应确定对端的版本，对端不支持kVERSION_1时按方法名重发，返回true表示已重发
+    bool OnVersionProbe(int64_t handle, RpcSession* session, int32_t ret);
+
+    // 从会话池分配会话，会话ID的低32位为池中下标，高32位为版本号，会话复用后旧的ID失效
+    RpcSession* AllocSession();
+
+    // 释放会话到会话池，调用前需要停止会话的定时器
+    void FreeSession(RpcSession* session);
+
+    // 按会话ID的下标直接定位会话，版本号不一致(过期的响应)时返回NULL
+    RpcSession* FindSession(uint64_t session_id);
+
+    // 从arena池分配请求的arena
+    Arena* AllocArena();
+
+    // 清空arena并放回arena池
+    void FreeArena(Arena* arena);
+
+    // 调用请求处理函数，处理函数调用了GetArena时通过arena返回请求的arena，否则返回NULL
+    int32_t CallRequestProc(const OnRpcRequest& on_request, const uint8_t* buff, uint32_t buff_len,
+        cxx::function<int32_t(int32_t, const uint8_t*, uint32_t)>& rsp, Arena** arena); // NOLINT
 
 private:
-    int32_t ProcessResponse(const RpcHead& rpc_head,
+    int32_t ProcessResponse(int64_t handle, const RpcHead& rpc_head,
                     const uint8_t* buff,
                     uint32_t buff_len);
 
@@ -281,16 +420,84 @@ private:
     inline void ResponseProcComplete(const std::string& name,
         int32_t result, int32_t time_cost_ms);
 
+    struct RpcMethod {
+        RpcMethod() : _method_id(0), _priority(kRPC_PRIORITY_NORMAL) {}
+        uint32_t     _method_id;
+        uint32_t     _priority;
+        OnRpcRequest _on_request;
+    };
+    typedef cxx::unordered_map<std::string, RpcMethod> RpcMethodMap;
+
+    // 查找请求对应的方法，kVERSION_1的请求按方法ID查找，否则按方法名查找
+    RpcMethodMap::value_type* FindMethod(const RpcHead& rpc_head);
+
+    // 请求的方法名，kVERSION_1的请求消息头中没有方法名，通过方法ID查找
+    const std::string& GetFunctionName(const RpcHead& rpc_head);
+
+    // 重建方法ID索引
+    void RebuildMethodIndex();
+
 private:
-    cxx::unordered_map<std::string, OnRpcRequest> m_service_map;
+    friend struct RpcSession;
+
+    RpcMethodMap m_service_map;
+    // 方法ID索引，开放寻址，按ID的低位直接定位，容量为2的幂且至少为方法数的2倍
+    std::vector<RpcMethodMap::value_type*> m_method_index;
+    int32_t m_rpc_version;
 
     uint8_t m_rpc_head_buff[1024];
     uint8_t m_rpc_exception_buff[10240];
 
-    SequenceTimer* m_timer;
+    WheelTimer* m_timer;
     uint64_t m_session_id;
-    cxx::unordered_map< uint64_t, cxx::shared_ptr<RpcSession> > m_session_map;
+
+    static const uint32_t SESSION_BLOCK_BITS = 8;
+    static const uint32_t SESSION_BLOCK_SIZE = 1 << SESSION_BLOCK_BITS;
+
+    // 会话池，按块分配，块地址不变，会话在整个生命期内复用，不产生内存分配
+    std::vector<RpcSession*> m_session_blocks;
+    std::vector<uint32_t> m_free_sessions;
+    uint32_t m_session_num;
     uint32_t m_proc_req_timeout_ms;
+
+    // 对数分桶:0-7ms每桶1ms，之后每个2的幂区间分4个桶，最大约2^21ms
+    static const uint32_t HEDGE_BUCKET_NUM   = 80;
+    // 样本数达到窗口大小时各桶减半，统计只反映最近的响应时间
+    static const uint32_t HEDGE_WINDOW       = 1024;
+    // 样本数不足时不对冲
+    static const uint32_t HEDGE_MIN_SAMPLES  = 64;
+    // 对冲配额上限，允许短时间内突发的对冲请求数
+    static const uint32_t HEDGE_MAX_BURST    = 10;
+
+    // 对冲方法的响应时间分布
+    struct HedgeStat {
+        HedgeStat() : _total(0) {
+            memset(_buckets, 0, sizeof(_buckets));
+        }
+        uint32_t _buckets[HEDGE_BUCKET_NUM];
+        uint32_t _total;
+    };
+
+    // 方法ID -> 响应时间分布
+    cxx::unordered_map<uint32_t, HedgeStat> m_hedge_stats;
+    uint32_t m_hedge_percentile;
+    uint32_t m_hedge_max_ratio;
+    int64_t  m_hedge_tokens;    // 对冲配额，以百分之一个请求为单位
+    int64_t  m_hedge_num;       // 累计发出的对冲请求数
+
+    // 连接重建后句柄会变化，记录数超过上限时清空，重新探测
+    static const uint32_t MAX_PEER_VERSION_NUM = 65536;
+
+    // 对端句柄 -> 对端支持的消息头版本，没有记录的对端发送kVERSION_1请求时需要探测
+    cxx::unordered_map<int64_t, int32_t> m_peer_versions;
+
+    ConcurrencyLimiter m_limiter;
+
+    // 请求的arena池，arena清空后保留第一个块，复用时不产生内存分配
+    std::vector<Arena*> m_free_arenas;
+    uint32_t m_arena_num;
+    Arena*   m_arena;           // 正在调用请求处理函数的请求的arena，处理函数未调用GetArena时为NULL
+    bool     m_in_request_proc; // 正在调用请求处理函数，GetArena只在此时分配arena
 };
 
 } // namespace pebble
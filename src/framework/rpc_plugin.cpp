@@ -22,6 +22,9 @@
 
 namespace pebble {
 
+// thrift消息头中标记kVERSION_1的保留方法名，"服务名:方法名"中不会出现'#'
+static const char kMETHOD_ID_MARK[] = "#1";
+
 
 int32_t ProtoBufRpcPlugin::HeadEncode(const RpcHead& rpc_head, uint8_t* buff, uint32_t buff_len) {
     if (NULL == buff || 0 == buff_len) {
@@ -41,10 +44,18 @@ int32_t ProtoBufRpcPlugin::HeadEncode(const RpcHead& rpc_head, uint8_t* buff, ui
     try {
         // 1. ProtoBufRpcHead赋值
         ProtoBufRpcHead pb_head;
-        // pb_head.version         = rpc_head.m_version; // 暂时不需要版本号
         pb_head.msg_type        = rpc_head.m_message_type;
         pb_head.session_id      = rpc_head.m_session_id;
-        pb_head.function_name   = rpc_head.m_function_name;
+        // kVERSION_1只携带方法ID，有method_id即表示kVERSION_1，不需要再编码版本号
+        if (rpc_head.m_version >= kVERSION_1 && rpc_head.m_method_id != 0) {
+            pb_head.__set_method_id(static_cast<int32_t>(rpc_head.m_method_id));
+        } else {
+            pb_head.function_name = rpc_head.m_function_name;
+        }
+        // 请求携带调用方的剩余时间
+        if (kRPC_CALL == rpc_head.m_message_type && rpc_head.m_timeout_ms > 0) {
+            pb_head.__set_timeout_ms(rpc_head.m_timeout_ms);
+        }
 
         // 2. 序列化ProtoBufRpcHead，考虑到性能不使用write(buff, bufflen)接口
         len = pb_head.write(encoder);
@@ -83,7 +94,15 @@ int32_t ProtoBufRpcPlugin::HeadDecode(const uint8_t* buff, uint32_t buff_len, Rp
         }
         rpc_head->m_message_type  = pb_head.msg_type;
         rpc_head->m_session_id    = pb_head.session_id;
-        rpc_head->m_function_name = pb_head.function_name;
+        if (pb_head.__isset.method_id) {
+            rpc_head->m_version   = kVERSION_1;
+            rpc_head->m_method_id = static_cast<uint32_t>(pb_head.method_id);
+        } else {
+            rpc_head->m_function_name.swap(pb_head.function_name);
+        }
+        if (pb_head.__isset.timeout_ms) {
+            rpc_head->m_timeout_ms = pb_head.timeout_ms;
+        }
     } catch (TException e) {
         PLOG_ERROR_N_EVERY_SECOND(1, "catch exception : %s", e.what());
         return kPEBBLE_RPC_DECODE_HEAD_FAILED;
@@ -114,9 +133,22 @@ int32_t ThriftRpcPlugin::HeadEncode(const RpcHead& rpc_head, uint8_t* buff, uint
 
     int32_t len = -1;
     try {
-        len = encoder->writeMessageBegin(rpc_head.m_function_name,
-            static_cast<pebble::dr::protocol::TMessageType>(rpc_head.m_message_type),
-            rpc_head.m_session_id);
+        // kVERSION_1以保留的方法名标记，紧跟32位方法ID，请求再跟32位剩余时间，旧版本的对端会按方法不存在处理
+        // 异常消息总是使用方法名格式，旧版本的对端回复异常时原样带回标记，不能据此解析方法ID
+        if (rpc_head.m_version >= kVERSION_1 && rpc_head.m_method_id != 0
+            && rpc_head.m_message_type != kRPC_EXCEPTION) {
+            len = encoder->writeMessageBegin(kMETHOD_ID_MARK,
+                static_cast<pebble::dr::protocol::TMessageType>(rpc_head.m_message_type),
+                rpc_head.m_session_id);
+            len += encoder->writeI32(static_cast<int32_t>(rpc_head.m_method_id));
+            if (kRPC_CALL == rpc_head.m_message_type) {
+                len += encoder->writeI32(rpc_head.m_timeout_ms);
+            }
+        } else {
+            len = encoder->writeMessageBegin(rpc_head.m_function_name,
+                static_cast<pebble::dr::protocol::TMessageType>(rpc_head.m_message_type),
+                rpc_head.m_session_id);
+        }
     } catch (TException e) {
         PLOG_ERROR_N_EVERY_SECOND(1, "catch exception : %s", e.what());
         return kPEBBLE_RPC_ENCODE_HEAD_FAILED;
@@ -147,6 +179,19 @@ int32_t ThriftRpcPlugin::HeadDecode(const uint8_t* buff, uint32_t buff_len, RpcH
         head_len = decoder->readMessageBegin(rpc_head->m_function_name, msg_type, seqid);
         rpc_head->m_message_type = static_cast<int32_t>(msg_type);
         rpc_head->m_session_id   = static_cast<uint64_t>(seqid);
+        // 带标记的非异常消息才携带方法ID
+        if (rpc_head->m_function_name == kMETHOD_ID_MARK) {
+            rpc_head->m_function_name.clear();
+            if (msg_type != pebble::dr::protocol::T_EXCEPTION) {
+                int32_t method_id = 0;
+                head_len += decoder->readI32(method_id);
+                rpc_head->m_version   = kVERSION_1;
+                rpc_head->m_method_id = static_cast<uint32_t>(method_id);
+                if (pebble::dr::protocol::T_CALL == msg_type) {
+                    head_len += decoder->readI32(rpc_head->m_timeout_ms);
+                }
+            }
+        }
     } catch (TException e) {
         PLOG_ERROR_N_EVERY_SECOND(1, "catch exception : %s", e.what());
         return kPEBBLE_RPC_DECODE_HEAD_FAILED;
@@ -13,11 +13,53 @@
 
 #include "common/coroutine.h"
 #include "common/log.h"
+#include "common/time_utility.h"
 #include "framework/rpc_util.inh"
 
 
 namespace pebble {
 
+/// @brief 在协程中处理RPC请求的任务
+/// @note 记录调用方的截止时间，处理过程中发起的同步/并行调用继承剩余时间，
+///     不同PebbleRpc实例共用协程调度器，通过当前协程任务即可取到截止时间
+class RpcRequestTask : public CoroutineTask {
+public:
+    RpcRequestTask() : m_rpc(NULL), m_handle(-1), m_buff(NULL), m_buff_len(0), m_deadline_ms(0) {}
+
+    virtual ~RpcRequestTask() {}
+
+    void Init(IRpc* rpc, int64_t handle, const RpcHead& rpc_head,
+        const uint8_t* buff, uint32_t buff_len) {
+        m_rpc      = rpc;
+        m_handle   = handle;
+        m_rpc_head = rpc_head;
+        m_buff     = buff;
+        m_buff_len = buff_len;
+        if (rpc_head.m_timeout_ms > 0) {
+            m_deadline_ms = (rpc_head.m_arrived_ms > 0 ? rpc_head.m_arrived_ms : TimeUtility::GetLoopMS())
+                + rpc_head.m_timeout_ms;
+        }
+    }
+
+    // 请求数据只在协程首次切出前有效，任务需要立即执行
+    virtual void Run() {
+        m_rpc->ProcessRequestImp(m_handle, m_rpc_head, m_buff, m_buff_len);
+    }
+
+    /// @brief 调用方的截止时间(ms)，0表示没有截止时间
+    int64_t DeadlineMS() const {
+        return m_deadline_ms;
+    }
+
+private:
+    IRpc*          m_rpc;
+    int64_t        m_handle;
+    RpcHead        m_rpc_head;
+    const uint8_t* m_buff;
+    uint32_t       m_buff_len;
+    int64_t        m_deadline_ms;
+};
+
 RpcUtil::RpcUtil(IRpc* rpc, CoroutineSchedule* coroutine_schedule) {
     m_rpc = rpc;
     m_coroutine_schedule = coroutine_schedule;
@@ -26,6 +68,24 @@ RpcUtil::RpcUtil(IRpc* rpc, CoroutineSchedule* coroutine_schedule) {
 RpcUtil::~RpcUtil() {
     m_rpc = NULL;
     m_coroutine_schedule = NULL;
+    for (std::vector<SyncResponse*>::iterator it = m_free_sync_rsps.begin();
+        it != m_free_sync_rsps.end(); ++it) {
+        delete *it;
+    }
+    m_free_sync_rsps.clear();
+}
+
+RpcUtil::SyncResponse* RpcUtil::AllocSyncResponse() {
+    if (m_free_sync_rsps.empty()) {
+        return new SyncResponse();
+    }
+    SyncResponse* sync_rsp = m_free_sync_rsps.back();
+    m_free_sync_rsps.pop_back();
+    return sync_rsp;
+}
+
+void RpcUtil::FreeSyncResponse(SyncResponse* sync_rsp) {
+    m_free_sync_rsps.push_back(sync_rsp);
 }
 
 int32_t RpcUtil::SendRequestSync(int64_t handle,
@@ -44,6 +104,11 @@ int32_t RpcUtil::SendRequestSync(int64_t handle,
         return kRPC_UTIL_NOT_IN_COROUTINE;
     }
 
+    if (!InheritDeadline(&timeout_ms)) {
+        PLOG_ERROR_N_EVERY_SECOND(1, "%s no time left for the request", rpc_head.m_function_name.c_str());
+        return kRPC_REQUEST_TIMEOUT;
+    }
+
     int32_t ret = kRPC_SUCCESS;
 
     SendRequestInCoroutine(handle, rpc_head, buff, buff_len, on_rsp, timeout_ms, &ret);
@@ -58,15 +123,18 @@ void RpcUtil::SendRequestInCoroutine(int64_t handle,
                     const OnRpcResponse& on_rsp,
                     uint32_t timeout_ms,
                     int32_t* ret) {
-    int64_t co_id = m_coroutine_schedule->CurrentTaskId();
-    OnRpcResponse rsp = cxx::bind(&RpcUtil::OnResponse, this,
-        cxx::placeholders::_1, cxx::placeholders::_2, cxx::placeholders::_3, co_id);
-    *ret = m_rpc->SendRequest(handle, rpc_head, buff, buff_len, rsp, timeout_ms);
+    // IRpc在响应或超时回调之后不再引用sync_rsp，协程恢复后即可回收
+    SyncResponse* sync_rsp = AllocSyncResponse();
+    sync_rsp->_util  = this;
+    sync_rsp->_co_id = m_coroutine_schedule->CurrentTaskId();
+    *ret = m_rpc->SendRequest(handle, rpc_head, buff, buff_len, cxx::ref(*sync_rsp), timeout_ms);
     if (*ret != kRPC_SUCCESS) {
+        FreeSyncResponse(sync_rsp);
         return;
     }
 
     m_coroutine_schedule->Yield();
+    FreeSyncResponse(sync_rsp);
 
     *ret = on_rsp(m_result._ret, m_result._buff, m_result._buff_len);
 }
@@ -101,6 +169,14 @@ void RpcUtil::SendRequestParallel(int64_t handle,
         return;
     }
 
+    if (!InheritDeadline(&timeout_ms)) {
+        PLOG_ERROR_N_EVERY_SECOND(1, "%s no time left for the request", rpc_head.m_function_name.c_str());
+        *ret_code = kRPC_REQUEST_TIMEOUT;
+        --(*num_called);
+        --(*num_parallel);
+        return;
+    }
+
     SendRequestParallelInCoroutine(handle,
                                    rpc_head,
                                    buff,
@@ -188,18 +264,27 @@ int32_t RpcUtil::ProcessRequest(int64_t handle, const RpcHead& rpc_head,
         return m_rpc->ProcessRequestImp(handle, rpc_head, buff, buff_len);
     }
 
-    CommonCoroutineTask* task = m_coroutine_schedule->NewTask<CommonCoroutineTask>();
-    cxx::function<void(void)> run = cxx::bind(&RpcUtil::ProcessRequestInCoroutine, this,
-        handle, rpc_head, buff, buff_len);
-    task->Init(run);
+    RpcRequestTask* task = m_coroutine_schedule->NewTask<RpcRequestTask>();
+    task->Init(m_rpc, handle, rpc_head, buff, buff_len);
     task->Start();
 
     return kRPC_SUCCESS;
 }
 
-int32_t RpcUtil::ProcessRequestInCoroutine(int64_t handle, const RpcHead& rpc_head,
-    const uint8_t* buff, uint32_t buff_len) {
-    return m_rpc->ProcessRequestImp(handle, rpc_head, buff, buff_len);
+bool RpcUtil::InheritDeadline(int32_t* timeout_ms) {
+    RpcRequestTask* task = dynamic_cast<RpcRequestTask*>(m_coroutine_schedule->CurrentTask());
+    if (NULL == task || task->DeadlineMS() <= 0) {
+        return true;
+    }
+
+    int64_t remain_ms = task->DeadlineMS() - TimeUtility::GetLoopMS();
+    if (remain_ms <= 0) {
+        return false;
+    }
+    if (*timeout_ms <= 0 || *timeout_ms > remain_ms) {
+        *timeout_ms = remain_ms;
+    }
+    return true;
 }
 
 
@@ -22,7 +22,7 @@
 namespace pebble {
 
 // 前置声明
-class SequenceTimer;
+class WheelTimer;
 
 /// @brief Session模块错误码定义
 typedef enum {
@@ -96,6 +96,11 @@ public:
     /// @return 超时的session数目
     int32_t CheckTimeout();
 
+    /// @brief 获取距离最近一个session超时的时间(ms)，<0表示没有session
+    int64_t GetNextTimeout() {
+        return m_timer->GetNextTimeout();
+    }
+
     /// @brief 重启会话的计时，若new_timeout_ms>0，使用new_timeout_ms作为超时时间重新计时\n
     ///     否则使用原超时时间重新计时
     /// @param session_id 会话ID
@@ -130,7 +135,7 @@ private:
     };
 
 private:
-    SequenceTimer* m_timer;
+    WheelTimer* m_timer;
     cxx::unordered_map<int64_t, SessionInfo> m_sessions;
     char m_last_error[256];
 };
@@ -20,7 +20,6 @@
 #include <unistd.h>
 #include <fcntl.h>
 
-#include "common/kv_cache.h"
 #include "common/log.h"
 #include "common/string_utility.h"
 #include "common/time_utility.h"
@@ -45,6 +44,106 @@ struct TcpMsgHead {
 #pragma pack()
 
 
+/// @brief 连接独占的可增长连续缓冲区，[_rpos, _wpos)为有效数据
+struct ConnBuffer {
+	ConnBuffer() : _data(NULL), _cap(0), _rpos(0), _wpos(0) {}
+	~ConnBuffer() { Release(); }
+
+	char* 	 ReadPtr() 		  { return _data + _rpos; }
+	char* 	 WritePtr() 	  { return _data + _wpos; }
+	uint32_t ReadableBytes()  const { return _wpos - _rpos; }
+	uint32_t WritableBytes()  const { return _cap - _wpos; }
+
+	/// @brief 保证至少有len字节可写空间，优先整理已读空间，不足时按2倍扩容
+	/// @return 0 成功，<0 超过上限或内存不足
+	int Reserve(uint32_t len);
+
+	/// @brief 追加数据
+	int Append(const char* data, uint32_t len);
+
+	/// @brief 标记len字节已写入
+	void Produce(uint32_t len) { _wpos += len; }
+
+	/// @brief 丢弃已处理的len字节，数据全部处理完时复位读写位置
+	void Consume(uint32_t len) {
+		if (len >= ReadableBytes()) {
+			_rpos = _wpos = 0;
+		} else {
+			_rpos += len;
+		}
+	}
+
+	/// @brief 缓冲区为空且容量超过idle_cap时释放内存
+	void Shrink(uint32_t idle_cap) {
+		if (_rpos == _wpos && _cap > idle_cap) {
+			Release();
+		}
+	}
+
+	void Release() {
+		free(_data);
+		_data = NULL;
+		_cap  = _rpos = _wpos = 0;
+	}
+
+	char* 		_data;
+	uint32_t 	_cap;
+	uint32_t 	_rpos;
+	uint32_t 	_wpos;
+};
+
+int ConnBuffer::Reserve(uint32_t len) {
+	if (WritableBytes() >= len) {
+		return 0;
+	}
+
+	uint32_t readable = ReadableBytes();
+	if (len > TcpDriver::MAX_CONNECTION_BUFF_LEN - readable) {
+		return -1;
+	}
+
+	// 已读空间足够时只做整理
+	if (_cap - readable >= len) {
+		memmove(_data, _data + _rpos, readable);
+		_rpos = 0;
+		_wpos = readable;
+		return 0;
+	}
+
+	uint32_t new_cap = (_cap > 0 ? _cap : TcpDriver::MIN_CONNECTION_BUFF_RESERVE);
+	while (new_cap - readable < len) {
+		if (new_cap > TcpDriver::MAX_CONNECTION_BUFF_LEN / 2) {
+			new_cap = TcpDriver::MAX_CONNECTION_BUFF_LEN;
+			break;
+		}
+		new_cap *= 2;
+	}
+
+	if (_rpos > 0) {
+		memmove(_data, _data + _rpos, readable);
+		_rpos = 0;
+		_wpos = readable;
+	}
+
+	char* data = static_cast<char*>(realloc(_data, new_cap));
+	if (NULL == data) {
+		return -2;
+	}
+	_data = data;
+	_cap  = new_cap;
+	return 0;
+}
+
+int ConnBuffer::Append(const char* data, uint32_t len) {
+	if (Reserve(len) != 0) {
+		return -1;
+	}
+	memcpy(WritePtr(), data, len);
+	Produce(len);
+	return 0;
+}
+
+
 struct Listener {
 protected:
 	Listener() {}
@@ -71,17 +170,23 @@ public:
 	Connection(TcpDriver* driver, struct ev_loop* loop, int64_t local, int64_t trans);
 	~Connection();
 	void Close();
+	void CloseSocket();
 	void RegisterWatcher(int fd);
 	int Connect(const std::string& ip, uint16_t port);
 	int ReConnect();
+	void StartRead();
+	void StopRead();
 	void Recv();
+	void Process();
 	void SendCacheData();
 	int SendV(uint32_t msg_frag_num, const uint8_t* msg_frag[], uint32_t msg_frag_len[]);
 	void OnError();
 
 	bool 			_start_read;
 	bool 			_start_write;
+	bool			_pending;	// 在TcpDriver的待处理队列中
 	int 			_fd;
+	int64_t			_recv_ms;	// 最近一次收到数据的时间，暂停期间不再收包，留在缓冲区的消息保持原到达时间
 	TcpDriver* 		_driver;
 	struct ev_loop* _loop;
 	ev_io 			_rw; 	// read watcher
@@ -90,6 +195,8 @@ public:
 	int64_t			_trans_handle;
 	std::string		_ip;
 	uint16_t		_port;
+	ConnBuffer		_recv_buff;
+	ConnBuffer		_send_buff;
 };
 
 int32_t UrlToIpPort(const std::string& url, std::string* ip, uint16_t* port) {
@@ -127,6 +234,8 @@ static void on_accept(EV_P_ ev_io *w, int revents) {
 
 static void on_read(EV_P_ ev_io *w, int revents) {
 	Connection* connection = CONTAINER(Connection, _rw, w);
+	// 消息回调中可能关闭本连接，处理期间保持连接对象有效
+	cxx::shared_ptr<Connection> guard = connection->_driver->GetConnection(connection->_trans_handle);
 	connection->Recv();
 }
 
@@ -172,6 +281,11 @@ int Listener::Listen(const std::string& ip, uint16_t port) {
 		PLOG_ERROR("setsockopt %d failed %d:%s", _fd, errno, strerror(errno));
         return -4;
     }
+	if (_driver->IsReusePort()
+		&& 0 != setsockopt(_fd, SOL_SOCKET, SO_REUSEPORT, &flag, sizeof(flag))) {
+		PLOG_ERROR("setsockopt SO_REUSEPORT %d failed %d:%s", _fd, errno, strerror(errno));
+        return -4;
+	}
 	
 	// TODO: TCP_NODELAY
 	struct sockaddr_in socket_addr;
@@ -231,7 +345,9 @@ Connection::Connection(TcpDriver* driver, struct ev_loop* loop, int64_t local, i
 	: _driver(driver), _loop(loop), _local_handle(local), _trans_handle(trans) {
 	_start_read = false;
 	_start_write = false;
+	_pending = false;
 	_fd = -1;
+	_recv_ms = 0;
 	_port = 0;
 }
 
@@ -240,11 +356,16 @@ Connection::~Connection() {
 }
 
 void Connection::Close() {
+	CloseSocket();
+	_recv_buff.Release();
+	_send_buff.Release();
+}
+
+/// @brief 只关闭socket，保留缓冲区，消息回调中关闭连接时回调参数仍指向接收缓冲区
+void Connection::CloseSocket() {
 	if (_start_read)  { ev_io_stop(_loop, &_rw); _start_read = false;  }
 	if (_start_write) { ev_io_stop(_loop, &_ww); _start_write = false; }
 	if (_fd >= 0) 	  { close(_fd); _fd = -1; }
-	_driver->GetSendCache()->Del(_trans_handle);
-	_driver->GetRecvCache()->Del(_trans_handle);
 }
 
 void Connection::RegisterWatcher(int fd) {
@@ -255,6 +376,20 @@ void Connection::RegisterWatcher(int fd) {
 	ev_io_start(_loop, &_rw);
 }
 
+void Connection::StartRead() {
+	if (!_start_read && _fd >= 0) {
+		ev_io_start(_loop, &_rw);
+		_start_read = true;
+	}
+}
+
+void Connection::StopRead() {
+	if (_start_read) {
+		ev_io_stop(_loop, &_rw);
+		_start_read = false;
+	}
+}
+
 int Connection::ReConnect() {
 	Close();
 	return Connect(_ip, _port);
@@ -308,14 +443,23 @@ int Connection::Connect(const std::string& ip, uint16_t port) {
 }
 
 void Connection::Recv() {
-	char* buff = _driver->GetCommonBuff();
-	int buff_len = TcpDriver::DEFAULT_COMMON_BUFF_LEN;
-	KVCache* cache = _driver->GetRecvCache();
-
-	// 1. get cache
-	int cache_len = cache->Get(_trans_handle, buff, buff_len);
-	if (cache_len >= buff_len || cache_len < 0) {
-		PLOG_ERROR_N_EVERY_SECOND(1, "get %ld's cache failed %d", _trans_handle, cache_len);
+	// 本轮配额已用完，数据留在socket中，暂停收包等后续Update处理
+	if (!_driver->HasRecvBudget()) {
+		_driver->SuspendConnection(this);
+		return;
+	}
+
+	// 1. reserve
+	uint32_t need_len = TcpDriver::MIN_CONNECTION_BUFF_RESERVE;
+	uint32_t data_len = 0;
+	int head_len = _driver->ParseHead((const uint8_t*)_recv_buff.ReadPtr(), _recv_buff.ReadableBytes(), &data_len);
+	if (head_len > 0 && head_len + data_len > _recv_buff.ReadableBytes()) {
+		// 不完整的大包一次预留足够空间，避免多次扩容
+		uint32_t rest_len = head_len + data_len - _recv_buff.ReadableBytes();
+		need_len = rest_len > need_len ? rest_len : need_len;
+	}
+	if (_recv_buff.Reserve(need_len) != 0) {
+		PLOG_ERROR_N_EVERY_SECOND(1, "handle %ld reserve recv buff failed, len = %u", _trans_handle, need_len);
 		OnError();
 		return;
 	}
@@ -323,7 +467,7 @@ void Connection::Recv() {
 	// 2. recv
 	int32_t recv_len = 0;
 	do {
-		recv_len = recv(_fd, buff + cache_len, buff_len, 0);
+		recv_len = recv(_fd, _recv_buff.WritePtr(), _recv_buff.WritableBytes(), 0);
 	} while (recv_len < 0 && errno == EINTR);
 
 	if (recv_len == 0 || (recv_len < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
@@ -333,51 +477,50 @@ void Connection::Recv() {
 	}
 
 	if (recv_len < 0) {
-		cache->Put(_trans_handle, buff, cache_len);
 		return;
 	}
+	_recv_buff.Produce(recv_len);
+	// 收到新数据时刷新循环时间，网络线程中刷新的是网络线程自己的缓存
+	TimeUtility::RefreshLoopTime();
+	_recv_ms = TimeUtility::GetLoopMS();
 
 	// 3. proc
-	int proc_len = _driver->OnMessage(this, (uint8_t*)buff, cache_len + recv_len);
-	int rest_len = cache_len + recv_len - proc_len;
-	if (rest_len > 0) {
-		int ret = cache->Put(_trans_handle, buff + proc_len, rest_len);
-		if (ret != 0) {
-			PLOG_ERROR_N_EVERY_SECOND(1, "put %ld's cache failed %d, len = ", _trans_handle, ret, rest_len);
-			OnError();
-			return;
-		}
-	}
+	Process();
 }
 
-void Connection::SendCacheData() {
-	char* buff = _driver->GetCommonBuff();
-	int buff_len = TcpDriver::DEFAULT_COMMON_BUFF_LEN;
-	KVCache* cache = _driver->GetSendCache();
-
-	// 1. get cache
-	int cache_len = cache->Get(_trans_handle, buff, buff_len);
-	if (cache_len >= buff_len || cache_len < 0) {
-		PLOG_ERROR_N_EVERY_SECOND(1, "get %ld's cache failed %d", _trans_handle, cache_len);
+void Connection::Process() {
+	// 直接在连接缓冲区上解析
+	int proc_len = _driver->OnMessage(this, (uint8_t*)_recv_buff.ReadPtr(), _recv_buff.ReadableBytes());
+	if (proc_len < 0) {
 		OnError();
 		return;
 	}
+	// 回调中连接可能已被关闭
+	if (_fd < 0) {
+		return;
+	}
+	_recv_buff.Consume(proc_len);
+	_recv_buff.Shrink(TcpDriver::MAX_CONNECTION_BUFF_IDLE);
+}
 
-	// 2. send
+void Connection::SendCacheData() {
+	// 1. send
 	int32_t send_ret = 0;
-	int32_t send_cnt = 0;
-	while (send_cnt < cache_len) {
-		send_ret = send(_fd, buff + send_cnt, cache_len - send_cnt, 0);
+	while (_send_buff.ReadableBytes() > 0) {
+		send_ret = send(_fd, _send_buff.ReadPtr(), _send_buff.ReadableBytes(), 0);
 		if ((send_ret < 0 && errno != EINTR) || send_ret == 0) {
 			break;
 		}
-		send_cnt += send_ret;
+		if (send_ret > 0) {
+			_send_buff.Consume(send_ret);
+		}
 	}
 
 	// send complete
-	if (send_cnt == cache_len) {
+	if (_send_buff.ReadableBytes() == 0) {
 		ev_io_stop(_loop, &_ww);
 		_start_write = false;
+		_send_buff.Shrink(TcpDriver::MAX_CONNECTION_BUFF_IDLE);
 		return;
 	}
 
@@ -387,25 +530,19 @@ void Connection::SendCacheData() {
 		return;
 	}
 
-	// cache
-	int rest_len = cache_len - send_ret;
-	int ret = cache->Put(_trans_handle, buff + send_ret, rest_len);
-	if (ret != 0) {
-		PLOG_ERROR_N_EVERY_SECOND(1, "put %ld's cache failed %d, len = %d", _trans_handle, ret, rest_len);
-		OnError();
-		return;
+	// 2. wait writable
+	if (!_start_write) {
+		ev_io_start(_loop, &_ww);
+		_start_write = true;
 	}
-	ev_io_start(_loop, &_ww);
-	_start_write = true;
 }
 
 int Connection::SendV(uint32_t msg_frag_num, const uint8_t* msg_frag[], uint32_t msg_frag_len[]) {
 	if (_start_write) {
-		KVCache* cache = _driver->GetSendCache();
-		for (int i = 0; i < (int)msg_frag_num; i++) {
-			int ret = cache->Put(_trans_handle, (char*)msg_frag[i], msg_frag_len[i]);
+		for (uint32_t i = 0; i < msg_frag_num; i++) {
+			int ret = _send_buff.Append((const char*)msg_frag[i], msg_frag_len[i]);
 			if (ret != 0) {
-				PLOG_ERROR_N_EVERY_SECOND(1, "put %ld's cache failed %d, len = ", _trans_handle, msg_frag_len[i]);
+				PLOG_ERROR_N_EVERY_SECOND(1, "append %ld's send buff failed %d, len = %u", _trans_handle, ret, msg_frag_len[i]);
 				OnError();
 				return kMESSAGE_SYSTEM_ERROR;
 			}
@@ -463,16 +600,31 @@ int Connection::SendV(uint32_t msg_frag_num, const uint8_t* msg_frag[], uint32_t
 		return -1;
 	}
 
+	// 未发送完的数据放入连接发送缓冲区，等待可写时继续发送
+	if (send_ret < 0) {
+		send_ret = 0;
+	}
+	for (uint32_t i = 0; i < msg.msg_iovlen; ++i) {
+		int ret = _send_buff.Append((const char*)msg.msg_iov[i].iov_base + send_ret,
+			msg.msg_iov[i].iov_len - send_ret);
+		if (ret != 0) {
+			PLOG_ERROR_N_EVERY_SECOND(1, "append %ld's send buff failed %d", _trans_handle, ret);
+			OnError();
+			return kMESSAGE_SYSTEM_ERROR;
+		}
+		send_ret = 0;
+	}
+
 	ev_io_start(_loop, &_ww);
 	_start_write = true;
 
 	return 0;
 }
 
-TcpDriver::TcpDriver() {
+TcpDriver::TcpDriver(bool own_loop) {
 	m_loop 			= NULL;
-	m_recv_cache	= NULL;
-	m_common_buff	= NULL;
+	m_own_loop		= own_loop;
+	m_reuse_port	= false;
 	m_proc_num      = 0;
 }
 
@@ -480,36 +632,23 @@ TcpDriver::~TcpDriver() {
 	m_connections.clear();
 	m_listeners.clear();
 
-    ev_loop_destroy(m_loop);
-
-	delete m_send_cache;
-	m_send_cache = NULL;
-	delete m_recv_cache;
-	m_recv_cache = NULL;
-
-	delete [] m_common_buff;
-	m_common_buff = NULL;
+    if (m_loop != NULL) {
+        ev_loop_destroy(m_loop);
+        m_loop = NULL;
+    }
 }
 
 int32_t TcpDriver::Init() {
-	m_send_cache = new KVCache();
-	int ret = m_send_cache->Init(100000, 20000, 2048);
-	if (ret != 0) {
-		PLOG_ERROR("cache init failed(%d)", ret);
-		return kMESSAGE_SYSTEM_ERROR;
+	if (m_own_loop) {
+		m_loop = ev_loop_new(0);
+	} else {
+		m_loop = ev_default_loop(0); // TODO: NEW, confict with business
 	}
-
-	m_recv_cache = new KVCache();
-	ret = m_recv_cache->Init(100000, 20000, 2048);
-	if (ret != 0) {
-		PLOG_ERROR("cache init failed(%d)", ret);
+	if (NULL == m_loop) {
+		PLOG_ERROR("create ev loop failed");
 		return kMESSAGE_SYSTEM_ERROR;
 	}
 
-	m_common_buff = new char[DEFAULT_COMMON_BUFF_LEN];
-
-	m_loop = ev_default_loop(0); // TODO: NEW, confict with business
-
 	signal(SIGPIPE, SIG_IGN);
 
 	return 0;
@@ -610,17 +749,52 @@ int32_t TcpDriver::SendRaw(int64_t handle, uint32_t msg_frag_num, const uint8_t*
 
 int32_t TcpDriver::Close(int64_t handle) {
 	m_listeners.erase(handle);
-	m_connections.erase(handle);
+	// 消息回调中关闭时连接对象被on_read暂时持有，先关闭socket让收包循环立即停止
+	cxx::unordered_map<int64_t, cxx::shared_ptr<Connection> >::iterator it = m_connections.find(handle);
+	if (it != m_connections.end()) {
+		it->second->CloseSocket();
+		m_connections.erase(it);
+	}
 	return 0;
 }
 
 int32_t TcpDriver::Update() {
+	ResumeConnections();
 	ev_run(m_loop, EVRUN_NOWAIT);
-	int num = m_proc_num;
+	// 还有暂停的连接时不能让出CPU
+	int num = m_proc_num + m_pending.size();
 	m_proc_num = 0;
 	return num;
 }
 
+void TcpDriver::SuspendConnection(Connection* connection) {
+	connection->StopRead();
+	if (!connection->_pending) {
+		connection->_pending = true;
+		m_pending.push_back(connection->_trans_handle);
+	}
+	OnCarryOver();
+}
+
+void TcpDriver::ResumeConnections() {
+	// 只处理本轮开始前已暂停的连接，处理中再次暂停的连接排到队尾
+	size_t num = m_pending.size();
+	while (num-- > 0 && HasLoopMsgBudget()) {
+		int64_t handle = m_pending.front();
+		m_pending.pop_front();
+
+		cxx::shared_ptr<Connection> connection = GetConnection(handle);
+		if (!connection || connection->_fd < 0) {
+			continue;
+		}
+		connection->_pending = false;
+		connection->Process();
+		if (!connection->_pending) {
+			connection->StartRead();
+		}
+	}
+}
+
 int32_t TcpDriver::ParseHead(const uint8_t* head, uint32_t head_len, uint32_t* data_len) {
     if (head == NULL || data_len == NULL || head_len < sizeof(TcpMsgHead)) {
         return -1;
@@ -660,7 +834,11 @@ void TcpDriver::CloseListener(int64_t handle) {
 }
 
 void TcpDriver::CloseConnection(int64_t local_handle, int64_t trans_handle) {
-	m_connections.erase(trans_handle);
+	cxx::unordered_map<int64_t, cxx::shared_ptr<Connection> >::iterator it = m_connections.find(trans_handle);
+	if (it != m_connections.end()) {
+		it->second->CloseSocket();
+		m_connections.erase(it);
+	}
 	if (local_handle == trans_handle) {
 		if (m_cbs._on_closed) {
 			m_cbs._on_closed(local_handle);
@@ -672,34 +850,71 @@ void TcpDriver::CloseConnection(int64_t local_handle, int64_t trans_handle) {
 	}
 }
 
+int32_t TcpDriver::CloseAndNotify(int64_t handle) {
+	cxx::shared_ptr<Connection> connection = GetConnection(handle);
+	if (!connection) {
+		return kMESSAGE_INVAILD_HANDLE;
+	}
+	CloseConnection(connection->_local_handle, connection->_trans_handle);
+	return 0;
+}
+
+cxx::shared_ptr<Connection> TcpDriver::GetConnection(int64_t handle) {
+	cxx::unordered_map<int64_t, cxx::shared_ptr<Connection> >::iterator it = m_connections.find(handle);
+	if (m_connections.end() == it) {
+		return cxx::shared_ptr<Connection>();
+	}
+	return it->second;
+}
+
 int32_t TcpDriver::OnMessage(Connection* connection, const uint8_t* msg, uint32_t msg_len) {
 	const uint8_t* buff = msg;
 	uint32_t buff_len = msg_len;
 	int32_t  proc_len = 0;
+	uint32_t msg_num  = 0;
 	do {
 		uint32_t data_len = 0;
 		int head_len = ParseHead(buff, buff_len, &data_len);
-		if (head_len < 0) {
+		if (head_len == -1) {
 			break;
 		}
+		if (head_len < 0) {
+			// 消息头非法，数据流已无法继续解析
+			return -1;
+		}
+		if (data_len > MAX_CONNECTION_BUFF_LEN - head_len) {
+			PLOG_ERROR_N_EVERY_SECOND(1, "handle %ld msg len %u too large", connection->_trans_handle, data_len);
+			return -1;
+		}
 		if (data_len + head_len > buff_len) {
 			break;
 		}
+		// 配额用完，剩余的消息留在连接缓冲区中，后续Update再处理，避免其他连接饥饿
+		if (!AcquireMsgBudget(msg_num)) {
+			SuspendConnection(connection);
+			break;
+		}
+		msg_num++;
 		buff += head_len;
 		buff_len -= head_len;
 		if (m_cbs._on_message) {
 			MsgExternInfo msg_info;
 			msg_info._self_handle 	 = connection->_local_handle;
 			msg_info._remote_handle  = connection->_trans_handle;
-			msg_info._msg_arrived_ms = TimeUtility::GetCurrentMS();
+			msg_info._msg_arrived_ms = connection->_recv_ms;
 			m_cbs._on_message(buff, data_len, &msg_info);
-			buff += data_len;
-			buff_len -= data_len;
 
 			m_proc_num++;
 		}
+		buff += data_len;
+		buff_len -= data_len;
 		proc_len += head_len + data_len;
-	} while (true); // TODO: avoid other connection hunger
+
+		// 回调中连接可能已被关闭
+		if (connection->_fd < 0) {
+			break;
+		}
+	} while (true);
 
 	return proc_len;
 }
@@ -15,6 +15,8 @@
 #ifndef _PEBBLE_TCP_DRIVER_H_
 #define _PEBBLE_TCP_DRIVER_H_
 
+#include <list>
+
 #include "framework/message.h"
 //#include "ev.h"
 
@@ -23,19 +25,29 @@ struct ev_loop;
 namespace pebble {
 
 class Connection;
-class KVCache;
 class Listener;
 
+/// @brief 解析"ip:port"形式的地址
+int32_t UrlToIpPort(const std::string& url, std::string* ip, uint16_t* port);
+
 
-/// @brief RAW TCP/UDP网络驱动接口
-/// @note 这里不考虑性能，仅供开发、测试使用，生产环境使用tbuspp
+/// @brief RAW TCP网络驱动接口
+/// @note 每个连接独占可增长的收发缓冲区，不完整的消息保留在原缓冲区中，收包时原地解析
+///     消息处理配额用完时连接暂停收包，已收到的消息留在缓冲区中，后续Update按轮询顺序继续处理
 class TcpDriver : public MessageDriver {
 public:
-    TcpDriver();
+    /// @param own_loop 为true时使用独立的ev loop(供网络线程使用)，否则使用default loop
+    explicit TcpDriver(bool own_loop = false);
 	virtual ~TcpDriver();
 
-    // 默认接收缓冲区为2M
-    static const int32_t DEFAULT_COMMON_BUFF_LEN = 1024 * 1024 * 2;
+    // 连接缓冲区每次至少预留的可写空间为16K
+    static const uint32_t MIN_CONNECTION_BUFF_RESERVE = 1024 * 16;
+
+    // 连接缓冲区空闲时超过256K则释放，避免长期占用内存
+    static const uint32_t MAX_CONNECTION_BUFF_IDLE = 1024 * 256;
+
+    // 单个连接缓冲区上限为64M
+    static const uint32_t MAX_CONNECTION_BUFF_LEN = 1024 * 1024 * 64;
 
     virtual int32_t Init();
 
@@ -66,24 +78,40 @@ public:
 
 	void CloseConnection(int64_t local_handle, int64_t trans_handle);
 
-	KVCache* GetSendCache() { return m_send_cache; }
+	/// @brief 关闭连接并像对端关闭一样回调通知，连接不存在时返回kMESSAGE_INVAILD_HANDLE
+	int32_t CloseAndNotify(int64_t handle);
+
+	cxx::shared_ptr<Connection> GetConnection(int64_t handle);
 
-	KVCache* GetRecvCache() { return m_recv_cache; }
+	/// @brief 本轮是否还可以收包
+	bool HasRecvBudget() const { return HasLoopMsgBudget(); }
 
-	char* GetCommonBuff() { return m_common_buff; }
+	/// @brief 配额用完，暂停连接收包并放入待处理队列
+	void SuspendConnection(Connection* connection);
+
+	struct ev_loop* GetLoop() { return m_loop; }
+
+	/// @brief 监听时设置SO_REUSEPORT，多个网络线程监听同一地址，由内核分配连接
+	void SetReusePort(bool reuse_port) { m_reuse_port = reuse_port; }
+
+	bool IsReusePort() const { return m_reuse_port; }
 
 protected:
 	int32_t SendRaw(int64_t handle, uint32_t msg_frag_num, const uint8_t* msg_frag[], uint32_t msg_frag_len[]);
 
+	/// @brief 按轮询顺序继续处理上轮因配额用完而暂停的连接
+	void ResumeConnections();
+
 private:
 	struct ev_loop* m_loop;
-	KVCache* m_send_cache;
-	KVCache* m_recv_cache;
-	char* m_common_buff;
+	bool m_own_loop;
+	bool m_reuse_port;
 	int m_proc_num;
 
 	cxx::unordered_map<int64_t, cxx::shared_ptr<Listener> > m_listeners;
 	cxx::unordered_map<int64_t, cxx::shared_ptr<Connection> > m_connections;
+	// 因配额用完而暂停收包的连接(trans handle)，先进先出
+	std::list<int64_t> m_pending;
 };
 
 
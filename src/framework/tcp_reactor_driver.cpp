@@ -0,0 +1,563 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <deque>
+
+#include "common/log.h"
+#include "common/spsc_queue.h"
+#include "common/thread.h"
+#include "ev.h"
+#include "framework/tcp_driver.h"
+#include "framework/tcp_reactor_driver.h"
+
+
+namespace pebble {
+
+// 网络线程内部TcpDriver的handle中[48, 60)位记录线程序号(从1开始)
+#define IO_THREAD_HANDLE_OFFSET 48
+#define IO_THREAD_HANDLE_MASK   0xFFFLL
+
+typedef enum {
+    // 主线程 -> 网络线程
+    kIO_CMD_BIND            = 0,
+    kIO_CMD_CONNECT         = 1,
+    kIO_CMD_SEND            = 2,
+    kIO_CMD_CLOSE           = 3,
+    kIO_CMD_STOP            = 4,
+    // 网络线程 -> 主线程
+    kIO_EVENT_MESSAGE       = 10,
+    kIO_EVENT_PEER_CONNECTED = 11,
+    kIO_EVENT_PEER_CLOSED   = 12,
+    kIO_EVENT_CLOSED        = 13,
+} IoEventType;
+
+/// @brief 同步命令的结果，由网络线程写入_ret后置位_done
+struct SyncResult {
+    SyncResult() : _ret(0), _done(0) {}
+    int64_t _ret;
+    int32_t _done;
+};
+
+/// @brief 主线程与网络线程间传递的命令/事件，_data由发送方malloc，接收方free
+struct IoEvent {
+    IoEvent() : _type(0), _local_handle(-1), _remote_handle(-1), _arrived_ms(0),
+        _data(NULL), _data_len(0), _result(NULL) {}
+
+    int32_t         _type;
+    int64_t         _local_handle;
+    int64_t         _remote_handle;
+    int64_t         _arrived_ms;
+    uint8_t*        _data;
+    uint32_t        _data_len;
+    SyncResult*     _result;
+};
+
+static uint8_t* CopyData(const uint8_t* data, uint32_t len) {
+    uint8_t* buff = static_cast<uint8_t*>(malloc(len > 0 ? len : 1));
+    if (buff != NULL && len > 0) {
+        memcpy(buff, data, len);
+    }
+    return buff;
+}
+
+class IoThread : public Thread {
+public:
+    IoThread(uint32_t idx)
+        :   m_idx(idx), m_driver(true), m_commands(TcpReactorDriver::IO_QUEUE_SIZE),
+            m_events(TcpReactorDriver::IO_QUEUE_SIZE), m_stop(0) {}
+
+    virtual ~IoThread() {
+        IoEvent event;
+        while (m_commands.TryPop(&event)) {
+            free(event._data);
+        }
+        while (m_events.TryPop(&event)) {
+            free(event._data);
+        }
+        for (std::deque<IoEvent>::iterator it = m_pending_events.begin(); it != m_pending_events.end(); ++it) {
+            free(it->_data);
+        }
+    }
+
+    int32_t Init(int64_t handle_mask);
+
+    virtual void Run();
+
+    /// @brief 主线程调用，投递命令到网络线程
+    bool PostCommand(const IoEvent& command);
+
+    /// @brief 主线程调用，投递命令并等待网络线程执行完成
+    /// @note 等待期间把网络线程上报的事件转存到主线程本地，避免事件队列满时双方互相等待
+    int64_t SyncCommand(int32_t type, int64_t handle, const std::string& url);
+
+    /// @brief 主线程调用，停止网络线程并等待退出
+    void Stop();
+
+    /// @brief 主线程调用，取网络线程上报的事件，先取同步命令等待期间转存的事件以保持顺序
+    bool PopEvent(IoEvent* event);
+
+    bool IsEventEmpty() const { return m_pending_events.empty() && m_events.IsEmpty(); }
+
+    void OnCommand();
+
+private:
+    void PushEvent(const IoEvent& event);
+
+    int OnMessage(const uint8_t* msg, uint32_t msg_len, MsgExternInfo* info);
+
+    int OnPeerConnected(int64_t local_handle, int64_t peer_handle);
+
+    int OnPeerClosed(int64_t local_handle, int64_t peer_handle);
+
+    int OnClosed(int64_t handle);
+
+private:
+    ev_async            m_async;
+    uint32_t            m_idx;
+    TcpDriver           m_driver;
+    SpscQueue<IoEvent>  m_commands;     // 主线程 -> 网络线程
+    SpscQueue<IoEvent>  m_events;       // 网络线程 -> 主线程
+    int32_t             m_stop;
+    std::deque<IoEvent> m_pending_events; // 同步命令等待期间从m_events转存的事件，仅主线程访问
+};
+
+static void on_io_command(EV_P_ ev_async *w, int revents) {
+    IoThread* io_thread = static_cast<IoThread*>(w->data);
+    io_thread->OnCommand();
+}
+
+int32_t IoThread::Init(int64_t handle_mask) {
+    MessageCallbacks cbs;
+    using namespace cxx::placeholders;
+    cbs._on_message        = cxx::bind(&IoThread::OnMessage, this, _1, _2, _3);
+    cbs._on_peer_connected = cxx::bind(&IoThread::OnPeerConnected, this, _1, _2);
+    cbs._on_peer_closed    = cxx::bind(&IoThread::OnPeerClosed, this, _1, _2);
+    cbs._on_closed         = cxx::bind(&IoThread::OnClosed, this, _1);
+    m_driver.SetCallBack(cbs);
+    m_driver.SetHandleMask(handle_mask);
+    m_driver.SetReusePort(true);
+
+    int32_t ret = m_driver.Init();
+    if (ret != 0) {
+        return ret;
+    }
+
+    ev_async_init(&m_async, on_io_command);
+    m_async.data = this;
+    ev_async_start(m_driver.GetLoop(), &m_async);
+    return 0;
+}
+
+void IoThread::Run() {
+    // 网络线程只处理自己loop上的事件，命令通过ev_async唤醒
+    ev_run(m_driver.GetLoop(), 0);
+}
+
+bool IoThread::PostCommand(const IoEvent& command) {
+    if (!m_commands.TryPush(command)) {
+        return false;
+    }
+    ev_async_send(m_driver.GetLoop(), &m_async);
+    return true;
+}
+
+int64_t IoThread::SyncCommand(int32_t type, int64_t handle, const std::string& url) {
+    SyncResult result;
+    IoEvent command;
+    command._type     = type;
+    command._remote_handle = handle;
+    command._data     = CopyData((const uint8_t*)url.data(), url.size());
+    command._data_len = url.size();
+    command._result   = &result;
+    if (!PostCommand(command)) {
+        free(command._data);
+        return kMESSAGE_SYSTEM_ERROR;
+    }
+
+    // Bind/Connect不在关键路径上，简单等待网络线程完成
+    // 网络线程可能正阻塞在PushEvent中等待事件队列腾出空间，等待期间持续把事件转存出来
+    IoEvent event;
+    while (__atomic_load_n(&result._done, __ATOMIC_ACQUIRE) == 0) {
+        bool drained = false;
+        while (m_events.TryPop(&event)) {
+            m_pending_events.push_back(event);
+            drained = true;
+        }
+        if (!drained) {
+            usleep(100);
+        }
+    }
+    return result._ret;
+}
+
+bool IoThread::PopEvent(IoEvent* event) {
+    if (!m_pending_events.empty()) {
+        *event = m_pending_events.front();
+        m_pending_events.pop_front();
+        return true;
+    }
+    return m_events.TryPop(event);
+}
+
+void IoThread::Stop() {
+    __atomic_store_n(&m_stop, 1, __ATOMIC_RELEASE);
+    IoEvent command;
+    command._type = kIO_CMD_STOP;
+    while (!PostCommand(command)) {
+        usleep(100);
+    }
+    Join();
+}
+
+void IoThread::OnCommand() {
+    IoEvent command;
+    while (m_commands.TryPop(&command)) {
+        int64_t ret = 0;
+        switch (command._type) {
+            case kIO_CMD_BIND:
+                ret = m_driver.Bind(std::string((const char*)command._data, command._data_len));
+                break;
+
+            case kIO_CMD_CONNECT:
+                ret = m_driver.Connect(std::string((const char*)command._data, command._data_len));
+                break;
+
+            case kIO_CMD_SEND:
+                ret = m_driver.Send(command._remote_handle, command._data, command._data_len, 0);
+                if (ret != 0) {
+                    PLOG_ERROR_N_EVERY_SECOND(1, "io thread %u send to %ld failed(%ld)",
+                        m_idx, command._remote_handle, ret);
+                    // 主线程投递时已返回成功，发送失败通过关闭事件通知业务
+                    // 连接已不存在时关闭事件已经上报过(或由业务自己关闭)，不重复上报
+                    m_driver.CloseAndNotify(command._remote_handle);
+                }
+                break;
+
+            case kIO_CMD_CLOSE:
+                ret = m_driver.Close(command._remote_handle);
+                break;
+
+            case kIO_CMD_STOP:
+                ev_break(m_driver.GetLoop(), EVBREAK_ALL);
+                break;
+
+            default:
+                break;
+        }
+
+        free(command._data);
+        if (command._result != NULL) {
+            command._result->_ret = ret;
+            __atomic_store_n(&command._result->_done, 1, __ATOMIC_RELEASE);
+        }
+    }
+}
+
+void IoThread::PushEvent(const IoEvent& event) {
+    // 主线程处理不过来时网络线程等待，形成反压
+    while (!m_events.TryPush(event)) {
+        if (__atomic_load_n(&m_stop, __ATOMIC_ACQUIRE) != 0) {
+            free(event._data);
+            return;
+        }
+        usleep(10);
+    }
+    // 主线程可能阻塞在Message::Poll中
+    Message::Wakeup();
+}
+
+int IoThread::OnMessage(const uint8_t* msg, uint32_t msg_len, MsgExternInfo* info) {
+    IoEvent event;
+    event._type          = kIO_EVENT_MESSAGE;
+    event._local_handle  = info->_self_handle;
+    event._remote_handle = info->_remote_handle;
+    event._arrived_ms    = info->_msg_arrived_ms;
+    event._data          = CopyData(msg, msg_len);
+    event._data_len      = msg_len;
+    if (NULL == event._data) {
+        return kMESSAGE_SYSTEM_ERROR;
+    }
+    PushEvent(event);
+    return 0;
+}
+
+int IoThread::OnPeerConnected(int64_t local_handle, int64_t peer_handle) {
+    IoEvent event;
+    event._type          = kIO_EVENT_PEER_CONNECTED;
+    event._local_handle  = local_handle;
+    event._remote_handle = peer_handle;
+    PushEvent(event);
+    return 0;
+}
+
+int IoThread::OnPeerClosed(int64_t local_handle, int64_t peer_handle) {
+    IoEvent event;
+    event._type          = kIO_EVENT_PEER_CLOSED;
+    event._local_handle  = local_handle;
+    event._remote_handle = peer_handle;
+    PushEvent(event);
+    return 0;
+}
+
+int IoThread::OnClosed(int64_t handle) {
+    IoEvent event;
+    event._type          = kIO_EVENT_CLOSED;
+    event._local_handle  = handle;
+    event._remote_handle = handle;
+    PushEvent(event);
+    return 0;
+}
+
+
+TcpReactorDriver::TcpReactorDriver(uint32_t io_thread_num) {
+    m_io_thread_num = io_thread_num;
+    m_next_connect_thread = 0;
+    m_next_update_thread = 0;
+}
+
+TcpReactorDriver::~TcpReactorDriver() {
+    for (std::vector<IoThread*>::iterator it = m_io_threads.begin(); it != m_io_threads.end(); ++it) {
+        (*it)->Stop();
+        delete *it;
+    }
+    m_io_threads.clear();
+}
+
+int32_t TcpReactorDriver::Init() {
+    if (m_io_thread_num == 0 || m_io_thread_num > MAX_IO_THREAD_NUM) {
+        PLOG_ERROR("io thread num %u invalid, should be in [1, %u]", m_io_thread_num, MAX_IO_THREAD_NUM);
+        return kMESSAGE_INVAILD_PARAM;
+    }
+
+    for (uint32_t i = 0; i < m_io_thread_num; i++) {
+        IoThread* io_thread = new IoThread(i);
+        int64_t handle_mask = GetHandleMask() | (static_cast<int64_t>(i + 1) << IO_THREAD_HANDLE_OFFSET);
+        int32_t ret = io_thread->Init(handle_mask);
+        if (ret != 0) {
+            PLOG_ERROR("io thread %u init failed(%d)", i, ret);
+            delete io_thread;
+            return kMESSAGE_SYSTEM_ERROR;
+        }
+        if (!io_thread->Start()) {
+            PLOG_ERROR("io thread %u start failed", i);
+            delete io_thread;
+            return kMESSAGE_SYSTEM_ERROR;
+        }
+        m_io_threads.push_back(io_thread);
+    }
+
+    return 0;
+}
+
+int64_t TcpReactorDriver::Bind(const std::string& url) {
+    int64_t handle = GenHandle();
+    if (handle < 0) {
+        PLOG_ERROR("gen handle %ld invalid", handle);
+        return kMESSAGE_SYSTEM_ERROR;
+    }
+
+    std::vector<int64_t> listeners;
+    for (uint32_t i = 0; i < m_io_threads.size(); i++) {
+        int64_t listener = m_io_threads[i]->SyncCommand(kIO_CMD_BIND, -1, url);
+        if (listener < 0) {
+            PLOG_ERROR("io thread %u bind %s failed(%ld)", i, url.c_str(), listener);
+            for (uint32_t j = 0; j < listeners.size(); j++) {
+                GetIoThread(listeners[j])->SyncCommand(kIO_CMD_CLOSE, listeners[j], "");
+            }
+            return listener;
+        }
+        listeners.push_back(listener);
+    }
+
+    for (uint32_t i = 0; i < listeners.size(); i++) {
+        m_listener_to_bind[listeners[i]] = handle;
+    }
+    m_bind_handles[handle] = listeners;
+
+    return handle;
+}
+
+int64_t TcpReactorDriver::Connect(const std::string& url) {
+    IoThread* io_thread = m_io_threads[m_next_connect_thread++ % m_io_threads.size()];
+    return io_thread->SyncCommand(kIO_CMD_CONNECT, -1, url);
+}
+
+int32_t TcpReactorDriver::Send(int64_t handle, const uint8_t* msg, uint32_t msg_len, int32_t flag) {
+    const uint8_t* frags[1] = { msg     };
+    uint32_t fragslen[1]    = { msg_len };
+
+    return SendV(handle, 1, frags, fragslen, flag);
+}
+
+int32_t TcpReactorDriver::SendV(int64_t handle, uint32_t msg_frag_num,
+                                const uint8_t* msg_frag[], uint32_t msg_frag_len[], int32_t flag) {
+    IoThread* io_thread = GetIoThread(handle);
+    if (NULL == io_thread) {
+        return kMESSAGE_INVAILD_HANDLE;
+    }
+
+    uint32_t msg_len = 0;
+    for (uint32_t i = 0; i < msg_frag_num; i++) {
+        msg_len += msg_frag_len[i];
+    }
+
+    IoEvent command;
+    command._type          = kIO_CMD_SEND;
+    command._remote_handle = handle;
+    command._data          = static_cast<uint8_t*>(malloc(msg_len > 0 ? msg_len : 1));
+    command._data_len      = msg_len;
+    if (NULL == command._data) {
+        return kMESSAGE_SYSTEM_ERROR;
+    }
+    uint32_t offset = 0;
+    for (uint32_t i = 0; i < msg_frag_num; i++) {
+        memcpy(command._data + offset, msg_frag[i], msg_frag_len[i]);
+        offset += msg_frag_len[i];
+    }
+
+    if (!io_thread->PostCommand(command)) {
+        free(command._data);
+        PLOG_ERROR_N_EVERY_SECOND(1, "handle %ld io queue full", handle);
+        return kMESSAGE_SEND_BUFF_NOT_ENOUGH;
+    }
+
+    return 0;
+}
+
+int32_t TcpReactorDriver::Close(int64_t handle) {
+    cxx::unordered_map<int64_t, std::vector<int64_t> >::iterator it = m_bind_handles.find(handle);
+    if (it != m_bind_handles.end()) {
+        for (uint32_t i = 0; i < it->second.size(); i++) {
+            int64_t listener = it->second[i];
+            GetIoThread(listener)->SyncCommand(kIO_CMD_CLOSE, listener, "");
+            m_listener_to_bind.erase(listener);
+        }
+        m_bind_handles.erase(it);
+        return 0;
+    }
+
+    IoThread* io_thread = GetIoThread(handle);
+    if (NULL == io_thread) {
+        return kMESSAGE_INVAILD_HANDLE;
+    }
+
+    IoEvent command;
+    command._type          = kIO_CMD_CLOSE;
+    command._remote_handle = handle;
+    if (!io_thread->PostCommand(command)) {
+        return kMESSAGE_SEND_BUFF_NOT_ENOUGH;
+    }
+    return 0;
+}
+
+int32_t TcpReactorDriver::Update() {
+    int num = 0;
+    uint32_t thread_num = m_io_threads.size();
+    IoEvent event;
+    // 每轮从不同的网络线程开始，每个线程一次最多处理单连接配额个消息，轮询直到配额用完或全部处理完
+    bool has_more = true;
+    while (has_more && HasLoopMsgBudget()) {
+        has_more = false;
+        for (uint32_t n = 0; n < thread_num && HasLoopMsgBudget(); n++) {
+            IoThread* io_thread = m_io_threads[(m_next_update_thread + n) % thread_num];
+            uint32_t batch_num = GetMsgBudget(IO_QUEUE_SIZE);
+            uint32_t msg_num = 0;
+            while (msg_num < batch_num && io_thread->PopEvent(&event)) {
+                // 连接事件不占用配额
+                if (kIO_EVENT_MESSAGE == event._type) {
+                    AcquireMsgBudget(0);
+                    msg_num++;
+                }
+                OnEvent(event);
+                num++;
+            }
+            if (msg_num >= batch_num) {
+                has_more = true;
+            }
+        }
+    }
+
+    if (thread_num > 0) {
+        m_next_update_thread = (m_next_update_thread + 1) % thread_num;
+    }
+
+    // 配额用完时仍有未处理的事件，留到后续Update处理，并且不能让出CPU
+    for (uint32_t i = 0; i < thread_num; i++) {
+        if (!m_io_threads[i]->IsEventEmpty()) {
+            OnCarryOver();
+            num++;
+        }
+    }
+
+    return num;
+}
+
+void TcpReactorDriver::OnEvent(IoEvent& event) {
+    int64_t local_handle = ToBindHandle(event._local_handle);
+    switch (event._type) {
+        case kIO_EVENT_MESSAGE:
+            if (m_cbs._on_message) {
+                MsgExternInfo msg_info;
+                msg_info._self_handle    = local_handle;
+                msg_info._remote_handle  = event._remote_handle;
+                msg_info._msg_arrived_ms = event._arrived_ms;
+                m_cbs._on_message(event._data, event._data_len, &msg_info);
+            }
+            break;
+
+        case kIO_EVENT_PEER_CONNECTED:
+            if (m_cbs._on_peer_connected) {
+                m_cbs._on_peer_connected(local_handle, event._remote_handle);
+            }
+            break;
+
+        case kIO_EVENT_PEER_CLOSED:
+            if (m_cbs._on_peer_closed) {
+                m_cbs._on_peer_closed(local_handle, event._remote_handle);
+            }
+            break;
+
+        case kIO_EVENT_CLOSED:
+            if (m_cbs._on_closed) {
+                m_cbs._on_closed(local_handle);
+            }
+            break;
+
+        default:
+            break;
+    }
+    free(event._data);
+    event._data = NULL;
+}
+
+IoThread* TcpReactorDriver::GetIoThread(int64_t handle) {
+    int64_t idx = ((handle >> IO_THREAD_HANDLE_OFFSET) & IO_THREAD_HANDLE_MASK) - 1;
+    if (idx < 0 || idx >= static_cast<int64_t>(m_io_threads.size())) {
+        return NULL;
+    }
+    return m_io_threads[idx];
+}
+
+int64_t TcpReactorDriver::ToBindHandle(int64_t handle) {
+    cxx::unordered_map<int64_t, int64_t>::iterator it = m_listener_to_bind.find(handle);
+    if (it != m_listener_to_bind.end()) {
+        return it->second;
+    }
+    return handle;
+}
+
+
+} // namespace pebble
@@ -0,0 +1,85 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#ifndef _PEBBLE_TCP_REACTOR_DRIVER_H_
+#define _PEBBLE_TCP_REACTOR_DRIVER_H_
+
+#include <vector>
+
+#include "framework/message.h"
+
+
+namespace pebble {
+
+class IoThread;
+struct IoEvent;
+
+
+/// @brief 多网络线程的TCP驱动，与TcpDriver使用相同的"tcp"前缀和消息格式
+/// @note 每个网络线程拥有独立的ev loop和TcpDriver，Bind时各线程以SO_REUSEPORT监听同一地址，
+///     由内核把连接分配到各线程；网络线程完成收包和消息拆分，通过无锁SPSC队列把完整消息交给主线程，
+///     主线程的发送和关闭请求同样经SPSC队列交给连接所属的网络线程
+///     消息回调均在主线程Update中执行，业务仍是单线程语义
+class TcpReactorDriver : public MessageDriver {
+public:
+    explicit TcpReactorDriver(uint32_t io_thread_num);
+    virtual ~TcpReactorDriver();
+
+    static const uint32_t MAX_IO_THREAD_NUM = 64;
+
+    // 主线程与每个网络线程间单向队列的长度
+    static const uint32_t IO_QUEUE_SIZE = 64 * 1024;
+
+    virtual int32_t Init();
+
+    virtual int64_t Bind(const std::string& url);
+
+    virtual int64_t Connect(const std::string& url);
+
+    virtual int32_t Send(int64_t handle, const uint8_t* msg, uint32_t msg_len, int32_t flag);
+
+    /// @note 消息拷贝后交给网络线程异步发送，返回0只表示已投递；网络线程发送失败时关闭连接，
+    ///     通过on_closed/on_peer_closed回调通知
+    virtual int32_t SendV(int64_t handle, uint32_t msg_frag_num,
+                          const uint8_t* msg_frag[], uint32_t msg_frag_len[], int32_t flag);
+
+    virtual int32_t Close(int64_t handle);
+
+    virtual int32_t Update();
+
+    virtual const char* Prefix() const { return "tcp"; }
+
+private:
+    IoThread* GetIoThread(int64_t handle);
+
+    int64_t ToBindHandle(int64_t handle);
+
+    void OnEvent(IoEvent& event);
+
+private:
+    uint32_t m_io_thread_num;
+    uint32_t m_next_connect_thread;
+    uint32_t m_next_update_thread;
+    std::vector<IoThread*> m_io_threads;
+
+    // Bind返回给用户的handle -> 各网络线程的监听handle
+    cxx::unordered_map<int64_t, std::vector<int64_t> > m_bind_handles;
+    // 网络线程的监听handle -> Bind返回给用户的handle
+    cxx::unordered_map<int64_t, int64_t> m_listener_to_bind;
+};
+
+
+} // namespace pebble
+
+#endif // _PEBBLE_TCP_REACTOR_DRIVER_H_
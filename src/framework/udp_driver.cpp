@@ -0,0 +1,522 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <vector>
+
+#include "common/log.h"
+#include "common/time_utility.h"
+#include "ev.h"
+#include "framework/tcp_driver.h"
+#include "framework/udp_driver.h"
+
+
+namespace pebble {
+
+#define OFFSETOF(TYPE, MEMBER) ((size_t)(&((TYPE*)0)->MEMBER))
+#define CONTAINER(TYPE, MEMBER, pMember) (NULL == pMember ? NULL : ((TYPE*)((size_t)(pMember) - OFFSETOF(TYPE, MEMBER))))
+
+// 检查空闲对端的周期
+#define PEER_CHECK_INTERVAL_MS 60000
+
+
+struct UdpPeer {
+    struct sockaddr_in  _addr;
+    int64_t             _last_active_ms;
+};
+
+/// @brief 待发送的数据报，数据存放在UdpSocket::_send_data中
+struct PendingMsg {
+    uint32_t            _offset;
+    uint32_t            _len;
+    int64_t             _peer;      // 已connect的socket为-1
+};
+
+struct UdpSocket {
+    UdpSocket(UdpDriver* driver, struct ev_loop* loop, int64_t handle)
+        : _fd(-1), _start_read(false), _connected(false), _driver(driver), _loop(loop), _handle(handle) {}
+    ~UdpSocket() { Close(); }
+
+    int Open(const std::string& ip, uint16_t port, bool is_bind);
+    void Close();
+
+    static uint64_t AddrKey(const struct sockaddr_in& addr) {
+        return (static_cast<uint64_t>(addr.sin_addr.s_addr) << 16) | addr.sin_port;
+    }
+
+    int                 _fd;
+    bool                _start_read;
+    bool                _connected;
+    UdpDriver*          _driver;
+    struct ev_loop*     _loop;
+    ev_io               _rw;    // read watcher
+    int64_t             _handle;
+
+    cxx::unordered_map<int64_t, UdpPeer>    _peers;         // peer handle -> peer
+    cxx::unordered_map<uint64_t, int64_t>   _addr_to_peer;  // addr key -> peer handle
+
+    std::vector<char>       _send_data;
+    std::vector<PendingMsg> _send_msgs;
+};
+
+static void on_udp_read(EV_P_ ev_io *w, int revents) {
+    UdpSocket* sock = CONTAINER(UdpSocket, _rw, w);
+    sock->_driver->Recv(sock);
+}
+
+int UdpSocket::Open(const std::string& ip, uint16_t port, bool is_bind) {
+    _fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (_fd < 0) {
+        PLOG_ERROR("socket failed %d:%s", errno, strerror(errno));
+        return -1;
+    }
+
+    int flags = fcntl(_fd, F_GETFL);
+    if (flags < 0 || fcntl(_fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        PLOG_ERROR("fcntl %d failed %d:%s", _fd, errno, strerror(errno));
+        return -2;
+    }
+
+    struct sockaddr_in socket_addr;
+    bzero(&socket_addr, sizeof(socket_addr));
+    socket_addr.sin_family = AF_INET;
+    if (inet_aton(ip.c_str(), &(socket_addr.sin_addr)) == 0) {
+        PLOG_ERROR("ip %s is invalid", ip.c_str());
+        return -3;
+    }
+    socket_addr.sin_port = htons(port);
+
+    if (is_bind) {
+        int flag = 1;
+        if (0 != setsockopt(_fd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag))) {
+            PLOG_ERROR("setsockopt %d failed %d:%s", _fd, errno, strerror(errno));
+            return -4;
+        }
+        if (0 != bind(_fd, (struct sockaddr *)&socket_addr, sizeof(socket_addr))) {
+            PLOG_ERROR("bind %d failed %d:%s", _fd, errno, strerror(errno));
+            return -5;
+        }
+    } else {
+        if (0 != connect(_fd, (struct sockaddr *)&socket_addr, sizeof(socket_addr))) {
+            PLOG_ERROR("connect %d failed %d:%s", _fd, errno, strerror(errno));
+            return -6;
+        }
+        _connected = true;
+    }
+
+    ev_io_init(&_rw, on_udp_read, _fd, EV_READ);
+    ev_io_start(_loop, &_rw);
+    _start_read = true;
+
+    return 0;
+}
+
+void UdpSocket::Close() {
+    if (_start_read) { ev_io_stop(_loop, &_rw); _start_read = false; }
+    if (_fd >= 0)    { close(_fd); _fd = -1; }
+    _send_data.clear();
+    _send_msgs.clear();
+}
+
+UdpDriver::UdpDriver() {
+    m_loop          = NULL;
+    m_proc_num      = 0;
+    m_recv_buff     = NULL;
+    m_last_check_ms = 0;
+}
+
+UdpDriver::~UdpDriver() {
+    m_peers.clear();
+    m_sockets.clear();
+
+    // 与TcpDriver共用default loop，由TcpDriver销毁
+    m_loop = NULL;
+
+    delete [] m_recv_buff;
+    m_recv_buff = NULL;
+}
+
+int32_t UdpDriver::Init() {
+    m_recv_buff = new char[BATCH_MSG_NUM * MAX_UDP_MSG_LEN];
+    m_loop = ev_default_loop(0);
+    m_last_check_ms = TimeUtility::GetLoopMS();
+    return 0;
+}
+
+int64_t UdpDriver::Bind(const std::string& url) {
+    std::string ip;
+    uint16_t port = 0;
+    if (UrlToIpPort(url, &ip, &port) != 0) {
+        return kMESSAGE_INVAILD_PARAM;
+    }
+
+    int64_t handle = GenHandle();
+    if (handle < 0) {
+        PLOG_ERROR("gen handle %ld invalid", handle);
+        return kMESSAGE_SYSTEM_ERROR;
+    }
+
+    cxx::shared_ptr<UdpSocket> sock(new UdpSocket(this, m_loop, handle));
+    if (sock->Open(ip, port, true) != 0) {
+        return kMESSAGE_BIND_ADDR_FAILED;
+    }
+
+    m_sockets[handle] = sock;
+
+    return handle;
+}
+
+int64_t UdpDriver::Connect(const std::string& url) {
+    std::string ip;
+    uint16_t port = 0;
+    if (UrlToIpPort(url, &ip, &port) != 0) {
+        return kMESSAGE_INVAILD_PARAM;
+    }
+
+    int64_t handle = GenHandle();
+    if (handle < 0) {
+        PLOG_ERROR("gen handle %ld invalid", handle);
+        return kMESSAGE_SYSTEM_ERROR;
+    }
+
+    cxx::shared_ptr<UdpSocket> sock(new UdpSocket(this, m_loop, handle));
+    if (sock->Open(ip, port, false) != 0) {
+        return kMESSAGE_CONNECT_ADDR_FAILED;
+    }
+
+    m_sockets[handle] = sock;
+
+    return handle;
+}
+
+int32_t UdpDriver::Send(int64_t handle, const uint8_t* msg, uint32_t msg_len, int32_t flag) {
+    const uint8_t* frags[1] = { msg     };
+    uint32_t fragslen[1]    = { msg_len };
+
+    return SendV(handle, 1, frags, fragslen, flag);
+}
+
+int32_t UdpDriver::SendV(int64_t handle, uint32_t msg_frag_num,
+                         const uint8_t* msg_frag[], uint32_t msg_frag_len[], int32_t flag) {
+    int64_t sock_handle = handle;
+    int64_t peer = -1;
+    cxx::unordered_map<int64_t, int64_t>::iterator pit = m_peers.find(handle);
+    if (pit != m_peers.end()) {
+        sock_handle = pit->second;
+        peer = handle;
+    }
+
+    cxx::unordered_map<int64_t, cxx::shared_ptr<UdpSocket> >::iterator it = m_sockets.find(sock_handle);
+    if (m_sockets.end() == it) {
+        return kMESSAGE_INVAILD_HANDLE;
+    }
+    UdpSocket* sock = it->second.get();
+    // Bind的socket没有默认对端，只能通过对端handle回包
+    if (peer < 0 && !sock->_connected) {
+        return kMESSAGE_INVAILD_HANDLE;
+    }
+
+    uint32_t msg_len = 0;
+    for (uint32_t i = 0; i < msg_frag_num; i++) {
+        msg_len += msg_frag_len[i];
+    }
+    if (msg_len > MAX_UDP_MSG_LEN) {
+        PLOG_ERROR_N_EVERY_SECOND(1, "handle %ld msg len %u > %u", handle, msg_len, MAX_UDP_MSG_LEN);
+        return kMESSAGE_INVAILD_PARAM;
+    }
+
+    if (sock->_send_msgs.size() >= BATCH_MSG_NUM) {
+        FlushSocket(sock);
+    }
+    if (sock->_send_msgs.size() >= MAX_PENDING_SEND_NUM) {
+        PLOG_ERROR_N_EVERY_SECOND(1, "handle %ld pending send num exceed %u", handle, MAX_PENDING_SEND_NUM);
+        return kMESSAGE_SEND_BUFF_NOT_ENOUGH;
+    }
+
+    PendingMsg pending;
+    pending._offset = sock->_send_data.size();
+    pending._len    = msg_len;
+    pending._peer   = peer;
+    for (uint32_t i = 0; i < msg_frag_num; i++) {
+        sock->_send_data.insert(sock->_send_data.end(),
+            (const char*)msg_frag[i], (const char*)msg_frag[i] + msg_frag_len[i]);
+    }
+    sock->_send_msgs.push_back(pending);
+
+    m_proc_num++;
+
+    return 0;
+}
+
+int32_t UdpDriver::Close(int64_t handle) {
+    cxx::unordered_map<int64_t, int64_t>::iterator pit = m_peers.find(handle);
+    if (pit != m_peers.end()) {
+        cxx::unordered_map<int64_t, cxx::shared_ptr<UdpSocket> >::iterator it = m_sockets.find(pit->second);
+        if (it != m_sockets.end()) {
+            UdpSocket* sock = it->second.get();
+            cxx::unordered_map<int64_t, UdpPeer>::iterator peer_it = sock->_peers.find(handle);
+            if (peer_it != sock->_peers.end()) {
+                sock->_addr_to_peer.erase(UdpSocket::AddrKey(peer_it->second._addr));
+                sock->_peers.erase(peer_it);
+            }
+        }
+        m_peers.erase(pit);
+        return 0;
+    }
+
+    cxx::unordered_map<int64_t, cxx::shared_ptr<UdpSocket> >::iterator it = m_sockets.find(handle);
+    if (it != m_sockets.end()) {
+        cxx::unordered_map<int64_t, UdpPeer>::iterator peer_it = it->second->_peers.begin();
+        for (; peer_it != it->second->_peers.end(); ++peer_it) {
+            m_peers.erase(peer_it->first);
+        }
+        // 关闭前尽量把缓存的数据发出去
+        FlushSocket(it->second.get());
+        it->second->Close();
+        m_sockets.erase(it);
+    }
+    return 0;
+}
+
+int32_t UdpDriver::Update() {
+    ev_run(m_loop, EVRUN_NOWAIT);
+
+    Flush();
+
+    CheckIdlePeer();
+
+    int num = m_proc_num;
+    m_proc_num = 0;
+    return num;
+}
+
+void UdpDriver::Flush() {
+    cxx::unordered_map<int64_t, cxx::shared_ptr<UdpSocket> >::iterator it = m_sockets.begin();
+    for (; it != m_sockets.end(); ++it) {
+        if (!it->second->_send_msgs.empty()) {
+            FlushSocket(it->second.get());
+        }
+    }
+}
+
+void UdpDriver::Recv(UdpSocket* sock) {
+    // 消息回调中可能关闭socket，处理期间保持socket对象有效
+    cxx::shared_ptr<UdpSocket> guard;
+    cxx::unordered_map<int64_t, cxx::shared_ptr<UdpSocket> >::iterator it = m_sockets.find(sock->_handle);
+    if (it != m_sockets.end()) {
+        guard = it->second;
+    }
+
+    // 每次读取的数据报个数受消息处理配额限制，未读的数据报留在socket中，后续Update再处理
+    uint32_t batch_num = GetMsgBudget(BATCH_MSG_NUM);
+    if (batch_num == 0) {
+        OnCarryOver();
+        return;
+    }
+
+    struct mmsghdr msgs[BATCH_MSG_NUM];
+    struct iovec iovs[BATCH_MSG_NUM];
+    struct sockaddr_in addrs[BATCH_MSG_NUM];
+    memset(msgs, 0, sizeof(msgs));
+    for (uint32_t i = 0; i < batch_num; i++) {
+        iovs[i].iov_base = m_recv_buff + i * MAX_UDP_MSG_LEN;
+        iovs[i].iov_len  = MAX_UDP_MSG_LEN;
+        msgs[i].msg_hdr.msg_iov     = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen  = 1;
+        msgs[i].msg_hdr.msg_name    = &addrs[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+    }
+
+    int n = 0;
+    do {
+        n = recvmmsg(sock->_fd, msgs, batch_num, MSG_DONTWAIT, NULL);
+    } while (n < 0 && errno == EINTR);
+
+    if (n < 0) {
+        // 已connect的socket可能收到ICMP错误(如ECONNREFUSED)，忽略即可
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            PLOG_ERROR_N_EVERY_SECOND(1, "handle %ld fd %d recvmmsg error %d:%s",
+                sock->_handle, sock->_fd, errno, strerror(errno));
+        }
+        return;
+    }
+
+    if (batch_num < BATCH_MSG_NUM && static_cast<uint32_t>(n) == batch_num) {
+        OnCarryOver();
+    }
+
+    // 收到新数据时刷新循环时间，作为这批消息的到达时间
+    TimeUtility::RefreshLoopTime();
+    int64_t arrived_ms = TimeUtility::GetLoopMS();
+    for (int i = 0; i < n; i++) {
+        AcquireMsgBudget(0);
+
+        if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+            PLOG_ERROR_N_EVERY_SECOND(1, "handle %ld msg truncated", sock->_handle);
+            continue;
+        }
+        if (msgs[i].msg_len == 0) {
+            continue;
+        }
+
+        MsgExternInfo msg_info;
+        msg_info._self_handle    = sock->_handle;
+        msg_info._remote_handle  = sock->_handle;
+        msg_info._msg_arrived_ms = arrived_ms;
+        if (!sock->_connected) {
+            msg_info._remote_handle = GetPeerHandle(sock, &addrs[i]);
+            if (msg_info._remote_handle < 0) {
+                continue;
+            }
+        }
+
+        if (m_cbs._on_message) {
+            m_cbs._on_message((const uint8_t*)iovs[i].iov_base, msgs[i].msg_len, &msg_info);
+            m_proc_num++;
+        }
+
+        // 回调中socket可能已被关闭
+        if (sock->_fd < 0) {
+            return;
+        }
+    }
+}
+
+int64_t UdpDriver::GetPeerHandle(UdpSocket* sock, const void* addr) {
+    const struct sockaddr_in* peer_addr = static_cast<const struct sockaddr_in*>(addr);
+    uint64_t key = UdpSocket::AddrKey(*peer_addr);
+    cxx::unordered_map<uint64_t, int64_t>::iterator it = sock->_addr_to_peer.find(key);
+    if (it != sock->_addr_to_peer.end()) {
+        sock->_peers[it->second]._last_active_ms = TimeUtility::GetLoopMS();
+        return it->second;
+    }
+
+    int64_t peer = GenHandle();
+    if (peer < 0) {
+        PLOG_ERROR("gen handle %ld invalid", peer);
+        return -1;
+    }
+
+    UdpPeer& udp_peer = sock->_peers[peer];
+    udp_peer._addr = *peer_addr;
+    udp_peer._last_active_ms = TimeUtility::GetLoopMS();
+    sock->_addr_to_peer[key] = peer;
+    m_peers[peer] = sock->_handle;
+
+    if (m_cbs._on_peer_connected) {
+        m_cbs._on_peer_connected(sock->_handle, peer);
+    }
+
+    return peer;
+}
+
+int32_t UdpDriver::FlushSocket(UdpSocket* sock) {
+    struct mmsghdr msgs[BATCH_MSG_NUM];
+    struct iovec iovs[BATCH_MSG_NUM];
+
+    uint32_t sent = 0;
+    uint32_t total = sock->_send_msgs.size();
+    while (sent < total) {
+        uint32_t num = 0;
+        memset(msgs, 0, sizeof(msgs));
+        for (uint32_t i = sent; i < total && num < BATCH_MSG_NUM; i++) {
+            const PendingMsg& pending = sock->_send_msgs[i];
+            iovs[num].iov_base = &sock->_send_data[0] + pending._offset;
+            iovs[num].iov_len  = pending._len;
+            msgs[num].msg_hdr.msg_iov    = &iovs[num];
+            msgs[num].msg_hdr.msg_iovlen = 1;
+            if (pending._peer >= 0) {
+                // 对端可能已被关闭或清理，没有对端地址时跳过
+                cxx::unordered_map<int64_t, UdpPeer>::iterator it = sock->_peers.find(pending._peer);
+                if (it == sock->_peers.end()) {
+                    if (num == 0) {
+                        sent++;
+                        continue;
+                    }
+                    break;
+                }
+                msgs[num].msg_hdr.msg_name    = &(it->second._addr);
+                msgs[num].msg_hdr.msg_namelen = sizeof(it->second._addr);
+            }
+            num++;
+        }
+        if (num == 0) {
+            continue;
+        }
+
+        int ret = sendmmsg(sock->_fd, msgs, num, MSG_DONTWAIT);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            // 首个数据报发送失败，丢弃后继续发送其余数据报
+            PLOG_ERROR_N_EVERY_SECOND(1, "handle %ld fd %d sendmmsg error %d:%s",
+                sock->_handle, sock->_fd, errno, strerror(errno));
+            ret = 1;
+        }
+        sent += ret;
+    }
+
+    if (sent >= total) {
+        sock->_send_data.clear();
+        sock->_send_msgs.clear();
+    } else if (sent > 0) {
+        // 数据报按顺序连续存放，已发送的数据一并删除，剩余数据报的偏移前移
+        uint32_t base = sock->_send_msgs[sent]._offset;
+        sock->_send_data.erase(sock->_send_data.begin(), sock->_send_data.begin() + base);
+        sock->_send_msgs.erase(sock->_send_msgs.begin(), sock->_send_msgs.begin() + sent);
+        for (std::vector<PendingMsg>::iterator it = sock->_send_msgs.begin();
+            it != sock->_send_msgs.end(); ++it) {
+            it->_offset -= base;
+        }
+    }
+
+    return sent;
+}
+
+void UdpDriver::CheckIdlePeer() {
+    int64_t now = TimeUtility::GetLoopMS();
+    if (now - m_last_check_ms < PEER_CHECK_INTERVAL_MS) {
+        return;
+    }
+    m_last_check_ms = now;
+
+    std::vector<std::pair<int64_t, int64_t> > idle_peers;
+    cxx::unordered_map<int64_t, cxx::shared_ptr<UdpSocket> >::iterator it = m_sockets.begin();
+    for (; it != m_sockets.end(); ++it) {
+        cxx::unordered_map<int64_t, UdpPeer>::iterator peer_it = it->second->_peers.begin();
+        for (; peer_it != it->second->_peers.end(); ++peer_it) {
+            if (now - peer_it->second._last_active_ms > PEER_IDLE_TIMEOUT_MS) {
+                idle_peers.push_back(std::make_pair(it->first, peer_it->first));
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < idle_peers.size(); i++) {
+        Close(idle_peers[i].second);
+        if (m_cbs._on_peer_closed) {
+            m_cbs._on_peer_closed(idle_peers[i].first, idle_peers[i].second);
+        }
+    }
+}
+
+
+} // namespace pebble
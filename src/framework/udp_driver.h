@@ -0,0 +1,91 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#ifndef _PEBBLE_UDP_DRIVER_H_
+#define _PEBBLE_UDP_DRIVER_H_
+
+#include "framework/message.h"
+
+struct ev_loop;
+
+namespace pebble {
+
+struct UdpSocket;
+
+
+/// @brief RAW UDP网络驱动接口
+/// @note 一个数据报即一个消息，不附加消息头
+///     收包使用recvmmsg批量读取，发包先缓存在socket上，每次Update时使用sendmmsg批量发出
+///     Bind的socket收到新的对端地址时生成对端handle，对端长时间无消息时自动清理
+class UdpDriver : public MessageDriver {
+public:
+    UdpDriver();
+    virtual ~UdpDriver();
+
+    // 单个数据报的最大长度
+    static const uint32_t MAX_UDP_MSG_LEN = 65536;
+
+    // recvmmsg/sendmmsg每批处理的数据报个数
+    static const uint32_t BATCH_MSG_NUM = 32;
+
+    // 单个socket上等待发送的数据报个数上限
+    static const uint32_t MAX_PENDING_SEND_NUM = 10240;
+
+    // 对端超过10分钟无消息视为已断开
+    static const int64_t PEER_IDLE_TIMEOUT_MS = 600000;
+
+    virtual int32_t Init();
+
+    virtual int64_t Bind(const std::string& url);
+
+    virtual int64_t Connect(const std::string& url);
+
+    virtual int32_t Send(int64_t handle, const uint8_t* msg, uint32_t msg_len, int32_t flag);
+
+    virtual int32_t SendV(int64_t handle, uint32_t msg_frag_num,
+                          const uint8_t* msg_frag[], uint32_t msg_frag_len[], int32_t flag);
+
+    virtual int32_t Close(int64_t handle);
+
+    virtual int32_t Update();
+
+    virtual const char* Prefix() const { return "udp"; }
+
+    virtual void Flush();
+
+public:
+    void Recv(UdpSocket* sock);
+
+private:
+    int64_t GetPeerHandle(UdpSocket* sock, const void* addr);
+
+    int32_t FlushSocket(UdpSocket* sock);
+
+    void CheckIdlePeer();
+
+private:
+    struct ev_loop* m_loop;
+    int m_proc_num;
+    char* m_recv_buff;
+    int64_t m_last_check_ms;
+
+    cxx::unordered_map<int64_t, cxx::shared_ptr<UdpSocket> > m_sockets;
+    // peer handle -> 所属的socket handle
+    cxx::unordered_map<int64_t, int64_t> m_peers;
+};
+
+
+} // namespace pebble
+
+#endif // _PEBBLE_UDP_DRIVER_H_
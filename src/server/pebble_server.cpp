@@ -24,6 +24,7 @@
 #include "common/log.h"
 #include "common/memory.h"
 #include "common/string_utility.h"
+#include "common/thread_pool.h"
 #include "common/time_utility.h"
 #include "common/timer.h"
 #include "framework/broadcast_mgr.h"
@@ -296,8 +297,10 @@ PebbleServer::PebbleServer() {
     m_monitor_centor     = NULL;
     m_task_monitor       = NULL;
     m_message_expire_monitor = NULL;
+    m_codel_monitor      = NULL;
     m_stat_manager       = NULL;
     m_timer              = NULL;
+    m_thread_pool        = NULL;
     m_stat_timer_ms      = 1000;
     m_rpc_event_handler  = NULL;
     m_last_pid_cpu_use   = 0;
@@ -344,8 +347,11 @@ PebbleServer::~PebbleServer() {
     delete m_monitor_centor;
     delete m_task_monitor;
     delete m_message_expire_monitor;
+    delete m_codel_monitor;
     delete m_stat_manager;
     delete m_ini_reader;
+    // 等待线程池中的任务执行完成后再释放协程
+    delete m_thread_pool;
     delete m_coroutine_schedule;
     delete m_timer;
     delete m_session_mgr;
@@ -372,6 +378,12 @@ int32_t PebbleServer::Init(AppEventHandler* app_event_handler, NetEventHandler*
 
     PLOG_INFO("%s", m_options.ToString().c_str());
 
+    // 要在创建网络线程之前设置，之后只读
+    if (m_options._app_tsc_clock && !TimeUtility::EnableTscClock(true)) {
+        PLOG_ERROR("invariant tsc not supported, use CLOCK_MONOTONIC");
+    }
+    TimeUtility::RefreshLoopTime();
+
     int32_t ret = InitTimer();
     CHECK_RETURN(ret);
 
@@ -387,8 +399,9 @@ int32_t PebbleServer::Init(AppEventHandler* app_event_handler, NetEventHandler*
 	cbs._on_peer_connected = cxx::bind(&PebbleServer::OnPeerConnected, this, _1, _2);
 	cbs._on_peer_closed = cxx::bind(&PebbleServer::OnPeerClosed, this, _1, _2);
 	cbs._on_closed = cxx::bind(&PebbleServer::OnClosed, this, _1);
-    ret = Message::Init(cbs);
+    ret = Message::Init(cbs, m_options._io_thread_num);
     CHECK_RETURN(ret);
+    SetMsgBudget();
 
     InitMonitor();
 
@@ -480,7 +493,8 @@ int32_t PebbleServer::Attach(Router* router, IProcessor* processor) {
 }
 
 PebbleRpc* PebbleServer::GetPebbleRpc(ProtocolType protocol_type) {
-    if (protocol_type < kPEBBLE_RPC_BINARY || protocol_type > kPEBBLE_RPC_PROTOBUF) {
+    if (protocol_type < kPEBBLE_RPC_BINARY || protocol_type >= kPROTOCOL_TYPE_BUTT
+        || protocol_type == kPEBBLE_PIPE) {
         PLOG_ERROR("param protocol_type invalid(%d)", protocol_type);
         return NULL;
     }
@@ -508,6 +522,10 @@ PebbleRpc* PebbleServer::GetPebbleRpc(ProtocolType protocol_type) {
             rpc_code_type = kCODE_PB;
             break;
 
+        case kPEBBLE_RPC_COMPACT:
+            rpc_code_type = kCODE_COMPACT;
+            break;
+
         default:
             PLOG_FATAL("unsupport protocol type %d", protocol_type);
             return NULL;
@@ -517,6 +535,9 @@ PebbleRpc* PebbleServer::GetPebbleRpc(ProtocolType protocol_type) {
     rpc_instance->SetSendFunction(Message::Send, Message::SendV);
     rpc_instance->SetEventHandler(m_rpc_event_handler);
     rpc_instance->SetProcRequestTimeoutMS(m_options._proc_req_timeout_ms);
+    rpc_instance->SetRpcVersion(m_options._rpc_version);
+    rpc_instance->SetHedgeOptions(m_options._hedge_percentile, m_options._hedge_max_ratio);
+    rpc_instance->SetConcurrencyLimit(m_options._concurrency_limit);
     m_processor_array[protocol_type] = rpc_instance;
 
     return rpc_instance;
@@ -617,12 +638,23 @@ int32_t PebbleServer::Stop() {
 int32_t PebbleServer::Update() {
     int32_t num = 0;
 
-    int64_t old = TimeUtility::GetCurrentUS();
+    // 每轮刷新一次循环时间，本轮内的定时器、超时检查、耗时统计都使用这个缓存值
+    TimeUtility::RefreshLoopTime();
+    int64_t old = TimeUtility::GetLoopUS();
 
-    Log::Instance().SetCurrentTime(old);
+    Log::Instance().SetCurrentTime(TimeUtility::GetWallUS());
 
 	num += Message::Update();
 
+    // 恢复在线程池中执行完成的协程，完成时通过Message::Wakeup唤醒主循环
+    if (m_thread_pool) {
+        int64_t co_id = -1;
+        while (m_thread_pool->GetFinishedTaskID(&co_id)) {
+            m_coroutine_schedule->Resume(co_id);
+            num++;
+        }
+    }
+
     for (int32_t i = 0; i < kNAMING_BUTT; ++i) {
         if (m_naming_array[i]) {
             num += m_naming_array[i]->Update();
@@ -653,9 +685,9 @@ int32_t PebbleServer::Update() {
     int64_t user_begin = 0;
     int64_t user_end = 0;
     if (m_event_handler) {
-        user_begin = TimeUtility::GetCurrentUS();
+        user_begin = TimeUtility::GetMonotonicUS();
         num += m_event_handler->OnUpdate();
-        user_end = TimeUtility::GetCurrentUS();
+        user_end = TimeUtility::GetMonotonicUS();
     }
 
     if (m_broadcast_mgr) {
@@ -664,7 +696,7 @@ int32_t PebbleServer::Update() {
 
     if (m_stat_manager) {
         num += m_stat_manager->Update();
-        m_stat_manager->GetStat()->AddResourceItem("_loop", (TimeUtility::GetCurrentUS() - old) / 1000);
+        m_stat_manager->GetStat()->AddResourceItem("_loop", (TimeUtility::GetMonotonicUS() - old) / 1000);
         m_stat_manager->GetStat()->AddResourceItem("_user_loop", (user_end - user_begin) / 1000);
     }
 
@@ -698,13 +730,19 @@ int32_t PebbleServer::Reload() {
 
     // flow control
     m_task_monitor->SetTaskThreshold(m_options._task_threshold);
+    SetMsgBudget();
     m_message_expire_monitor->SetExpireThreshold(m_options._message_expire_ms);
+    m_codel_monitor->SetTarget(m_options._codel_target_ms);
+    m_codel_monitor->SetInterval(m_options._codel_interval_ms);
 
     // rpc
-    for (int i = kPEBBLE_RPC_BINARY; i <= kPEBBLE_RPC_PROTOBUF; i++) {
-        if (m_processor_array[i]) {
-            (dynamic_cast<PebbleRpc*>(m_processor_array[i]))
-                ->SetProcRequestTimeoutMS(m_options._proc_req_timeout_ms);
+    for (int i = kPEBBLE_RPC_BINARY; i < kPROTOCOL_TYPE_BUTT; i++) {
+        PebbleRpc* rpc = dynamic_cast<PebbleRpc*>(m_processor_array[i]);
+        if (rpc) {
+            rpc->SetProcRequestTimeoutMS(m_options._proc_req_timeout_ms);
+            rpc->SetRpcVersion(m_options._rpc_version);
+            rpc->SetHedgeOptions(m_options._hedge_percentile, m_options._hedge_max_ratio);
+            rpc->SetConcurrencyLimit(m_options._concurrency_limit);
         }
     }
 
@@ -723,7 +761,51 @@ void PebbleServer::Idle() {
     Log::Instance().Flush();
     oss::CLogDataAPI::Flush();
 
-    usleep(m_options._idle_us);
+    // 阻塞等待网络事件，最长_idle_us，有定时器更早到期时只等到定时器到期
+    int64_t wait_us = m_options._idle_us;
+    int64_t next_timeout_ms = GetNextTimeout();
+    if (next_timeout_ms >= 0 && next_timeout_ms * 1000 < wait_us) {
+        wait_us = next_timeout_ms * 1000;
+    }
+
+    Message::Poll(wait_us);
+}
+
+// 取两个剩余时间中较小的一个，<0表示没有定时事件
+static int64_t MinTimeout(int64_t a, int64_t b) {
+    if (a < 0) {
+        return b;
+    }
+    if (b < 0) {
+        return a;
+    }
+    return a < b ? a : b;
+}
+
+int64_t PebbleServer::GetNextTimeout() {
+    int64_t next = -1;
+
+    if (m_timer) {
+        next = MinTimeout(next, m_timer->GetNextTimeout());
+    }
+
+    if (m_session_mgr) {
+        next = MinTimeout(next, m_session_mgr->GetNextTimeout());
+    }
+
+    for (int32_t i = 0; i < kPROTOCOL_TYPE_BUTT; ++i) {
+        if (m_processor_array[i]) {
+            next = MinTimeout(next, m_processor_array[i]->GetNextTimeout());
+        }
+    }
+
+    for (std::map<int, IProcessor*>::iterator it = m_user_processor.begin(); it != m_user_processor.end(); ++it) {
+        if (it->second) {
+            next = MinTimeout(next, it->second->GetNextTimeout());
+        }
+    }
+
+    return next;
 }
 
 int32_t PebbleServer::OnMessage(const uint8_t* msg, uint32_t msg_len, MsgExternInfo* info) {
@@ -734,8 +816,10 @@ int32_t PebbleServer::OnMessage(const uint8_t* msg, uint32_t msg_len, MsgExternI
 	    m_is_overload = kNO_OVERLOAD;
 	    if (m_options._enable_flow_control) {
 	        m_message_expire_monitor->OnMessage(info->_msg_arrived_ms);
+	        m_codel_monitor->OnMessage(info->_msg_arrived_ms);
 	        m_task_monitor->SetTaskNum(m_coroutine_schedule->Size()); // 内部实现暂使用协程数
 	        m_is_overload = m_monitor_centor->IsOverLoad();
+	        info->_overload_level = m_monitor_centor->GetOverLoadLevel();
 	    }
 	    it->second->OnMessage(info->_remote_handle, msg, msg_len, info, m_is_overload);
 	}
@@ -780,7 +864,8 @@ int32_t PebbleServer::InitCoSchedule() {
     }
 
     m_coroutine_schedule = new CoroutineSchedule();
-    int32_t ret = m_coroutine_schedule->Init(GetTimer(), m_options._co_stack_size_bytes);
+    int32_t ret = m_coroutine_schedule->Init(GetTimer(), m_options._co_stack_size_bytes,
+        m_options._co_shared_stack_num, m_options._co_stack_pool_size, m_options._co_stack_madv_free);
     if (ret != 0) {
         delete m_coroutine_schedule;
         m_coroutine_schedule = NULL;
@@ -811,21 +896,27 @@ void PebbleServer::InitMonitor() {
     if (!m_message_expire_monitor) {
         m_message_expire_monitor = new MessageExpireMonitor();
     }
+    if (!m_codel_monitor) {
+        m_codel_monitor = new CoDelMonitor();
+    }
     if (!m_monitor_centor) {
         m_monitor_centor = new MonitorCenter();
     }
 
     m_task_monitor->SetTaskThreshold(m_options._task_threshold);
     m_message_expire_monitor->SetExpireThreshold(m_options._message_expire_ms);
+    m_codel_monitor->SetTarget(m_options._codel_target_ms);
+    m_codel_monitor->SetInterval(m_options._codel_interval_ms);
 
     m_monitor_centor->Clear();
     m_monitor_centor->AddMonitor(m_task_monitor);
     m_monitor_centor->AddMonitor(m_message_expire_monitor);
+    m_monitor_centor->AddMonitor(m_codel_monitor);
 }
 
 int32_t PebbleServer::InitTimer() {
     if (!m_timer) {
-        m_timer = new SequenceTimer();
+        m_timer = new WheelTimer();
     }
 
     TimeoutCallback on_stat_timeout = cxx::bind(&PebbleServer::OnStatTimeout, this);
@@ -865,9 +956,17 @@ int32_t PebbleServer::LoadOptionsFromIni(const std::string& file_name) {
     m_options._app_unit_id = ini_reader->GetInt32(kSectionApp, kAppUnitId, m_options._app_unit_id);
     m_options._app_program_id = ini_reader->GetInt32(kSectionApp, kAppProgramId, m_options._app_program_id);
     m_options._app_ctrl_cmd_addr = ini_reader->Get(kSectionApp, kAppCtrlCmdAddr, m_options._app_ctrl_cmd_addr);
+    m_options._app_tsc_clock = ini_reader->GetBoolean(kSectionApp, kAppTscClock, m_options._app_tsc_clock);
 
     // coroutine
     m_options._co_stack_size_bytes = ini_reader->GetUInt32(kSectionCoroutine, kCoStackSize, m_options._co_stack_size_bytes);
+    m_options._co_shared_stack_num = ini_reader->GetUInt32(kSectionCoroutine, kCoSharedStackNum, m_options._co_shared_stack_num);
+    m_options._co_stack_pool_size = ini_reader->GetUInt32(kSectionCoroutine, kCoStackPoolSize, m_options._co_stack_pool_size);
+    m_options._co_stack_madv_free = ini_reader->GetBoolean(kSectionCoroutine, kCoStackMadvFree, m_options._co_stack_madv_free);
+    m_options._co_pool_thread_num = ini_reader->GetUInt32(kSectionCoroutine, kCoPoolThreadNum, m_options._co_pool_thread_num);
+
+    // message
+    m_options._io_thread_num = ini_reader->GetUInt32(kSectionMessage, kIoThreadNum, m_options._io_thread_num);
 
     // log
     m_options._log_device = ini_reader->Get(kSectionLog, kLogDevice, m_options._log_device);
@@ -886,8 +985,11 @@ int32_t PebbleServer::LoadOptionsFromIni(const std::string& file_name) {
     // flow control
     m_options._enable_flow_control = ini_reader->GetBoolean(kSectionFlowControl, kEnableFlowControl, m_options._enable_flow_control);
     m_options._max_msg_num_per_loop = ini_reader->GetUInt32(kSectionFlowControl, kMaxMsgNumPerLoop, m_options._max_msg_num_per_loop);
+    m_options._max_msg_num_per_connection = ini_reader->GetUInt32(kSectionFlowControl, kMaxMsgNumPerConnection, m_options._max_msg_num_per_connection);
     m_options._task_threshold = ini_reader->GetUInt32(kSectionFlowControl, kTaskThreshold, m_options._task_threshold);
     m_options._message_expire_ms = ini_reader->GetUInt32(kSectionFlowControl, kMessageExpireMs, m_options._message_expire_ms);
+    m_options._codel_target_ms = ini_reader->GetUInt32(kSectionFlowControl, kCoDelTargetMs, m_options._codel_target_ms);
+    m_options._codel_interval_ms = ini_reader->GetUInt32(kSectionFlowControl, kCoDelIntervalMs, m_options._codel_interval_ms);
     m_options._idle_us = ini_reader->GetUInt32(kSectionFlowControl, kIdleUs, m_options._idle_us);
 
     // broadcast
@@ -897,6 +999,10 @@ int32_t PebbleServer::LoadOptionsFromIni(const std::string& file_name) {
 
     // rpc
     m_options._proc_req_timeout_ms = ini_reader->GetUInt32(kSectionRpc, kProcReqTimeoutMs, m_options._proc_req_timeout_ms);
+    m_options._rpc_version = ini_reader->GetInt32(kSectionRpc, kRpcVersion, m_options._rpc_version);
+    m_options._hedge_percentile = ini_reader->GetUInt32(kSectionRpc, kHedgePercentile, m_options._hedge_percentile);
+    m_options._hedge_max_ratio = ini_reader->GetUInt32(kSectionRpc, kHedgeMaxRatio, m_options._hedge_max_ratio);
+    m_options._concurrency_limit = ini_reader->GetUInt32(kSectionRpc, kConcurrencyLimit, m_options._concurrency_limit);
 
     return 0;
 }
@@ -906,6 +1012,7 @@ int32_t PebbleServer::OnStatTimeout() {
     StatCpu(stat);
     StatMemory(stat);
     StatCoroutine(stat);
+    StatMessage(stat);
     StatProcessorResource(stat);
 
     return m_stat_timer_ms;
@@ -961,6 +1068,31 @@ void PebbleServer::StatMemory(Stat* stat) {
 
 void PebbleServer::StatCoroutine(Stat* stat) {
     stat->AddResourceItem("_coroutine", m_coroutine_schedule->Size());
+    stat->AddResourceItem("_co_stack_high_watermark(K)", m_coroutine_schedule->StackHighWatermark() / 1024);
+    stat->AddResourceItem("_co_idle_stack", m_coroutine_schedule->IdleStackNum());
+
+    if (m_coroutine_schedule->IsSharedStack()) {
+        int64_t num = 0;
+        int64_t bytes = m_coroutine_schedule->TotalSavedStackSize(&num);
+        stat->AddResourceItem("_co_saved_stack(K)", bytes / 1024);
+        stat->AddResourceItem("_co_avg_saved_stack", num > 0 ? bytes / num : 0);
+    }
+}
+
+void PebbleServer::StatMessage(Stat* stat) {
+    int64_t exhausted_num  = 0;
+    int64_t carry_over_num = 0;
+    Message::GetBudgetStat(&exhausted_num, &carry_over_num);
+    stat->AddResourceItem("_msg_budget_exhausted", exhausted_num);
+    stat->AddResourceItem("_msg_carry_over", carry_over_num);
+}
+
+void PebbleServer::SetMsgBudget() {
+    if (m_options._enable_flow_control) {
+        Message::SetMsgBudget(m_options._max_msg_num_per_loop, m_options._max_msg_num_per_connection);
+    } else {
+        Message::SetMsgBudget(0, 0);
+    }
 }
 
 void PebbleServer::StatProcessorResource(Stat* stat) {
@@ -1119,7 +1251,7 @@ int32_t PebbleServer::InitControlService() {
     ret = m_control_handler->RegisterCommand(
         cxx::bind(&PebbleServer::OnControlPrint, this, _1, _2, _3), "print",
         "print              # print pebble runtime info\n"
-        "                   # format  : print status | config\n"
+        "                   # format  : print status | config | limit\n"
         "                   # example : print status",
         true);
     RETURN_IF_ERROR(ret != 0, ret, "register print failed.");
@@ -1158,6 +1290,47 @@ int32_t PebbleServer::MakeCoroutine(const cxx::function<void()>& routine) {
     return coid < 0 ? -1 : 0;
 }
 
+int32_t PebbleServer::RunInPool(const cxx::function<void()>& fn) {
+    if (!m_coroutine_schedule || !fn) {
+        PLOG_ERROR("coroutine schedule is null or fn is null");
+        return -1;
+    }
+
+    int64_t co_id = m_coroutine_schedule->CurrentTaskId();
+    if (INVALID_CO_ID == co_id) {
+        PLOG_ERROR("RunInPool must be called in coroutine");
+        return -1;
+    }
+
+    // 共享栈模式下协程换出后栈上变量失效，fn通常会访问协程栈上的变量
+    if (m_coroutine_schedule->IsSharedStack()) {
+        PLOG_ERROR("RunInPool is not supported in shared stack mode");
+        return -1;
+    }
+
+    if (!m_thread_pool) {
+        m_thread_pool = new ThreadPool();
+        m_thread_pool->SetFinishedNotify(Message::Wakeup);
+        int ret = m_thread_pool->Init(m_options._co_pool_thread_num);
+        if (ret != 0) {
+            PLOG_ERROR("thread pool init failed(%d), thread num = %u", ret, m_options._co_pool_thread_num);
+            delete m_thread_pool;
+            m_thread_pool = NULL;
+            return -1;
+        }
+    }
+
+    cxx::function<void()> task = fn;
+    int ret = m_thread_pool->AddTask(task, co_id);
+    if (ret != 0) {
+        PLOG_ERROR("add task to thread pool failed(%d)", ret);
+        return -1;
+    }
+
+    m_coroutine_schedule->Yield();
+    return 0;
+}
+
 int32_t PebbleServer::RegisterControlCommand(const OnControlCommand& on_cmd,
     const std::string& cmd, const std::string& desc) {
     // desc 可以为空
@@ -1197,6 +1370,16 @@ void PebbleServer::OnControlPrint(const std::vector<std::string>& options,
                 << "runtime : " << m_stat_manager->GetRuntimeInSecond() << " S" << std::endl;
             data->assign(oss.str());
             return;
+        } else if (strcasecmp(options.front().c_str(), "limit") == 0) {
+            std::ostringstream oss;
+            for (int i = kPEBBLE_RPC_BINARY; i < kPROTOCOL_TYPE_BUTT; i++) {
+                PebbleRpc* rpc = dynamic_cast<PebbleRpc*>(m_processor_array[i]);
+                if (rpc) {
+                    oss << "Rpc(" << rpc << "):\n" << rpc->GetConcurrencyLimiter().ToString();
+                }
+            }
+            data->assign(oss.str());
+            return;
         }
     }
 
@@ -33,6 +33,7 @@ namespace pebble {
 class _PebbleBroadcastClient;
 class BroadcastMgr;
 class BroadcastRelayHandler;
+class CoDelMonitor;
 class CoroutineSchedule;
 class IEventHandler;
 class INIReader;
@@ -49,6 +50,7 @@ class SessionMgr;
 class Stat;
 class StatManager;
 class TaskMonitor;
+class ThreadPool;
 class Timer;
 
 
@@ -127,6 +129,7 @@ typedef enum {
     kPEBBLE_RPC_JSON,       // thrift json编码协议
     kPEBBLE_RPC_PROTOBUF,   // protobuf编码协议
     kPEBBLE_PIPE,           // pipe协议，pipe是接入gconnd的私有协议，上面承载其他rpc编码协议
+    kPEBBLE_RPC_COMPACT,    // thrift compact编码协议，整数使用varint/zigzag编码，适合小整数为主的消息
     kPROTOCOL_TYPE_BUTT
 } ProtocolType;
 
@@ -308,6 +311,14 @@ public:
     /// @return <0 失败
     int32_t MakeCoroutine(const cxx::function<void()>& routine);
 
+    /// @brief 在线程池中执行fn，当前协程挂起，fn执行完成后在主循环中恢复
+    ///     用于把压缩、加解密等耗CPU的处理从主循环卸载到其他线程
+    /// @param fn 在线程池的线程中执行，不能调用框架的非线程安全接口
+    /// @return 0 成功，fn已执行完成
+    /// @return <0 失败，fn未执行
+    /// @note 必须在协程中调用；共享栈模式下协程挂起后栈上变量的地址无效，不支持此接口
+    int32_t RunInPool(const cxx::function<void()>& fn);
+
     /// @brief 注册控制命令
     /// @param on_cmd 命令处理回调
     /// @param cmd 用户自定义命令
@@ -346,6 +357,9 @@ public:
 
     void Idle();
 
+    /// @brief 获取各模块中最近一个定时事件的剩余时间(ms)，<0表示没有定时事件
+    int64_t GetNextTimeout();
+
 private:
     int32_t OnMessage(const uint8_t* msg, uint32_t msg_len, MsgExternInfo* info);
 
@@ -378,8 +392,12 @@ private:
 
     void StatCoroutine(Stat* stat);
 
+    void StatMessage(Stat* stat);
+
     void StatProcessorResource(Stat* stat);
 
+    void SetMsgBudget();
+
     void OnControlReload(const std::vector<std::string>& options, int32_t* ret_code, std::string* data);
 
     void OnControlPrint(const std::vector<std::string>& options, int32_t* ret_code, std::string* data);
@@ -395,12 +413,14 @@ private:
     MonitorCenter*     m_monitor_centor;
     TaskMonitor*       m_task_monitor;
     MessageExpireMonitor* m_message_expire_monitor;
+    CoDelMonitor*      m_codel_monitor;
     Naming*            m_naming_array[kNAMING_BUTT];
     IProcessor*        m_processor_array[kPROTOCOL_TYPE_BUTT];
     IEventHandler*     m_rpc_event_handler;
     IEventHandler*     m_broadcast_event_handler;
     StatManager*       m_stat_manager;
     Timer*             m_timer;
+    ThreadPool*        m_thread_pool;
     int64_t            m_last_pid_cpu_use;
     int64_t            m_last_total_cpu_use;
     uint32_t           m_stat_timer_ms; // 资源使用采样定时器，供统计用
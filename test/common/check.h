@@ -0,0 +1,31 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#ifndef _PEBBLE_TEST_COMMON_CHECK_H_
+#define _PEBBLE_TEST_COMMON_CHECK_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/// @brief 测试用断言，条件不成立时打印位置并以非0退出，不受NDEBUG影响
+/// 测试程序均为独立的可执行文件，由blade test根据退出码判断成败
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1); \
+        } \
+    } while (0)
+
+#endif // _PEBBLE_TEST_COMMON_CHECK_H_
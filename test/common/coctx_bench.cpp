@@ -0,0 +1,142 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+// 协程切换开销:
+//   coctx_swap        当前编译的coctx实现(汇编或PEBBLE_USE_UCONTEXT时的ucontext)来回切换
+//   swapcontext       glibc ucontext来回切换，作为对比基准
+//   Resume/Yield      经过CoroutineSchedule的一次Resume加一次Yield，独立栈和共享栈两种模式
+// 每项输出单次切换的平均耗时(一来一回算两次切换)
+// 用法: coctx_bench [来回次数]
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ucontext.h>
+
+#include "common/coctx.h"
+#include "common/coroutine.h"
+#include "common/time_utility.h"
+#include "test/common/check.h"
+
+using namespace pebble;
+
+static const uint32_t kStackSize = 64 * 1024;
+
+static int64_t g_rounds  = 0;
+static int64_t g_counter = 0;
+
+static void Report(const char* name, int64_t rounds, int64_t cost_us) {
+    printf("%-28s %10ld rounds %8.1f ns/switch\n", name, rounds, cost_us * 1000.0 / rounds / 2);
+}
+
+// coctx_swap
+static coctx g_main_ctx;
+static coctx g_co_ctx;
+
+static void CoctxEntry(void* arg) {
+    while (true) {
+        g_counter++;
+        coctx_swap(&g_co_ctx, &g_main_ctx);
+    }
+}
+
+static void BenchCoctx(int64_t rounds) {
+    char* stack = static_cast<char*>(malloc(kStackSize));
+    CHECK(0 == coctx_make(&g_co_ctx, stack, kStackSize, CoctxEntry, NULL));
+
+    g_counter = 0;
+    int64_t start = TimeUtility::GetCurrentUS();
+    for (int64_t i = 0; i < rounds; i++) {
+        coctx_swap(&g_main_ctx, &g_co_ctx);
+    }
+    int64_t cost = TimeUtility::GetCurrentUS() - start;
+    CHECK(g_counter == rounds);
+    Report(PEBBLE_COCTX_ASM ? "coctx_swap (asm)" : "coctx_swap (ucontext)", rounds, cost);
+    free(stack);
+}
+
+// swapcontext
+static ucontext_t g_main_uc;
+static ucontext_t g_co_uc;
+
+static void UcontextEntry() {
+    while (true) {
+        g_counter++;
+        swapcontext(&g_co_uc, &g_main_uc);
+    }
+}
+
+static void BenchUcontext(int64_t rounds) {
+    char* stack = static_cast<char*>(malloc(kStackSize));
+    CHECK(0 == getcontext(&g_co_uc));
+    g_co_uc.uc_stack.ss_sp   = stack;
+    g_co_uc.uc_stack.ss_size = kStackSize;
+    g_co_uc.uc_link          = NULL;
+    makecontext(&g_co_uc, UcontextEntry, 0);
+
+    g_counter = 0;
+    int64_t start = TimeUtility::GetCurrentUS();
+    for (int64_t i = 0; i < rounds; i++) {
+        swapcontext(&g_main_uc, &g_co_uc);
+    }
+    int64_t cost = TimeUtility::GetCurrentUS() - start;
+    CHECK(g_counter == rounds);
+    Report("swapcontext", rounds, cost);
+    free(stack);
+}
+
+// CoroutineSchedule
+static void YieldLoop(CoroutineSchedule* schedule) {
+    for (int64_t i = 0; i < g_rounds; i++) {
+        g_counter++;
+        schedule->Yield();
+    }
+}
+
+static void BenchSchedule(const char* name, int64_t rounds, uint32_t shared_stack_num) {
+    CoroutineSchedule schedule;
+    CHECK(0 == schedule.Init(NULL, kStackSize, shared_stack_num));
+
+    g_rounds  = rounds;
+    g_counter = 0;
+    CommonCoroutineTask* task = schedule.NewTask<CommonCoroutineTask>();
+    CHECK(task != NULL);
+    task->Init(cxx::bind(YieldLoop, &schedule));
+    // Start运行到第一次Yield
+    int64_t id = task->Start();
+    CHECK(id != INVALID_CO_ID);
+
+    int64_t start = TimeUtility::GetCurrentUS();
+    for (int64_t i = 1; i < rounds; i++) {
+        schedule.Resume(id);
+    }
+    int64_t cost = TimeUtility::GetCurrentUS() - start;
+    CHECK(g_counter == rounds);
+
+    // 最后一次Resume让协程结束
+    schedule.Resume(id);
+    CHECK(0 == schedule.Size());
+    Report(name, rounds - 1, cost);
+    schedule.Close();
+}
+
+int main(int argc, char** argv) {
+    int64_t rounds = argc > 1 ? atoll(argv[1]) : 2000000;
+    CHECK(rounds > 1);
+
+    BenchCoctx(rounds);
+    BenchUcontext(rounds);
+    BenchSchedule("Resume/Yield", rounds, 0);
+    BenchSchedule("Resume/Yield shared stack", rounds, 1);
+    return 0;
+}
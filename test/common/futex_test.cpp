@@ -0,0 +1,187 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+// futex等待/唤醒测试: 值不等时不休眠，超时按时返回，先改值再唤醒的交接不丢失唤醒，
+// 唤醒指定个数和全部唤醒
+// 丢失唤醒时测试会卡住，由alarm超时退出
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <vector>
+
+#include "common/futex.h"
+#include "common/thread.h"
+#include "common/time_utility.h"
+#include "test/common/check.h"
+
+using namespace pebble;
+
+static void TestNoSleep() {
+    int32_t value = 1;
+    int64_t start = TimeUtility::GetMonotonicMS();
+    FutexWait(&value, 0, -1);
+    FutexWait(&value, 0, 1000);
+    CHECK(TimeUtility::GetMonotonicMS() - start < 100);
+    printf("%-24s ok\n", "value mismatch");
+}
+
+static void TestTimeout() {
+    int32_t value = 0;
+    int64_t start = TimeUtility::GetMonotonicMS();
+    FutexWait(&value, 0, 50);
+    int64_t cost = TimeUtility::GetMonotonicMS() - start;
+    // 可能虚假唤醒，但不能睡过头
+    CHECK(cost < 1000);
+    printf("%-24s ok, %ld ms\n", "timeout", cost);
+}
+
+/// @brief 两个线程轮流推进计数，每次交接先改值再唤醒对方
+class PingPong : public Thread {
+public:
+    PingPong(int32_t* turn, int32_t me, int32_t rounds) : m_turn(turn), m_me(me), m_rounds(rounds) {}
+
+    virtual void Run() {
+        for (int32_t i = 0; i < m_rounds; i++) {
+            int32_t turn = 0;
+            while ((turn = __atomic_load_n(m_turn, __ATOMIC_ACQUIRE)) % 2 != m_me) {
+                FutexWait(m_turn, turn, -1);
+            }
+            __atomic_store_n(m_turn, turn + 1, __ATOMIC_RELEASE);
+            FutexWake(m_turn, 1);
+        }
+    }
+
+private:
+    int32_t* m_turn;
+    int32_t m_me;
+    int32_t m_rounds;
+};
+
+static void TestPingPong() {
+    const int32_t kRounds = 100000;
+    int32_t turn = 0;
+    PingPong ping(&turn, 0, kRounds);
+    PingPong pong(&turn, 1, kRounds);
+    int64_t start = TimeUtility::GetMonotonicMS();
+    CHECK(ping.Start());
+    CHECK(pong.Start());
+    ping.Join();
+    pong.Join();
+    CHECK(turn == 2 * kRounds);
+    printf("%-24s ok, %d handoffs %ld ms\n", "ping-pong", 2 * kRounds,
+        TimeUtility::GetMonotonicMS() - start);
+}
+
+/// @brief 等待门打开，每次醒来计数，用于检查唤醒个数
+class GateWaiter : public Thread {
+public:
+    GateWaiter(int32_t* gate, int32_t* passed) : m_gate(gate), m_passed(passed) {}
+
+    virtual void Run() {
+        while (__atomic_load_n(m_gate, __ATOMIC_ACQUIRE) == 0) {
+            FutexWait(m_gate, 0, -1);
+        }
+        __atomic_add_fetch(m_passed, 1, __ATOMIC_RELEASE);
+    }
+
+private:
+    int32_t* m_gate;
+    int32_t* m_passed;
+};
+
+static void TestWakeAll() {
+    const int32_t kWaiterNum = 16;
+    int32_t gate   = 0;
+    int32_t passed = 0;
+    std::vector<GateWaiter*> waiters;
+    for (int32_t i = 0; i < kWaiterNum; i++) {
+        waiters.push_back(new GateWaiter(&gate, &passed));
+        CHECK(waiters.back()->Start());
+    }
+    usleep(100 * 1000);
+    CHECK(0 == __atomic_load_n(&passed, __ATOMIC_ACQUIRE));
+
+    // 不改值只唤醒，醒来的线程重新检查后继续等待
+    FutexWake(&gate, kWaiterNum);
+    usleep(50 * 1000);
+    CHECK(0 == __atomic_load_n(&passed, __ATOMIC_ACQUIRE));
+
+    __atomic_store_n(&gate, 1, __ATOMIC_RELEASE);
+    FutexWake(&gate, 0x7fffffff);
+    for (int32_t i = 0; i < kWaiterNum; i++) {
+        waiters[i]->Join();
+        delete waiters[i];
+    }
+    CHECK(kWaiterNum == passed);
+    printf("%-24s ok\n", "wake all");
+}
+
+/// @brief 票号等待，每个线程等待自己的票号，唤醒方每发一张票唤醒一次
+/// 多个等待者共享同一个futex字，检查唤醒全部等待者时不遗漏目标线程
+class TicketWaiter : public Thread {
+public:
+    TicketWaiter(int32_t* serving, int32_t ticket) : m_serving(serving), m_ticket(ticket) {}
+
+    virtual void Run() {
+        int32_t serving = 0;
+        while ((serving = __atomic_load_n(m_serving, __ATOMIC_ACQUIRE)) < m_ticket) {
+            FutexWait(m_serving, serving, -1);
+        }
+    }
+
+private:
+    int32_t* m_serving;
+    int32_t m_ticket;
+};
+
+static void TestTickets() {
+    const int32_t kWaiterNum = 32;
+    const int32_t kRounds    = 200;
+    int64_t start = TimeUtility::GetMonotonicMS();
+    for (int32_t round = 0; round < kRounds; round++) {
+        int32_t serving = 0;
+        std::vector<TicketWaiter*> waiters;
+        for (int32_t i = 0; i < kWaiterNum; i++) {
+            waiters.push_back(new TicketWaiter(&serving, i + 1));
+            CHECK(waiters.back()->Start());
+        }
+        for (int32_t i = 0; i < kWaiterNum; i++) {
+            __atomic_add_fetch(&serving, 1, __ATOMIC_RELEASE);
+            FutexWake(&serving, 0x7fffffff);
+            if (i % 4 == 0) {
+                sched_yield();
+            }
+        }
+        for (int32_t i = 0; i < kWaiterNum; i++) {
+            waiters[i]->Join();
+            delete waiters[i];
+        }
+    }
+    printf("%-24s ok, %d rounds %ld ms\n", "tickets", kRounds, TimeUtility::GetMonotonicMS() - start);
+}
+
+int main(int argc, char** argv) {
+    // 丢失唤醒时会一直阻塞
+    alarm(300);
+
+    TestNoSleep();
+    TestTimeout();
+    TestPingPong();
+    TestWakeAll();
+    TestTickets();
+
+    printf("PASS\n");
+    return 0;
+}
@@ -0,0 +1,329 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+// MpmcQueue压力测试: 多生产者多消费者下元素不丢失、不重复，同一生产者的元素按顺序出队，
+// 阻塞的生产者/消费者都能被唤醒，超时按时返回
+// 丢失唤醒时测试会卡住，由alarm超时退出
+
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+#include "common/mpmc_queue.h"
+#include "common/thread.h"
+#include "common/time_utility.h"
+#include "test/common/check.h"
+
+using namespace pebble;
+
+static const int64_t kPoison = -1;
+
+// 元素值 = 生产者编号 << 32 | 生产者内的序号
+static int64_t MakeValue(int32_t producer, int32_t seq) {
+    return (static_cast<int64_t>(producer) << 32) | seq;
+}
+
+/// @brief 记录每个元素被消费的次数
+class Tally {
+public:
+    Tally(int32_t producer_num, int32_t item_num)
+        : m_producer_num(producer_num), m_item_num(item_num),
+          m_counts(producer_num * item_num, 0), m_total(0) {}
+
+    void Add(int64_t value) {
+        int32_t producer = static_cast<int32_t>(value >> 32);
+        int32_t seq      = static_cast<int32_t>(value & 0xFFFFFFFF);
+        CHECK(producer >= 0 && producer < m_producer_num);
+        CHECK(seq >= 0 && seq < m_item_num);
+        __atomic_add_fetch(&m_counts[producer * m_item_num + seq], 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&m_total, 1, __ATOMIC_RELAXED);
+    }
+
+    int64_t Total() const {
+        return __atomic_load_n(&m_total, __ATOMIC_ACQUIRE);
+    }
+
+    // 每个元素恰好被消费一次
+    void Verify() const {
+        CHECK(Total() == static_cast<int64_t>(m_counts.size()));
+        for (size_t i = 0; i < m_counts.size(); i++) {
+            if (m_counts[i] != 1) {
+                fprintf(stderr, "item %d:%d consumed %d times\n",
+                    static_cast<int32_t>(i / m_item_num), static_cast<int32_t>(i % m_item_num), m_counts[i]);
+                exit(1);
+            }
+        }
+    }
+
+private:
+    int32_t m_producer_num;
+    int32_t m_item_num;
+    std::vector<int32_t> m_counts;
+    int64_t m_total;
+};
+
+class Producer : public Thread {
+public:
+    Producer(MpmcQueue<int64_t>* queue, int32_t id, int32_t item_num, bool blocking)
+        : m_queue(queue), m_id(id), m_item_num(item_num), m_blocking(blocking) {}
+
+    virtual void Run() {
+        for (int32_t i = 0; i < m_item_num; i++) {
+            int64_t value = MakeValue(m_id, i);
+            if (m_blocking) {
+                m_queue->PushBack(value);
+                continue;
+            }
+            while (!m_queue->TryPushBack(value)) {
+                sched_yield();
+            }
+        }
+    }
+
+private:
+    MpmcQueue<int64_t>* m_queue;
+    int32_t m_id;
+    int32_t m_item_num;
+    bool m_blocking;
+};
+
+class Consumer : public Thread {
+public:
+    Consumer(MpmcQueue<int64_t>* queue, Tally* tally, int32_t producer_num, bool blocking)
+        : m_queue(queue), m_tally(tally), m_last(producer_num, -1), m_blocking(blocking) {}
+
+    virtual void Run() {
+        int64_t value = 0;
+        while (true) {
+            if (m_blocking) {
+                m_queue->PopFront(&value);
+            } else if (!m_queue->TryPopFront(&value)) {
+                sched_yield();
+                continue;
+            }
+            if (kPoison == value) {
+                break;
+            }
+            // 同一生产者的元素对任一消费者都是按入队顺序出现的
+            int32_t producer = static_cast<int32_t>(value >> 32);
+            int32_t seq      = static_cast<int32_t>(value & 0xFFFFFFFF);
+            CHECK(seq > m_last[producer]);
+            m_last[producer] = seq;
+            m_tally->Add(value);
+        }
+    }
+
+private:
+    MpmcQueue<int64_t>* m_queue;
+    Tally* m_tally;
+    std::vector<int32_t> m_last;
+    bool m_blocking;
+};
+
+// 生产者全部结束后每个消费者收到一个结束标记
+static void RunStress(const char* name, size_t capacity, bool futex_wait, bool blocking,
+    int32_t producer_num, int32_t consumer_num, int32_t item_num) {
+    MpmcQueue<int64_t> queue(capacity, futex_wait);
+    Tally tally(producer_num, item_num);
+
+    std::vector<Producer*> producers;
+    std::vector<Consumer*> consumers;
+    int64_t start = TimeUtility::GetMonotonicMS();
+    for (int32_t i = 0; i < consumer_num; i++) {
+        consumers.push_back(new Consumer(&queue, &tally, producer_num, blocking));
+        CHECK(consumers.back()->Start());
+    }
+    for (int32_t i = 0; i < producer_num; i++) {
+        producers.push_back(new Producer(&queue, i, item_num, blocking));
+        CHECK(producers.back()->Start());
+    }
+
+    for (int32_t i = 0; i < producer_num; i++) {
+        producers[i]->Join();
+        delete producers[i];
+    }
+    for (int32_t i = 0; i < consumer_num; i++) {
+        queue.PushBack(kPoison);
+    }
+    for (int32_t i = 0; i < consumer_num; i++) {
+        consumers[i]->Join();
+        delete consumers[i];
+    }
+
+    tally.Verify();
+    CHECK(queue.IsEmpty());
+    printf("%-28s P=%d C=%d cap=%zu items=%d: ok, %ld ms\n", name, producer_num, consumer_num,
+        queue.Capacity(), producer_num * item_num, TimeUtility::GetMonotonicMS() - start);
+}
+
+class BlockedPopper : public Thread {
+public:
+    explicit BlockedPopper(MpmcQueue<int64_t>* queue) : m_queue(queue), m_value(0), m_done(0) {}
+
+    virtual void Run() {
+        m_queue->PopFront(&m_value);
+        __atomic_store_n(&m_done, 1, __ATOMIC_RELEASE);
+    }
+
+    bool Done() const {
+        return __atomic_load_n(&m_done, __ATOMIC_ACQUIRE) != 0;
+    }
+
+    MpmcQueue<int64_t>* m_queue;
+    int64_t m_value;
+    int32_t m_done;
+};
+
+class BlockedPusher : public Thread {
+public:
+    BlockedPusher(MpmcQueue<int64_t>* queue, int64_t value) : m_queue(queue), m_value(value), m_done(0) {}
+
+    virtual void Run() {
+        m_queue->PushBack(m_value);
+        __atomic_store_n(&m_done, 1, __ATOMIC_RELEASE);
+    }
+
+    bool Done() const {
+        return __atomic_load_n(&m_done, __ATOMIC_ACQUIRE) != 0;
+    }
+
+    MpmcQueue<int64_t>* m_queue;
+    int64_t m_value;
+    int32_t m_done;
+};
+
+static int32_t CountDone(const std::vector<BlockedPopper*>& threads) {
+    int32_t num = 0;
+    for (size_t i = 0; i < threads.size(); i++) {
+        num += threads[i]->Done() ? 1 : 0;
+    }
+    return num;
+}
+
+static int32_t CountDone(const std::vector<BlockedPusher*>& threads) {
+    int32_t num = 0;
+    for (size_t i = 0; i < threads.size(); i++) {
+        num += threads[i]->Done() ? 1 : 0;
+    }
+    return num;
+}
+
+// 所有线程都已进入futex等待后，每放入(取出)一个元素恰好唤醒一个等待者
+static void TestWakeup() {
+    const int32_t kThreadNum = 8;
+
+    MpmcQueue<int64_t> empty_queue(16);
+    std::vector<BlockedPopper*> poppers;
+    for (int32_t i = 0; i < kThreadNum; i++) {
+        poppers.push_back(new BlockedPopper(&empty_queue));
+        CHECK(poppers.back()->Start());
+    }
+    usleep(100 * 1000);
+    CHECK(0 == CountDone(poppers));
+
+    int64_t sum = 0;
+    for (int32_t i = 0; i < kThreadNum; i++) {
+        CHECK(empty_queue.TryPushBack(i + 1));
+        int64_t deadline = TimeUtility::GetMonotonicMS() + 1000;
+        while (CountDone(poppers) < i + 1 && TimeUtility::GetMonotonicMS() < deadline) {
+            usleep(1000);
+        }
+        CHECK(CountDone(poppers) == i + 1);
+    }
+    for (int32_t i = 0; i < kThreadNum; i++) {
+        poppers[i]->Join();
+        sum += poppers[i]->m_value;
+        delete poppers[i];
+    }
+    CHECK(sum == kThreadNum * (kThreadNum + 1) / 2);
+    CHECK(empty_queue.IsEmpty());
+
+    MpmcQueue<int64_t> full_queue(2);
+    CHECK(full_queue.TryPushBack(0));
+    CHECK(full_queue.TryPushBack(0));
+    CHECK(!full_queue.TryPushBack(0));
+    std::vector<BlockedPusher*> pushers;
+    for (int32_t i = 0; i < kThreadNum; i++) {
+        pushers.push_back(new BlockedPusher(&full_queue, i + 1));
+        CHECK(pushers.back()->Start());
+    }
+    usleep(100 * 1000);
+    CHECK(0 == CountDone(pushers));
+
+    sum = 0;
+    int64_t value = 0;
+    for (int32_t i = 0; i < kThreadNum; i++) {
+        CHECK(full_queue.TryPopFront(&value));
+        sum += value;
+        int64_t deadline = TimeUtility::GetMonotonicMS() + 1000;
+        while (CountDone(pushers) < i + 1 && TimeUtility::GetMonotonicMS() < deadline) {
+            usleep(1000);
+        }
+        CHECK(CountDone(pushers) == i + 1);
+    }
+    for (int32_t i = 0; i < kThreadNum; i++) {
+        pushers[i]->Join();
+        delete pushers[i];
+    }
+    while (full_queue.TryPopFront(&value)) {
+        sum += value;
+    }
+    CHECK(sum == kThreadNum * (kThreadNum + 1) / 2);
+    printf("%-28s ok\n", "wakeup one per element");
+}
+
+static void TestTimeout() {
+    MpmcQueue<int64_t> queue(2);
+    int64_t value = 0;
+
+    int64_t start = TimeUtility::GetMonotonicMS();
+    CHECK(!queue.TimedPopFront(&value, 50));
+    int64_t cost = TimeUtility::GetMonotonicMS() - start;
+    CHECK(cost >= 49 && cost < 1000);
+
+    CHECK(!queue.TimedPopFront(&value, 0));
+
+    CHECK(queue.TimedPushBack(1, 0));
+    CHECK(queue.TimedPushBack(2, 50));
+    start = TimeUtility::GetMonotonicMS();
+    CHECK(!queue.TimedPushBack(3, 50));
+    cost = TimeUtility::GetMonotonicMS() - start;
+    CHECK(cost >= 49 && cost < 1000);
+
+    CHECK(queue.TimedPopFront(&value, 50) && 1 == value);
+    CHECK(queue.TimedPopFront(&value, -1) && 2 == value);
+    CHECK(queue.IsEmpty());
+    printf("%-28s ok\n", "timeout");
+}
+
+int main(int argc, char** argv) {
+    // 丢失唤醒时会一直阻塞
+    alarm(300);
+
+    TestTimeout();
+    TestWakeup();
+
+    RunStress("try, futex",         64, true,  false, 4, 4, 200000);
+    RunStress("blocking, futex",    4,  true,  true,  4, 4, 100000);
+    RunStress("blocking, futex",    4,  true,  true,  1, 8, 200000);
+    RunStress("blocking, futex",    4,  true,  true,  8, 1, 25000);
+    RunStress("blocking, yield",    4,  false, true,  4, 4, 100000);
+    RunStress("blocking, capacity 2", 2, true, true,  8, 8, 20000);
+
+    printf("PASS\n");
+    return 0;
+}
@@ -0,0 +1,111 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+// ThreadPool PENDING与WORK_STEALING模式对比:
+//   flat   主线程连续投递大量小任务
+//   nested 任务在工作线程中递归投递子任务(二叉树)，WORK_STEALING模式下子任务进入本线程队列
+// 用法: thread_pool_bench [flat任务数] [线程数] [nested深度]
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "common/thread_pool.h"
+#include "common/time_utility.h"
+#include "test/common/check.h"
+
+using namespace pebble;
+
+static int64_t g_done = 0;
+static ThreadPool* g_pool = NULL;
+
+// 模拟很短的任务，任务调度开销占主要部分
+static void Work() {
+    volatile int64_t x = 0;
+    for (int32_t i = 0; i < 100; i++) {
+        x += i * i;
+    }
+    __atomic_add_fetch(&g_done, 1, __ATOMIC_RELEASE);
+}
+
+static void Spawn(int32_t depth) {
+    if (depth > 0) {
+        cxx::function<void()> child = cxx::bind(Spawn, depth - 1);
+        CHECK(0 == g_pool->AddTask(child));
+        CHECK(0 == g_pool->AddTask(child));
+    }
+    Work();
+}
+
+static void WaitDone(int64_t total) {
+    while (__atomic_load_n(&g_done, __ATOMIC_ACQUIRE) < total) {
+        usleep(100);
+    }
+}
+
+static const char* ModeName(int32_t mode) {
+    return ThreadPool::WORK_STEALING == mode ? "WORK_STEALING" : "PENDING";
+}
+
+static void RunFlat(ThreadPool* pool, int32_t mode, int64_t task_num) {
+    cxx::function<void()> work = Work;
+    __atomic_store_n(&g_done, 0, __ATOMIC_RELEASE);
+    int64_t start = TimeUtility::GetMonotonicMS();
+    for (int64_t i = 0; i < task_num; i++) {
+        CHECK(0 == pool->AddTask(work));
+    }
+    WaitDone(task_num);
+    int64_t cost = TimeUtility::GetMonotonicMS() - start;
+
+    ThreadPool::Stats stats;
+    pool->GetStatus(&stats);
+    printf("%-14s flat   %8ld tasks %6ld ms %6.2f Mtask/s stolen=%ld\n", ModeName(mode), task_num,
+        cost, task_num / 1000.0 / (cost > 0 ? cost : 1), stats.stolen_task_num);
+}
+
+static void RunNested(ThreadPool* pool, int32_t mode, int32_t depth) {
+    int64_t total = (1LL << (depth + 1)) - 1;
+    __atomic_store_n(&g_done, 0, __ATOMIC_RELEASE);
+    ThreadPool::Stats before;
+    pool->GetStatus(&before);
+
+    int64_t start = TimeUtility::GetMonotonicMS();
+    cxx::function<void()> root = cxx::bind(Spawn, depth);
+    CHECK(0 == pool->AddTask(root));
+    WaitDone(total);
+    int64_t cost = TimeUtility::GetMonotonicMS() - start;
+
+    ThreadPool::Stats stats;
+    pool->GetStatus(&stats);
+    printf("%-14s nested %8ld tasks %6ld ms %6.2f Mtask/s stolen=%ld\n", ModeName(mode), total,
+        cost, total / 1000.0 / (cost > 0 ? cost : 1), stats.stolen_task_num - before.stolen_task_num);
+}
+
+int main(int argc, char** argv) {
+    int64_t task_num   = argc > 1 ? atoll(argv[1]) : 1000000;
+    int32_t thread_num = argc > 2 ? atoi(argv[2]) : 4;
+    int32_t depth      = argc > 3 ? atoi(argv[3]) : 17;
+
+    const int32_t modes[] = { ThreadPool::PENDING, ThreadPool::WORK_STEALING };
+    for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+        ThreadPool pool;
+        CHECK(0 == pool.Init(thread_num, modes[i]));
+        g_pool = &pool;
+        RunFlat(&pool, modes[i], task_num);
+        RunNested(&pool, modes[i], depth);
+        pool.Terminate(true);
+        g_pool = NULL;
+    }
+    return 0;
+}
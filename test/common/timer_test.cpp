@@ -0,0 +1,264 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+// WheelTimer测试: 跨第0/1/2层的定时器下移后按时超时；回调中停止、重启自己和其他定时器；
+// 超长超时时间不提前超时；GetNextTimeout不晚于实际的超时时间
+// 时间轮使用真实的循环时间，第2层的下移需要等待约16s
+
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <vector>
+
+#include "common/time_utility.h"
+#include "common/timer.h"
+#include "test/common/check.h"
+
+using namespace pebble;
+
+// 超时回调在Update中执行，允许的延迟
+static const int64_t kSlackMs = 50;
+
+/// @brief 驱动定时器运行duration_ms
+static void RunFor(WheelTimer* timer, int64_t duration_ms) {
+    int64_t end = TimeUtility::GetMonotonicMS() + duration_ms;
+    while (TimeUtility::GetMonotonicMS() < end) {
+        TimeUtility::RefreshLoopTime();
+        timer->Update();
+        usleep(200);
+    }
+    TimeUtility::RefreshLoopTime();
+    timer->Update();
+}
+
+static int64_t Now() {
+    TimeUtility::RefreshLoopTime();
+    return TimeUtility::GetLoopMS();
+}
+
+/// @brief 记录超时时间，返回ret
+struct Recorder {
+    Recorder() : ret(-1) {}
+
+    int32_t operator()(int64_t timer_id) {
+        fired.push_back(TimeUtility::GetLoopMS());
+        return ret;
+    }
+
+    int32_t ret;
+    std::vector<int64_t> fired;
+};
+
+static void CheckFiredOnce(const Recorder& recorder, int64_t start, int64_t timeout_ms) {
+    CHECK(recorder.fired.size() == 1);
+    int64_t cost = recorder.fired[0] - start;
+    if (cost < timeout_ms || cost > timeout_ms + kSlackMs) {
+        fprintf(stderr, "timeout %ld fired after %ld ms\n", timeout_ms, cost);
+        CHECK(false);
+    }
+}
+
+static void TestCascade() {
+    WheelTimer timer;
+    // 第0层256ms，第1层覆盖到16384ms，更长的放在第2层
+    const uint32_t timeouts[] = { 1, 100, 255, 256, 257, 300, 511, 512, 1000, 16383, 16500 };
+    const uint32_t num = sizeof(timeouts) / sizeof(timeouts[0]);
+    Recorder recorders[num];
+
+    int64_t start = Now();
+    for (uint32_t i = 0; i < num; i++) {
+        CHECK(timer.StartTimer(timeouts[i], cxx::ref(recorders[i])) >= 0);
+    }
+    CHECK(timer.GetTimerNum() == num);
+
+    RunFor(&timer, timeouts[num - 1] + kSlackMs);
+    for (uint32_t i = 0; i < num; i++) {
+        CheckFiredOnce(recorders[i], start, timeouts[i]);
+    }
+    CHECK(timer.GetTimerNum() == 0);
+    printf("%-36s ok\n", "cascade across levels");
+}
+
+/// @brief 回调中操作定时器
+struct SelfControl {
+    SelfControl() : timer(NULL), other(-1), calls(0), action(0) {}
+
+    enum {
+        STOP_AND_CONTINUE = 0,  // 停止自己但返回0，停止优先
+        RESTART_AND_REMOVE,     // 第一次重启自己但返回-1，重启优先
+        NEW_TIMEOUT,            // 第一次返回新的超时时间
+        STOP_OTHER,             // 停止另一个定时器并启动一个新的定时器
+    };
+
+    int32_t operator()(int64_t timer_id) {
+        calls++;
+        fired.push_back(TimeUtility::GetLoopMS());
+        switch (action) {
+            case STOP_AND_CONTINUE:
+                CHECK(0 == timer->StopTimer(timer_id));
+                // 重复停止时定时器仍在回调中，同样返回成功
+                CHECK(0 == timer->StopTimer(timer_id));
+                return 0;
+
+            case RESTART_AND_REMOVE:
+                if (1 == calls) {
+                    CHECK(0 == timer->ReStartTimer(timer_id));
+                }
+                return -1;
+
+            case NEW_TIMEOUT:
+                return 1 == calls ? 50 : -1;
+
+            case STOP_OTHER:
+                CHECK(0 == timer->StopTimer(other));
+                CHECK(timer->StartTimer(20, cxx::ref(started)) >= 0);
+                return -1;
+
+            default:
+                return -1;
+        }
+    }
+
+    WheelTimer* timer;
+    int64_t other;
+    int32_t calls;
+    int32_t action;
+    std::vector<int64_t> fired;
+    Recorder started;
+};
+
+static void TestCallbackControl() {
+    WheelTimer timer;
+    int64_t start = Now();
+
+    SelfControl stop;
+    stop.timer  = &timer;
+    stop.action = SelfControl::STOP_AND_CONTINUE;
+    CHECK(timer.StartTimer(10, cxx::ref(stop)) >= 0);
+
+    SelfControl restart;
+    restart.timer  = &timer;
+    restart.action = SelfControl::RESTART_AND_REMOVE;
+    CHECK(timer.StartTimer(10, cxx::ref(restart)) >= 0);
+
+    SelfControl new_timeout;
+    new_timeout.timer  = &timer;
+    new_timeout.action = SelfControl::NEW_TIMEOUT;
+    CHECK(timer.StartTimer(10, cxx::ref(new_timeout)) >= 0);
+
+    // 同一个槽中后超时的定时器被前一个回调停止
+    Recorder victim;
+    SelfControl stop_other;
+    stop_other.timer  = &timer;
+    stop_other.action = SelfControl::STOP_OTHER;
+    CHECK(timer.StartTimer(30, cxx::ref(stop_other)) >= 0);
+    stop_other.other = timer.StartTimer(30, cxx::ref(victim));
+    CHECK(stop_other.other >= 0);
+
+    RunFor(&timer, 150);
+
+    CHECK(1 == stop.calls);
+    CHECK(2 == restart.calls);
+    CHECK(restart.fired[1] - restart.fired[0] >= 10);
+    CHECK(2 == new_timeout.calls);
+    CHECK(new_timeout.fired[1] - new_timeout.fired[0] >= 50);
+    CHECK(1 == stop_other.calls);
+    CHECK(victim.fired.empty());
+    CheckFiredOnce(stop_other.started, stop_other.fired[0], 20);
+    CHECK(stop_other.fired[0] - start >= 30);
+
+    // 被停止的定时器ID失效
+    CHECK(kTIMER_UNEXISTED == timer.StopTimer(stop_other.other));
+    CHECK(timer.GetTimerNum() == 0);
+    printf("%-36s ok\n", "stop/restart in callback");
+}
+
+static void TestLongTimeout() {
+    WheelTimer timer;
+    const uint32_t timeouts[] = { 3 * 24 * 3600 * 1000U, 0xFFFFFFFFU };
+    const uint32_t num = sizeof(timeouts) / sizeof(timeouts[0]);
+    Recorder recorders[num];
+    int64_t ids[num];
+
+    Now();
+    for (uint32_t i = 0; i < num; i++) {
+        ids[i] = timer.StartTimer(timeouts[i], cxx::ref(recorders[i]));
+        CHECK(ids[i] >= 0);
+    }
+    // 不会因为超出层的范围而提前超时
+    RunFor(&timer, 300);
+    for (uint32_t i = 0; i < num; i++) {
+        CHECK(recorders[i].fired.empty());
+    }
+
+    int64_t next = timer.GetNextTimeout();
+    CHECK(next > 0 && next <= timeouts[0]);
+
+    for (uint32_t i = 0; i < num; i++) {
+        CHECK(0 == timer.StopTimer(ids[i]));
+        CHECK(kTIMER_UNEXISTED == timer.StopTimer(ids[i]));
+    }
+    CHECK(timer.GetTimerNum() == 0);
+    CHECK(timer.GetNextTimeout() < 0);
+    printf("%-36s ok\n", "very long timeouts");
+}
+
+static void TestNextTimeout() {
+    WheelTimer timer;
+    CHECK(timer.GetNextTimeout() < 0);
+
+    Recorder short_timer;
+    Recorder long_timer;
+    int64_t start = Now();
+    CHECK(timer.StartTimer(100, cxx::ref(short_timer)) >= 0);
+    CHECK(timer.StartTimer(1000, cxx::ref(long_timer)) >= 0);
+
+    // 第0层精确
+    int64_t next = timer.GetNextTimeout();
+    CHECK(next > 100 - kSlackMs && next <= 100);
+
+    // 到期后还没有Update时为0
+    usleep(120 * 1000);
+    CHECK(0 == timer.GetNextTimeout());
+    RunFor(&timer, 0);
+    CheckFiredOnce(short_timer, start, 100);
+
+    // 剩下第1层的定时器，返回值不晚于实际的超时时间
+    next = timer.GetNextTimeout();
+    int64_t remain = start + 1000 - Now();
+    CHECK(next >= 0 && next <= remain);
+
+    // 按GetNextTimeout等待，不会错过超时
+    while (long_timer.fired.empty()) {
+        next = timer.GetNextTimeout();
+        CHECK(next >= 0);
+        usleep(next * 1000);
+        RunFor(&timer, 0);
+        CHECK(Now() - start <= 1000 + kSlackMs);
+    }
+    CheckFiredOnce(long_timer, start, 1000);
+    CHECK(timer.GetNextTimeout() < 0);
+    printf("%-36s ok\n", "GetNextTimeout");
+}
+
+int main(int argc, char** argv) {
+    alarm(120);
+
+    TestCallbackControl();
+    TestLongTimeout();
+    TestNextTimeout();
+    TestCascade();
+
+    printf("PASS\n");
+    return 0;
+}
@@ -0,0 +1,181 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+// WorkStealingDeque测试: 单线程下Pop后进先出、Steal先进先出、扩容不丢元素；
+// 所有者Push/Pop与多个窃取线程并发时，每个元素恰好被取出一次，包括只剩最后一个元素时的竞争
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <vector>
+
+#include "common/thread.h"
+#include "common/time_utility.h"
+#include "common/work_stealing_deque.h"
+#include "test/common/check.h"
+
+using namespace pebble;
+
+static void TestSingleThread() {
+    const int32_t kNum = 1000;
+    std::vector<int32_t> items(kNum);
+    for (int32_t i = 0; i < kNum; i++) {
+        items[i] = i;
+    }
+
+    // 初始容量很小，Push过程中多次扩容
+    WorkStealingDeque<int32_t> deque(2);
+    int32_t* value = NULL;
+    CHECK(!deque.Pop(&value));
+    CHECK(!deque.Steal(&value));
+
+    for (int32_t i = 0; i < kNum; i++) {
+        deque.Push(&items[i]);
+    }
+    CHECK(deque.Size() == static_cast<size_t>(kNum));
+
+    // 顶部先进先出
+    for (int32_t i = 0; i < kNum / 2; i++) {
+        CHECK(deque.Steal(&value) && *value == i);
+    }
+    // 底部后进先出
+    for (int32_t i = kNum - 1; i >= kNum / 2; i--) {
+        CHECK(deque.Pop(&value) && *value == i);
+    }
+    CHECK(deque.IsEmpty());
+    CHECK(!deque.Pop(&value));
+    CHECK(!deque.Steal(&value));
+    printf("%-32s ok\n", "single thread order and grow");
+}
+
+/// @brief 共享的元素表，记录每个元素被取出的次数
+struct Items {
+    explicit Items(int32_t num) : ids(num), counts(num, 0), taken(0), stop(0) {
+        for (int32_t i = 0; i < num; i++) {
+            ids[i] = i;
+        }
+    }
+
+    void Take(int32_t* value) {
+        CHECK(*value >= 0 && *value < static_cast<int32_t>(ids.size()));
+        __atomic_add_fetch(&counts[*value], 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&taken, 1, __ATOMIC_RELAXED);
+    }
+
+    void Verify() const {
+        CHECK(__atomic_load_n(&taken, __ATOMIC_ACQUIRE) == static_cast<int64_t>(ids.size()));
+        for (size_t i = 0; i < counts.size(); i++) {
+            if (counts[i] != 1) {
+                fprintf(stderr, "item %zu taken %d times\n", i, counts[i]);
+                exit(1);
+            }
+        }
+    }
+
+    std::vector<int32_t> ids;
+    std::vector<int32_t> counts;
+    int64_t taken;
+    int32_t stop;
+};
+
+class Thief : public Thread {
+public:
+    Thief(WorkStealingDeque<int32_t>* deque, Items* items)
+        : m_deque(deque), m_items(items), m_stolen(0) {}
+
+    virtual void Run() {
+        int32_t* value = NULL;
+        while (__atomic_load_n(&m_items->stop, __ATOMIC_ACQUIRE) == 0) {
+            if (m_deque->Steal(&value)) {
+                m_items->Take(value);
+                m_stolen++;
+            }
+        }
+        // 所有者结束后把剩余的元素偷完
+        while (m_deque->Steal(&value)) {
+            m_items->Take(value);
+            m_stolen++;
+        }
+    }
+
+    int64_t Stolen() const {
+        return m_stolen;
+    }
+
+private:
+    WorkStealingDeque<int32_t>* m_deque;
+    Items* m_items;
+    int64_t m_stolen;
+};
+
+// batch为每轮Push的元素个数，每轮Push后Pop回一半，batch为1时每次Pop都与窃取线程争最后一个元素
+static void RunRace(const char* name, int32_t item_num, int32_t batch, int32_t thief_num) {
+    WorkStealingDeque<int32_t> deque(4);
+    Items items(item_num);
+
+    std::vector<Thief*> thieves;
+    for (int32_t i = 0; i < thief_num; i++) {
+        thieves.push_back(new Thief(&deque, &items));
+        CHECK(thieves.back()->Start());
+    }
+
+    int64_t start = TimeUtility::GetMonotonicMS();
+    int64_t popped = 0;
+    int32_t* value = NULL;
+    int32_t next = 0;
+    while (next < item_num) {
+        int32_t end = next + batch < item_num ? next + batch : item_num;
+        for (; next < end; next++) {
+            deque.Push(&items.ids[next]);
+        }
+        for (int32_t i = 0; i < (batch + 1) / 2; i++) {
+            if (!deque.Pop(&value)) {
+                break;
+            }
+            items.Take(value);
+            popped++;
+        }
+    }
+    while (deque.Pop(&value)) {
+        items.Take(value);
+        popped++;
+    }
+    __atomic_store_n(&items.stop, 1, __ATOMIC_RELEASE);
+
+    int64_t stolen = 0;
+    for (int32_t i = 0; i < thief_num; i++) {
+        thieves[i]->Join();
+        stolen += thieves[i]->Stolen();
+        delete thieves[i];
+    }
+
+    items.Verify();
+    CHECK(deque.IsEmpty());
+    printf("%-32s items=%d thieves=%d popped=%ld stolen=%ld: ok, %ld ms\n", name, item_num, thief_num,
+        popped, stolen, TimeUtility::GetMonotonicMS() - start);
+}
+
+int main(int argc, char** argv) {
+    alarm(300);
+
+    TestSingleThread();
+
+    RunRace("last element race",        1000000, 1,   3);
+    RunRace("small batches",            1000000, 8,   3);
+    RunRace("large batches with grow",  1000000, 512, 3);
+    RunRace("many thieves",             500000,  16,  8);
+
+    printf("PASS\n");
+    return 0;
+}
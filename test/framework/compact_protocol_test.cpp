@@ -0,0 +1,374 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+// TCompactProtocol测试:
+//   roundtrip  所有字段类型、负数zigzag、bool字段打包、嵌套结构体和容器，经TProtocol*虚接口和
+//              TCompactProtocolT<TMemoryBuffer>模板两种方式编解码，编码结果逐字节一致
+//   wire       varint/zigzag和bool字段头的编码格式
+//   corrupt    截断、逐字节篡改、随机数据、超长长度和深层嵌套的输入抛异常，不崩溃
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+#include "framework/dr/protocol/compact_protocol.h"
+#include "framework/dr/transport/buffer_transport.h"
+#include "test/common/check.h"
+#include "test/framework/compact_test.h"
+
+using namespace pebble::dr;
+
+typedef cxx::shared_ptr<transport::TMemoryBuffer> MemoryBufferPtr;
+typedef protocol::TCompactProtocolT<transport::TMemoryBuffer> CompactProtocol;
+
+static void FillInner(compact_test::Inner* inner, bool flag, int32_t value, int32_t flag_num) {
+    inner->flag  = flag;
+    inner->value = value;
+    for (int32_t i = 0; i < flag_num; i++) {
+        inner->flags.push_back(i % 3 == 0);
+    }
+}
+
+// 最小值、-1等负数，zigzag编码后的varint最长
+static void FillNegative(compact_test::AllTypes* data) {
+    data->b1    = false;
+    data->i8    = INT8_MIN;
+    data->i16v  = INT16_MIN;
+    data->i32v  = INT32_MIN;
+    data->i64v  = INT64_MIN;
+    data->dbl   = -0.0;
+    data->str   = "";
+    data->bin   = std::string("\0\xff\x80\x7f", 4);
+    data->color = compact_test::BLUE;
+    data->b2    = false;
+    FillInner(&data->inner, false, -1, 20);
+    data->ints.push_back(-1);
+    data->ints.push_back(INT32_MIN);
+    data->ints.push_back(-64);
+    data->longs.insert(-1);
+    data->longs.insert(INT64_MIN);
+    data->longs.insert(-(1LL << 35));
+    FillInner(&data->named[""], false, INT32_MIN, 0);
+    data->nested.resize(16);
+    for (int32_t i = 0; i < 16; i++) {
+        data->nested[i].push_back(-i);
+        data->nested[i].push_back(INT16_MIN);
+    }
+    data->groups[-1].push_back("minus one");
+    data->groups[INT32_MIN].push_back(std::string("\0", 1));
+    data->far_bool  = false;
+    data->far_i64   = -2;
+    data->back_bool = true;
+    data->inners.resize(2);
+    FillInner(&data->inners[1], true, -7, 1);
+    data->__set_opt(-100);
+}
+
+static void FillPositive(compact_test::AllTypes* data) {
+    data->b1    = true;
+    data->i8    = INT8_MAX;
+    data->i16v  = INT16_MAX;
+    data->i32v  = INT32_MAX;
+    data->i64v  = INT64_MAX;
+    data->dbl   = 1.0e300;
+    data->str   = std::string(300, 'x');
+    data->bin   = "binary";
+    data->color = compact_test::RED;
+    data->b2    = true;
+    FillInner(&data->inner, true, INT32_MAX, 14);
+    for (int32_t i = 0; i < 15; i++) {
+        data->ints.push_back(i * 1000);
+    }
+    data->longs.insert(0);
+    data->longs.insert(INT64_MAX);
+    FillInner(&data->named["a"], true, 1, 15);
+    FillInner(&data->named["b"], false, 0, 0);
+    data->nested.resize(1);
+    data->groups[INT32_MAX].push_back("max");
+    data->groups[INT32_MAX].push_back("");
+    data->far_bool  = true;
+    data->far_i64   = INT64_MAX;
+    data->back_bool = false;
+    data->inners.resize(1);
+    FillInner(&data->inners[0], true, 1, 2);
+}
+
+static std::string EncodeVirtual(const compact_test::AllTypes& data) {
+    MemoryBufferPtr buff(new transport::TMemoryBuffer());
+    protocol::TCompactProtocol prot(buff);
+    protocol::TProtocol* vprot = &prot;
+    data.write(vprot);
+    return buff->getBufferAsString();
+}
+
+static std::string EncodeTemplate(const compact_test::AllTypes& data) {
+    MemoryBufferPtr buff(new transport::TMemoryBuffer());
+    CompactProtocol prot(buff);
+    data.write(&prot);
+    return buff->getBufferAsString();
+}
+
+static void DecodeVirtual(const std::string& encoded, compact_test::AllTypes* data) {
+    MemoryBufferPtr buff(new transport::TMemoryBuffer(
+        reinterpret_cast<uint8_t*>(const_cast<char*>(encoded.data())), encoded.size()));
+    protocol::TCompactProtocol prot(buff);
+    protocol::TProtocol* vprot = &prot;
+    data->read(vprot);
+}
+
+static void DecodeTemplate(const std::string& encoded, compact_test::AllTypes* data) {
+    MemoryBufferPtr buff(new transport::TMemoryBuffer(
+        reinterpret_cast<uint8_t*>(const_cast<char*>(encoded.data())), encoded.size()));
+    CompactProtocol prot(buff);
+    data->read(&prot);
+}
+
+static void CheckRoundtrip(const char* name, const compact_test::AllTypes& data) {
+    std::string encoded = EncodeVirtual(data);
+    CHECK(encoded == EncodeTemplate(data));
+
+    compact_test::AllTypes virtual_decoded;
+    DecodeVirtual(encoded, &virtual_decoded);
+    CHECK(virtual_decoded == data);
+    CHECK(EncodeTemplate(virtual_decoded) == encoded);
+
+    compact_test::AllTypes template_decoded;
+    DecodeTemplate(encoded, &template_decoded);
+    CHECK(template_decoded == data);
+    CHECK(EncodeVirtual(template_decoded) == encoded);
+    printf("%-36s %5zu bytes ok\n", name, encoded.size());
+}
+
+static void TestRoundtrip() {
+    compact_test::AllTypes empty;
+    CheckRoundtrip("roundtrip default", empty);
+
+    compact_test::AllTypes negative;
+    FillNegative(&negative);
+    CheckRoundtrip("roundtrip negative", negative);
+
+    compact_test::AllTypes positive;
+    FillPositive(&positive);
+    CheckRoundtrip("roundtrip positive", positive);
+}
+
+/// @brief 用模板协议写入，返回编码结果
+struct Writer {
+    Writer() : buff(new transport::TMemoryBuffer()), prot(buff) {}
+
+    std::string Data() {
+        return buff->getBufferAsString();
+    }
+
+    MemoryBufferPtr buff;
+    CompactProtocol prot;
+};
+
+static void TestWire() {
+    {
+        Writer w;
+        w.prot.writeI32(-1);
+        w.prot.writeI32(1);
+        w.prot.writeI16(-64);
+        CHECK(w.Data() == std::string("\x01\x02\x7f", 3));
+    }
+    {
+        Writer w;
+        w.prot.writeI64(INT64_MIN);
+        CHECK(w.Data() == std::string("\xff\xff\xff\xff\xff\xff\xff\xff\xff\x01", 10));
+
+        int64_t i64 = 0;
+        CompactProtocol rprot(w.buff);
+        CHECK(10 == rprot.readI64(i64));
+        CHECK(INT64_MIN == i64);
+    }
+
+    // bool字段的值打包在字段头中，短格式为delta<<4|type，长格式为type加zigzag i16的字段ID
+    const bool values[] = { true, false };
+    for (int32_t i = 0; i < 2; i++) {
+        Writer w;
+        w.prot.writeStructBegin("s");
+        w.prot.writeFieldBegin("a", protocol::T_BOOL, 1);
+        w.prot.writeBool(values[i]);
+        w.prot.writeFieldEnd();
+        w.prot.writeFieldBegin("b", protocol::T_BOOL, 300);
+        w.prot.writeBool(values[i]);
+        w.prot.writeFieldEnd();
+        w.prot.writeFieldStop();
+        w.prot.writeStructEnd();
+        char type = values[i] ? 0x01 : 0x02;
+        std::string expected;
+        expected += static_cast<char>(0x10 | type);
+        expected += type;
+        expected += "\xd8\x04";
+        expected += '\0';
+        CHECK(w.Data() == expected);
+
+        CompactProtocol rprot(w.buff);
+        std::string name;
+        protocol::TType type_read;
+        int16_t id = 0;
+        bool value = !values[i];
+        rprot.readStructBegin(name);
+        rprot.readFieldBegin(name, type_read, id);
+        CHECK(protocol::T_BOOL == type_read && 1 == id);
+        rprot.readBool(value);
+        CHECK(values[i] == value);
+        rprot.readFieldEnd();
+        rprot.readFieldBegin(name, type_read, id);
+        CHECK(protocol::T_BOOL == type_read && 300 == id);
+        value = !values[i];
+        rprot.readBool(value);
+        CHECK(values[i] == value);
+        rprot.readFieldEnd();
+        rprot.readFieldBegin(name, type_read, id);
+        CHECK(protocol::T_STOP == type_read);
+        rprot.readStructEnd();
+    }
+    printf("%-36s ok\n", "wire format");
+}
+
+/// @brief 解码可能被篡改的数据，返回是否抛出异常，两种方式的结果必须一致
+static bool DecodeCorrupt(const std::string& encoded) {
+    bool virtual_thrown = false;
+    try {
+        compact_test::AllTypes data;
+        DecodeVirtual(encoded, &data);
+    } catch (pebble::TException& e) {
+        virtual_thrown = true;
+    }
+
+    bool template_thrown = false;
+    try {
+        compact_test::AllTypes data;
+        DecodeTemplate(encoded, &data);
+    } catch (pebble::TException& e) {
+        template_thrown = true;
+    }
+    CHECK(virtual_thrown == template_thrown);
+    return virtual_thrown;
+}
+
+static void TestTruncated() {
+    compact_test::AllTypes data;
+    FillNegative(&data);
+    std::string encoded = EncodeVirtual(data);
+
+    // 最外层结构体的stop字节在最后，任何截断都读不到结束
+    for (size_t len = 0; len < encoded.size(); len++) {
+        CHECK(DecodeCorrupt(encoded.substr(0, len)));
+    }
+    CHECK(!DecodeCorrupt(encoded));
+    printf("%-36s %5zu prefixes ok\n", "truncated input", encoded.size());
+}
+
+static void TestMutated() {
+    compact_test::AllTypes data;
+    FillPositive(&data);
+    std::string encoded = EncodeVirtual(data);
+
+    // 篡改后的数据可能仍然合法，只要求不崩溃
+    const uint8_t patterns[] = { 0x00, 0xff, 0x7f, 0x80, 0x0f, 0xf0 };
+    int64_t thrown = 0;
+    int64_t total  = 0;
+    srand(12345);
+    for (size_t pos = 0; pos < encoded.size(); pos++) {
+        for (size_t i = 0; i <= sizeof(patterns); i++) {
+            std::string mutated = encoded;
+            mutated[pos] = i < sizeof(patterns) ? patterns[i] : static_cast<char>(rand());
+            thrown += DecodeCorrupt(mutated) ? 1 : 0;
+            total++;
+        }
+    }
+
+    for (int32_t i = 0; i < 20000; i++) {
+        std::string garbage(rand() % 64, '\0');
+        for (size_t j = 0; j < garbage.size(); j++) {
+            garbage[j] = static_cast<char>(rand());
+        }
+        thrown += DecodeCorrupt(garbage) ? 1 : 0;
+        total++;
+    }
+    printf("%-36s %5ld inputs, %ld rejected ok\n", "mutated input", total, thrown);
+}
+
+static void CheckProtocolError(const std::string& encoded,
+    protocol::TProtocolException::TProtocolExceptionType type) {
+    for (int32_t i = 0; i < 2; i++) {
+        try {
+            compact_test::AllTypes data;
+            if (0 == i) {
+                DecodeVirtual(encoded, &data);
+            } else {
+                DecodeTemplate(encoded, &data);
+            }
+            CHECK(false);
+        } catch (protocol::TProtocolException& e) {
+            CHECK(type == e.getType());
+        }
+    }
+}
+
+static void TestLimits() {
+    // 字段7(string)长度为负数或超过8M限制，在分配内存前拒绝
+    CheckProtocolError(std::string("\x78\xff\xff\xff\xff\x0f", 6), protocol::TProtocolException::NEGATIVE_SIZE);
+    CheckProtocolError(std::string("\x78\x80\x80\x80\x08", 5), protocol::TProtocolException::SIZE_LIMIT);
+    // 字段12(list<i32>)元素个数超过限制
+    CheckProtocolError(std::string("\xc9\xf5\x80\x80\x80\x08", 6), protocol::TProtocolException::SIZE_LIMIT);
+    // 字段14(map)元素个数为负数
+    CheckProtocolError(std::string("\xeb\xff\xff\xff\xff\x0f\x8c", 7),
+        protocol::TProtocolException::NEGATIVE_SIZE);
+    // varint超过10字节
+    CheckProtocolError(std::string("\x56") + std::string(11, '\xff'), protocol::TProtocolException::INVALID_DATA);
+    // 未知的类型
+    CheckProtocolError(std::string("\x1d", 1), protocol::TProtocolException::INVALID_DATA);
+
+    // 未知字段是嵌套很深的结构体，skip时超过嵌套深度限制
+    std::string deep(1 << 20, '\x1c');
+    CheckProtocolError(deep, protocol::TProtocolException::DEPTH_LIMIT);
+
+    // 抛异常后同一个协议对象可以继续解码
+    compact_test::AllTypes data;
+    FillPositive(&data);
+    std::string encoded = EncodeVirtual(data);
+    MemoryBufferPtr buff(new transport::TMemoryBuffer());
+    protocol::TCompactProtocol prot(buff);
+    for (int32_t i = 0; i < 100; i++) {
+        buff->resetBuffer(reinterpret_cast<uint8_t*>(&deep[0]), deep.size());
+        compact_test::AllTypes decoded;
+        try {
+            decoded.read(&prot);
+            CHECK(false);
+        } catch (protocol::TProtocolException& e) {
+            CHECK(protocol::TProtocolException::DEPTH_LIMIT == e.getType());
+        }
+        prot.clearContext();
+
+        buff->resetBuffer(reinterpret_cast<uint8_t*>(&encoded[0]), encoded.size());
+        decoded.read(&prot);
+        CHECK(decoded == data);
+    }
+    printf("%-36s ok\n", "size and depth limits");
+}
+
+int main(int argc, char** argv) {
+    TestRoundtrip();
+    TestWire();
+    TestTruncated();
+    TestMutated();
+    TestLimits();
+
+    printf("PASS\n");
+    return 0;
+}
@@ -0,0 +1,65 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#ifndef _PEBBLE_TEST_FRAMEWORK_DR_BENCH_DATA_H_
+#define _PEBBLE_TEST_FRAMEWORK_DR_BENCH_DATA_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+#include "common/time_utility.h"
+#include "test/common/check.h"
+#include "test/framework/dr_bench.h"
+
+/// @brief dr序列化benchmark的公共数据
+/// 典型的玩家数据: 20个道具、20个属性，字符串以普通文本为主
+inline void FillPlayer(dr_bench::Player* player) {
+    player->uid    = 123456789;
+    player->name   = "\xe7\x8e\xa9\xe5\xae\xb6_player_01";
+    player->level  = 30;
+    player->exp    = 12345;
+    player->x      = 1.5;
+    player->y      = -2.25;
+    player->online = true;
+    for (int32_t i = 0; i < 20; i++) {
+        dr_bench::Item item;
+        item.id     = 1000 + i;
+        item.count  = i * 3;
+        item.expire = 1500000000LL + i;
+        item.bound  = (i % 3 == 0);
+        player->items.push_back(item);
+        player->attrs[i] = i * 100;
+    }
+    player->tags.insert("vip");
+    player->tags.insert("guild:\xe9\xbe\x99\xe4\xb9\x8b\xe8\xb0\xb7");
+    player->named["main weapon"] = player->items[0];
+    player->named["mount"]       = player->items[1];
+    player->notes.push_back("last login from 10.0.0.1");
+}
+
+/// @brief 计时辅助，返回每次操作的平均耗时(ns)
+class BenchTimer {
+public:
+    BenchTimer() : m_start(pebble::TimeUtility::GetCurrentUS()) {}
+
+    double NsPerOp(int64_t ops) const {
+        return (pebble::TimeUtility::GetCurrentUS() - m_start) * 1000.0 / ops;
+    }
+
+private:
+    int64_t m_start;
+};
+
+#endif // _PEBBLE_TEST_FRAMEWORK_DR_BENCH_DATA_H_
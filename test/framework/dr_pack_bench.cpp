@@ -0,0 +1,127 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+// dr::TryPack/TryUnPack与Pack/UnPack(TBinaryProtocol)对比:
+//   pack      buffer足够时打包
+//   retry     先用64字节buffer打包，不足时再用足够的buffer重试
+//   unpack    完整数据解包
+//   truncated 数据截断时解包失败的开销
+// 同时检查两者编码结果一致、截断数据在任意位置都能报告失败
+// 用法: dr_pack_bench [次数]
+
+#include <string.h>
+
+#include "framework/dr/protocol/binary_protocol.h"
+#include "framework/dr/serialize.h"
+#include "test/framework/dr_bench_data.h"
+
+using namespace pebble::dr;
+
+typedef protocol::TBinaryProtocol Binary;
+
+static void CheckEquivalent(const dr_bench::Player& player) {
+    uint8_t expect[4096];
+    uint8_t actual[4096];
+    int expect_len = Pack<dr_bench::Player, Binary>(&player, expect, sizeof(expect));
+    CHECK(expect_len > 0);
+
+    // 溢出时返回完整长度，用这个长度重试必定成功
+    bool overflow = false;
+    int need = TryPack(&player, actual, 16, &overflow);
+    CHECK(overflow && need == expect_len);
+    int actual_len = TryPack(&player, actual, need, &overflow);
+    CHECK(!overflow && actual_len == expect_len);
+    CHECK(0 == memcmp(expect, actual, expect_len));
+
+    dr_bench::Player decoded;
+    CHECK(TryUnPack(&decoded, actual, actual_len, &overflow) == actual_len && !overflow);
+    CHECK(decoded == player);
+
+    for (int cut = 0; cut < actual_len; cut++) {
+        dr_bench::Player truncated;
+        CHECK(TryUnPack(&truncated, actual, cut, &overflow) == kINVALIDBUFFER && overflow);
+    }
+    printf("%-10s ok, %d bytes\n", "equivalent", expect_len);
+}
+
+int main(int argc, char** argv) {
+    int64_t num = argc > 1 ? atoll(argv[1]) : 200000;
+    CHECK(num >= 10);
+
+    dr_bench::Player player;
+    FillPlayer(&player);
+    CheckEquivalent(player);
+
+    uint8_t buff[4096];
+    uint8_t small[64];
+    bool overflow = false;
+    int64_t sink = 0;
+    int len = Pack<dr_bench::Player, Binary>(&player, buff, sizeof(buff));
+
+    BenchTimer timer;
+    for (int64_t i = 0; i < num; i++) {
+        sink += Pack<dr_bench::Player, Binary>(&player, buff, sizeof(buff));
+    }
+    double pack_ns = timer.NsPerOp(num);
+    timer = BenchTimer();
+    for (int64_t i = 0; i < num; i++) {
+        sink += TryPack(&player, buff, sizeof(buff), &overflow);
+    }
+    printf("%-10s Pack   %7.0f ns  TryPack   %7.0f ns\n", "pack", pack_ns, timer.NsPerOp(num));
+
+    // 失败路径开销较大，次数减少到1/10
+    int64_t retry_num = num / 10;
+    timer = BenchTimer();
+    for (int64_t i = 0; i < retry_num; i++) {
+        int ret = Pack<dr_bench::Player, Binary>(&player, small, sizeof(small));
+        if (kINSUFFICIENTBUFFER == ret) {
+            ret = Pack<dr_bench::Player, Binary>(&player, buff, sizeof(buff));
+        }
+        sink += ret;
+    }
+    pack_ns = timer.NsPerOp(retry_num);
+    timer = BenchTimer();
+    for (int64_t i = 0; i < retry_num; i++) {
+        int ret = TryPack(&player, small, sizeof(small), &overflow);
+        if (overflow) {
+            ret = TryPack(&player, buff, ret, &overflow);
+        }
+        sink += ret;
+    }
+    printf("%-10s Pack   %7.0f ns  TryPack   %7.0f ns\n", "retry", pack_ns, timer.NsPerOp(retry_num));
+
+    dr_bench::Player decoded;
+    timer = BenchTimer();
+    for (int64_t i = 0; i < num; i++) {
+        sink += UnPack<dr_bench::Player, Binary>(&decoded, buff, len);
+    }
+    double unpack_ns = timer.NsPerOp(num);
+    timer = BenchTimer();
+    for (int64_t i = 0; i < num; i++) {
+        sink += TryUnPack(&decoded, buff, len, &overflow);
+    }
+    printf("%-10s UnPack %7.0f ns  TryUnPack %7.0f ns\n", "unpack", unpack_ns, timer.NsPerOp(num));
+
+    timer = BenchTimer();
+    for (int64_t i = 0; i < retry_num; i++) {
+        sink += UnPack<dr_bench::Player, Binary>(&decoded, buff, len - 5);
+    }
+    unpack_ns = timer.NsPerOp(retry_num);
+    timer = BenchTimer();
+    for (int64_t i = 0; i < retry_num; i++) {
+        sink += TryUnPack(&decoded, buff, len - 5, &overflow);
+    }
+    printf("%-10s UnPack %7.0f ns  TryUnPack %7.0f ns\n", "truncated", unpack_ns, timer.NsPerOp(retry_num));
+
+    return sink == 0 ? 1 : 0;
+}
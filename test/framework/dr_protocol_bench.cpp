@@ -0,0 +1,119 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+// 生成代码的read/write经TProtocol*虚接口调用与模板化协议直接调用的对比:
+//   virtual   TBinaryProtocol/TCompactProtocol，通过TProtocol*调用read/write(TProtocol*)
+//   template  TBinaryProtocolT<TMemoryBuffer>/TCompactProtocolT<TMemoryBuffer>，调用模板read/write
+// 同时检查两种方式编码结果逐字节一致，输出格式为 virtual -> template
+// 用法: dr_protocol_bench [次数]
+
+#include "framework/dr/protocol/binary_protocol.h"
+#include "framework/dr/protocol/compact_protocol.h"
+#include "framework/dr/transport/buffer_transport.h"
+#include "test/framework/dr_bench_data.h"
+
+using namespace pebble::dr;
+
+typedef cxx::shared_ptr<transport::TMemoryBuffer> MemoryBufferPtr;
+
+struct Result {
+    double write_ns;
+    double read_ns;
+    std::string encoded;
+};
+
+// 通过TProtocol*调用，只使用虚接口
+static void RunVirtual(protocol::TProtocol* prot, transport::TMemoryBuffer* buff,
+    const dr_bench::Player& player, int64_t num, Result* result) {
+    BenchTimer timer;
+    for (int64_t i = 0; i < num; i++) {
+        buff->resetBuffer();
+        player.write(prot);
+    }
+    result->write_ns = timer.NsPerOp(num);
+    result->encoded  = buff->getBufferAsString();
+
+    dr_bench::Player decoded;
+    uint8_t* data = reinterpret_cast<uint8_t*>(const_cast<char*>(result->encoded.data()));
+    timer = BenchTimer();
+    for (int64_t i = 0; i < num; i++) {
+        buff->resetBuffer(data, result->encoded.size());
+        decoded.read(prot);
+    }
+    result->read_ns = timer.NsPerOp(num);
+    CHECK(decoded == player);
+}
+
+// 具体协议类型，调用生成代码的模板read/write
+template <class Protocol_>
+static void RunTemplate(Protocol_* prot, transport::TMemoryBuffer* buff,
+    const dr_bench::Player& player, int64_t num, Result* result) {
+    BenchTimer timer;
+    for (int64_t i = 0; i < num; i++) {
+        buff->resetBuffer();
+        player.write(prot);
+    }
+    result->write_ns = timer.NsPerOp(num);
+    result->encoded  = buff->getBufferAsString();
+
+    dr_bench::Player decoded;
+    uint8_t* data = reinterpret_cast<uint8_t*>(const_cast<char*>(result->encoded.data()));
+    timer = BenchTimer();
+    for (int64_t i = 0; i < num; i++) {
+        buff->resetBuffer(data, result->encoded.size());
+        decoded.read(prot);
+    }
+    result->read_ns = timer.NsPerOp(num);
+    CHECK(decoded == player);
+}
+
+static void Report(const char* name, const Result& virtual_result, const Result& template_result) {
+    // 两种方式的编码结果必须一致
+    CHECK(virtual_result.encoded == template_result.encoded);
+    printf("%-8s %5zu bytes  write %6.0f -> %6.0f ns  read %6.0f -> %6.0f ns\n", name,
+        virtual_result.encoded.size(), virtual_result.write_ns, template_result.write_ns,
+        virtual_result.read_ns, template_result.read_ns);
+}
+
+int main(int argc, char** argv) {
+    int64_t num = argc > 1 ? atoll(argv[1]) : 200000;
+    CHECK(num > 0);
+
+    dr_bench::Player player;
+    FillPlayer(&player);
+
+    {
+        Result virtual_result;
+        Result template_result;
+        MemoryBufferPtr buff(new transport::TMemoryBuffer());
+        protocol::TBinaryProtocol virtual_prot(buff);
+        RunVirtual(&virtual_prot, buff.get(), player, num, &virtual_result);
+        MemoryBufferPtr template_buff(new transport::TMemoryBuffer());
+        protocol::TBinaryProtocolT<transport::TMemoryBuffer> template_prot(template_buff);
+        RunTemplate(&template_prot, template_buff.get(), player, num, &template_result);
+        Report("binary", virtual_result, template_result);
+    }
+
+    {
+        Result virtual_result;
+        Result template_result;
+        MemoryBufferPtr buff(new transport::TMemoryBuffer());
+        protocol::TCompactProtocol virtual_prot(buff);
+        RunVirtual(&virtual_prot, buff.get(), player, num, &virtual_result);
+        MemoryBufferPtr template_buff(new transport::TMemoryBuffer());
+        protocol::TCompactProtocolT<transport::TMemoryBuffer> template_prot(template_buff);
+        RunTemplate(&template_prot, template_buff.get(), player, num, &template_result);
+        Report("compact", virtual_result, template_result);
+    }
+    return 0;
+}
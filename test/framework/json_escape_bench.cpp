@@ -0,0 +1,237 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+// TJSONProtocol字符串转义/反转义:
+//   1. 随机字符串(控制字符、引号、反斜杠、UTF-8)的编码结果与逐字符转义的参考实现逐字节一致，且能解码还原
+//   2. 典型业务字符串的writeString/readString耗时，与参考实现对比
+//   3. 包含上述字符串的玩家结构体整体读写耗时
+// SIMD级别在编译期决定(__AVX2__/__SSE2__)，分别用不同编译选项运行即可对比
+// 用法: json_escape_bench [次数系数]
+
+#include <string.h>
+
+#include "framework/dr/protocol/json_protocol.h"
+#include "framework/dr/transport/buffer_transport.h"
+#include "test/framework/dr_bench_data.h"
+
+using namespace pebble::dr;
+
+typedef cxx::shared_ptr<transport::TMemoryBuffer> MemoryBufferPtr;
+
+/// @brief 参考实现: 逐字符转义，规则与TJSONProtocol一致
+///   '"'、'\\'以及\b \t \n \f \r使用反斜杠转义，其他控制字符使用\u00xx，其余字节原样输出
+static void ReferenceEscape(const std::string& str, std::string* out) {
+    static const char kHex[] = "0123456789abcdef";
+    out->clear();
+    out->push_back('"');
+    for (size_t i = 0; i < str.size(); i++) {
+        uint8_t ch = static_cast<uint8_t>(str[i]);
+        switch (ch) {
+            case '"':  out->append("\\\""); break;
+            case '\\': out->append("\\\\"); break;
+            case '\b': out->append("\\b");  break;
+            case '\t': out->append("\\t");  break;
+            case '\n': out->append("\\n");  break;
+            case '\f': out->append("\\f");  break;
+            case '\r': out->append("\\r");  break;
+            default:
+                if (ch < 0x20) {
+                    out->append("\\u00");
+                    out->push_back(kHex[ch >> 4]);
+                    out->push_back(kHex[ch & 0x0F]);
+                } else {
+                    out->push_back(static_cast<char>(ch));
+                }
+                break;
+        }
+    }
+    out->push_back('"');
+}
+
+static std::string RandomString(size_t len) {
+    static const char kSpecial[] = "\"\\\b\t\n\f\r\x01\x1f";
+    // 中、é，以及单个续字节和0x7f
+    static const char* kMultiByte[] = { "\xe4\xb8\xad", "\xc3\xa9", "\x80", "\x7f" };
+    std::string str;
+    while (str.size() < len) {
+        int32_t r = rand() % 10;
+        if (r < 6) {
+            str.push_back(static_cast<char>(0x20 + rand() % 0x5f));
+        } else if (r < 8) {
+            str.push_back(kSpecial[rand() % (sizeof(kSpecial) - 1)]);
+        } else {
+            str.append(kMultiByte[rand() % 4]);
+        }
+    }
+    return str;
+}
+
+static void CheckEquivalent(int32_t num) {
+    srand(7);
+    std::string expect;
+    for (int32_t n = 0; n < num; n++) {
+        // 覆盖SIMD块边界附近的长度
+        std::string str = RandomString(n < 200 ? n : rand() % 300);
+
+        MemoryBufferPtr buff(new transport::TMemoryBuffer());
+        protocol::TJSONProtocol prot(buff);
+        uint32_t len = prot.writeString(str);
+        ReferenceEscape(str, &expect);
+        std::string actual = buff->getBufferAsString();
+        if (actual != expect || len != expect.size()) {
+            fprintf(stderr, "escape mismatch for string %d:\n  expect %s\n  actual %s\n",
+                n, expect.c_str(), actual.c_str());
+            exit(1);
+        }
+
+        std::string decoded;
+        prot.readString(decoded);
+        CHECK(decoded == str);
+        CHECK(0 == buff->available_read());
+    }
+    printf("%-12s ok, %d random strings\n", "equivalent", num);
+}
+
+struct Sample {
+    const char* name;
+    std::string value;
+};
+
+static std::vector<Sample> MakeSamples() {
+    std::vector<Sample> samples;
+    Sample sample;
+
+    sample.name  = "nickname";
+    sample.value = "\xe7\x8e\xa9\xe5\xae\xb6_Player01";
+    samples.push_back(sample);
+
+    sample.name  = "chat";
+    sample.value = "\xe4\xbb\x8a\xe6\x99\x9a\xe5\x85\xab\xe7\x82\xb9\xe5\x89\xaf\xe6\x9c\xac\xe9\x9b\x86\xe5\x90\x88\xef\xbc\x8c"
+        "bring potions and don't be late! \xe8\xb0\x81\xe6\x9d\xa5\xe5\xbc\x80\xe5\x9b\xa2? gg wp";
+    samples.push_back(sample);
+
+    sample.name  = "path";
+    sample.value = "C:\\Program Files\\Game\\save\\slot_03\\profile.dat";
+    samples.push_back(sample);
+
+    sample.name  = "json config";
+    sample.value = "{\"rate\":0.25,\"drops\":[{\"id\":1001,\"w\":30},{\"id\":1002,\"w\":70}],"
+        "\"msg\":\"welcome\\nback\",\"enabled\":true}";
+    samples.push_back(sample);
+
+    sample.name = "long text";
+    sample.value.clear();
+    while (sample.value.size() < 4096) {
+        sample.value += "The quick brown fox jumps over the lazy dog. "
+            "\xe5\xbf\xab\xe9\x80\x9f\xe7\x9a\x84\xe7\x8b\x90\xe7\x8b\xb8\xe3\x80\x82 ";
+    }
+    sample.value.resize(4096);
+    samples.push_back(sample);
+
+    return samples;
+}
+
+static void BenchStrings(const std::vector<Sample>& samples, int64_t scale) {
+    std::string ref_out;
+    for (size_t i = 0; i < samples.size(); i++) {
+        const std::string& value = samples[i].value;
+        int64_t num = scale * 400000 / (value.size() + 64);
+
+        BenchTimer timer;
+        for (int64_t n = 0; n < num; n++) {
+            ReferenceEscape(value, &ref_out);
+        }
+        double ref_ns = timer.NsPerOp(num);
+
+        MemoryBufferPtr buff(new transport::TMemoryBuffer());
+        protocol::TJSONProtocol prot(buff);
+        timer = BenchTimer();
+        for (int64_t n = 0; n < num; n++) {
+            buff->resetBuffer();
+            prot.writeString(value);
+        }
+        double write_ns = timer.NsPerOp(num);
+        std::string encoded = buff->getBufferAsString();
+        CHECK(encoded == ref_out);
+
+        MemoryBufferPtr read_buff(new transport::TMemoryBuffer());
+        protocol::TJSONProtocol read_prot(read_buff);
+        std::string decoded;
+        timer = BenchTimer();
+        for (int64_t n = 0; n < num; n++) {
+            read_buff->resetBuffer(reinterpret_cast<uint8_t*>(const_cast<char*>(encoded.data())),
+                encoded.size());
+            read_prot.readString(decoded);
+        }
+        double read_ns = timer.NsPerOp(num);
+        CHECK(decoded == value);
+
+        printf("%-12s %5zu bytes  reference %7.0f ns  write %7.0f ns  read %7.0f ns\n",
+            samples[i].name, value.size(), ref_ns, write_ns, read_ns);
+    }
+}
+
+static void BenchStruct(const std::vector<Sample>& samples, int64_t scale) {
+    dr_bench::Player player;
+    FillPlayer(&player);
+    player.name = samples[0].value;
+    for (size_t i = 1; i < samples.size(); i++) {
+        player.notes.push_back(samples[i].value);
+    }
+
+    MemoryBufferPtr buff(new transport::TMemoryBuffer());
+    protocol::TJSONProtocol prot(buff);
+    player.write(&prot);
+    std::string encoded = buff->getBufferAsString();
+    dr_bench::Player decoded;
+    decoded.read(&prot);
+    CHECK(decoded == player);
+
+    int64_t num = scale * 2000;
+    BenchTimer timer;
+    for (int64_t n = 0; n < num; n++) {
+        buff->resetBuffer();
+        player.write(&prot);
+    }
+    double write_ns = timer.NsPerOp(num);
+
+    timer = BenchTimer();
+    for (int64_t n = 0; n < num; n++) {
+        buff->resetBuffer(reinterpret_cast<uint8_t*>(const_cast<char*>(encoded.data())), encoded.size());
+        decoded.read(&prot);
+    }
+    double read_ns = timer.NsPerOp(num);
+
+    printf("%-12s %5zu bytes  write %7.1f us  read %7.1f us\n", "struct", encoded.size(),
+        write_ns / 1000, read_ns / 1000);
+}
+
+int main(int argc, char** argv) {
+    int64_t scale = argc > 1 ? atoll(argv[1]) : 10;
+    CHECK(scale > 0);
+
+#if defined(__AVX2__)
+    printf("simd: avx2\n");
+#elif defined(__SSE2__)
+    printf("simd: sse2\n");
+#else
+    printf("simd: none\n");
+#endif
+
+    CheckEquivalent(3000);
+
+    std::vector<Sample> samples = MakeSamples();
+    BenchStrings(samples, scale);
+    BenchStruct(samples, scale);
+    return 0;
+}
@@ -0,0 +1,187 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+// RPC会话的内存分配统计: 客户端和服务端两个PebbleRpc在进程内直接互发消息，
+// 重载全局operator new计数，统计稳态下每次调用客户端(发请求+处理响应)和服务端(处理请求+回响应)的分配次数
+// 消息放在固定大小的槽里转发，传输本身不分配内存
+// 用法: rpc_session_bench [调用次数]
+
+#include <new>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common/time_utility.h"
+#include "framework/pebble_rpc.h"
+#include "test/common/check.h"
+
+using namespace pebble;
+
+static int64_t g_alloc_num = 0;
+
+void* operator new(size_t size) {
+    g_alloc_num++;
+    void* p = malloc(size > 0 ? size : 1);
+    if (NULL == p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void* operator new[](size_t size) {
+    g_alloc_num++;
+    void* p = malloc(size > 0 ? size : 1);
+    if (NULL == p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) throw() {
+    free(p);
+}
+
+void operator delete[](void* p) throw() {
+    free(p);
+}
+
+static const int64_t kServerHandle = 1;
+static const int64_t kClientHandle = 2;
+static const uint32_t kMsgSlotNum  = 64;
+
+struct MsgSlot {
+    int64_t to;
+    uint32_t len;
+    uint8_t data[512];
+};
+
+static MsgSlot g_slots[kMsgSlotNum];
+static uint32_t g_head = 0;
+static uint32_t g_tail = 0;
+
+static int32_t SendV(int64_t handle, uint32_t msg_frag_num,
+    const uint8_t* msg_frag[], uint32_t msg_frag_len[], int32_t flag) {
+    CHECK(g_tail - g_head < kMsgSlotNum);
+    MsgSlot& slot = g_slots[g_tail++ % kMsgSlotNum];
+    slot.to  = handle;
+    slot.len = 0;
+    for (uint32_t i = 0; i < msg_frag_num; i++) {
+        CHECK(slot.len + msg_frag_len[i] <= sizeof(slot.data));
+        memcpy(slot.data + slot.len, msg_frag[i], msg_frag_len[i]);
+        slot.len += msg_frag_len[i];
+    }
+    return 0;
+}
+
+static int32_t Send(int64_t handle, const uint8_t* msg, uint32_t msg_len, int32_t flag) {
+    const uint8_t* msg_frag[] = { msg };
+    uint32_t msg_frag_len[]   = { msg_len };
+    return SendV(handle, 1, msg_frag, msg_frag_len, flag);
+}
+
+static int32_t OnEcho(const uint8_t* buff, uint32_t buff_len,
+    cxx::function<int32_t(int32_t, const uint8_t*, uint32_t)>& rsp) {
+    return rsp(0, buff, buff_len);
+}
+
+static int64_t g_ok_num = 0;
+
+static int32_t OnResponse(int32_t ret, const uint8_t* buff, uint32_t buff_len) {
+    if (0 == ret) {
+        g_ok_num++;
+    }
+    return 0;
+}
+
+static const char* CodeName(CodeType code_type) {
+    switch (code_type) {
+        case kCODE_BINARY:  return "binary";
+        case kCODE_JSON:    return "json";
+        case kCODE_PB:      return "pb";
+        case kCODE_COMPACT: return "compact";
+        default:            return "unknown";
+    }
+}
+
+static void Run(CodeType code_type, int32_t rpc_version, int64_t call_num) {
+    PebbleRpc server(code_type, NULL);
+    PebbleRpc client(code_type, NULL);
+    server.SetSendFunction(Send, SendV);
+    client.SetSendFunction(Send, SendV);
+    client.SetRpcVersion(rpc_version);
+
+    const char* name = "Bench:Echo";
+    uint32_t method_id = IRpc::GenMethodId(name);
+    CHECK(0 == server.AddOnRequestFunction(name, method_id, OnEcho));
+
+    RpcHead head;
+    head.m_function_name = name;
+    head.m_method_id     = method_id;
+
+    // 前面的调用用于预热会话池和各缓冲区，不计入统计
+    const int64_t kWarmUp = 1000;
+    int64_t client_alloc = 0;
+    int64_t server_alloc = 0;
+    int64_t start = 0;
+    g_ok_num = 0;
+    for (int64_t i = 0; i < kWarmUp + call_num; i++) {
+        bool steady = i >= kWarmUp;
+        if (i == kWarmUp) {
+            start = TimeUtility::GetCurrentUS();
+        }
+
+        head.m_message_type = kRPC_CALL;
+        head.m_session_id   = client.GenSessionId();
+        int64_t alloc_num = g_alloc_num;
+        CHECK(0 == client.SendRequest(kServerHandle, head,
+            reinterpret_cast<const uint8_t*>("hello"), 5, OnResponse, 1000));
+        if (steady) {
+            client_alloc += g_alloc_num - alloc_num;
+        }
+
+        while (g_head != g_tail) {
+            MsgSlot& slot = g_slots[g_head++ % kMsgSlotNum];
+            alloc_num = g_alloc_num;
+            if (kServerHandle == slot.to) {
+                server.OnMessage(kClientHandle, slot.data, slot.len, NULL, 0);
+                if (steady) {
+                    server_alloc += g_alloc_num - alloc_num;
+                }
+            } else {
+                client.OnMessage(kServerHandle, slot.data, slot.len, NULL, 0);
+                if (steady) {
+                    client_alloc += g_alloc_num - alloc_num;
+                }
+            }
+        }
+    }
+    int64_t cost = TimeUtility::GetCurrentUS() - start;
+    CHECK(g_ok_num == kWarmUp + call_num);
+
+    printf("%-8s v%d  client %6.3f allocs/call  server %6.3f allocs/call  %7.1f ns/call\n",
+        CodeName(code_type), rpc_version, static_cast<double>(client_alloc) / call_num,
+        static_cast<double>(server_alloc) / call_num, cost * 1000.0 / call_num);
+}
+
+int main(int argc, char** argv) {
+    int64_t call_num = argc > 1 ? atoll(argv[1]) : 100000;
+    CHECK(call_num > 0);
+
+    const CodeType code_types[] = { kCODE_BINARY, kCODE_COMPACT, kCODE_JSON, kCODE_PB };
+    for (size_t i = 0; i < sizeof(code_types) / sizeof(code_types[0]); i++) {
+        Run(code_types[i], 0, call_num);
+        Run(code_types[i], 1, call_num);
+    }
+    return 0;
+}
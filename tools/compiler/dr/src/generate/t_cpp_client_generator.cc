@@ -26,6 +26,7 @@
  */
 
 #include <cassert>
+#include <cstdio>
 
 #include <fstream>
 #include <iostream>
@@ -46,6 +47,23 @@ using std::vector;
 
 static const string endl = "\n";  // avoid ostream << std::endl flushes
 
+/**
+ * RPC方法ID，"服务名:方法名"的32位FNV-1a，和pebble::IRpc::GenMethodId保持一致，0保留
+ */
+static string rpc_method_id(const string& name) {
+  uint32_t hash = 2166136261u;
+  for (string::const_iterator it = name.begin(); it != name.end(); ++it) {
+    hash ^= static_cast<uint8_t>(*it);
+    hash *= 16777619u;
+  }
+  if (hash == 0) {
+    hash = 1;
+  }
+  char buff[16];
+  snprintf(buff, sizeof(buff), "0x%08Xu", hash);
+  return string(buff);
+}
+
 /**
  * C++ code generator. This is legitimacy incarnate.
  *
@@ -2582,7 +2600,8 @@ void t_cpp_client_generator::generate_service_client(t_service* tservice, string
 
     out << indent() <<
         "::pebble::RpcHead head;" << endl << indent() <<
-        "head.m_function_name.assign(\"" << service_name_ << ":" << funname << "\");" << endl << indent();
+        "head.m_function_name.assign(\"" << service_name_ << ":" << funname << "\");" << endl << indent() <<
+        "head.m_method_id = " << rpc_method_id(service_name_ + ":" + funname) << ";" << endl << indent();
     if (!(*f_iter)->is_oneway()) {
         out << "head.m_message_type = pebble::dr::protocol::T_CALL;" << endl << indent();
     } else {
@@ -2647,7 +2666,8 @@ void t_cpp_client_generator::generate_service_client(t_service* tservice, string
 
       out << indent() <<
           "::pebble::RpcHead head;" << endl << indent() <<
-          "head.m_function_name.assign(\"" << service_name_ << ":" << funname << "\");" << endl << indent();
+          "head.m_function_name.assign(\"" << service_name_ << ":" << funname << "\");" << endl << indent() <<
+          "head.m_method_id = " << rpc_method_id(service_name_ + ":" + funname) << ";" << endl << indent();
       if (!(*f_iter)->is_oneway()) {
           out << "head.m_message_type = pebble::dr::protocol::T_CALL;" << endl << indent();
       } else {
@@ -3021,7 +3041,8 @@ void ProcessorGenerator4Client::generate_register_service_function() {
 
     f_out_ <<
       indent() << "ret = m_server->AddOnRequestFunction(\"" << service_name_ <<
-      ":" << (*f_iter)->get_name() << "\", cb);" << endl;
+      ":" << (*f_iter)->get_name() << "\", " <<
+      rpc_method_id(service_name_ + ":" + (*f_iter)->get_name()) << ", cb);" << endl;
 
     f_out_ <<
       indent() << "if (ret != pebble::kRPC_SUCCESS) {" << endl <<
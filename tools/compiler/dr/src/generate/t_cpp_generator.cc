@@ -32,6 +32,7 @@
  */
 
 #include <cassert>
+#include <cstdio>
 
 #include <fstream>
 #include <iostream>
@@ -52,6 +53,36 @@ using std::vector;
 
 static const string endl = "\n";  // avoid ostream << std::endl flushes
 
+/**
+ * RPC方法ID，"服务名:方法名"的32位FNV-1a，和pebble::IRpc::GenMethodId保持一致，0保留
+ */
+static string rpc_method_id(const string& name) {
+  uint32_t hash = 2166136261u;
+  for (string::const_iterator it = name.begin(); it != name.end(); ++it) {
+    hash ^= static_cast<uint8_t>(*it);
+    hash *= 16777619u;
+  }
+  if (hash == 0) {
+    hash = 1;
+  }
+  char buff[16];
+  snprintf(buff, sizeof(buff), "0x%08Xu", hash);
+  return string(buff);
+}
+
+/**
+ * 生成客户端请求的发送句柄，幂等的方法同时选出对冲请求的备用句柄
+ * 返回发送句柄的表达式，需要时先在out中输出句柄的计算
+ */
+static string rpc_request_handle(std::ostream& out, const string& indent_str, t_function* tfunction) {
+  if (!tfunction->is_idempotent()) {
+    return "GetHandle()";
+  }
+  out << indent_str << "int64_t handle = GetHandle();" << endl <<
+    indent_str << "head.m_hedge_handle = GetHedgeHandle(handle);" << endl;
+  return "handle";
+}
+
 /**
  * C++ code generator. This is legitimacy incarnate.
  *
@@ -118,9 +149,9 @@ class t_cpp_generator : public t_oop_generator {
   void generate_copy_constructor     (std::ofstream& out, t_struct* tstruct, bool is_exception);
   void generate_assignment_operator  (std::ofstream& out, t_struct* tstruct);
   void generate_struct_fingerprint   (std::ofstream& out, t_struct* tstruct, bool is_definition);
-  void generate_struct_reader        (std::ofstream& out, t_struct* tstruct, bool pointers=false);
-  void generate_struct_writer        (std::ofstream& out, t_struct* tstruct, bool pointers=false);
-  void generate_struct_result_writer (std::ofstream& out, t_struct* tstruct, bool pointers=false);
+  void generate_struct_reader        (std::ofstream& out, std::ofstream& tout, t_struct* tstruct, bool pointers=false);
+  void generate_struct_writer        (std::ofstream& out, std::ofstream& tout, t_struct* tstruct, bool pointers=false);
+  void generate_struct_result_writer (std::ofstream& out, std::ofstream& tout, t_struct* tstruct, bool pointers=false);
   void generate_struct_swap          (std::ofstream& out, t_struct* tstruct);
   void generate_struct_ostream_operator(std::ofstream& out, t_struct* tstruct);
   void generate_struct_reflection_info(std::ofstream& out, t_struct* tstruct);
@@ -233,6 +264,7 @@ class t_cpp_generator : public t_oop_generator {
   std::string function_signature_if(t_function* tfunction, std::string style, std::string prefix="", bool name_params=true);
   std::string argument_list(t_struct* tstruct, bool name_params=true, bool start_comma=false, bool add_ns = false);
   std::string type_to_enum(t_type* ttype);
+  std::string codec_call(std::string rpc, std::string obj, std::string method, std::string codec);
   std::string local_reflection_name(const char*, t_type* ttype, bool external=false);
 
   void generate_enum_constant_list(std::ofstream& f,
@@ -329,6 +361,8 @@ class t_cpp_generator : public t_oop_generator {
   // 基本数据结构定义及实现
   std::ofstream f_types_h_;
   std::ofstream f_types_cpp_;
+  // 模板化的read/write实现，由f_types_h_包含
+  std::ofstream f_types_tcc_;
   // 每个服务独立的用户接口和实现
   std::ofstream f_service_h_;
   std::ofstream f_service_inh_;
@@ -369,11 +403,21 @@ void t_cpp_generator::init_generator() {
   string f_types_impl_name = get_out_dir()+program_name_+".cpp";
   f_types_cpp_.open(f_types_impl_name.c_str());
 
+  string f_types_tcc_name = get_out_dir()+program_name_+".tcc";
+  f_types_tcc_.open(f_types_tcc_name.c_str());
+
   // Print header
   f_types_h_ <<
     autogen_comment();
   f_types_cpp_ <<
     autogen_comment();
+  f_types_tcc_ <<
+    autogen_comment();
+
+  f_types_tcc_ <<
+    "#ifndef __" << program_name_ << "_tcc__" << endl <<
+    "#define __" << program_name_ << "_tcc__" << endl <<
+    endl;
 
   // Start ifndef
   f_types_h_ <<
@@ -445,6 +489,10 @@ void t_cpp_generator::init_generator() {
   f_types_cpp_ <<
     ns_open_ << endl <<
     endl;
+
+  f_types_tcc_ <<
+    ns_open_ << endl <<
+    endl;
 }
 
 /**
@@ -454,13 +502,20 @@ void t_cpp_generator::close_generator() {
   // Close namespace
   f_types_h_ << ns_close_ << endl << endl;
   f_types_cpp_ << ns_close_ << endl;
+  f_types_tcc_ << ns_close_ << endl << endl;
+
+  // 模板化的read/write实现放在所有类型定义之后
+  f_types_h_ <<
+    "#include \"" << get_include_prefix(*get_program()) << program_name_ << ".tcc\"" << endl << endl;
 
   // Close ifndef
   f_types_h_ << "#endif // __" << program_name_ << "_h__" << endl;
+  f_types_tcc_ << "#endif // __" << program_name_ << "_tcc__" << endl;
 
   // Close output file
   f_types_h_.close();
   f_types_cpp_.close();
+  f_types_tcc_.close();
 }
 
 /**
@@ -727,8 +782,8 @@ void t_cpp_generator::generate_cpp_struct(t_struct* tstruct, bool is_exception)
   generate_local_reflection_pointer(f_types_cpp_, tstruct);
 
   std::ofstream& out = (f_types_cpp_);
-  generate_struct_reader(out, tstruct);
-  generate_struct_writer(out, tstruct);
+  generate_struct_reader(out, f_types_tcc_, tstruct);
+  generate_struct_writer(out, f_types_tcc_, tstruct);
   generate_struct_swap(f_types_cpp_, tstruct);
   generate_copy_constructor(f_types_cpp_, tstruct, is_exception);
   generate_assignment_operator(f_types_cpp_, tstruct);
@@ -1065,6 +1120,24 @@ void t_cpp_generator::generate_struct_declaration(ofstream& out,
   }
   out << endl;
 
+  if (read || write) {
+    out <<
+        indent() << "// 以具体的协议类型实例化，字段的编解码不经过虚函数调用" << endl;
+  }
+  if (read) {
+    out <<
+        indent() << "template <class Protocol_>" << endl <<
+        indent() << "uint32_t read(Protocol_* iprot);" << endl;
+  }
+  if (write) {
+    out <<
+        indent() << "template <class Protocol_>" << endl <<
+        indent() << "uint32_t write(Protocol_* oprot) const;" << endl;
+  }
+  if (read || write) {
+    out << endl;
+  }
+
   if (read) {
     out <<
         indent() << "// 从binary码流和json字符串反序列化，返回<0时表示失败，成功时返回处理的长度" << endl <<
@@ -1353,6 +1426,7 @@ void t_cpp_generator::generate_local_reflection_pointer(std::ofstream& out,
  * @param tstruct The struct
  */
 void t_cpp_generator::generate_struct_reader(ofstream& out,
+                                             ofstream& tout,
                                              t_struct* tstruct,
                                              bool pointers) {
   indent(out) <<
@@ -1381,23 +1455,24 @@ void t_cpp_generator::generate_struct_reader(ofstream& out,
   indent(out) <<
     "}" << endl << endl;
 
-  if (gen_templates_) {
-    out <<
-      indent() << "template <class Protocol_>" << endl <<
-      indent() << "uint32_t " << tstruct->get_name() <<
-      "::read(Protocol_* iprot) {" << endl;
-  } else {
-    indent(out) <<
-      "uint32_t " << tstruct->get_name() <<
-      "::read(::pebble::dr::protocol::TProtocol* iprot) {" << endl;
-  }
+  // 虚接口转调以TProtocol实例化的模板
+  indent(out) <<
+    "uint32_t " << tstruct->get_name() <<
+    "::read(::pebble::dr::protocol::TProtocol* iprot) {" << endl <<
+    indent(1) << "return read< ::pebble::dr::protocol::TProtocol>(iprot);" << endl <<
+    indent() << "}" << endl << endl;
+
+  tout <<
+    indent() << "template <class Protocol_>" << endl <<
+    indent() << "uint32_t " << tstruct->get_name() <<
+    "::read(Protocol_* iprot) {" << endl;
   indent_up();
 
   const vector<t_field*>& fields = tstruct->get_members();
   vector<t_field*>::const_iterator f_iter;
 
   // Declare stack tmp variables
-  out <<
+  tout <<
     endl <<
     indent() << "uint32_t xfer = 0;" << endl <<
     indent() << "std::string fname;" << endl <<
@@ -1412,54 +1487,54 @@ void t_cpp_generator::generate_struct_reader(ofstream& out,
   // Required variables aren't in __isset, so we need tmp vars to check them.
   for (f_iter = fields.begin(); f_iter != fields.end(); ++f_iter) {
     if ((*f_iter)->get_req() == t_field::T_REQUIRED)
-      indent(out) << "bool isset_" << (*f_iter)->get_name() << " = false;" << endl;
+      indent(tout) << "bool isset_" << (*f_iter)->get_name() << " = false;" << endl;
   }
-  out << endl;
+  tout << endl;
 
 
   // Loop over reading in fields
-  indent(out) <<
+  indent(tout) <<
     "while (true)" << endl;
-    scope_up(out);
+    scope_up(tout);
 
     // Read beginning field marker
-    indent(out) <<
+    indent(tout) <<
       "xfer += iprot->readFieldBegin(fname, ftype, fid);" << endl;
 
     // Check for field STOP marker
-    out <<
+    tout <<
       indent() << "if (ftype == ::pebble::dr::protocol::T_STOP) {" << endl <<
       indent() << indent() << "break;" << endl <<
       indent() << "}" << endl;
 
     if(fields.empty()) {
-      out <<
+      tout <<
         indent() << "xfer += iprot->skip(ftype);" << endl;
     }
     else {
       // Switch statement on the field we are reading
-      out << indent() << "if (fid == -1) {" << endl;
+      tout << indent() << "if (fid == -1) {" << endl;
       indent_up();
       for (f_iter = fields.begin(); f_iter != fields.end(); ++f_iter) {
-          out << indent() <<(f_iter == fields.begin() ? "" : "else ") <<
+          tout << indent() <<(f_iter == fields.begin() ? "" : "else ") <<
               "if (fname == \"" << (*f_iter)->get_name() << "\") {" << endl;
-          out << indent(1) << "fid = " << (*f_iter)->get_key() << ";" << endl;
-          out << indent() << "}" << endl;
+          tout << indent(1) << "fid = " << (*f_iter)->get_key() << ";" << endl;
+          tout << indent() << "}" << endl;
       }
       indent_down();
-      out << indent() << "}" << endl;
+      tout << indent() << "}" << endl;
 
-      indent(out) <<
+      indent(tout) <<
         "switch (fid)" << endl;
 
-        scope_up(out);
+        scope_up(tout);
 
         // Generate deserialization code for known cases
         for (f_iter = fields.begin(); f_iter != fields.end(); ++f_iter) {
-          indent(out) <<
+          indent(tout) <<
             "case " << (*f_iter)->get_key() << ":" << endl;
           indent_up();
-          indent(out) <<
+          indent(tout) <<
             "if (ftype == ::pebble::dr::protocol::T_NULL || ftype == " << type_to_enum((*f_iter)->get_type()) << ") {" << endl;
           indent_up();
 
@@ -1471,20 +1546,20 @@ void t_cpp_generator::generate_struct_reader(ofstream& out,
           // We've decided to leave it out for performance reasons.
           // TODO(dreiss): Generate this code and "if" it out to make it easier
           // for people recompiling thrift to include it.
-          out <<
+          tout <<
             indent() << "if (" << isset_prefix << (*f_iter)->get_name() << ")" << endl <<
             indent() << "  throw TProtocolException(TProtocolException::INVALID_DATA);" << endl;
 #endif
 
           if (pointers && !(*f_iter)->get_type()->is_xception()) {
-            generate_deserialize_field(out, *f_iter, "iprot", "(*(this->", "))");
+            generate_deserialize_field(tout, *f_iter, "iprot", "(*(this->", "))");
           } else {
-            generate_deserialize_field(out, *f_iter, "iprot", "this->");
+            generate_deserialize_field(tout, *f_iter, "iprot", "this->");
           }
-          out <<
+          tout <<
             indent() << isset_prefix << (*f_iter)->get_name() << " = true;" << endl;
           indent_down();
-          out <<
+          tout <<
             indent() << "} else {" << endl <<
             indent(1) << "xfer += iprot->skip(ftype);" << endl <<
             // TODO(dreiss): Make this an option when thrift structs
@@ -1496,38 +1571,38 @@ void t_cpp_generator::generate_struct_reader(ofstream& out,
       }
 
       // In the default case we skip the field
-      out <<
+      tout <<
         indent() << "default:" << endl <<
         indent(1) << "xfer += iprot->skip(ftype);" << endl <<
         indent(1) << "break;" << endl;
 
-      scope_down(out);
+      scope_down(tout);
     } //!fields.empty()
     // Read field end marker
-    indent(out) <<
+    indent(tout) <<
       "xfer += iprot->readFieldEnd();" << endl;
 
-    scope_down(out);
+    scope_down(tout);
 
-  out <<
+  tout <<
     endl <<
     indent() << "xfer += iprot->readStructEnd();" << endl;
 
   // Throw if any required fields are missing.
   // We do this after reading the struct end so that
   // there might possibly be a chance of continuing.
-  out << endl;
+  tout << endl;
   for (f_iter = fields.begin(); f_iter != fields.end(); ++f_iter) {
     if ((*f_iter)->get_req() == t_field::T_REQUIRED)
-      out <<
+      tout <<
         indent() << "if (!isset_" << (*f_iter)->get_name() << ')' << endl <<
         indent(1) << "throw TProtocolException(TProtocolException::INVALID_DATA);" << endl;
   }
 
-  indent(out) << "return xfer;" << endl;
+  indent(tout) << "return xfer;" << endl;
 
   indent_down();
-  indent(out) <<
+  indent(tout) <<
     "}" << endl << endl;
 }
 
@@ -1538,6 +1613,7 @@ void t_cpp_generator::generate_struct_reader(ofstream& out,
  * @param tstruct The struct
  */
 void t_cpp_generator::generate_struct_writer(ofstream& out,
+                                             ofstream& tout,
                                              t_struct* tstruct,
                                              bool pointers) {
   string name = tstruct->get_name();
@@ -1587,67 +1663,67 @@ void t_cpp_generator::generate_struct_writer(ofstream& out,
     "}" << endl << endl;
 
 
-  if (gen_templates_) {
-    out <<
-      indent() << "template <class Protocol_>" << endl <<
-      indent() << "uint32_t " << tstruct->get_name() <<
-      "::write(Protocol_* oprot) const {" << endl;
-  } else {
-    indent(out) <<
-      "uint32_t " << tstruct->get_name() <<
-      "::write(::pebble::dr::protocol::TProtocol* oprot) const {" << endl;
-  }
+  indent(out) <<
+    "uint32_t " << tstruct->get_name() <<
+    "::write(::pebble::dr::protocol::TProtocol* oprot) const {" << endl <<
+    indent(1) << "return write< ::pebble::dr::protocol::TProtocol>(oprot);" << endl <<
+    indent() << "}" << endl << endl;
+
+  tout <<
+    indent() << "template <class Protocol_>" << endl <<
+    indent() << "uint32_t " << tstruct->get_name() <<
+    "::write(Protocol_* oprot) const {" << endl;
   indent_up();
 
-  out <<
+  tout <<
     indent() << "uint32_t xfer = 0;" << endl;
 
-  indent(out) << "oprot->incrementRecursionDepth();" << endl;
-  indent(out) <<
+  indent(tout) << "oprot->incrementRecursionDepth();" << endl;
+  indent(tout) <<
     "xfer += oprot->writeStructBegin(\"" << name << "\");" << endl;
 
   for (f_iter = fields.begin(); f_iter != fields.end(); ++f_iter) {
     bool check_if_set = (*f_iter)->get_req() == t_field::T_OPTIONAL ||
                         (*f_iter)->get_type()->is_xception();
     if (check_if_set) {
-      out << endl << indent() << "if (this->__isset." << (*f_iter)->get_name() << ") {" << endl;
+      tout << endl << indent() << "if (this->__isset." << (*f_iter)->get_name() << ") {" << endl;
       indent_up();
     } else {
-      out << endl;
+      tout << endl;
     }
 
     // Write field header
-    out <<
+    tout <<
       indent() << "xfer += oprot->writeFieldBegin(" <<
       "\"" << (*f_iter)->get_name() << "\", " <<
       type_to_enum((*f_iter)->get_type()) << ", " <<
       (*f_iter)->get_key() << ");" << endl;
     // Write field contents
     if (pointers && !(*f_iter)->get_type()->is_xception()) {
-      generate_serialize_field(out, *f_iter, "oprot", "(*(this->", "))");
+      generate_serialize_field(tout, *f_iter, "oprot", "(*(this->", "))");
     } else {
-      generate_serialize_field(out, *f_iter, "oprot", "this->");
+      generate_serialize_field(tout, *f_iter, "oprot", "this->");
     }
     // Write field closer
-    indent(out) <<
+    indent(tout) <<
       "xfer += oprot->writeFieldEnd();" << endl;
     if (check_if_set) {
       indent_down();
-      indent(out) << '}';
+      indent(tout) << '}';
     }
   }
 
-  out << endl;
+  tout << endl;
 
   // Write the struct map
-  out <<
+  tout <<
     indent() << "xfer += oprot->writeFieldStop();" << endl <<
     indent() << "xfer += oprot->writeStructEnd();" << endl <<
     indent() << "oprot->decrementRecursionDepth();" << endl <<
     indent() << "return xfer;" << endl;
 
   indent_down();
-  indent(out) <<
+  indent(tout) <<
     "}" << endl <<
     endl;
 }
@@ -1661,76 +1737,77 @@ void t_cpp_generator::generate_struct_writer(ofstream& out,
  * @param tstruct The result struct
  */
 void t_cpp_generator::generate_struct_result_writer(ofstream& out,
+                                                    ofstream& tout,
                                                     t_struct* tstruct,
                                                     bool pointers) {
   string name = tstruct->get_name();
   const vector<t_field*>& fields = tstruct->get_sorted_members();
   vector<t_field*>::const_iterator f_iter;
 
-  if (gen_templates_) {
-    out <<
-      indent() << "template <class Protocol_>" << endl <<
-      indent() << "uint32_t " << tstruct->get_name() <<
-      "::write(Protocol_* oprot) const {" << endl;
-  } else {
-    indent(out) <<
-      "uint32_t " << tstruct->get_name() <<
-      "::write(::pebble::dr::protocol::TProtocol* oprot) const {" << endl;
-  }
+  indent(out) <<
+    "uint32_t " << tstruct->get_name() <<
+    "::write(::pebble::dr::protocol::TProtocol* oprot) const {" << endl <<
+    indent(1) << "return write< ::pebble::dr::protocol::TProtocol>(oprot);" << endl <<
+    indent() << "}" << endl << endl;
+
+  tout <<
+    indent() << "template <class Protocol_>" << endl <<
+    indent() << "uint32_t " << tstruct->get_name() <<
+    "::write(Protocol_* oprot) const {" << endl;
   indent_up();
 
-  out <<
+  tout <<
     endl <<
     indent() << "uint32_t xfer = 0;" << endl <<
     endl;
 
-  indent(out) <<
+  indent(tout) <<
     "xfer += oprot->writeStructBegin(\"" << name << "\");" << endl;
 
   bool first = true;
   for (f_iter = fields.begin(); f_iter != fields.end(); ++f_iter) {
     if (first) {
       first = false;
-      out <<
+      tout <<
         endl <<
         indent() << "if ";
     } else {
-      out <<
+      tout <<
         " else if ";
     }
 
-    out << "(this->__isset." << (*f_iter)->get_name() << ") {" << endl;
+    tout << "(this->__isset." << (*f_iter)->get_name() << ") {" << endl;
 
     indent_up();
 
     // Write field header
-    out <<
+    tout <<
       indent() << "xfer += oprot->writeFieldBegin(" <<
       "\"" << (*f_iter)->get_name() << "\", " <<
       type_to_enum((*f_iter)->get_type()) << ", " <<
       (*f_iter)->get_key() << ");" << endl;
     // Write field contents
     if (pointers) {
-      generate_serialize_field(out, *f_iter, "oprot", "(*(this->", "))");
+      generate_serialize_field(tout, *f_iter, "oprot", "(*(this->", "))");
     } else {
-      generate_serialize_field(out, *f_iter, "oprot", "this->");
+      generate_serialize_field(tout, *f_iter, "oprot", "this->");
     }
     // Write field closer
-    indent(out) << "xfer += oprot->writeFieldEnd();" << endl;
+    indent(tout) << "xfer += oprot->writeFieldEnd();" << endl;
 
     indent_down();
-    indent(out) << "}";
+    indent(tout) << "}";
   }
 
   // Write the struct map
-  out <<
+  tout <<
     endl <<
     indent() << "xfer += oprot->writeFieldStop();" << endl <<
     indent() << "xfer += oprot->writeStructEnd();" << endl <<
     indent() << "return xfer;" << endl;
 
   indent_down();
-  indent(out) <<
+  indent(tout) <<
     "}" << endl <<
     endl;
 }
@@ -2178,12 +2255,12 @@ void t_cpp_generator::generate_service_helpers(t_service* tservice) {
     ts->set_name(tservice->get_name() + "_" + (*f_iter)->get_name() + "_args");
     generate_struct_declaration(f_service_inh_, ts, false);
     generate_struct_definition(out, out, ts, false);
-    generate_struct_reader(out, ts);
-    generate_struct_writer(out, ts);
+    generate_struct_reader(out, out, ts);
+    generate_struct_writer(out, out, ts);
     ts->set_name(tservice->get_name() + "_" + (*f_iter)->get_name() + "_pargs");
     generate_struct_declaration(f_service_inh_, ts, false, true, false, true);
     generate_struct_definition(out, out, ts, false);
-    generate_struct_writer(out, ts, true);
+    generate_struct_writer(out, out, ts, true);
     ts->set_name(name_orig);
 
     generate_function_helpers(tservice, *f_iter);
@@ -2675,6 +2752,9 @@ void t_cpp_generator::generate_service_client(t_service* tservice, string style)
       indent() << "void SetRouteFunction(const cxx::function<int64_t(uint64_t key)>& route_callback);" << endl << endl <<
       indent() << "// 设置路由key，如使用取模或哈希路由策略时使用" << endl <<
       indent() << "void SetRouteKey(uint64_t route_key);" << endl << endl <<
+      indent() << "// 设置对冲路由函数，参数为请求发送的连接句柄，返回对冲请求的备用连接句柄，<0表示不对冲" << endl <<
+      indent() << "// 只对IDL中标注了(idempotent = \"true\")的方法生效，对冲策略见IRpc::SetHedgeOptions" << endl <<
+      indent() << "void SetHedgeRouteFunction(const cxx::function<int64_t(int64_t handle)>& hedge_route_func);" << endl << endl <<
       indent() << "// 设置广播的频道名字，设置了频道后Client将所有的RPC请求按广播处理，广播至channel_name" << endl <<
       indent() << "void SetBroadcast(const std::string& channel_name);" << endl << endl <<
       indent() << "// 设置RPC请求超时时间(单位ms)，未指定方法名时对所有方法生效，指定方法名时只对指定方法生效，默认的超时时间为10s" << endl <<
@@ -2742,11 +2822,13 @@ void t_cpp_generator::generate_service_client(t_service* tservice, string style)
   if (tservice->get_extends() == NULL) {
     f_service_h_ << endl << "public:" << endl;
     f_service_h_ << indent(1) << "int64_t GetHandle();" << endl;
+    f_service_h_ << indent(1) << "int64_t GetHedgeHandle(int64_t handle);" << endl;
     f_service_h_ << endl << "protected:" << endl;
     f_service_h_ << indent(1) << "::pebble::PebbleRpc* m_client;" << endl;
     f_service_h_ << indent(1) << "int64_t m_handle;" << endl;
     f_service_h_ << indent(1) << "cxx::function<int64_t(uint64_t)> m_route_func;" << endl;
     f_service_h_ << indent(1) << "uint64_t m_route_key;" << endl;
+    f_service_h_ << indent(1) << "cxx::function<int64_t(int64_t)> m_hedge_route_func;" << endl;
     f_service_h_ << indent(1) << "std::string m_channel_name;" << endl;
     f_service_h_ << indent(1) << "cxx::unordered_map<std::string, int32_t> m_methods;" << endl;
   }
@@ -2802,6 +2884,11 @@ void t_cpp_generator::generate_service_client(t_service* tservice, string style)
       "}" << endl <<
       endl;
 
+    out << "void " << scope << "SetHedgeRouteFunction(const cxx::function<int64_t(int64_t handle)>& hedge_route_func) {" << endl <<
+      indent(1) << "m_hedge_route_func = hedge_route_func;" << endl <<
+      "}" << endl <<
+      endl;
+
     out << "void " << scope << "SetBroadcast(const std::string& channel_name) {" << endl <<
       indent(1) << "m_channel_name = channel_name;" << endl <<
       "}" << endl <<
@@ -2832,6 +2919,15 @@ void t_cpp_generator::generate_service_client(t_service* tservice, string style)
       indent(1) << "return m_handle;" << endl <<
       "}" << endl <<
       endl;
+
+    out << "int64_t " << scope << "GetHedgeHandle(int64_t handle) {" << endl <<
+      indent(1) << "if (m_hedge_route_func) {" << endl <<
+      indent(2) << "return m_hedge_route_func(handle);" << endl <<
+      indent(1) << "}" << endl <<
+      endl <<
+      indent(1) << "return -1;" << endl <<
+      "}" << endl <<
+      endl;
   }
 
   for (f_iter = functions.begin(); f_iter != functions.end(); ++f_iter) {
@@ -2851,7 +2947,8 @@ void t_cpp_generator::generate_service_client(t_service* tservice, string style)
 
     out << indent() <<
         "::pebble::RpcHead head;" << endl << indent() <<
-        "head.m_function_name.assign(\"" << service_name_ << ":" << funname << "\");" << endl << indent();
+        "head.m_function_name.assign(\"" << service_name_ << ":" << funname << "\");" << endl << indent() <<
+        "head.m_method_id = " << rpc_method_id(service_name_ + ":" + funname) << ";" << endl << indent();
     if (!(*f_iter)->is_oneway()) {
         out << "head.m_message_type = pebble::dr::protocol::T_CALL;" << endl << indent();
     } else {
@@ -2872,7 +2969,7 @@ void t_cpp_generator::generate_service_client(t_service* tservice, string style)
 
     out << indent() <<
       "try {" << endl << indent(1) <<
-      "args.write(encoder);" << endl << indent(1) <<
+      codec_call("m_client", "args", "write", "encoder") <<
       "encoder->writeMessageEnd();" << endl << indent(1) <<
       "encoder->getTransport()->writeEnd();" << endl << indent() <<
       "} catch (pebble::TException ex) {" << endl << indent(1) <<
@@ -2897,8 +2994,10 @@ void t_cpp_generator::generate_service_client(t_service* tservice, string style)
         endl;
       out << indent(1) <<
         "pebble::OnRpcResponse on_rsp = cxx::bind(&" << scope << "recv_" << funname << "_sync, this," << endl << indent(2) <<
-        "cxx::placeholders::_1, cxx::placeholders::_2, cxx::placeholders::_3" << ret_sync << ");" << endl << indent(1) <<
-        "return m_client->SendRequestSync(GetHandle(), head, buff, buff_len, on_rsp, m_methods[\"" << funname << "\"]);" <<
+        "cxx::placeholders::_1, cxx::placeholders::_2, cxx::placeholders::_3" << ret_sync << ");" << endl;
+      string handle = rpc_request_handle(out, indent(1), *f_iter);
+      out << indent(1) <<
+        "return m_client->SendRequestSync(" << handle << ", head, buff, buff_len, on_rsp, m_methods[\"" << funname << "\"]);" <<
         endl;
       out << indent() << "} else {" << endl << indent(1) <<
         "return m_client->BroadcastRequest(m_channel_name, head, buff, buff_len);" << endl << indent() <<
@@ -2946,7 +3045,8 @@ void t_cpp_generator::generate_service_client(t_service* tservice, string style)
 
       out << indent() <<
           "::pebble::RpcHead head;" << endl << indent() <<
-          "head.m_function_name.assign(\"" << service_name_ << ":" << funname << "\");" << endl << indent();
+          "head.m_function_name.assign(\"" << service_name_ << ":" << funname << "\");" << endl << indent() <<
+          "head.m_method_id = " << rpc_method_id(service_name_ + ":" + funname) << ";" << endl << indent();
       if (!(*f_iter)->is_oneway()) {
           out << "head.m_message_type = pebble::dr::protocol::T_CALL;" << endl << indent();
       } else {
@@ -2967,7 +3067,7 @@ void t_cpp_generator::generate_service_client(t_service* tservice, string style)
 
       out << indent() <<
         "try {" << endl << indent(1) <<
-        "args.write(encoder);" << endl << indent(1) <<
+        codec_call("m_client", "args", "write", "encoder") <<
         "encoder->writeMessageEnd();" << endl << indent(1) <<
         "encoder->getTransport()->writeEnd();" << endl << indent() <<
         "} catch (pebble::TException ex) {" << endl << indent(1) <<
@@ -2993,8 +3093,10 @@ void t_cpp_generator::generate_service_client(t_service* tservice, string style)
           endl;
         out << indent(1) <<
           "pebble::OnRpcResponse on_rsp = cxx::bind(&" << scope << "recv_" << funname << "_parallel, this," << endl << indent(2) <<
-          "cxx::placeholders::_1, cxx::placeholders::_2, cxx::placeholders::_3, ret_code" << ret_sync << ");" << endl << indent(1) <<
-          "m_client->SendRequestParallel(GetHandle(), head, buff, buff_len, on_rsp, m_methods[\"" << funname << "\"], ret_code, num_called, num_parallel" << ");" <<
+          "cxx::placeholders::_1, cxx::placeholders::_2, cxx::placeholders::_3, ret_code" << ret_sync << ");" << endl;
+        string handle = rpc_request_handle(out, indent(1), *f_iter);
+        out << indent(1) <<
+          "m_client->SendRequestParallel(" << handle << ", head, buff, buff_len, on_rsp, m_methods[\"" << funname << "\"], ret_code, num_called, num_parallel" << ");" <<
           endl;
         out << indent() << "} else {" << endl << indent(1) <<
           "*ret_code = m_client->BroadcastRequest(m_channel_name, head, buff, buff_len);" << endl << indent(1) <<
@@ -3058,7 +3160,8 @@ void t_cpp_generator::generate_service_client(t_service* tservice, string style)
 
       out << indent() <<
           "::pebble::RpcHead head;" << endl << indent() <<
-          "head.m_function_name.assign(\"" << service_name_ << ":" << funname << "\");" << endl << indent();
+          "head.m_function_name.assign(\"" << service_name_ << ":" << funname << "\");" << endl << indent() <<
+          "head.m_method_id = " << rpc_method_id(service_name_ + ":" + funname) << ";" << endl << indent();
       if (!(*f_iter)->is_oneway()) {
           out << "head.m_message_type = pebble::dr::protocol::T_CALL;" << endl << indent();
       } else {
@@ -3075,7 +3178,7 @@ void t_cpp_generator::generate_service_client(t_service* tservice, string style)
 
       out << indent() <<
         "try {" << endl << indent(1) <<
-        "args.write(encoder);" << endl << indent(1) <<
+        codec_call("m_client", "args", "write", "encoder") <<
         "encoder->writeMessageEnd();" << endl << indent(1) <<
         "encoder->getTransport()->writeEnd();" << endl << indent() <<
         "} catch (pebble::TException ex) {" << endl << indent(1) <<
@@ -3097,8 +3200,10 @@ void t_cpp_generator::generate_service_client(t_service* tservice, string style)
 
       out << indent(1) <<
         "pebble::OnRpcResponse on_rsp = cxx::bind(&" << scope << "recv_" << funname << ", this," << endl << indent(2) <<
-        "cxx::placeholders::_1, cxx::placeholders::_2, cxx::placeholders::_3, cb);" << endl << indent(1) <<
-        "int32_t ret = m_client->SendRequest(GetHandle(), head, buff, buff_len, on_rsp, m_methods[\"" << funname << "\"]);" << endl << indent(1) <<
+        "cxx::placeholders::_1, cxx::placeholders::_2, cxx::placeholders::_3, cb);" << endl;
+      string handle = rpc_request_handle(out, indent(1), *f_iter);
+      out << indent(1) <<
+        "int32_t ret = m_client->SendRequest(" << handle << ", head, buff, buff_len, on_rsp, m_methods[\"" << funname << "\"]);" << endl << indent(1) <<
         "if (ret != pebble::kRPC_SUCCESS) {" << endl << indent(2) <<
         "cb(ret" << ret_str << ");" << endl << indent(2) <<
         "return;" << endl << indent(1) <<
@@ -3186,7 +3291,7 @@ void t_cpp_generator::generate_service_client(t_service* tservice, string style)
       }
       out << indent() <<
         "try {" << endl << indent(1) <<
-        "result.read(decoder);" << endl << indent(1) <<
+        codec_call("m_client", "result", "read", "decoder") <<
         "decoder->readMessageEnd();" << endl << indent(1) <<
         "decoder->getTransport()->readEnd();" << endl << indent() <<
         "} catch (pebble::TException ex) {" << endl << indent(1) <<
@@ -3266,7 +3371,7 @@ void t_cpp_generator::generate_service_client(t_service* tservice, string style)
       }
       out << indent() <<
         "try {" << endl << indent(1) <<
-        "result.read(decoder);" << endl << indent(1) <<
+        codec_call("m_client", "result", "read", "decoder") <<
         "decoder->readMessageEnd();" << endl << indent(1) <<
         "decoder->getTransport()->readEnd();" << endl << indent() <<
         "} catch (pebble::TException ex) {" << endl << indent(1) <<
@@ -3536,13 +3641,21 @@ void ProcessorGenerator::generate_register_service_function() {
 
     f_out_ <<
       indent() << "ret = m_server->AddOnRequestFunction(\"" << service_name_ <<
-      ":" << (*f_iter)->get_name() << "\", cb);" << endl;
+      ":" << (*f_iter)->get_name() << "\", " <<
+      rpc_method_id(service_name_ + ":" + (*f_iter)->get_name()) << ", cb);" << endl;
 
     f_out_ <<
       indent() << "if (ret != pebble::kRPC_SUCCESS) {" << endl <<
       indent(1) << "return ret;" << endl <<
-      indent() << "}" << endl <<
-      endl;
+      indent() << "}" << endl;
+
+    string priority = (*f_iter)->get_priority();
+    if (!priority.empty()) {
+      f_out_ <<
+        indent() << "m_server->SetMethodPriority(\"" << service_name_ <<
+        ":" << (*f_iter)->get_name() << "\", " << priority << ");" << endl;
+    }
+    f_out_ << endl;
   }
 
   if (!extends_.empty()) {
@@ -3679,15 +3792,15 @@ void t_cpp_generator::generate_function_helpers(t_service* tservice,
 
   generate_struct_declaration(f_service_inh_, &result, false);
   generate_struct_definition(out, out, &result, false);
-  generate_struct_reader(out, &result);
-  generate_struct_result_writer(out, &result);
+  generate_struct_reader(out, out, &result);
+  generate_struct_result_writer(out, out, &result);
 
   result.set_name(tservice->get_name() + "_" + tfunction->get_name() + "_presult");
   generate_struct_declaration(f_service_inh_, &result, false, true, true, gen_cob_style_);
   generate_struct_definition(out, out, &result, false);
-  generate_struct_reader(out, &result, true);
+  generate_struct_reader(out, out, &result, true);
   if (gen_cob_style_) {
-    generate_struct_writer(out, &result, true);
+    generate_struct_writer(out, out, &result, true);
   }
 
 }
@@ -3735,7 +3848,7 @@ void t_cpp_generator::generate_process_function(t_service* tservice,
   out <<
     indent() << tservice->get_name() + "_" + tfunction->get_name() << "_args args;" << endl << indent() <<
       "try {" << endl << indent(1) <<
-      "args.read(decoder);" << endl << indent(1) <<
+      codec_call("m_server", "args", "read", "decoder") <<
       "decoder->readMessageEnd();" << endl << indent(1) <<
       "decoder->getTransport()->readEnd();" << endl << indent() <<
       "} catch (pebble::TException ex) {" << endl << indent(1) <<
@@ -3855,7 +3968,7 @@ void t_cpp_generator::generate_return_function  (t_service* tservice, t_function
 
   out << endl << indent() <<
     "try {" << endl << indent(1) <<
-    "result.write(encoder);" << endl << indent(1) <<
+    codec_call("m_server", "result", "write", "encoder") <<
     "encoder->writeMessageEnd();" << endl << indent(1) <<
     "encoder->getTransport()->writeEnd();" << endl << indent() <<
     "} catch (pebble::TException ex) {" << endl << indent(1) <<
@@ -4841,6 +4954,26 @@ string t_cpp_generator::argument_list(t_struct* tstruct, bool name_params, bool
   return result;
 }
 
+/**
+ * 生成args/result的编解码调用，binary编码时调用以具体协议类型实例化的read/write
+ * 用在try块的首行，返回的代码以下一行的缩进结尾
+ *
+ * @param rpc PebbleRpc对象
+ * @param obj args/result对象
+ * @param method read或write
+ * @param codec GetCodec返回的编解码器
+ */
+string t_cpp_generator::codec_call(string rpc, string obj, string method, string codec) {
+  std::ostringstream out;
+  out << "::pebble::PebbleRpc::BinaryCodec* binary_codec = " << rpc << "->GetBinaryCodec(" << codec << ");" << endl <<
+    indent(1) << "if (binary_codec != NULL) {" << endl <<
+    indent(2) << obj << "." << method << "(binary_codec);" << endl <<
+    indent(1) << "} else {" << endl <<
+    indent(2) << obj << "." << method << "(" << codec << ");" << endl <<
+    indent(1) << "}" << endl << indent(1);
+  return out.str();
+}
+
 /**
  * Converts the parse type to a C++ enum string for the given type.
  *
@@ -88,6 +88,30 @@ class t_function : public t_doc {
     return oneway_;
   }
 
+  // 幂等的方法可以重复发送，如对冲请求
+  bool is_idempotent() {
+    std::map<std::string, std::string>::iterator it = annotations_.find("idempotent");
+    if (annotations_.end() == it) {
+      return false;
+    }
+    return it->second == "true" || it->second == "1";
+  }
+
+  // 方法的优先级，过载时按优先级丢弃请求，未指定时返回空，取值非法在解析时报错(见is_valid_priority)
+  std::string get_priority() {
+    std::map<std::string, std::string>::iterator it = annotations_.find("priority");
+    if (annotations_.end() == it) {
+      return "";
+    }
+    return priority_constant(it->second);
+  }
+
+  // 未指定priority或取值为critical/high/normal/low之一时返回true
+  bool is_valid_priority() {
+    std::map<std::string, std::string>::iterator it = annotations_.find("priority");
+    return annotations_.end() == it || !priority_constant(it->second).empty();
+  }
+
   std::string get_timeout_ms() {
     std::string timeoutms("-1");
     std::string timeout_annotations[2][2] = {
@@ -130,6 +154,21 @@ class t_function : public t_doc {
   std::map<std::string, std::string> annotations_;
 
  private:
+  static std::string priority_constant(const std::string& priority) {
+    const char* priorities[4][2] = {
+        { "critical", "pebble::kRPC_PRIORITY_CRITICAL" },
+        { "high",     "pebble::kRPC_PRIORITY_HIGH"     },
+        { "normal",   "pebble::kRPC_PRIORITY_NORMAL"   },
+        { "low",      "pebble::kRPC_PRIORITY_LOW"      },
+    };
+    for (int i = 0; i < 4; i++) {
+      if (priority == priorities[i][0]) {
+        return priorities[i][1];
+      }
+    }
+    return "";
+  }
+
   t_type* returntype_;
   std::string name_;
   t_struct* arglist_;
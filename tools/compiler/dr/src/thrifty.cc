@@ -2697,6 +2697,11 @@ yyreduce:
         (yyval.tfunction)->annotations_ = (yyvsp[(9) - (10)].ttype)->annotations_;
         delete (yyvsp[(9) - (10)].ttype);
       }
+      if (!(yyval.tfunction)->is_valid_priority()) {
+        yyerror("function %s: invalid priority \"%s\", must be one of critical, high, normal, low",
+                (yyvsp[(4) - (10)].id), (yyval.tfunction)->annotations_["priority"].c_str());
+        exit(1);
+      }
     ;}
     break;
 
@@ -949,6 +949,11 @@ Function:
         $$->annotations_ = $9->annotations_;
         delete $9;
       }
+      if (!$$->is_valid_priority()) {
+        yyerror("function %s: invalid priority \"%s\", must be one of critical, high, normal, low",
+                $4, $$->annotations_["priority"].c_str());
+        exit(1);
+      }
     }
 
 Oneway:
@@ -1,5 +1,7 @@
 
 #include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <map>
 #include <sstream>
 
@@ -37,6 +39,21 @@ std::string FileNameIdentifier(const std::string& filename) {
     return result;
 }
 
+// RPC方法ID，"服务名:方法名"的32位FNV-1a，和pebble::IRpc::GenMethodId保持一致，0保留
+std::string RpcMethodId(const std::string& name) {
+    uint32_t hash = 2166136261u;
+    for (std::string::const_iterator it = name.begin(); it != name.end(); ++it) {
+        hash ^= static_cast<uint8_t>(*it);
+        hash *= 16777619u;
+    }
+    if (hash == 0) {
+        hash = 1;
+    }
+    char buff[16];
+    snprintf(buff, sizeof(buff), "0x%08Xu", hash);
+    return std::string(buff);
+}
+
 // 生成include信息
 void PrintIncludes(Printer* printer, const std::vector<std::string>& headers,
                    const Parameters& params) {
@@ -621,6 +638,9 @@ std::string GetSourceIncludes(File* file, const Parameters& params) {
 
     cxx::shared_ptr<Printer> printer = file->CreatePrinter(&output);
     std::vector<std::string> headers;
+#ifndef __RPC_CLIENT__
+    headers.push_back("common/arena.h");
+#endif
     headers.push_back(file->filename_without_path() + file->service_header_ext()); // filename.rpc.pb.h
     PrintIncludes(printer.get(), headers, params);
     printer->Print("\n");
@@ -649,6 +669,7 @@ void PrintSourceClientMethod(Printer* printer, const Method* method,
     }
 
     (*vars)["Method"] = method->name();
+    (*vars)["MethodId"] = RpcMethodId((*vars)["Service"] + ":" + method->name());
     (*vars)["Request"] = method->input_type_name();
     (*vars)["Response"] = method->output_type_name();
 
@@ -661,6 +682,7 @@ void PrintSourceClientMethod(Printer* printer, const Method* method,
 
         printer->Print("::pebble::RpcHead __head;\n");
         printer->Print(*vars, "__head.m_function_name.assign(\"$Service$:$Method$\");\n");
+        printer->Print(*vars, "__head.m_method_id = $MethodId$;\n");
         printer->Print("__head.m_message_type = ::pebble::kRPC_CALL;\n");
         printer->Print("__head.m_session_id = m_imp->m_client->GenSessionId();\n\n");
 
@@ -702,6 +724,7 @@ void PrintSourceClientMethod(Printer* printer, const Method* method,
 
         printer->Print("::pebble::RpcHead __head;\n");
         printer->Print(*vars, "__head.m_function_name.assign(\"$Service$:$Method$\");\n");
+        printer->Print(*vars, "__head.m_method_id = $MethodId$;\n");
         printer->Print("__head.m_message_type = ::pebble::kRPC_CALL;\n");
         printer->Print("__head.m_session_id = m_imp->m_client->GenSessionId();\n\n");
 
@@ -745,6 +768,7 @@ void PrintSourceClientMethod(Printer* printer, const Method* method,
 
         printer->Print("::pebble::RpcHead __head;\n");
         printer->Print(*vars, "__head.m_function_name.assign(\"$Service$:$Method$\");\n");
+        printer->Print(*vars, "__head.m_method_id = $MethodId$;\n");
         printer->Print("__head.m_message_type = ::pebble::kRPC_CALL;\n");
         printer->Print("__head.m_session_id = m_imp->m_client->GenSessionId();\n\n");
 
@@ -890,8 +914,33 @@ void PrintSourceServerMethod(Printer* printer, const Method* method,
         " cxx::function<int32_t(int32_t ret, const uint8_t* buff, uint32_t buff_len)>& rsp) {\n");
     printer->Indent();
 
+#ifndef __RPC_CLIENT__
+    // protobuf 3.0及以上请求分配在本次请求的arena上，响应发送后随arena整体释放
+    // 更低版本的protobuf没有Arena，消息的字段仍在堆上分配，请求对象放在栈上即可
+    printer->Outdent();
+    printer->Print("#if GOOGLE_PROTOBUF_VERSION >= 3000000\n");
+    printer->Indent();
+    printer->Print("::pebble::Arena* __arena = m_server->GetArena();\n");
+    printer->Print(*vars, "$Request$* __request = __arena != NULL ? __NewMessage< $Request$>(__arena) : NULL;\n");
+    printer->Print("if (NULL == __request) {\n");
+    printer->Indent();
+    printer->Print("rsp(::pebble::kPEBBLE_RPC_INSUFFICIENT_MEMORY, NULL, 0);\n");
+    printer->Print("return ::pebble::kPEBBLE_RPC_INSUFFICIENT_MEMORY;\n");
+    printer->Outdent();
+    printer->Print("}\n");
+    printer->Outdent();
+    printer->Print("#else\n");
+    printer->Indent();
+    printer->Print(*vars, "$Request$ __request_obj;\n");
+    printer->Print(*vars, "$Request$* __request = &__request_obj;\n");
+    printer->Outdent();
+    printer->Print("#endif\n");
+    printer->Indent();
+    printer->Print("if (!__request->ParseFromArray((const void*)buff, buff_len)) {\n");
+#else
     printer->Print(*vars, "$Request$ __request;\n");
     printer->Print("if (!__request.ParseFromArray((const void*)buff, buff_len)) {\n");
+#endif
     printer->Indent();
     printer->Print("rsp(::pebble::kPEBBLE_RPC_DECODE_BODY_FAILED, NULL, 0);\n");
     printer->Print("return ::pebble::kPEBBLE_RPC_DECODE_BODY_FAILED;\n");
@@ -902,7 +951,11 @@ void PrintSourceServerMethod(Printer* printer, const Method* method,
     printer->Print(*vars, "    cxx::bind(&__$Service$Skeleton::return_$Method$, this,\n");
     printer->Print("        rsp, cxx::placeholders::_1, cxx::placeholders::_2);\n\n");
 
+#ifndef __RPC_CLIENT__
+    printer->Print(*vars, "m_iface->$Method$(*__request, __rsp);\n\n");
+#else
     printer->Print(*vars, "m_iface->$Method$(__request, __rsp);\n\n");
+#endif
     printer->Print("return ::pebble::kRPC_SUCCESS;\n");
 
     printer->Outdent();
@@ -1060,9 +1113,10 @@ void PrintSourceService(Printer* printer, const Service* service,
 
     for (int i = 0; i < service->method_count(); ++i) {
         (*vars)["Method"] = service->method(i)->name();
+        (*vars)["MethodId"] = RpcMethodId((*vars)["Service"] + ":" + service->method(i)->name());
         printer->Print(*vars, "cb = cxx::bind(&__$Service$Skeleton::process_$Method$, this,\n");
         printer->Print("    cxx::placeholders::_1, cxx::placeholders::_2, cxx::placeholders::_3);\n");
-        printer->Print(*vars, "ret = m_server->AddOnRequestFunction(\"$Service$:$Method$\", cb);\n");
+        printer->Print(*vars, "ret = m_server->AddOnRequestFunction(\"$Service$:$Method$\", $MethodId$, cb);\n");
         printer->Print("if (ret != ::pebble::kRPC_SUCCESS) {\n");
         printer->Indent();
         printer->Print("return ret;\n");
@@ -1080,6 +1134,27 @@ void PrintSourceService(Printer* printer, const Service* service,
     }
 }
 
+#ifndef __RPC_CLIENT__
+// 生成在请求arena上创建消息的函数，只用于protobuf 3.0及以上
+// 使用protobuf的Arena，消息的字段也分配在arena上，Arena的首块内存取自请求的arena
+void PrintSourceNewMessage(Printer* printer) {
+    printer->Print("#if GOOGLE_PROTOBUF_VERSION >= 3000000\n");
+    printer->Print("namespace {\n\n");
+    printer->Print("template <typename Message>\n");
+    printer->Print("Message* __NewMessage(::pebble::Arena* arena) {\n");
+    printer->Indent();
+    printer->Print("::google::protobuf::ArenaOptions options;\n");
+    printer->Print("options.initial_block_size = 1024;\n");
+    printer->Print("options.initial_block = static_cast<char*>(arena->Allocate(options.initial_block_size));\n");
+    printer->Print("::google::protobuf::Arena* pb_arena = arena->Create< ::google::protobuf::Arena>(options);\n");
+    printer->Print("return pb_arena != NULL ? ::google::protobuf::Arena::CreateMessage<Message>(pb_arena) : NULL;\n");
+    printer->Outdent();
+    printer->Print("}\n\n");
+    printer->Print("} // namespace\n");
+    printer->Print("#endif\n\n");
+}
+#endif
+
 // 生成服务实现
 std::string GetSourceServices(File* file, const Parameters& params) {
     std::string output;
@@ -1099,6 +1174,12 @@ std::string GetSourceServices(File* file, const Parameters& params) {
         vars["prefix"] = "";
     }
 
+#ifndef __RPC_CLIENT__
+    if (file->service_count() > 0) {
+        PrintSourceNewMessage(printer.get());
+    }
+#endif
+
     for (int i = 0; i < file->service_count(); ++i) {
         PrintSourceService(printer.get(), file->service(i).get(), &vars);
         printer->Print("\n");